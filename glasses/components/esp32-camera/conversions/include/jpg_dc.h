@@ -0,0 +1,68 @@
+// Copyright 2015-2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef _JPG_DC_H_
+#define _JPG_DC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Read the frame size of a baseline JPEG and the size of its 1/8 scale image
+ *
+ * @param src       JPEG data
+ * @param src_len   Length of src
+ * @param width     Out: image width in pixels
+ * @param height    Out: image height in pixels
+ *
+ * @return ESP_OK on success, ESP_FAIL if no SOF marker was found, ESP_ERR_NO_MEM
+ */
+esp_err_t jpg_dc_get_size(const uint8_t *src, size_t src_len, uint16_t *width, uint16_t *height);
+
+/**
+ * @brief Decode the luma DC coefficients of a baseline JPEG into a 1/8 scale grayscale image
+ *
+ * Each output pixel is the average of one 8x8 luma block, so no IDCT and no
+ * chroma work is done. The output is identical to libjpeg decoding with
+ * scale_num/scale_denom = 1/8 and out_color_space = JCS_GRAYSCALE.
+ * Needs about 44 KB of working memory for a YCbCr frame, taken from internal
+ * RAM when possible and freed before returning.
+ *
+ * @param src       JPEG data
+ * @param src_len   Length of src
+ * @param out       Output buffer, one byte per pixel, row stride is out_width
+ * @param out_size  Size of out, at least ceil(width/8) * ceil(height/8)
+ * @param out_width  Out (optional): ceil(width/8)
+ * @param out_height Out (optional): ceil(height/8)
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG Null pointer
+ *     - ESP_ERR_INVALID_SIZE out is too small
+ *     - ESP_ERR_NO_MEM No memory for the decoding tables
+ *     - ESP_ERR_NOT_SUPPORTED Progressive, arithmetic coded or multi-scan JPEG
+ *     - ESP_FAIL Corrupt data
+ */
+esp_err_t jpg_dc_decode_gray(const uint8_t *src, size_t src_len, uint8_t *out, size_t out_size,
+                             uint16_t *out_width, uint16_t *out_height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _JPG_DC_H_ */
@@ -0,0 +1,666 @@
+// Copyright 2015-2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "jpg_dc.h"
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+// The tables are read for every coefficient, keep them out of PSRAM if there is room
+#define dc_calloc(n, size)  heap_caps_calloc_prefer(n, size, 2, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, MALLOC_CAP_DEFAULT)
+#define dc_free(p)          heap_caps_free(p)
+#else
+#define dc_calloc(n, size)  calloc(n, size)
+#define dc_free(p)          free(p)
+#endif
+
+#define JPG_MAX_COMPONENTS 4
+#define JPG_MAX_MCU_BLOCKS 10   // per interleaved MCU, T.81 B.2.3
+#define HUFF_LOOKAHEAD      10   // codes up to this length are decoded with one table lookup
+
+/*
+ * Entry of the AC skip table, indexed by the next HUFF_LOOKAHEAD bits.
+ * The AC values are never needed, so a code is skipped together with its
+ * magnitude bits in one step. Only the code has to fit in the lookahead.
+ */
+#define AC_SKIP_BITS(e)     ((e) & 0x1F)            // code and magnitude bits, 0 = code longer than lookahead
+#define AC_SKIP_ADVANCE(e)  ((e) >> 5)              // coefficients covered
+#define AC_SKIP_EOB         64
+
+/*
+ * Entry of the AC run table, indexed by the next RUN_LOOKAHEAD bits: all the
+ * whole coefficients (code and magnitude bits) these bits start with, so a
+ * block is skipped a few coefficients per lookup.
+ */
+#define RUN_LOOKAHEAD       12
+#define RUN_BITS(e)         ((e) & 0x1F)            // bits taken, 0 = the first coefficient does not fit
+#define RUN_ADVANCE(e)      (((e) >> 5) & 0x7F)     // coefficients covered, not counting an EOB
+#define RUN_EOB             (1 << 12)               // the coefficients end with an EOB
+
+typedef struct {
+    bool present;
+    uint8_t vals[256];
+    int32_t maxcode[18];        // largest code of each length, -1 if none
+    int32_t valptr[17];         // index into vals of the first code of each length
+    int32_t mincode[17];
+    // DC: code length << 8 | symbol; AC: see AC_SKIP_*; 0 = code longer than lookahead
+    uint16_t lookup[1 << HUFF_LOOKAHEAD];
+    const uint16_t *run;        // AC tables of the scan, see RUN_*
+} jpg_huff_t;
+
+typedef uint16_t jpg_run_t[1 << RUN_LOOKAHEAD];
+
+typedef struct {
+    uint8_t id;
+    uint8_t h, v;
+    uint8_t tq;
+    uint8_t td, ta;
+} jpg_comp_t;
+
+// Bit buffer of the native register width: 32 bits on the ESP32-S3, 64 on a host
+typedef uintptr_t jpg_buf_t;
+#define BUF_BITS            ((int)sizeof(jpg_buf_t) * 8)
+// A filled buffer holds at least BUF_BITS - 7 bits
+#define RUNS_PER_FILL       ((BUF_BITS - 7) / RUN_LOOKAHEAD)
+
+// Entropy coded data reader, kept separate so the hot loop can hold it in registers
+typedef struct {
+    const uint8_t *src;
+    size_t len;
+    size_t pos;
+    jpg_buf_t bits;             // MSB aligned bit buffer
+    int nbits;
+    bool marker_hit;            // reached a marker, feed zeros until the next restart
+} jpg_bits_t;
+
+// One block of an MCU, in scan order
+typedef struct {
+    const jpg_huff_t *dc;
+    const jpg_huff_t *ac;
+    uint8_t pred;               // index into the DC predictors
+    int8_t x, y;                // luma block position in the MCU, x = -1 for chroma
+} jpg_block_t;
+
+typedef struct {
+    const uint8_t *src;
+    size_t len;
+    uint16_t width, height;
+    uint8_t ncomp;
+    uint8_t hmax, vmax;
+    jpg_comp_t comp[JPG_MAX_COMPONENTS];
+    uint16_t qt[4];             // only the DC quantizer of each table is needed
+    jpg_huff_t dc[4];
+    jpg_huff_t ac[4];
+    uint16_t restart_interval;
+    uint8_t scan_comp[JPG_MAX_COMPONENTS];
+    uint8_t scan_ncomp;
+    jpg_run_t *runs;            // built only for the AC tables the scan uses
+} jpg_dc_t;
+
+static inline uint16_t be16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// Load a word big-endian, so that the first byte lands in the top bits
+static inline jpg_buf_t load_be(const uint8_t *p)
+{
+    jpg_buf_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = sizeof(v) == 8 ? (jpg_buf_t)__builtin_bswap64(v) : (jpg_buf_t)__builtin_bswap32(v);
+#endif
+    return v;
+}
+
+// Non-zero if any byte of v is 0xFF
+static inline jpg_buf_t has_ff(jpg_buf_t v)
+{
+    const jpg_buf_t ones = (jpg_buf_t) -1 / 0xFF;
+    v = ~v;
+    return (v - ones) & ~v & (ones << 7);
+}
+
+// Top up the bit buffer to at least BUF_BITS - 7 bits, removing stuffed zero bytes
+static inline void fill_bits(jpg_bits_t *b)
+{
+    if (b->nbits > BUF_BITS - 8) {
+        return;
+    }
+    // Fast path: a word of plain entropy coded bytes
+    if (!b->marker_hit && b->pos + sizeof(jpg_buf_t) <= b->len) {
+        jpg_buf_t w = load_be(&b->src[b->pos]);
+        if (!has_ff(w)) {
+            int bytes = (BUF_BITS - b->nbits) >> 3;
+            if (bytes < (int)sizeof(jpg_buf_t)) {
+                w &= ~(jpg_buf_t)0 << (BUF_BITS - bytes * 8);
+            }
+            b->bits |= w >> b->nbits;
+            b->nbits += bytes * 8;
+            b->pos += bytes;
+            return;
+        }
+    }
+    while (b->nbits <= BUF_BITS - 8) {
+        jpg_buf_t v = 0;
+        if (!b->marker_hit && b->pos < b->len) {
+            v = b->src[b->pos];
+            if (v != 0xFF) {
+                b->pos++;
+            } else if (b->pos + 1 < b->len && b->src[b->pos + 1] == 0x00) {
+                b->pos += 2;
+            } else {
+                b->marker_hit = true;
+                v = 0;
+            }
+        }
+        b->bits |= v << (BUF_BITS - 8 - b->nbits);
+        b->nbits += 8;
+    }
+}
+
+static inline uint32_t peek_bits(const jpg_bits_t *b, int n)
+{
+    return (uint32_t)(b->bits >> (BUF_BITS - n));
+}
+
+static inline void drop_bits(jpg_bits_t *b, int n)
+{
+    b->bits <<= n;
+    b->nbits -= n;
+}
+
+static inline int32_t extend(uint32_t v, int s)
+{
+    return v < (1u << (s - 1)) ? (int32_t)v - (1 << s) + 1 : (int32_t)v;
+}
+
+// Decode a code longer than HUFF_LOOKAHEAD; the buffer must hold at least 16 bits
+static inline int huff_decode_slow(jpg_bits_t *b, const jpg_huff_t *h)
+{
+    int l = HUFF_LOOKAHEAD + 1;
+    int32_t code = peek_bits(b, l);
+    while (code > h->maxcode[l]) {
+        if (++l > 16) {
+            return -1;
+        }
+        code = peek_bits(b, l);
+    }
+    drop_bits(b, l);
+    return h->vals[h->valptr[l] + code - h->mincode[l]];
+}
+
+static void build_lookup(jpg_huff_t *h, bool ac)
+{
+    memset(h->lookup, 0, sizeof(h->lookup));
+    for (int l = 1; l <= HUFF_LOOKAHEAD; l++) {
+        if (h->maxcode[l] < 0) {
+            continue;
+        }
+        for (int32_t code = h->mincode[l]; code <= h->maxcode[l]; code++) {
+            uint8_t sym = h->vals[h->valptr[l] + code - h->mincode[l]];
+            uint16_t e;
+            if (!ac) {
+                e = (uint16_t)((l << 8) | sym);
+            } else {
+                int r = sym >> 4, s = sym & 0x0F;
+                if (s == 0) {
+                    e = (uint16_t)(l | ((r == 15 ? 16 : AC_SKIP_EOB) << 5));
+                } else {
+                    e = (uint16_t)((l + s) | ((r + 1) << 5));
+                }
+            }
+            int shift = HUFF_LOOKAHEAD - l;
+            for (int fill = 0; fill < (1 << shift); fill++) {
+                h->lookup[(code << shift) | fill] = e;
+            }
+        }
+    }
+}
+
+/*
+ * Chain the single-code entries of an AC table into the run table. The run
+ * of m bits is the first code followed by the run of the bits after it, so
+ * the runs of all shorter lengths are built first into scratch, which is
+ * indexed (1 << m) - 1 + bits.
+ */
+static void build_run(jpg_huff_t *h, jpg_run_t run, jpg_run_t scratch)
+{
+    for (int m = 0; m <= RUN_LOOKAHEAD; m++) {
+        uint16_t *out = m < RUN_LOOKAHEAD ? &scratch[(1 << m) - 1] : run;
+        for (uint32_t j = 0; j < (1u << m); j++) {
+            // bits past the m known ones read as zeros, only codes that end before them count
+            uint16_t e = h->lookup[(j << (RUN_LOOKAHEAD - m)) >> (RUN_LOOKAHEAD - HUFF_LOOKAHEAD)];
+            int bits = AC_SKIP_BITS(e);
+            if (!e || bits > m) {
+                out[j] = 0;
+                continue;
+            }
+            if (AC_SKIP_ADVANCE(e) == AC_SKIP_EOB) {
+                out[j] = (uint16_t)(bits | RUN_EOB);
+                continue;
+            }
+            int left = m - bits;
+            uint16_t rest = scratch[(1 << left) - 1 + (j & ((1u << left) - 1))];
+            // past the end of any block, the lone code is as good
+            if (AC_SKIP_ADVANCE(e) + RUN_ADVANCE(rest) >= 64) {
+                rest = 0;
+            }
+            out[j] = (uint16_t)((bits + RUN_BITS(rest)) | ((AC_SKIP_ADVANCE(e) + RUN_ADVANCE(rest)) << 5) |
+                                (rest & RUN_EOB));
+        }
+    }
+    h->run = run;
+}
+
+static bool parse_dht(jpg_dc_t *d, const uint8_t *p, size_t n)
+{
+    while (n >= 17) {
+        uint8_t tc = p[0] >> 4, th = p[0] & 0x0F;
+        if (tc > 1 || th > 3) {
+            return false;
+        }
+        jpg_huff_t *h = tc ? &d->ac[th] : &d->dc[th];
+        const uint8_t *counts = &p[1];
+        size_t total = 0;
+        for (int i = 0; i < 16; i++) {
+            total += counts[i];
+        }
+        if (total > 256 || n < 17 + total) {
+            return false;
+        }
+        memcpy(h->vals, &p[17], total);
+        int32_t code = 0, k = 0;
+        for (int l = 1; l <= 16; l++) {
+            h->valptr[l] = k;
+            h->mincode[l] = code;
+            code += counts[l - 1];
+            // more codes of this length than the code space holds, the lookup would overflow
+            if (code > (1 << l)) {
+                return false;
+            }
+            k += counts[l - 1];
+            h->maxcode[l] = counts[l - 1] ? code - 1 : -1;
+            code <<= 1;
+        }
+        h->maxcode[17] = 0x7FFFFFFF;
+        h->present = true;
+        h->run = NULL;
+        build_lookup(h, tc == 1);
+        p += 17 + total;
+        n -= 17 + total;
+    }
+    return n == 0;
+}
+
+static bool parse_dqt(jpg_dc_t *d, const uint8_t *p, size_t n)
+{
+    while (n > 0) {
+        uint8_t pq = p[0] >> 4, tq = p[0] & 0x0F;
+        size_t size = 1 + (pq ? 128 : 64);
+        if (tq > 3 || n < size) {
+            return false;
+        }
+        d->qt[tq] = pq ? be16(&p[1]) : p[1];
+        p += size;
+        n -= size;
+    }
+    return true;
+}
+
+static bool parse_sof(jpg_dc_t *d, const uint8_t *p, size_t n)
+{
+    if (n < 6) {
+        return false;
+    }
+    d->height = be16(&p[1]);
+    d->width = be16(&p[3]);
+    d->ncomp = p[5];
+    if (p[0] != 8 || !d->width || !d->height || !d->ncomp || d->ncomp > JPG_MAX_COMPONENTS || n < 6 + d->ncomp * 3u) {
+        return false;
+    }
+    d->hmax = d->vmax = 1;
+    int blocks = 0;
+    for (int i = 0; i < d->ncomp; i++) {
+        jpg_comp_t *c = &d->comp[i];
+        c->id = p[6 + i * 3];
+        c->h = p[7 + i * 3] >> 4;
+        c->v = p[7 + i * 3] & 0x0F;
+        c->tq = p[8 + i * 3] & 0x03;
+        if (!c->h || !c->v || c->h > 4 || c->v > 4) {
+            return false;
+        }
+        if (c->h > d->hmax) d->hmax = c->h;
+        if (c->v > d->vmax) d->vmax = c->v;
+        blocks += c->h * c->v;
+    }
+    return d->ncomp == 1 || blocks <= JPG_MAX_MCU_BLOCKS;
+}
+
+static bool parse_sos(jpg_dc_t *d, const uint8_t *p, size_t n)
+{
+    if (n < 1 || n < 1 + p[0] * 2u + 3 || p[0] == 0 || p[0] > d->ncomp) {
+        return false;
+    }
+    d->scan_ncomp = p[0];
+    for (int i = 0; i < d->scan_ncomp; i++) {
+        int ci;
+        for (ci = 0; ci < d->ncomp && d->comp[ci].id != p[1 + i * 2]; ci++);
+        if (ci == d->ncomp) {
+            return false;
+        }
+        d->comp[ci].td = p[2 + i * 2] >> 4;
+        d->comp[ci].ta = p[2 + i * 2] & 0x0F;
+        if (d->comp[ci].td > 3 || d->comp[ci].ta > 3 ||
+            !d->dc[d->comp[ci].td].present || !d->ac[d->comp[ci].ta].present) {
+            return false;
+        }
+        d->scan_comp[i] = ci;
+    }
+    return true;
+}
+
+/**
+ * Walk the marker segments up to the first SOS. Returns the offset of the
+ * entropy coded data, or 0 on error (err is set).
+ */
+static size_t parse_headers(jpg_dc_t *d, bool stop_at_sof, esp_err_t *err)
+{
+    const uint8_t *src = d->src;
+    size_t pos = 2;
+    bool have_sof = false;
+    *err = ESP_FAIL;
+    if (d->len < 4 || src[0] != 0xFF || src[1] != 0xD8) {
+        return 0;
+    }
+    while (pos + 4 <= d->len) {
+        if (src[pos] != 0xFF) {
+            return 0;
+        }
+        uint8_t marker = src[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        size_t seg_len = be16(&src[pos + 2]);
+        if (seg_len < 2 || pos + 2 + seg_len > d->len) {
+            return 0;
+        }
+        const uint8_t *p = &src[pos + 4];
+        size_t n = seg_len - 2;
+        switch (marker) {
+        case 0xC0: // SOF0 baseline
+        case 0xC1: // SOF1 extended sequential, Huffman
+            if (!parse_sof(d, p, n)) {
+                return 0;
+            }
+            have_sof = true;
+            if (stop_at_sof) {
+                *err = ESP_OK;
+                return pos;
+            }
+            break;
+        case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+        case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+            *err = ESP_ERR_NOT_SUPPORTED;
+            return 0;
+        case 0xC4:
+            if (!parse_dht(d, p, n)) {
+                return 0;
+            }
+            break;
+        case 0xDB:
+            if (!parse_dqt(d, p, n)) {
+                return 0;
+            }
+            break;
+        case 0xDD:
+            if (n < 2) {
+                return 0;
+            }
+            d->restart_interval = be16(p);
+            break;
+        case 0xDA:
+            if (!have_sof || !parse_sos(d, p, n)) {
+                return 0;
+            }
+            if (d->scan_ncomp != d->ncomp) {
+                *err = ESP_ERR_NOT_SUPPORTED;
+                return 0;
+            }
+            *err = ESP_OK;
+            return pos + 2 + seg_len;
+        default:
+            break;
+        }
+        pos += 2 + seg_len;
+    }
+    return 0;
+}
+
+esp_err_t jpg_dc_get_size(const uint8_t *src, size_t src_len, uint16_t *width, uint16_t *height)
+{
+    if (!src || !width || !height) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    jpg_dc_t *d = dc_calloc(1, sizeof(jpg_dc_t));
+    if (!d) {
+        return ESP_ERR_NO_MEM;
+    }
+    d->src = src;
+    d->len = src_len;
+    esp_err_t err;
+    parse_headers(d, true, &err);
+    if (err == ESP_OK) {
+        *width = d->width;
+        *height = d->height;
+    }
+    dc_free(d);
+    return err;
+}
+
+static inline void process_restart(jpg_bits_t *b)
+{
+    // Discard the buffered padding bits and expect RSTn
+    b->bits = 0;
+    b->nbits = 0;
+    if (!b->marker_hit) {
+        while (b->pos + 1 < b->len && !(b->src[b->pos] == 0xFF && b->src[b->pos + 1] != 0x00)) {
+            b->pos++;
+        }
+    }
+    if (b->pos + 1 < b->len && (b->src[b->pos + 1] & 0xF8) == 0xD0) {
+        b->pos += 2;
+        b->marker_hit = false;
+    }
+}
+
+static inline bool decode_block(jpg_bits_t *b, const jpg_huff_t *dc, const jpg_huff_t *ac, int32_t *dc_pred)
+{
+    fill_bits(b);
+    uint16_t e = dc->lookup[peek_bits(b, HUFF_LOOKAHEAD)];
+    int s;
+    if (e) {
+        drop_bits(b, e >> 8);
+        s = e & 0xFF;
+    } else {
+        s = huff_decode_slow(b, dc);
+    }
+    if (s < 0 || s > 15) {
+        return false;
+    }
+    if (s) {
+        fill_bits(b);
+        *dc_pred += extend(peek_bits(b, s), s);
+        drop_bits(b, s);
+    }
+
+    for (int k = 1; k < 64;) {
+        fill_bits(b);
+        for (int n = 0; n < RUNS_PER_FILL && k < 64; n++) {
+            // a run may only be taken whole if the block cannot end inside it
+            e = ac->run[peek_bits(b, RUN_LOOKAHEAD)];
+            if (e && k + RUN_ADVANCE(e) < 64) {
+                drop_bits(b, RUN_BITS(e));
+                k = (e & RUN_EOB) ? 64 : k + RUN_ADVANCE(e);
+                continue;
+            }
+            // otherwise one coefficient at a time
+            fill_bits(b);
+            e = ac->lookup[peek_bits(b, HUFF_LOOKAHEAD)];
+            if (e) {
+                drop_bits(b, AC_SKIP_BITS(e));
+                k += AC_SKIP_ADVANCE(e);
+                break;
+            }
+            int rs = huff_decode_slow(b, ac);
+            if (rs < 0) {
+                return false;
+            }
+            s = rs & 0x0F;
+            if (s) {
+                fill_bits(b);
+                drop_bits(b, s);
+                k += (rs >> 4) + 1;
+            } else {
+                k += (rs >> 4) == 15 ? 16 : AC_SKIP_EOB;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+static inline uint8_t dc_to_pixel(int32_t dc, uint16_t q)
+{
+    // Same rounding as libjpeg's jpeg_idct_1x1
+    int32_t v = ((dc * q + 4) >> 3) + 128;
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+esp_err_t jpg_dc_decode_gray(const uint8_t *src, size_t src_len, uint8_t *out, size_t out_size,
+                             uint16_t *out_width, uint16_t *out_height)
+{
+    if (!src || !out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    jpg_dc_t *d = dc_calloc(1, sizeof(jpg_dc_t));
+    if (!d) {
+        return ESP_ERR_NO_MEM;
+    }
+    d->src = src;
+    d->len = src_len;
+
+    esp_err_t err;
+    size_t scan = parse_headers(d, false, &err);
+    if (err != ESP_OK) {
+        goto out;
+    }
+    // One run table per AC table the scan uses, plus the build scratch
+    uint8_t ac_used = 0;
+    for (int si = 0; si < d->scan_ncomp; si++) {
+        ac_used |= 1 << d->comp[d->scan_comp[si]].ta;
+    }
+    int nruns = __builtin_popcount(ac_used);
+    d->runs = dc_calloc(nruns + 1, sizeof(jpg_run_t));
+    if (!d->runs) {
+        err = ESP_ERR_NO_MEM;
+        goto out;
+    }
+    for (int i = 0, used = 0; i < 4; i++) {
+        if (ac_used & (1 << i)) {
+            build_run(&d->ac[i], d->runs[used++], d->runs[nruns]);
+        }
+    }
+    uint16_t ow = (d->width + 7) / 8;
+    uint16_t oh = (d->height + 7) / 8;
+    if (out_width) {
+        *out_width = ow;
+    }
+    if (out_height) {
+        *out_height = oh;
+    }
+    if (out_size < (size_t)ow * oh) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto out;
+    }
+
+    jpg_bits_t br = { .src = src, .len = src_len, .pos = scan };
+    uint16_t q = d->qt[d->comp[0].tq];
+    uint32_t mcu_w, mcu_h;
+    uint8_t yh, yv;
+    if (d->ncomp == 1) {
+        // Non-interleaved: one block per MCU regardless of sampling factors
+        mcu_w = ow;
+        mcu_h = oh;
+        yh = yv = 1;
+    } else {
+        mcu_w = (d->width + 8 * d->hmax - 1) / (8 * d->hmax);
+        mcu_h = (d->height + 8 * d->vmax - 1) / (8 * d->vmax);
+        yh = d->comp[0].h;
+        yv = d->comp[0].v;
+    }
+
+    // Flatten the MCU once, the loop below only walks this list
+    jpg_block_t blocks[JPG_MAX_MCU_BLOCKS];
+    int nblocks = 0;
+    for (int si = 0; si < d->scan_ncomp; si++) {
+        int ci = d->scan_comp[si];
+        const jpg_comp_t *c = &d->comp[ci];
+        uint8_t bh = d->ncomp == 1 ? 1 : c->h;
+        uint8_t bv = d->ncomp == 1 ? 1 : c->v;
+        for (int by = 0; by < bv; by++) {
+            for (int bx = 0; bx < bh; bx++) {
+                blocks[nblocks++] = (jpg_block_t) {
+                    .dc = &d->dc[c->td], .ac = &d->ac[c->ta], .pred = (uint8_t)ci,
+                    .x = (int8_t)(ci == 0 ? bx : -1), .y = (int8_t)by,
+                };
+            }
+        }
+    }
+
+    int32_t dc_pred[JPG_MAX_COMPONENTS] = { 0 };
+    uint32_t restarts_left = d->restart_interval;
+    for (uint32_t my = 0; my < mcu_h; my++) {
+        for (uint32_t mx = 0; mx < mcu_w; mx++) {
+            if (d->restart_interval) {
+                if (restarts_left == 0) {
+                    process_restart(&br);
+                    memset(dc_pred, 0, sizeof(dc_pred));
+                    restarts_left = d->restart_interval;
+                }
+                restarts_left--;
+            }
+            for (int i = 0; i < nblocks; i++) {
+                const jpg_block_t *bl = &blocks[i];
+                if (!decode_block(&br, bl->dc, bl->ac, &dc_pred[bl->pred])) {
+                    err = ESP_FAIL;
+                    goto out;
+                }
+                if (bl->x >= 0) {
+                    uint32_t px = mx * yh + bl->x;
+                    uint32_t py = my * yv + bl->y;
+                    if (px < ow && py < oh) {
+                        out[py * ow + px] = dc_to_pixel(dc_pred[0], q);
+                    }
+                }
+            }
+        }
+    }
+    err = ESP_OK;
+out:
+    dc_free(d->runs);
+    dc_free(d);
+    return err;
+}
@@ -18,6 +18,7 @@
 #include "esp_heap_caps.h"
 #include "ll_cam.h"
 #include "cam_hal.h"
+#include "trace_ring.h"
 
 #if (ESP_IDF_VERSION_MAJOR == 3) && (ESP_IDF_VERSION_MINOR == 3)
 #include "rom/ets_sys.h"
@@ -150,10 +151,12 @@ static void cam_task(void *arg)
                             DBG_PIN_SET(0);
                             continue;
                         }
+                        TRACE_BEGIN(TRACE_EV_CAM_COPY, cnt);
                         frame_buffer_event->len += ll_cam_memcpy(cam_obj,
                             &frame_buffer_event->buf[frame_buffer_event->len],
                             &cam_obj->dma_buffer[(cnt % cam_obj->dma_half_buffer_cnt) * cam_obj->dma_half_buffer_size],
                             cam_obj->dma_half_buffer_size);
+                        TRACE_END(TRACE_EV_CAM_COPY, cnt);
                     }
                     //Check for JPEG SOI in the first buffer. stop if not found
                     if (cam_obj->jpeg_mode && cnt == 0 && cam_verify_jpeg_soi(frame_buffer_event->buf, frame_buffer_event->len) != 0) {
@@ -173,10 +176,12 @@ static void cam_task(void *arg)
                                     ESP_LOGW(TAG, "FB-OVF");
                                     cnt--;
                                 } else {
+                                    TRACE_BEGIN(TRACE_EV_CAM_COPY, cnt);
                                     frame_buffer_event->len += ll_cam_memcpy(cam_obj,
                                         &frame_buffer_event->buf[frame_buffer_event->len],
                                         &cam_obj->dma_buffer[(cnt % cam_obj->dma_half_buffer_cnt) * cam_obj->dma_half_buffer_size],
                                         cam_obj->dma_half_buffer_size);
+                                    TRACE_END(TRACE_EV_CAM_COPY, cnt);
                                 }
                             }
                             cnt++;
@@ -197,6 +202,9 @@ static void cam_task(void *arg)
                             }
                         }
                         //send frame
+                        if (!cam_obj->frames[frame_pos].en) {
+                            TRACE_INSTANT(TRACE_EV_CAM_FRAME, frame_pos);
+                        }
                         if(!cam_obj->frames[frame_pos].en && xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
                             //pop frame buffer from the queue
                             camera_fb_t * fb2 = NULL;
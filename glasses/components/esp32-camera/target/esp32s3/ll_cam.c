@@ -25,6 +25,7 @@
 #include "ll_cam.h"
 #include "cam_hal.h"
 #include "esp_rom_gpio.h"
+#include "trace_ring.h"
 
 #if (ESP_IDF_VERSION_MAJOR >= 5)
 #include "soc/gpio_sig_map.h"
@@ -100,11 +101,13 @@ static void CAMERA_ISR_IRAM_ATTR ll_cam_vsync_isr(void *arg)
         return;
     }
 
+    TRACE_BEGIN(TRACE_EV_CAM_VSYNC_ISR, 0);
     LCD_CAM.lc_dma_int_clr.val = status.val;
 
     if (status.cam_vsync_int_st) {
         ll_cam_send_event(cam, CAM_VSYNC_EVENT, &HPTaskAwoken);
     }
+    TRACE_END(TRACE_EV_CAM_VSYNC_ISR, 0);
 
     if (HPTaskAwoken == pdTRUE) {
         portYIELD_FROM_ISR();
@@ -122,11 +125,13 @@ static void CAMERA_ISR_IRAM_ATTR ll_cam_dma_isr(void *arg)
         return;
     }
 
+    TRACE_BEGIN(TRACE_EV_CAM_DMA_ISR, 0);
     GDMA.channel[cam->dma_num].in.int_clr.val = status.val;
 
     if (status.in_suc_eof) {
         ll_cam_send_event(cam, CAM_IN_SUC_EOF_EVENT, &HPTaskAwoken);
     }
+    TRACE_END(TRACE_EV_CAM_DMA_ISR, 0);
 
     if (HPTaskAwoken == pdTRUE) {
         portYIELD_FROM_ISR();
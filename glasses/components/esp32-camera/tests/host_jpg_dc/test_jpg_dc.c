@@ -0,0 +1,391 @@
+/*
+ * Host golden test and benchmark for the JPEG DC-only grayscale decoder
+ *
+ * Every image is decoded with jpg_dc_decode_gray() and with libjpeg at
+ * scale 1/8 into JCS_GRAYSCALE; the outputs must be identical. Synthetic
+ * images cover the sampling factors, restart intervals and odd sizes the
+ * decoder has to handle; camera frames are passed on the command line. A
+ * frame with an expected DC image next to it (frame.pgm) must also match
+ * that image, so a change in libjpeg cannot hide a regression.
+ *
+ *   ./test_jpg_dc [frame.jpg ...]            golden test
+ *   ./test_jpg_dc -g frame.jpg ...           write the expected frame.pgm
+ *   ./test_jpg_dc -b [iterations] [frame.jpg] benchmark
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jpeglib.h>
+#include "jpg_dc.h"
+
+typedef struct {
+    const char *name;
+    int width, height;
+    int components;         // 1 = grayscale, 3 = YCbCr
+    int h_samp, v_samp;     // luma sampling factors
+    int restart_interval;   // in MCUs, 0 = none
+    int quality;
+} synth_case_t;
+
+static const synth_case_t s_cases[] = {
+    {"svga_422_q90",      800,  600, 3, 2, 1,  0, 90},   // OV3660 default output
+    {"svga_422_rst",      800,  600, 3, 2, 1, 50, 90},
+    {"uxga_422_q95",     1600, 1200, 3, 2, 1,  0, 95},
+    {"vga_420",           640,  480, 3, 2, 2,  0, 75},
+    {"vga_444_rst",       640,  480, 3, 1, 1,  3, 60},
+    {"odd_420",           321,  239, 3, 2, 2,  7, 50},
+    {"tiny_420_rst1",      17,    9, 3, 2, 2,  1, 30},
+    {"gray",              333,  177, 1, 1, 1,  0, 85},
+    {"gray_rst",          160,  120, 1, 1, 1,  4, 10},
+    {"flat_q100",         256,  256, 3, 2, 1,  0, 100},
+};
+
+static unsigned char *synth_encode(const synth_case_t *c, unsigned seed, unsigned long *out_len)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char *out = NULL;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &out, out_len);
+    cinfo.image_width = c->width;
+    cinfo.image_height = c->height;
+    cinfo.input_components = c->components;
+    cinfo.in_color_space = c->components == 3 ? JCS_RGB : JCS_GRAYSCALE;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, c->quality, TRUE);
+    if (c->components == 3) {
+        cinfo.comp_info[0].h_samp_factor = c->h_samp;
+        cinfo.comp_info[0].v_samp_factor = c->v_samp;
+    }
+    cinfo.restart_interval = c->restart_interval;
+    jpeg_start_compress(&cinfo, TRUE);
+
+    // Gradients, edges and noise, so both DC and AC tables get exercised
+    unsigned char *row = malloc((size_t)c->width * c->components);
+    srand(seed);
+    for (int y = 0; y < c->height; y++) {
+        for (int x = 0; x < c->width * c->components; x++) {
+            int v = x * 255 / (c->width * c->components) + (((x / 29) ^ (y / 17)) & 1) * 60 + rand() % 24;
+            if (!strcmp(c->name, "flat_q100")) {
+                v = 128;
+            }
+            row[x] = v > 255 ? 255 : v;
+        }
+        JSAMPROW r = row;
+        jpeg_write_scanlines(&cinfo, &r, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+    return out;
+}
+
+static unsigned char *reference_decode(const unsigned char *jpg, size_t len, int *w, int *h)
+{
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_error_mgr jerr;
+
+    dinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&dinfo);
+    jpeg_mem_src(&dinfo, (unsigned char *)jpg, len);
+    jpeg_read_header(&dinfo, TRUE);
+    dinfo.scale_num = 1;
+    dinfo.scale_denom = 8;
+    dinfo.out_color_space = JCS_GRAYSCALE;
+    jpeg_start_decompress(&dinfo);
+    *w = dinfo.output_width;
+    *h = dinfo.output_height;
+    unsigned char *out = malloc((size_t)*w * *h);
+    while (dinfo.output_scanline < dinfo.output_height) {
+        JSAMPROW r = out + (size_t)dinfo.output_scanline * *w;
+        jpeg_read_scanlines(&dinfo, &r, 1);
+    }
+    jpeg_finish_decompress(&dinfo);
+    jpeg_destroy_decompress(&dinfo);
+    return out;
+}
+
+static unsigned char *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *buf = malloc(*len);
+    if (fread(buf, 1, *len, f) != *len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+// frame.jpg -> frame.pgm
+static char *expected_path(const char *path)
+{
+    size_t n = strlen(path);
+    const char *dot = strrchr(path, '.');
+    if (dot && !strchr(dot, '/')) {
+        n = dot - path;
+    }
+    char *pgm = malloc(n + 5);
+    memcpy(pgm, path, n);
+    strcpy(pgm + n, ".pgm");
+    return pgm;
+}
+
+static unsigned char *read_pgm(const char *path, int *w, int *h)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    int maxval;
+    unsigned char *img = NULL;
+    if (fscanf(f, "P5 %d %d %d", w, h, &maxval) == 3 && maxval == 255 && fgetc(f) != EOF) {
+        img = malloc((size_t)*w * *h);
+        if (fread(img, 1, (size_t)*w * *h, f) != (size_t)*w * *h) {
+            free(img);
+            img = NULL;
+        }
+    }
+    fclose(f);
+    return img;
+}
+
+static int write_expected(const char *path)
+{
+    size_t len;
+    unsigned char *jpg = read_file(path, &len);
+    if (!jpg) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 1;
+    }
+    int w, h;
+    unsigned char *ref = reference_decode(jpg, len, &w, &h);
+    char *pgm = expected_path(path);
+    FILE *f = fopen(pgm, "wb");
+    int fail = !f;
+    if (f) {
+        fprintf(f, "P5\n%d %d\n255\n", w, h);
+        fail = fwrite(ref, 1, (size_t)w * h, f) != (size_t)w * h;
+        fail |= fclose(f) != 0;
+    }
+    printf("%-4s %s %dx%d\n", fail ? "FAIL" : "ok", pgm, w, h);
+    free(pgm);
+    free(ref);
+    free(jpg);
+    return fail;
+}
+
+// Compare with the expected image stored next to the frame, if there is one
+static int expected(const char *path, const unsigned char *jpg, size_t len)
+{
+    char *pgm = expected_path(path);
+    int ew, eh;
+    unsigned char *exp = read_pgm(pgm, &ew, &eh);
+    if (!exp) {
+        free(pgm);
+        return 0;
+    }
+    unsigned char *out = malloc((size_t)ew * eh);
+    uint16_t w = 0, h = 0;
+    esp_err_t err = jpg_dc_decode_gray(jpg, len, out, (size_t)ew * eh, &w, &h);
+    size_t mismatch = 0;
+    int fail = err != ESP_OK || w != ew || h != eh;
+    if (!fail) {
+        for (size_t i = 0; i < (size_t)ew * eh; i++) {
+            mismatch += out[i] != exp[i];
+        }
+        fail = mismatch != 0;
+    }
+    printf("%-4s %-20s expected %s", fail ? "FAIL" : "ok", path, pgm);
+    if (err != ESP_OK) {
+        printf("  err=0x%x", err);
+    } else if (mismatch) {
+        printf("  %zu pixels differ", mismatch);
+    }
+    printf("\n");
+    free(out);
+    free(exp);
+    free(pgm);
+    return fail;
+}
+
+static int golden(const char *name, const unsigned char *jpg, size_t len)
+{
+    int rw, rh;
+    unsigned char *ref = reference_decode(jpg, len, &rw, &rh);
+    unsigned char *out = malloc((size_t)rw * rh);
+    uint16_t w = 0, h = 0;
+    esp_err_t err = jpg_dc_decode_gray(jpg, len, out, (size_t)rw * rh, &w, &h);
+
+    int fail = err != ESP_OK || w != rw || h != rh;
+    size_t mismatch = 0;
+    if (!fail) {
+        for (size_t i = 0; i < (size_t)rw * rh; i++) {
+            mismatch += out[i] != ref[i];
+        }
+        fail = mismatch != 0;
+    }
+    printf("%-4s %-20s %6zu bytes -> %3dx%-3d", fail ? "FAIL" : "ok", name, len, rw, rh);
+    if (err != ESP_OK) {
+        printf("  err=0x%x", err);
+    } else if (mismatch) {
+        printf("  %zu pixels differ", mismatch);
+    }
+    printf("\n");
+    free(out);
+    free(ref);
+    return fail;
+}
+
+// Malformed input must be rejected, never read out of bounds
+static int robustness(void)
+{
+    unsigned long len;
+    unsigned char *jpg = synth_encode(&s_cases[1], 7, &len);
+    unsigned char out[100 * 75];
+    int fail = 0;
+
+    for (unsigned long cut = 0; cut < len; cut += len / 97 + 1) {
+        unsigned char *copy = malloc(cut ? cut : 1);
+        memcpy(copy, jpg, cut);
+        jpg_dc_decode_gray(copy, cut, out, sizeof(out), NULL, NULL);
+        free(copy);
+    }
+    srand(1);
+    for (int i = 0; i < 200; i++) {
+        unsigned char *copy = malloc(len);
+        memcpy(copy, jpg, len);
+        for (int n = 0; n < 8; n++) {
+            copy[rand() % len] = rand();
+        }
+        jpg_dc_decode_gray(copy, len, out, sizeof(out), NULL, NULL);
+        free(copy);
+    }
+    // an AC table with all its codes of length 2, more than the four that fit
+    unsigned char *copy = malloc(len);
+    memcpy(copy, jpg, len);
+    int tables = 0;
+    for (unsigned long i = 0; i + 4 + 17 < len; i++) {
+        if (copy[i] == 0xFF && copy[i + 1] == 0xC4) {
+            unsigned char *counts = &copy[i + 5];
+            if (copy[i + 4] >> 4 == 1) {
+                int total = 0;
+                for (int l = 0; l < 16; l++) {
+                    total += counts[l];
+                    counts[l] = 0;
+                }
+                counts[1] = total;
+                tables++;
+            }
+            i += 1 + ((copy[i + 2] << 8) | copy[i + 3]);
+        }
+    }
+    if (!tables || jpg_dc_decode_gray(copy, len, out, sizeof(out), NULL, NULL) == ESP_OK) {
+        printf("FAIL oversubscribed Huffman table not rejected\n");
+        fail = 1;
+    }
+    free(copy);
+    if (jpg_dc_decode_gray(jpg, len, out, 10, NULL, NULL) != ESP_ERR_INVALID_SIZE) {
+        printf("FAIL small output buffer not rejected\n");
+        fail = 1;
+    }
+    printf("%-4s truncated/corrupted input\n", fail ? "FAIL" : "ok");
+    free(jpg);
+    return fail;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int bench(int iterations, const char *path)
+{
+    size_t len;
+    unsigned char *jpg;
+    if (path) {
+        jpg = read_file(path, &len);
+        if (!jpg) {
+            fprintf(stderr, "cannot read %s\n", path);
+            return 1;
+        }
+    } else {
+        unsigned long ulen;
+        jpg = synth_encode(&s_cases[0], 1, &ulen);
+        len = ulen;
+    }
+    uint16_t w, h;
+    jpg_dc_get_size(jpg, len, &w, &h);
+    size_t out_size = (size_t)((w + 7) / 8) * ((h + 7) / 8);
+    unsigned char *out = malloc(out_size);
+
+    double t0 = now_ms();
+    for (int i = 0; i < iterations; i++) {
+        jpg_dc_decode_gray(jpg, len, out, out_size, NULL, NULL);
+    }
+    double dc_ms = (now_ms() - t0) / iterations;
+
+    t0 = now_ms();
+    for (int i = 0; i < iterations; i++) {
+        int rw, rh;
+        free(reference_decode(jpg, len, &rw, &rh));
+    }
+    double ref_ms = (now_ms() - t0) / iterations;
+
+    printf("%s: %ux%u, %zu bytes\n", path ? path : s_cases[0].name, w, h, len);
+    printf("  jpg_dc_decode_gray  %8.3f ms/frame  %7.1f MB/s\n", dc_ms, len / dc_ms / 1e3);
+    printf("  libjpeg scale 1/8   %8.3f ms/frame  %7.1f MB/s\n", ref_ms, len / ref_ms / 1e3);
+    free(out);
+    free(jpg);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "-b")) {
+        int iterations = argc > 2 ? atoi(argv[2]) : 200;
+        return bench(iterations > 0 ? iterations : 200, argc > 3 ? argv[3] : NULL);
+    }
+    if (argc > 1 && !strcmp(argv[1], "-g")) {
+        int fails = 0;
+        for (int i = 2; i < argc; i++) {
+            fails += write_expected(argv[i]);
+        }
+        return fails ? 1 : 0;
+    }
+
+    int fails = 0;
+    for (size_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+        unsigned long len;
+        unsigned char *jpg = synth_encode(&s_cases[i], i + 1, &len);
+        fails += golden(s_cases[i].name, jpg, len);
+        free(jpg);
+    }
+    for (int i = 1; i < argc; i++) {
+        size_t len;
+        unsigned char *jpg = read_file(argv[i], &len);
+        if (!jpg) {
+            printf("FAIL %s: cannot read\n", argv[i]);
+            fails++;
+            continue;
+        }
+        fails += golden(argv[i], jpg, len);
+        fails += expected(argv[i], jpg, len);
+        free(jpg);
+    }
+    fails += robustness();
+
+    printf("%s: %d failure(s)\n", fails ? "FAILED" : "PASSED", fails);
+    return fails ? 1 : 0;
+}
@@ -117,8 +117,89 @@ typedef struct mdns_result_s {
     mdns_ip_addr_t *addr;                   /*!< linked list of IP addresses found */
 } mdns_result_t;
 
+/**
+ * @brief   mDNS action queue usage
+ */
+typedef struct {
+    uint32_t capacity;                      /*!< queue length, CONFIG_MDNS_ACTION_QUEUE_LEN */
+    uint32_t pending;                       /*!< actions currently waiting for the service task */
+    uint32_t high_water;                    /*!< most actions ever pending at once */
+    uint32_t dropped;                       /*!< actions refused because the queue was full */
+} mdns_action_queue_stats_t;
+
+/**
+ * @brief   mDNS receive path counters
+ */
+typedef struct {
+    uint32_t received;                      /*!< packets handed to the mDNS task */
+    uint32_t dropped;                       /*!< packets discarded for lack of a buffer or a queue slot */
+    uint32_t slots;                         /*!< receive buffers (BSD sockets networking), 0 with lwIP */
+    uint32_t slots_high_water;              /*!< most receive buffers ever in use at once */
+} mdns_rx_stats_t;
+
+/**
+ * @brief   mDNS locks, see mdns_get_lock_stats()
+ */
+typedef enum {
+    MDNS_LOCK_SERVICE = 0,                  /*!< registry, interfaces and scheduled packets, held by the mDNS task while it uses them */
+    MDNS_LOCK_SEARCH,                       /*!< list and timing of the running searches, taken by the timer */
+    MDNS_LOCK_MAX
+} mdns_lock_t;
+
+/**
+ * @brief   Contention and hold times of one mDNS lock
+ */
+typedef struct {
+    uint32_t taken;                         /*!< times the lock was taken */
+    uint32_t contended;                     /*!< times the lock was held by another task when taken */
+    uint32_t wait_max_us;                   /*!< longest wait for the lock */
+    uint32_t hold_max_us;                   /*!< longest time the lock was held */
+    uint64_t hold_total_us;                 /*!< sum of all hold times */
+} mdns_lock_stats_t;
+
+/**
+ * @brief   mDNS heap use, see mdns_get_mem_stats()
+ */
+typedef struct {
+    uint32_t allocs;                        /*!< allocations made */
+    uint32_t failed;                        /*!< allocations that returned NULL */
+    uint32_t live;                          /*!< allocations not freed yet */
+    uint32_t live_bytes;                    /*!< bytes of the live allocations */
+    uint32_t peak_bytes;                    /*!< most bytes allocated at once */
+    uint32_t sites;                         /*!< call sites seen */
+} mdns_mem_stats_t;
+
+/**
+ * @brief   Allocations made from one call site of the mdns_mem_* functions
+ */
+typedef struct {
+    const void *site;                       /*!< return address of the call, NULL for sites that did not fit in the table */
+    uint32_t allocs;                        /*!< allocations made */
+    uint32_t bytes;                         /*!< bytes requested by them */
+    uint32_t live;                          /*!< allocations not freed yet */
+    uint32_t live_bytes;                    /*!< bytes of the live allocations */
+} mdns_mem_site_stats_t;
+
+/**
+ * @brief   Changes to the results of a browse, see mdns_browse_new_diff()
+ *
+ * The diff, its lists and the results in them are owned by the browse and
+ * are valid only while the notifier runs: the mDNS task updates results in
+ * place as records arrive or expire and frees the removed ones once the
+ * notifier returns. Copy whatever is needed afterwards.
+ */
+typedef struct {
+    mdns_result_t **added;                  /*!< instances seen for the first time */
+    size_t num_added;
+    mdns_result_t **updated;                /*!< instances whose host, port, TXT, addresses or TTL changed */
+    size_t num_updated;
+    mdns_result_t **removed;                /*!< instances that were withdrawn (ttl 0) */
+    size_t num_removed;
+} mdns_browse_diff_t;
+
 typedef void (*mdns_query_notify_t)(mdns_search_once_t *search);
 typedef void (*mdns_browse_notify_t)(mdns_result_t *result);
+typedef void (*mdns_browse_diff_notify_t)(const mdns_browse_diff_t *diff);
 
 /**
  * @brief  Initialize mDNS on given interface
@@ -692,6 +773,10 @@ mdns_search_once_t *mdns_query_async_new(const char *name, const char *service_t
  * @brief  Generic mDNS query
  *         All following query methods are derived from this one
  *
+ * The query is repeated after 1, 2, 4... seconds until the timeout. It returns early once
+ * max_results is reached, or, for other than PTR queries, as soon as a responder sent the
+ * complete set of the unique records asked for (cache-flush bit set).
+ *
  * @param  name         service instance or host name (NULL for PTR queries)
  * @param  service_type service type (_http, _arduino, _ftp etc.) (NULL for host queries)
  * @param  proto        service protocol (_tcp, _udp, etc.) (NULL for host queries)
@@ -908,9 +993,94 @@ esp_err_t mdns_unregister_netif(esp_netif_t *esp_netif);
  */
 esp_err_t mdns_netif_action(esp_netif_t *esp_netif, mdns_event_actions_t event_action);
 
+/**
+ * @brief   Get usage of the queue that passes API calls, received packets and timer events to the mDNS task
+ *
+ * A high water mark close to the capacity means CONFIG_MDNS_ACTION_QUEUE_LEN should be raised.
+ *
+ * @param stats  Filled with the current usage
+ * @return
+ *     - ESP_OK                 success
+ *     - ESP_ERR_INVALID_ARG    stats is NULL
+ *     - ESP_ERR_INVALID_STATE  mDNS is not running
+ */
+esp_err_t mdns_get_action_queue_stats(mdns_action_queue_stats_t *stats);
+
+/**
+ * @brief   Get counters of the receive path
+ *
+ * With CONFIG_MDNS_NETWORKING_SOCKET, a high water mark equal to the number of
+ * slots together with drops means CONFIG_MDNS_RX_RING_SLOTS should be raised.
+ *
+ * @param stats  Filled with the counters
+ * @return
+ *     - ESP_OK                 success
+ *     - ESP_ERR_INVALID_ARG    stats is NULL
+ */
+esp_err_t mdns_get_rx_stats(mdns_rx_stats_t *stats);
+
+/**
+ * @brief   Get contention and hold times of an mDNS lock
+ *
+ * Needs CONFIG_MDNS_LOCK_STATS. A long hold_max_us on MDNS_LOCK_SERVICE is
+ * the time API calls may wait behind the mDNS task.
+ *
+ * @param lock   The lock
+ * @param stats  Filled with the statistics
+ * @param reset  Start counting again after reading
+ * @return
+ *     - ESP_OK                 success
+ *     - ESP_ERR_NOT_SUPPORTED  CONFIG_MDNS_LOCK_STATS is disabled
+ *     - ESP_ERR_INVALID_ARG    stats is NULL or lock is out of range
+ *     - ESP_ERR_INVALID_STATE  mDNS is not running
+ */
+esp_err_t mdns_get_lock_stats(mdns_lock_t lock, mdns_lock_stats_t *stats, bool reset);
+
+/**
+ * @brief   Get the allocations of the mDNS component, in total and per call site
+ *
+ * Needs CONFIG_MDNS_MEMORY_PROFILING. Works whether or not mDNS is running.
+ * Counters are read one by one, so allocations made while reading may be
+ * counted in some and not in others.
+ *
+ * @param stats      Filled with the totals
+ * @param sites      Filled with the call sites, may be NULL
+ * @param num_sites  In: length of sites, out: number of sites written, may be NULL if sites is
+ * @param reset      Start counting allocations and the peak again after reading, live allocations stay counted
+ * @return
+ *     - ESP_OK                 success
+ *     - ESP_ERR_NOT_SUPPORTED  CONFIG_MDNS_MEMORY_PROFILING is disabled
+ *     - ESP_ERR_INVALID_ARG    stats is NULL, or sites without num_sites
+ */
+esp_err_t mdns_get_mem_stats(mdns_mem_stats_t *stats, mdns_mem_site_stats_t *sites, size_t *num_sites, bool reset);
+
+/**
+ * @brief   Process a captured mDNS payload as if it was received, and wait until the mDNS task is done with it
+ *
+ * For replaying recorded traffic in host benchmarks. The payload goes through the
+ * same pre-filter, parser and responder as a received packet, answers are sent on
+ * the interface. Call from one task at a time.
+ *
+ * @param netif     Interface the packet arrives on, registered and enabled for the protocol of src
+ * @param src       Source address of the packet
+ * @param src_port  Source UDP port, anything but 5353 is answered as a legacy unicast query
+ * @param data      The mDNS message
+ * @param len       Length of data
+ * @return
+ *     - ESP_OK                 processed
+ *     - ESP_ERR_NOT_SUPPORTED  needs CONFIG_MDNS_NETWORKING_SOCKET
+ *     - ESP_ERR_INVALID_ARG    NULL argument, len is 0 or above 1460 bytes
+ *     - ESP_ERR_INVALID_STATE  netif is not enabled for the protocol
+ *     - ESP_ERR_NO_MEM         the packet could not be queued
+ */
+esp_err_t mdns_rx_replay(esp_netif_t *netif, const esp_ip_addr_t *src, uint16_t src_port, const uint8_t *data, size_t len);
+
 /**
  * @brief   Browse mDNS for a service `_service._proto`.
  *
+ * Changes within CONFIG_MDNS_BROWSE_COALESCE_MS of each other are merged,
+ * and the notifier is called once for each instance that changed.
+ *
  * @param service  Pointer to the `_service` which will be browsed.
  * @param proto    Pointer to the `_proto` which will be browsed.
  * @param notifier The callback which will be called when the browsing service changed.
@@ -919,6 +1089,23 @@ esp_err_t mdns_netif_action(esp_netif_t *esp_netif, mdns_event_actions_t event_a
  */
 mdns_browse_t *mdns_browse_new(const char *service, const char *proto, mdns_browse_notify_t notifier);
 
+/**
+ * @brief   Browse mDNS for a service `_service._proto`, notifying changes in batches.
+ *
+ * Changes within CONFIG_MDNS_BROWSE_COALESCE_MS of each other are merged
+ * and delivered in one call, split into added, updated and removed
+ * instances. An instance added and removed within the window is not
+ * reported. Stop it with mdns_browse_delete().
+ *
+ * @param service  Pointer to the `_service` which will be browsed.
+ * @param proto    Pointer to the `_proto` which will be browsed.
+ * @param notifier The callback which will be called with the changes, on the mDNS
+ *                 task. The diff is valid only during the call, see mdns_browse_diff_t.
+ * @return mdns_browse_t pointer to new browse object if initiated successfully.
+ *         NULL otherwise.
+ */
+mdns_browse_t *mdns_browse_new_diff(const char *service, const char *proto, mdns_browse_diff_notify_t notifier);
+
 /**
  * @brief   Stop the `_service._proto` browse.
  * @param service  Pointer to the `_service` which will be browsed.
@@ -5,6 +5,7 @@
  */
 
 #include <string.h>
+#include <ctype.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -20,11 +21,12 @@
 
 static void _mdns_browse_item_free(mdns_browse_t *browse);
 static esp_err_t _mdns_send_browse_action(mdns_action_type_t type, mdns_browse_t *browse);
-static esp_err_t _mdns_sync_browse_action(mdns_action_type_t type, mdns_browse_sync_t *browse_sync);
-static void _mdns_browse_sync(mdns_browse_sync_t *browse_sync);
+static void _mdns_browse_flush_due(void);
+static void _mdns_browse_publish(void);
 static void _mdns_browse_finish(mdns_browse_t *browse);
 static void _mdns_browse_add(mdns_browse_t *browse);
 static void _mdns_browse_send(mdns_browse_t *browse, mdns_if_t interface);
+static inline uint16_t _mdns_read_u16(const uint8_t *packet, uint16_t index);
 
 #if CONFIG_ETH_ENABLED && CONFIG_MDNS_PREDEF_NETIF_ETH
 #include "esp_eth.h"
@@ -40,6 +42,13 @@ static void _mdns_browse_send(mdns_browse_t *browse, mdns_if_t interface);
 #include "esp_wifi.h"
 #endif
 
+#if __has_include("trace_ring.h")
+#include "trace_ring.h"
+#else
+#define TRACE_BEGIN(ev, arg)    do { (void)(arg); } while (0)
+#define TRACE_END(ev, arg)      do { (void)(arg); } while (0)
+#endif
+
 #ifdef MDNS_ENABLE_DEBUG
 void mdns_debug_packet(const uint8_t *data, size_t len);
 #endif
@@ -63,18 +72,55 @@ static const char *TAG = "mdns";
 
 static volatile TaskHandle_t _mdns_service_task_handle = NULL;
 static SemaphoreHandle_t _mdns_service_semaphore = NULL;
+static SemaphoreHandle_t _mdns_search_semaphore = NULL;
 static StackType_t *_mdns_stack_buffer;
 
+#if CONFIG_MDNS_LOCK_STATS
+static struct {
+    mdns_lock_stats_t stats;
+    int64_t taken_at;       // written by the holder only
+} s_lock_stats[MDNS_LOCK_MAX];
+
+static void _mdns_lock_take(SemaphoreHandle_t sem, mdns_lock_t lock)
+{
+    int64_t start = esp_timer_get_time();
+    bool contended = xSemaphoreTake(sem, 0) != pdTRUE;
+    if (contended) {
+        xSemaphoreTake(sem, portMAX_DELAY);
+    }
+    mdns_lock_stats_t *stats = &s_lock_stats[lock].stats;
+    int64_t now = esp_timer_get_time();
+    uint32_t wait = now - start;
+    stats->taken++;
+    stats->contended += contended;
+    if (wait > stats->wait_max_us) {
+        stats->wait_max_us = wait;
+    }
+    s_lock_stats[lock].taken_at = now;
+}
+
+static void _mdns_lock_give(SemaphoreHandle_t sem, mdns_lock_t lock)
+{
+    mdns_lock_stats_t *stats = &s_lock_stats[lock].stats;
+    uint32_t hold = esp_timer_get_time() - s_lock_stats[lock].taken_at;
+    stats->hold_total_us += hold;
+    if (hold > stats->hold_max_us) {
+        stats->hold_max_us = hold;
+    }
+    xSemaphoreGive(sem);
+}
+#endif /* CONFIG_MDNS_LOCK_STATS */
+
 static void _mdns_search_finish_done(void);
 static mdns_search_once_t *_mdns_search_find_from(mdns_search_once_t *search, mdns_name_t *name, uint16_t type, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol);
 static mdns_browse_t *_mdns_browse_find_from(mdns_browse_t *b, mdns_name_t *name, uint16_t type, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol);
 static void _mdns_browse_result_add_srv(mdns_browse_t *browse, const char *hostname, const char *instance, const char *service, const char *proto,
-                                        uint16_t port, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint32_t ttl, mdns_browse_sync_t *out_sync_browse);
+                                        uint16_t port, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint32_t ttl);
 static void _mdns_browse_result_add_ip(mdns_browse_t *browse, const char *hostname, esp_ip_addr_t *ip,
-                                       mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint32_t ttl, mdns_browse_sync_t *out_sync_browse);
+                                       mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint32_t ttl);
 static void _mdns_browse_result_add_txt(mdns_browse_t *browse,  const char *instance, const char *service, const char *proto,
                                         mdns_txt_item_t *txt, uint8_t *txt_value_len, size_t txt_count, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol,
-                                        uint32_t ttl, mdns_browse_sync_t *out_sync_browse);
+                                        uint32_t ttl);
 #ifdef MDNS_ENABLE_DEBUG
 static void debug_printf_browse_result(mdns_result_t *r_t, mdns_browse_t *b_t);
 static void debug_printf_browse_result_all(mdns_result_t *r_t);
@@ -95,6 +141,12 @@ static void _mdns_remap_self_service_hostname(const char *old_hostname, const ch
 static esp_err_t mdns_post_custom_action_tcpip_if(mdns_if_t mdns_if, mdns_event_actions_t event_action);
 
 static void _mdns_query_results_free(mdns_result_t *results);
+static void _mdns_prefilter_clear(void);
+static void *_mdns_rx_arena_alloc(size_t size);
+#if CONFIG_MDNS_PASSIVE_CACHE
+static void _mdns_cache_clear(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol);
+static void _mdns_search_send_pcb(mdns_search_once_t *search, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol);
+#endif
 typedef enum {
     MDNS_IF_STA = 0,
     MDNS_IF_AP = 1,
@@ -279,60 +331,6 @@ static bool _mdns_service_match(const mdns_service_t *srv, const char *service,
            (_str_null_or_empty(hostname) || !strcasecmp(srv->hostname, hostname));
 }
 
-/**
- * @brief  finds service from given service type
- * @param  server       the server
- * @param  service      service type to match
- * @param  proto        proto to match
- * @param  hostname     hostname of the service (if non-null)
- *
- * @return the service item if found or NULL on error
- */
-static mdns_srv_item_t *_mdns_get_service_item(const char *service, const char *proto, const char *hostname)
-{
-    mdns_srv_item_t *s = _mdns_server->services;
-    while (s) {
-        if (_mdns_service_match(s->service, service, proto, hostname)) {
-            return s;
-        }
-        s = s->next;
-    }
-    return NULL;
-}
-
-static mdns_srv_item_t *_mdns_get_service_item_subtype(const char *subtype, const char *service, const char *proto)
-{
-    mdns_srv_item_t *s = _mdns_server->services;
-    while (s) {
-        if (_mdns_service_match(s->service, service, proto, NULL)) {
-            mdns_subtype_t *subtype_item = s->service->subtype;
-            while (subtype_item) {
-                if (!strcasecmp(subtype_item->subtype, subtype)) {
-                    return s;
-                }
-                subtype_item = subtype_item->next;
-            }
-        }
-        s = s->next;
-    }
-    return NULL;
-}
-
-static mdns_host_item_t *mdns_get_host_item(const char *hostname)
-{
-    if (hostname == NULL || strcasecmp(hostname, _mdns_server->hostname) == 0) {
-        return &_mdns_self_host;
-    }
-    mdns_host_item_t *host = _mdns_host_list;
-    while (host != NULL) {
-        if (strcasecmp(host->hostname, hostname) == 0) {
-            return host;
-        }
-        host = host->next;
-    }
-    return NULL;
-}
-
 static bool _mdns_can_add_more_services(void)
 {
 #if MDNS_MAX_SERVICES == 0
@@ -351,25 +349,49 @@ static bool _mdns_can_add_more_services(void)
 #endif
 }
 
-esp_err_t _mdns_send_rx_action(mdns_rx_packet_t *packet)
-{
-    mdns_action_t *action = NULL;
+/**
+ * Action queue statistics. They live outside _mdns_server and are only
+ * touched with atomics, so mdns_get_action_queue_stats() needs no lock and
+ * cannot race with mdns_free(), which deletes the service lock before the
+ * server goes away.
+ */
+static struct {
+    atomic_bool running;            // cleared first thing in mdns_free()
+    atomic_uint pending;            // posted and not yet taken by the service task
+    atomic_uint high_water;         // most actions ever pending at once
+    atomic_uint dropped;            // actions refused because the queue was full
+} s_action_stats;
 
-    action = (mdns_action_t *)mdns_mem_malloc(sizeof(mdns_action_t));
-    if (!action) {
-        HOOK_MALLOC_FAILED;
+/**
+ * @brief  Post an action to the service task
+ *
+ * Actions are copied into the queue's own storage, so posting never allocates
+ *
+ * @return ESP_ERR_NO_MEM if the queue is full
+ */
+static esp_err_t _mdns_send_action(const mdns_action_t *action)
+{
+    // counted before sending, so the service task never takes it below zero
+    unsigned pending = atomic_fetch_add(&s_action_stats.pending, 1) + 1;
+    if (xQueueSend(_mdns_server->action_queue, action, (TickType_t)0) != pdPASS) {
+        atomic_fetch_sub(&s_action_stats.pending, 1);
+        atomic_fetch_add(&s_action_stats.dropped, 1);
         return ESP_ERR_NO_MEM;
     }
-
-    action->type = ACTION_RX_HANDLE;
-    action->data.rx_handle.packet = packet;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
-        mdns_mem_free(action);
-        return ESP_ERR_NO_MEM;
+    unsigned hwm = atomic_load(&s_action_stats.high_water);
+    while (pending > hwm && !atomic_compare_exchange_weak(&s_action_stats.high_water, &hwm, pending)) {
+        // hwm was reloaded, another sender got there first
     }
     return ESP_OK;
 }
 
+esp_err_t _mdns_send_rx_action(mdns_rx_packet_t *packet)
+{
+    mdns_action_t action = { .type = ACTION_RX_HANDLE };
+    action.data.rx_handle.packet = packet;
+    return _mdns_send_action(&action);
+}
+
 static const char *_mdns_get_default_instance_name(void)
 {
     if (_mdns_server && !_str_null_or_empty(_mdns_server->instance)) {
@@ -419,235 +441,760 @@ static bool _mdns_service_match_instance(const mdns_service_t *srv, const char *
            !strcasecmp(srv->proto, proto) && (_str_null_or_empty(hostname) || !strcasecmp(srv->hostname, hostname));
 }
 
-static mdns_srv_item_t *_mdns_get_service_item_instance(const char *instance, const char *service, const char *proto,
-                                                        const char *hostname)
+/**
+ * Hash index over our services and delegated hosts, so that matching the
+ * names of received questions and records does not walk the lists and compare
+ * every field. Keys are case-folded hashes of the fields a lookup compares,
+ * for each key only the first item in list order is kept, which is the one
+ * the list walk would have found. Hits are confirmed with the same match
+ * functions as before.
+ *
+ * The index points into the registry, so it is dropped whenever services, their
+ * names or subtypes, or delegated hosts change (see _mdns_index_clear()), and
+ * rebuilt by the next lookup. Small registries, and registries the index has no
+ * memory for, are searched by walking the lists.
+ */
+typedef enum {
+    MDNS_INDEX_TYPE = 1,        // service, proto
+    MDNS_INDEX_TYPE_HOST,       // service, proto, hostname
+    MDNS_INDEX_INSTANCE,        // instance (or the default instance), service, proto
+    MDNS_INDEX_INSTANCE_HOST,   // instance, service, proto, hostname
+    MDNS_INDEX_SUBTYPE,         // subtype, service, proto
+    MDNS_INDEX_HOST,            // delegated hostname
+} mdns_index_kind_t;
+
+static struct {
+    struct {
+        uint32_t key;           // hash with the kind in the low bits, 0 marks a free slot
+        void *item;             // mdns_srv_item_t or mdns_host_item_t
+    } *slots;
+    uint16_t mask;
+    bool built;                 // slots is NULL after a build if the lists are short
+} s_index;
+
+/**
+ * @brief  drops the index, it is rebuilt by the next lookup
+ */
+static void _mdns_index_clear(void)
 {
-    mdns_srv_item_t *s = _mdns_server->services;
-    while (s) {
-        if (instance) {
-            if (_mdns_service_match_instance(s->service, instance, service, proto, hostname)) {
-                return s;
-            }
-        } else {
-            if (_mdns_service_match(s->service, service, proto, hostname)) {
-                return s;
-            }
+    mdns_mem_free(s_index.slots);
+    s_index.slots = NULL;
+    s_index.built = false;
+}
+
+static uint32_t _mdns_index_key(mdns_index_kind_t kind, const char *a, const char *b, const char *c, const char *d)
+{
+    const char *fields[] = { a, b, c, d };
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 4 && fields[i]; i++) {
+        for (const uint8_t *p = (const uint8_t *)fields[i]; *p; p++) {
+            hash = (hash ^ (*p >= 'A' && *p <= 'Z' ? *p | 0x20 : *p)) * 16777619u;
         }
-        s = s->next;
+        hash = (hash ^ 0xff) * 16777619u;
     }
-    return NULL;
+    return (hash & ~7u) | kind;
 }
 
 /**
- * @brief  reads MDNS FQDN into mdns_name_t structure
- *         FQDN is in format: [hostname.|[instance.]_service._proto.]local.
- *
- * @param  packet       MDNS packet
- * @param  start        Starting point of FQDN
- * @param  name         mdns_name_t structure to populate
- * @param  buf          temporary char buffer
- *
- * @return the address after the parsed FQDN in the packet or NULL on error
+ * @brief  next item stored under key, starting the probe at *pos = key
  */
-static const uint8_t *_mdns_read_fqdn(const uint8_t *packet, const uint8_t *start, mdns_name_t *name, char *buf, size_t packet_len)
+static void *_mdns_index_next(uint32_t key, uint32_t *pos)
 {
-    size_t index = 0;
-    const uint8_t *packet_end = packet + packet_len;
-    while (start + index < packet_end && start[index]) {
-        if (name->parts == 4) {
-            name->invalid = true;
-        }
-        uint8_t len = start[index++];
-        if (len < 0xC0) {
-            if (len > 63) {
-                //length can not be more than 63
-                return NULL;
-            }
-            uint8_t i;
-            for (i = 0; i < len; i++) {
-                if (start + index >= packet_end) {
-                    return NULL;
-                }
-                buf[i] = start[index++];
-            }
-            buf[len] = '\0';
-            if (name->parts == 1 && buf[0] != '_'
-                    && (strcasecmp(buf, MDNS_DEFAULT_DOMAIN) != 0)
-                    && (strcasecmp(buf, "arpa") != 0)
-#ifndef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
-                    && (strcasecmp(buf, "ip6") != 0)
-                    && (strcasecmp(buf, "in-addr") != 0)
-#endif
-               ) {
-                strlcat(name->host, ".", sizeof(name->host));
-                strlcat(name->host, buf, sizeof(name->host));
-            } else if (strcasecmp(buf, MDNS_SUB_STR) == 0) {
-                name->sub = 1;
-            } else if (!name->invalid) {
-                char *mdns_name_ptrs[] = {name->host, name->service, name->proto, name->domain};
-                memcpy(mdns_name_ptrs[name->parts++], buf, len + 1);
-            }
-        } else {
-            size_t address = (((uint16_t)len & 0x3F) << 8) | start[index++];
-            if ((packet + address) >= start) {
-                //reference address can not be after where we are
-                return NULL;
-            }
-            if (_mdns_read_fqdn(packet, packet + address, name, buf, packet_len)) {
-                return start + index;
-            }
-            return NULL;
+    for (; s_index.slots[*pos & s_index.mask].key; (*pos)++) {
+        if (s_index.slots[*pos & s_index.mask].key == key) {
+            return s_index.slots[(*pos)++ & s_index.mask].item;
         }
     }
-    return start + index + 1;
+    return NULL;
 }
 
-/**
- * @brief  sets uint16_t value in a packet
- *
- * @param  packet       MDNS packet
- * @param  index        offset of uint16_t value
- * @param  value        the value to set
- */
-static inline void _mdns_set_u16(uint8_t *packet, uint16_t index, uint16_t value)
+static void _mdns_index_insert(uint32_t key, void *item)
 {
-    if ((index + 1) >= MDNS_MAX_PACKET_SIZE) {
-        return;
+    uint32_t i = key;
+    while (s_index.slots[i & s_index.mask].key) {
+        i++;
     }
-    packet[index] = (value >> 8) & 0xFF;
-    packet[index + 1] = value & 0xFF;
+    s_index.slots[i & s_index.mask].key = key;
+    s_index.slots[i & s_index.mask].item = item;
 }
 
-/**
- * @brief  appends byte in a packet, incrementing the index
- *
- * @param  packet       MDNS packet
- * @param  index        offset in the packet
- * @param  value        the value to set
- *
- * @return length of added data: 0 on error or 1 on success
- */
-static inline uint8_t _mdns_append_u8(uint8_t *packet, uint16_t *index, uint8_t value)
+static mdns_srv_item_t *_mdns_index_find_service(const char *service, const char *proto, const char *hostname)
 {
-    if (*index >= MDNS_MAX_PACKET_SIZE) {
-        return 0;
+    uint32_t key = _str_null_or_empty(hostname) ? _mdns_index_key(MDNS_INDEX_TYPE, service, proto, NULL, NULL)
+                   : _mdns_index_key(MDNS_INDEX_TYPE_HOST, service, proto, hostname, NULL);
+    uint32_t pos = key;
+    mdns_srv_item_t *s;
+    while ((s = _mdns_index_next(key, &pos))) {
+        if (_mdns_service_match(s->service, service, proto, hostname)) {
+            return s;
+        }
     }
-    packet[*index] = value;
-    *index += 1;
-    return 1;
+    return NULL;
 }
 
-/**
- * @brief  appends uint16_t in a packet, incrementing the index
- *
- * @param  packet       MDNS packet
- * @param  index        offset in the packet
- * @param  value        the value to set
- *
- * @return length of added data: 0 on error or 2 on success
- */
-static inline uint8_t _mdns_append_u16(uint8_t *packet, uint16_t *index, uint16_t value)
+static mdns_srv_item_t *_mdns_index_find_instance(const char *instance, const char *service, const char *proto, const char *hostname)
 {
-    if ((*index + 1) >= MDNS_MAX_PACKET_SIZE) {
-        return 0;
+    uint32_t key = _str_null_or_empty(hostname) ? _mdns_index_key(MDNS_INDEX_INSTANCE, instance, service, proto, NULL)
+                   : _mdns_index_key(MDNS_INDEX_INSTANCE_HOST, instance, service, proto, hostname);
+    uint32_t pos = key;
+    mdns_srv_item_t *s;
+    while ((s = _mdns_index_next(key, &pos))) {
+        if (_mdns_service_match_instance(s->service, instance, service, proto, hostname)) {
+            return s;
+        }
     }
-    _mdns_append_u8(packet, index, (value >> 8) & 0xFF);
-    _mdns_append_u8(packet, index, value & 0xFF);
-    return 2;
+    return NULL;
 }
 
-/**
- * @brief  appends uint32_t in a packet, incrementing the index
- *
- * @param  packet       MDNS packet
- * @param  index        offset in the packet
- * @param  value        the value to set
- *
- * @return length of added data: 0 on error or 4 on success
- */
-static inline uint8_t _mdns_append_u32(uint8_t *packet, uint16_t *index, uint32_t value)
+static bool _mdns_service_has_subtype(const mdns_service_t *srv, const char *subtype)
 {
-    if ((*index + 3) >= MDNS_MAX_PACKET_SIZE) {
-        return 0;
+    for (mdns_subtype_t *item = srv->subtype; item; item = item->next) {
+        if (!strcasecmp(item->subtype, subtype)) {
+            return true;
+        }
     }
-    _mdns_append_u8(packet, index, (value >> 24) & 0xFF);
-    _mdns_append_u8(packet, index, (value >> 16) & 0xFF);
-    _mdns_append_u8(packet, index, (value >> 8) & 0xFF);
-    _mdns_append_u8(packet, index, value & 0xFF);
-    return 4;
+    return false;
 }
 
-/**
- * @brief  appends answer type, class, ttl and data length to a packet, incrementing the index
- *
- * @param  packet       MDNS packet
- * @param  index        offset in the packet
- * @param  type         answer type
- * @param  ttl          answer ttl
- *
- * @return length of added data: 0 on error or 10 on success
- */
-static inline uint8_t _mdns_append_type(uint8_t *packet, uint16_t *index, uint8_t type, bool flush, uint32_t ttl)
+static mdns_srv_item_t *_mdns_index_find_subtype(const char *subtype, const char *service, const char *proto)
 {
-    if ((*index + 10) >= MDNS_MAX_PACKET_SIZE) {
-        return 0;
-    }
-    uint16_t mdns_class = MDNS_CLASS_IN;
-    if (flush) {
-        mdns_class = MDNS_CLASS_IN_FLUSH_CACHE;
-    }
-    if (type == MDNS_ANSWER_PTR) {
-        _mdns_append_u16(packet, index, MDNS_TYPE_PTR);
-        _mdns_append_u16(packet, index, mdns_class);
-    } else if (type == MDNS_ANSWER_TXT) {
-        _mdns_append_u16(packet, index, MDNS_TYPE_TXT);
-        _mdns_append_u16(packet, index, mdns_class);
-    } else if (type == MDNS_ANSWER_SRV) {
-        _mdns_append_u16(packet, index, MDNS_TYPE_SRV);
-        _mdns_append_u16(packet, index, mdns_class);
-    } else if (type == MDNS_ANSWER_A) {
-        _mdns_append_u16(packet, index, MDNS_TYPE_A);
-        _mdns_append_u16(packet, index, mdns_class);
-    } else if (type == MDNS_ANSWER_AAAA) {
-        _mdns_append_u16(packet, index, MDNS_TYPE_AAAA);
-        _mdns_append_u16(packet, index, mdns_class);
-    } else {
-        return 0;
+    uint32_t key = _mdns_index_key(MDNS_INDEX_SUBTYPE, subtype, service, proto, NULL);
+    uint32_t pos = key;
+    mdns_srv_item_t *s;
+    while ((s = _mdns_index_next(key, &pos))) {
+        if (_mdns_service_match(s->service, service, proto, NULL) && _mdns_service_has_subtype(s->service, subtype)) {
+            return s;
+        }
     }
-    _mdns_append_u32(packet, index, ttl);
-    _mdns_append_u16(packet, index, 0);
-    return 10;
+    return NULL;
 }
 
-static inline uint8_t _mdns_append_string_with_len(uint8_t *packet, uint16_t *index, const char *string, uint8_t len)
+static mdns_host_item_t *_mdns_index_find_host(const char *hostname)
 {
-    if ((*index + len + 1) >= MDNS_MAX_PACKET_SIZE) {
-        return 0;
+    uint32_t key = _mdns_index_key(MDNS_INDEX_HOST, hostname, NULL, NULL, NULL);
+    uint32_t pos = key;
+    mdns_host_item_t *host;
+    while ((host = _mdns_index_next(key, &pos))) {
+        if (!strcasecmp(host->hostname, hostname)) {
+            return host;
+        }
     }
-    _mdns_append_u8(packet, index, len);
-    memcpy(packet + *index, string, len);
-    *index += len;
-    return len + 1;
+    return NULL;
 }
 
 /**
- * @brief  appends single string to a packet, incrementing the index
- *
- * @param  packet       MDNS packet
- * @param  index        offset in the packet
- * @param  string       the string to append
+ * @brief  builds the index from the service and delegated host lists
  *
- * @return length of added data: 0 on error or length of the string + 1 on success
+ * @return false if the lists are to be walked instead
  */
-static inline uint8_t _mdns_append_string(uint8_t *packet, uint16_t *index, const char *string)
+static bool _mdns_index_build(void)
 {
-    uint8_t len = strlen(string);
-    if ((*index + len + 1) >= MDNS_MAX_PACKET_SIZE) {
-        return 0;
+    size_t count = 0;
+    for (mdns_srv_item_t *s = _mdns_server->services; s; s = s->next) {
+        count += 4;
+        for (mdns_subtype_t *sub = s->service->subtype; sub; sub = sub->next) {
+            count++;
+        }
     }
-    _mdns_append_u8(packet, index, len);
-    memcpy(packet + *index, string, len);
-    *index += len;
+    for (mdns_host_item_t *host = _mdns_host_list; host; host = host->next) {
+        count++;
+    }
+    if (count < MDNS_INDEX_MIN_ENTRIES) {
+        s_index.built = true;
+        return false;
+    }
+    size_t size = MDNS_INDEX_MIN_SIZE;
+    while (size < count + count / 2) {
+        size <<= 1;
+    }
+    s_index.slots = mdns_mem_calloc(size, sizeof(s_index.slots[0]));
+    if (!s_index.slots) {
+        return false;
+    }
+    s_index.mask = size - 1;
+    s_index.built = true;
+
+    // a key is only added if the items before did not take it
+    for (mdns_srv_item_t *s = _mdns_server->services; s; s = s->next) {
+        mdns_service_t *srv = s->service;
+        const char *instance = srv->instance ? srv->instance : _mdns_get_default_instance_name();
+        if (srv->hostname) {
+            if (!_mdns_index_find_service(srv->service, srv->proto, NULL)) {
+                _mdns_index_insert(_mdns_index_key(MDNS_INDEX_TYPE, srv->service, srv->proto, NULL, NULL), s);
+            }
+            if (!_mdns_index_find_service(srv->service, srv->proto, srv->hostname)) {
+                _mdns_index_insert(_mdns_index_key(MDNS_INDEX_TYPE_HOST, srv->service, srv->proto, srv->hostname, NULL), s);
+            }
+            for (mdns_subtype_t *sub = srv->subtype; sub; sub = sub->next) {
+                if (!_mdns_index_find_subtype(sub->subtype, srv->service, srv->proto)) {
+                    _mdns_index_insert(_mdns_index_key(MDNS_INDEX_SUBTYPE, sub->subtype, srv->service, srv->proto, NULL), s);
+                }
+            }
+        }
+        if (instance) {
+            if (!_mdns_index_find_instance(instance, srv->service, srv->proto, NULL)) {
+                _mdns_index_insert(_mdns_index_key(MDNS_INDEX_INSTANCE, instance, srv->service, srv->proto, NULL), s);
+            }
+            if (srv->hostname && !_mdns_index_find_instance(instance, srv->service, srv->proto, srv->hostname)) {
+                _mdns_index_insert(_mdns_index_key(MDNS_INDEX_INSTANCE_HOST, instance, srv->service, srv->proto, srv->hostname), s);
+            }
+        }
+    }
+    for (mdns_host_item_t *host = _mdns_host_list; host; host = host->next) {
+        if (!_mdns_index_find_host(host->hostname)) {
+            _mdns_index_insert(_mdns_index_key(MDNS_INDEX_HOST, host->hostname, NULL, NULL, NULL), host);
+        }
+    }
+    return true;
+}
+
+static inline bool _mdns_index_ready(void)
+{
+    if (s_index.built) {
+        return s_index.slots != NULL;
+    }
+    return _mdns_index_build();
+}
+
+/**
+ * @brief  finds service from given service type
+ * @param  server       the server
+ * @param  service      service type to match
+ * @param  proto        proto to match
+ * @param  hostname     hostname of the service (if non-null)
+ *
+ * @return the service item if found or NULL on error
+ */
+static mdns_srv_item_t *_mdns_get_service_item(const char *service, const char *proto, const char *hostname)
+{
+    if (!service || !proto) {
+        return NULL;
+    }
+    if (_mdns_index_ready()) {
+        return _mdns_index_find_service(service, proto, hostname);
+    }
+    mdns_srv_item_t *s = _mdns_server->services;
+    while (s) {
+        if (_mdns_service_match(s->service, service, proto, hostname)) {
+            return s;
+        }
+        s = s->next;
+    }
+    return NULL;
+}
+
+static mdns_srv_item_t *_mdns_get_service_item_subtype(const char *subtype, const char *service, const char *proto)
+{
+    if (!service || !proto) {
+        return NULL;
+    }
+    if (_mdns_index_ready()) {
+        return _mdns_index_find_subtype(subtype, service, proto);
+    }
+    mdns_srv_item_t *s = _mdns_server->services;
+    while (s) {
+        if (_mdns_service_match(s->service, service, proto, NULL) && _mdns_service_has_subtype(s->service, subtype)) {
+            return s;
+        }
+        s = s->next;
+    }
+    return NULL;
+}
+
+static mdns_host_item_t *mdns_get_host_item(const char *hostname)
+{
+    if (hostname == NULL || strcasecmp(hostname, _mdns_server->hostname) == 0) {
+        return &_mdns_self_host;
+    }
+    if (_mdns_index_ready()) {
+        return _mdns_index_find_host(hostname);
+    }
+    mdns_host_item_t *host = _mdns_host_list;
+    while (host != NULL) {
+        if (strcasecmp(host->hostname, hostname) == 0) {
+            return host;
+        }
+        host = host->next;
+    }
+    return NULL;
+}
+
+static mdns_srv_item_t *_mdns_get_service_item_instance(const char *instance, const char *service, const char *proto,
+                                                        const char *hostname)
+{
+    if (!instance) {
+        return _mdns_get_service_item(service, proto, hostname);
+    }
+    if (!service || !proto) {
+        return NULL;
+    }
+    if (_mdns_index_ready()) {
+        return _mdns_index_find_instance(instance, service, proto, hostname);
+    }
+    mdns_srv_item_t *s = _mdns_server->services;
+    while (s) {
+        if (_mdns_service_match_instance(s->service, instance, service, proto, hostname)) {
+            return s;
+        }
+        s = s->next;
+    }
+    return NULL;
+}
+
+/**
+ * Labels of the packet being parsed, by their offset. Compressed names point
+ * back to names earlier in the packet, so a name found again is taken from the
+ * table, with the labels already bounds checked and classified, instead of
+ * being walked and compared again. The table is bound to one packet at a time
+ * (see _mdns_labels_bind()), names in other buffers are always walked.
+ */
+#define MDNS_LABEL_HOST     0x01    // label can be part of a multi-label hostname
+#define MDNS_LABEL_SUB      0x02    // the _sub label of a subtype
+#define MDNS_LABEL_UNKNOWN  0xFF    // next label not walked yet
+#define MDNS_LABEL_END      0xFE    // label is the last one of its name
+
+typedef struct {
+    uint16_t offset;                // of the length byte
+    uint8_t len;
+    uint8_t kind;                   // MDNS_LABEL_HOST, MDNS_LABEL_SUB
+    uint8_t next;                   // index of the following label, MDNS_LABEL_UNKNOWN or MDNS_LABEL_END
+    bool pointer;                   // the following label is reached through a compression pointer
+} mdns_label_t;
+
+static struct {
+    const uint8_t *packet;
+    uint8_t count;
+    mdns_label_t labels[MDNS_LABEL_TABLE_SIZE];
+    uint8_t slots[MDNS_LABEL_TABLE_SIZE * 2];   // label index + 1 by offset, 0 is free
+} s_labels;
+
+/**
+ * @brief  binds the label table to a packet, NULL unbinds it
+ */
+static void _mdns_labels_bind(const uint8_t *packet)
+{
+    if (s_labels.count) {
+        memset(s_labels.slots, 0, sizeof(s_labels.slots));
+        s_labels.count = 0;
+    }
+    s_labels.packet = packet;
+}
+
+static uint8_t _mdns_labels_find(uint16_t offset)
+{
+    for (size_t i = offset;; i++) {
+        uint8_t slot = s_labels.slots[i & (sizeof(s_labels.slots) - 1)];
+        if (!slot) {
+            return MDNS_LABEL_UNKNOWN;
+        }
+        if (s_labels.labels[slot - 1].offset == offset) {
+            return slot - 1;
+        }
+    }
+}
+
+static uint8_t _mdns_labels_add(uint16_t offset, uint8_t len, uint8_t kind)
+{
+    if (s_labels.count == MDNS_LABEL_TABLE_SIZE) {
+        return MDNS_LABEL_UNKNOWN;
+    }
+    size_t i = offset;
+    while (s_labels.slots[i & (sizeof(s_labels.slots) - 1)]) {
+        i++;
+    }
+    mdns_label_t *label = &s_labels.labels[s_labels.count];
+    label->offset = offset;
+    label->len = len;
+    label->kind = kind;
+    label->next = MDNS_LABEL_UNKNOWN;
+    label->pointer = false;
+    s_labels.slots[i & (sizeof(s_labels.slots) - 1)] = ++s_labels.count;
+    return s_labels.count - 1;
+}
+
+/**
+ * @brief  records that label next follows label prev after the given number of pointers
+ *
+ * Only links whose pointer target can be checked again on the next walk are kept:
+ * at most one pointer, and none before the root label.
+ */
+static void _mdns_labels_link(uint8_t prev, uint8_t next, uint8_t pointers)
+{
+    if (prev == MDNS_LABEL_UNKNOWN || next == MDNS_LABEL_UNKNOWN || pointers > 1 || (pointers && next == MDNS_LABEL_END)) {
+        return;
+    }
+    s_labels.labels[prev].next = next;
+    s_labels.labels[prev].pointer = pointers;
+}
+
+static bool _mdns_label_is(const uint8_t *label, uint8_t len, const char *str)
+{
+    return len == strlen(str) && !strncasecmp((const char *)label, str, len);
+}
+
+static uint8_t _mdns_label_kind(const uint8_t *label, uint8_t len)
+{
+    if (_mdns_label_is(label, len, MDNS_SUB_STR)) {
+        return MDNS_LABEL_SUB;
+    }
+    if (label[0] == '_' || _mdns_label_is(label, len, MDNS_DEFAULT_DOMAIN) || _mdns_label_is(label, len, "arpa")
+#ifndef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
+            || _mdns_label_is(label, len, "ip6") || _mdns_label_is(label, len, "in-addr")
+#endif
+       ) {
+        return 0;
+    }
+    return MDNS_LABEL_HOST;
+}
+
+/**
+ * @brief  adds one label of a received name to mdns_name_t
+ */
+static void _mdns_name_add_label(mdns_name_t *name, const uint8_t *label, uint8_t len, uint8_t kind)
+{
+    if (name->parts == 1 && (kind & MDNS_LABEL_HOST)) {
+        // appended as far as it fits, like strlcat() would
+        size_t host_len = strlen(name->host);
+        size_t label_len = strnlen((const char *)label, len);
+        if (host_len + 1 < sizeof(name->host)) {
+            name->host[host_len++] = '.';
+            if (label_len > sizeof(name->host) - 1 - host_len) {
+                label_len = sizeof(name->host) - 1 - host_len;
+            }
+            memcpy(name->host + host_len, label, label_len);
+            name->host[host_len + label_len] = '\0';
+        }
+    } else if (kind & MDNS_LABEL_SUB) {
+        name->sub = 1;
+    } else if (!name->invalid) {
+        char *mdns_name_ptrs[] = {name->host, name->service, name->proto, name->domain};
+        memcpy(mdns_name_ptrs[name->parts], label, len);
+        mdns_name_ptrs[name->parts++][len] = '\0';
+    }
+}
+
+/**
+ * @brief  finds the end of a name in the packet without following pointers
+ *
+ * @return the address after the name or NULL on error
+ */
+static const uint8_t *_mdns_skip_fqdn(const uint8_t *packet, const uint8_t *start, size_t packet_len)
+{
+    const uint8_t *packet_end = packet + packet_len;
+    while (start < packet_end) {
+        uint8_t len = *start;
+        if (!len) {
+            return start + 1;
+        }
+        if (len >= 0xC0) {
+            return start + 2 <= packet_end ? start + 2 : NULL;
+        }
+        if (len > 63) {
+            return NULL;
+        }
+        start += len + 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief  reads MDNS FQDN into mdns_name_t structure
+ *         FQDN is in format: [hostname.|[instance.]_service._proto.]local.
+ *
+ * Compression pointers must point before the labels they follow, so they
+ * cannot loop. Names longer than MDNS_FQDN_MAX_LEN or following more than
+ * MDNS_FQDN_MAX_HOPS pointers are marked invalid without reading them further,
+ * as are names with more than four parts.
+ *
+ * @param  packet       MDNS packet
+ * @param  start        Starting point of FQDN
+ * @param  name         mdns_name_t structure to populate
+ *
+ * @return the address after the parsed FQDN in the packet or NULL on error
+ */
+static const uint8_t *_mdns_read_fqdn(const uint8_t *packet, const uint8_t *start, mdns_name_t *name, size_t packet_len)
+{
+    const bool table = s_labels.packet == packet;
+    const uint8_t *end = NULL;      // known at the first pointer or the root label
+    size_t pos = start - packet;
+    size_t segment = pos;           // pointers must point before this
+    size_t name_len = 1;
+    uint8_t hops = 0;
+    uint8_t between = 0;            // pointers followed since the previous label
+    uint8_t prev = MDNS_LABEL_UNKNOWN;
+    bool lookup = table;            // names are looked up where they start and at pointer targets
+
+    while (!name->invalid) {
+        uint8_t idx = lookup ? _mdns_labels_find(pos) : MDNS_LABEL_UNKNOWN;
+        if (idx != MDNS_LABEL_UNKNOWN) {
+            _mdns_labels_link(prev, idx, between);
+            // the rest of the name, or as much of it as was walked before, is known,
+            // only the checks that depend on where the name started are repeated
+            while (idx < MDNS_LABEL_END && !name->invalid) {
+                const mdns_label_t *label = &s_labels.labels[idx];
+                if (name->parts == 4) {
+                    name->invalid = true;
+                }
+                name_len += label->len + 1;
+                if (name_len > MDNS_FQDN_MAX_LEN) {
+                    name->invalid = true;
+                    break;
+                }
+                _mdns_name_add_label(name, packet + label->offset + 1, label->len, label->kind);
+                pos = label->offset + 1 + label->len;
+                if (name->invalid) {
+                    break;
+                }
+                if (label->next == MDNS_LABEL_END) {
+                    return end ? end : packet + pos + 1;
+                }
+                if (label->pointer) {
+                    if (name->parts == 4) {
+                        name->invalid = true;
+                    }
+                    size_t address = s_labels.labels[label->next].offset;
+                    if (address >= segment) {
+                        return NULL;
+                    }
+                    if (!end) {
+                        end = packet + pos + 2;
+                    }
+                    if (++hops > MDNS_FQDN_MAX_HOPS) {
+                        name->invalid = true;
+                        break;
+                    }
+                    pos = segment = address;
+                }
+                prev = idx;
+                idx = label->next;
+            }
+            between = 0;
+            continue;
+        }
+
+        if (pos >= packet_len) {
+            return NULL;
+        }
+        uint8_t len = packet[pos];
+        if (!len) {
+            _mdns_labels_link(prev, MDNS_LABEL_END, between);
+            return end ? end : packet + pos + 1;
+        }
+        if (name->parts == 4) {
+            name->invalid = true;
+        }
+        if (len >= 0xC0) {
+            if (pos + 1 >= packet_len) {
+                return NULL;
+            }
+            size_t address = (((uint16_t)len & 0x3F) << 8) | packet[pos + 1];
+            if (address >= segment) {
+                //reference address can not be after where we are
+                return NULL;
+            }
+            if (!end) {
+                end = packet + pos + 2;
+            }
+            if (++hops > MDNS_FQDN_MAX_HOPS) {
+                name->invalid = true;
+                break;
+            }
+            between++;
+            lookup = table;
+            pos = segment = address;
+            continue;
+        }
+        if (len > 63) {
+            //length can not be more than 63
+            return NULL;
+        }
+        if (pos + 1 + len > packet_len) {
+            return NULL;
+        }
+        name_len += len + 1;
+        if (name_len > MDNS_FQDN_MAX_LEN) {
+            name->invalid = true;
+            break;
+        }
+        uint8_t kind = _mdns_label_kind(packet + pos + 1, len);
+        idx = table ? _mdns_labels_add(pos, len, kind) : MDNS_LABEL_UNKNOWN;
+        _mdns_labels_link(prev, idx, between);
+        _mdns_name_add_label(name, packet + pos + 1, len, kind);
+        prev = idx;
+        between = 0;
+        lookup = false;
+        pos += len + 1;
+    }
+    // an invalid name is skipped, it ends at its first pointer or root label
+    return end ? end : _mdns_skip_fqdn(packet, start, packet_len);
+}
+
+/**
+ * @brief  sets uint16_t value in a packet
+ *
+ * @param  packet       MDNS packet
+ * @param  index        offset of uint16_t value
+ * @param  value        the value to set
+ */
+static inline void _mdns_set_u16(uint8_t *packet, uint16_t index, uint16_t value)
+{
+    if ((index + 1) >= MDNS_MAX_PACKET_SIZE) {
+        return;
+    }
+    packet[index] = (value >> 8) & 0xFF;
+    packet[index + 1] = value & 0xFF;
+}
+
+/**
+ * Set by the append functions when the packet has no room left for what is
+ * being written, as opposed to failing for other reasons. The dispatcher
+ * clears it before every record and moves records that ran out of room to
+ * the next packet.
+ */
+static bool s_tx_full;
+
+/**
+ * @brief  checks that len more bytes fit behind index, noting it if not
+ */
+static inline bool _mdns_no_room(uint16_t index, size_t len)
+{
+    if (index + len >= MDNS_MAX_PACKET_SIZE) {
+        s_tx_full = true;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief  appends byte in a packet, incrementing the index
+ *
+ * @param  packet       MDNS packet
+ * @param  index        offset in the packet
+ * @param  value        the value to set
+ *
+ * @return length of added data: 0 on error or 1 on success
+ */
+static inline uint8_t _mdns_append_u8(uint8_t *packet, uint16_t *index, uint8_t value)
+{
+    if (_mdns_no_room(*index, 0)) {
+        return 0;
+    }
+    packet[*index] = value;
+    *index += 1;
+    return 1;
+}
+
+/**
+ * @brief  appends uint16_t in a packet, incrementing the index
+ *
+ * @param  packet       MDNS packet
+ * @param  index        offset in the packet
+ * @param  value        the value to set
+ *
+ * @return length of added data: 0 on error or 2 on success
+ */
+static inline uint8_t _mdns_append_u16(uint8_t *packet, uint16_t *index, uint16_t value)
+{
+    if (_mdns_no_room(*index, 1)) {
+        return 0;
+    }
+    _mdns_append_u8(packet, index, (value >> 8) & 0xFF);
+    _mdns_append_u8(packet, index, value & 0xFF);
+    return 2;
+}
+
+/**
+ * @brief  appends uint32_t in a packet, incrementing the index
+ *
+ * @param  packet       MDNS packet
+ * @param  index        offset in the packet
+ * @param  value        the value to set
+ *
+ * @return length of added data: 0 on error or 4 on success
+ */
+static inline uint8_t _mdns_append_u32(uint8_t *packet, uint16_t *index, uint32_t value)
+{
+    if (_mdns_no_room(*index, 3)) {
+        return 0;
+    }
+    _mdns_append_u8(packet, index, (value >> 24) & 0xFF);
+    _mdns_append_u8(packet, index, (value >> 16) & 0xFF);
+    _mdns_append_u8(packet, index, (value >> 8) & 0xFF);
+    _mdns_append_u8(packet, index, value & 0xFF);
+    return 4;
+}
+
+/**
+ * @brief  appends answer type, class, ttl and data length to a packet, incrementing the index
+ *
+ * @param  packet       MDNS packet
+ * @param  index        offset in the packet
+ * @param  type         answer type
+ * @param  ttl          answer ttl
+ *
+ * @return length of added data: 0 on error or 10 on success
+ */
+static inline uint8_t _mdns_append_type(uint8_t *packet, uint16_t *index, uint8_t type, bool flush, uint32_t ttl)
+{
+    if (_mdns_no_room(*index, 10)) {
+        return 0;
+    }
+    uint16_t mdns_class = MDNS_CLASS_IN;
+    if (flush) {
+        mdns_class = MDNS_CLASS_IN_FLUSH_CACHE;
+    }
+    if (type == MDNS_ANSWER_PTR) {
+        _mdns_append_u16(packet, index, MDNS_TYPE_PTR);
+        _mdns_append_u16(packet, index, mdns_class);
+    } else if (type == MDNS_ANSWER_TXT) {
+        _mdns_append_u16(packet, index, MDNS_TYPE_TXT);
+        _mdns_append_u16(packet, index, mdns_class);
+    } else if (type == MDNS_ANSWER_SRV) {
+        _mdns_append_u16(packet, index, MDNS_TYPE_SRV);
+        _mdns_append_u16(packet, index, mdns_class);
+    } else if (type == MDNS_ANSWER_A) {
+        _mdns_append_u16(packet, index, MDNS_TYPE_A);
+        _mdns_append_u16(packet, index, mdns_class);
+    } else if (type == MDNS_ANSWER_AAAA) {
+        _mdns_append_u16(packet, index, MDNS_TYPE_AAAA);
+        _mdns_append_u16(packet, index, mdns_class);
+    } else {
+        return 0;
+    }
+    _mdns_append_u32(packet, index, ttl);
+    _mdns_append_u16(packet, index, 0);
+    return 10;
+}
+
+static inline uint8_t _mdns_append_string_with_len(uint8_t *packet, uint16_t *index, const char *string, uint8_t len)
+{
+    if (_mdns_no_room(*index, len + 1)) {
+        return 0;
+    }
+    _mdns_append_u8(packet, index, len);
+    memcpy(packet + *index, string, len);
+    *index += len;
+    return len + 1;
+}
+
+/**
+ * @brief  appends single string to a packet, incrementing the index
+ *
+ * @param  packet       MDNS packet
+ * @param  index        offset in the packet
+ * @param  string       the string to append
+ *
+ * @return length of added data: 0 on error or length of the string + 1 on success
+ */
+static inline uint8_t _mdns_append_string(uint8_t *packet, uint16_t *index, const char *string)
+{
+    uint8_t len = strlen(string);
+    if (_mdns_no_room(*index, len + 1)) {
+        return 0;
+    }
+    _mdns_append_u8(packet, index, len);
+    memcpy(packet + *index, string, len);
+    *index += len;
     return len + 1;
 }
 
@@ -669,7 +1216,7 @@ static inline int append_one_txt_record_entry(uint8_t *packet, uint16_t *index,
     }
     size_t key_len = strlen(txt->key);
     size_t len = key_len + txt->value_len + (txt->value ? 1 : 0);
-    if ((*index + len + 1) >= MDNS_MAX_PACKET_SIZE) {
+    if (_mdns_no_room(*index, len + 1)) {
         return 0;
     }
     _mdns_append_u8(packet, index, len);
@@ -685,7 +1232,7 @@ static inline int append_one_txt_record_entry(uint8_t *packet, uint16_t *index,
 #ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
 static inline int append_single_str(uint8_t *packet, uint16_t *index, const char *str, int len)
 {
-    if ((*index + len + 1) >= MDNS_MAX_PACKET_SIZE) {
+    if (_mdns_no_room(*index, len + 1)) {
         return 0;
     }
     if (!_mdns_append_u8(packet, index, len)) {
@@ -736,10 +1283,126 @@ static uint16_t append_fqdn_dots(uint8_t *packet, uint16_t *index, const char *n
 }
 #endif /* CONFIG_MDNS_RESPOND_REVERSE_QUERIES */
 
+/**
+ * Name compression dictionary of the packet being serialized. Every name suffix
+ * written by _mdns_append_fqdn() is recorded under the hash of its case folded
+ * labels, so later names find their compression target in O(1) instead of
+ * rescanning the packet. Offset 0 marks a free slot (names never start in the header).
+ */
+static struct {
+    const uint8_t *packet;
+    uint16_t used;
+    uint32_t hash[MDNS_NAME_DICT_SIZE];
+    uint16_t offset[MDNS_NAME_DICT_SIZE];
+} s_name_dict;
+
+_Static_assert((MDNS_NAME_DICT_SIZE & (MDNS_NAME_DICT_SIZE - 1)) == 0, "MDNS_NAME_DICT_SIZE must be a power of two");
+
+/**
+ * @brief  empties the name compression dictionary and binds it to a packet buffer
+ */
+static void _mdns_name_dict_reset(const uint8_t *packet)
+{
+    s_name_dict.packet = packet;
+    s_name_dict.used = 0;
+    memset(s_name_dict.offset, 0, sizeof(s_name_dict.offset));
+}
+
+/**
+ * @brief  FNV-1a hash of the case folded labels of a name
+ */
+static uint32_t _mdns_name_hash(const char *strings[], uint8_t count)
+{
+    uint32_t hash = 2166136261u;
+    for (uint8_t i = 0; i < count; i++) {
+        for (const char *c = strings[i]; *c; c++) {
+            hash = (hash ^ (uint8_t)tolower((unsigned char)*c)) * 16777619u;
+        }
+        hash = (hash ^ '.') * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief  checks that the name stored at offset consists of exactly the given labels
+ *
+ * Only backward pointers are followed, so this terminates on any buffer content.
+ */
+static bool _mdns_name_matches(const uint8_t *packet, uint16_t index, uint16_t offset, const char *strings[], uint8_t count)
+{
+    uint8_t i = 0;
+    while (offset < index) {
+        uint8_t len = packet[offset];
+        if ((len & 0xC0) == 0xC0) {
+            if (offset + 1 >= index) {
+                return false;
+            }
+            uint16_t target = ((len & 0x3F) << 8) | packet[offset + 1];
+            if (target >= offset) {
+                return false;
+            }
+            offset = target;
+            continue;
+        }
+        if (len & 0xC0) {
+            return false;
+        }
+        if (i == count) {
+            return len == 0;
+        }
+        if (!len || len != strlen(strings[i]) || offset + 1 + len > index
+                || strncasecmp((const char *)packet + offset + 1, strings[i], len)) {
+            return false;
+        }
+        offset += len + 1;
+        i++;
+    }
+    return false;
+}
+
+/**
+ * @brief  looks up an earlier occurrence of the name in the packet
+ *
+ * @return offset of the name or 0 if it has not been written yet
+ */
+static uint16_t _mdns_name_dict_find(const uint8_t *packet, uint16_t index, uint32_t hash, const char *strings[], uint8_t count)
+{
+    uint16_t slot = hash & (MDNS_NAME_DICT_SIZE - 1);
+    while (s_name_dict.offset[slot]) {
+        if (s_name_dict.hash[slot] == hash
+                && _mdns_name_matches(packet, index, s_name_dict.offset[slot], strings, count)) {
+            return s_name_dict.offset[slot];
+        }
+        slot = (slot + 1) & (MDNS_NAME_DICT_SIZE - 1);
+    }
+    return 0;
+}
+
+/**
+ * @brief  records a name written at offset; once the dictionary is full
+ *         further names are simply not compressed against
+ */
+static void _mdns_name_dict_add(uint32_t hash, uint16_t offset)
+{
+    if (s_name_dict.used >= MDNS_NAME_DICT_SIZE * 3 / 4 || offset & MDNS_NAME_REF) {
+        return;
+    }
+    uint16_t slot = hash & (MDNS_NAME_DICT_SIZE - 1);
+    while (s_name_dict.offset[slot]) {
+        slot = (slot + 1) & (MDNS_NAME_DICT_SIZE - 1);
+    }
+    s_name_dict.hash[slot] = hash;
+    s_name_dict.offset[slot] = offset;
+    s_name_dict.used++;
+}
+
 /**
  * @brief  appends FQDN to a packet, incrementing the index and
  *         compressing the output if previous occurrence of the string (or part of it) has been found
  *
+ * Compression targets come from the dictionary of the packet, so names must be
+ * written through this function to be found by later ones.
+ *
  * @param  packet       MDNS packet
  * @param  index        offset in the packet
  * @param  strings      string array containing the parts of the FQDN
@@ -753,61 +1416,29 @@ static uint16_t _mdns_append_fqdn(uint8_t *packet, uint16_t *index, const char *
         //empty string so terminate
         return _mdns_append_u8(packet, index, 0);
     }
-    static char buf[MDNS_NAME_BUF_LEN];
-    uint8_t len = strlen(strings[0]);
-    //try to find first the string length in the packet (if it exists)
-    uint8_t *len_location = (uint8_t *)memchr(packet, (char)len, *index);
-    while (len_location) {
-        mdns_name_t name;
-        //check if the string after len_location is the string that we are looking for
-        if (memcmp(len_location + 1, strings[0], len)) { //not continuing with our string
-search_next:
-            //try and find the length byte further in the packet
-            len_location = (uint8_t *)memchr(len_location + 1, (char)len, *index - (len_location + 1 - packet));
-            continue;
-        }
-        //seems that we might have found the string that we are looking for
-        //read the destination into name and compare
-        name.parts = 0;
-        name.sub = 0;
-        name.invalid = false;
-        name.host[0] = 0;
-        name.service[0] = 0;
-        name.proto[0] = 0;
-        name.domain[0] = 0;
-        const uint8_t *content = _mdns_read_fqdn(packet, len_location, &name, buf, packet_len);
-        if (!content) {
-            //not a readable fqdn?
-            goto search_next; // could be our unfinished fqdn, continue searching
-        }
-        if (name.parts == count) {
-            uint8_t i;
-            for (i = 0; i < count; i++) {
-                if (strcasecmp(strings[i], (const char *)&name + (i * (MDNS_NAME_BUF_LEN)))) {
-                    //not our string! let's search more
-                    goto search_next;
-                }
-            }
-            //we actually have found the string
-            break;
-        } else {
-            goto search_next;
-        }
+    if (s_name_dict.packet != packet) {
+        _mdns_name_dict_reset(packet);
+    }
+    uint32_t hash = _mdns_name_hash(strings, count);
+    uint16_t offset = _mdns_name_dict_find(packet, *index, hash, strings, count);
+    if (offset) {
+        //we have found the string so let's insert a pointer to it instead
+        return _mdns_append_u16(packet, index, offset | MDNS_NAME_REF);
     }
     //string is not yet in the packet, so let's add it
-    if (!len_location) {
-        uint8_t written = _mdns_append_string(packet, index, strings[0]);
-        if (!written) {
-            return 0;
-        }
-        //run the same for the other strings in the name
-        return written + _mdns_append_fqdn(packet, index, &strings[1], count - 1, packet_len);
+    offset = *index;
+    uint8_t written = _mdns_append_string(packet, index, strings[0]);
+    if (!written) {
+        return 0;
     }
-
-    //we have found the string so let's insert a pointer to it instead
-    uint16_t offset = len_location - packet;
-    offset |= MDNS_NAME_REF;
-    return _mdns_append_u16(packet, index, offset);
+    //run the same for the other strings in the name
+    uint16_t rest = _mdns_append_fqdn(packet, index, &strings[1], count - 1, packet_len);
+    if (!rest) {
+        return 0;
+    }
+    //only complete names may become compression targets
+    _mdns_name_dict_add(hash, offset);
+    return written + rest;
 }
 
 /**
@@ -1129,7 +1760,7 @@ static uint16_t _mdns_append_a_record(uint8_t *packet, uint16_t *index, const ch
 
     uint16_t data_len_location = *index - 2;
 
-    if ((*index + 3) >= MDNS_MAX_PACKET_SIZE) {
+    if (_mdns_no_room(*index, 3)) {
         return 0;
     }
     _mdns_append_u8(packet, index, ip & 0xFF);
@@ -1182,7 +1813,7 @@ static uint16_t _mdns_append_aaaa_record(uint8_t *packet, uint16_t *index, const
 
     uint16_t data_len_location = *index - 2;
 
-    if ((*index + MDNS_ANSWER_AAAA_SIZE) > MDNS_MAX_PACKET_SIZE) {
+    if (_mdns_no_room(*index, MDNS_ANSWER_AAAA_SIZE - 1)) {
         return 0;
     }
 
@@ -1313,17 +1944,15 @@ static uint8_t _mdns_append_host_answer(uint8_t *packet, uint16_t *index, mdns_h
 
 #ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
 /**
- * @brief Appends reverse lookup PTR record
+ * @brief Appends reverse lookup PTR record, its name is copied as it was built for the address
  */
-static uint8_t _mdns_append_reverse_ptr_record(uint8_t *packet, uint16_t *index, const char *name)
+static uint8_t _mdns_append_reverse_ptr_record(uint8_t *packet, uint16_t *index, const mdns_reverse_name_t *reverse)
 {
-    if (strstr(name, "in-addr") == NULL && strstr(name, "ip6") == NULL) {
-        return 0;
-    }
-
-    if (!append_fqdn_dots(packet, index, name, false)) {
+    if (_mdns_no_room(*index, reverse->len)) {
         return 0;
     }
+    memcpy(packet + *index, reverse->data, reverse->len);
+    *index += reverse->len;
 
     if (!_mdns_append_type(packet, index, MDNS_ANSWER_PTR, false, 10 /* TTL set to 10s*/)) {
         return 0;
@@ -1395,9 +2024,8 @@ static uint8_t _mdns_append_answer(uint8_t *packet, uint16_t *index, mdns_out_an
         if (answer->service) {
             return _mdns_append_service_ptr_answers(packet, index, answer->service, answer->flush, answer->bye);
 #ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
-        } else if (answer->host && answer->host->hostname &&
-                   (strstr(answer->host->hostname, "in-addr") || strstr(answer->host->hostname, "ip6"))) {
-            return _mdns_append_reverse_ptr_record(packet, index, answer->host->hostname) > 0;
+        } else if (answer->host && answer->host->reverse) {
+            return _mdns_append_reverse_ptr_record(packet, index, answer->host->reverse) > 0;
 #endif /* CONFIG_MDNS_RESPOND_REVERSE_QUERIES */
         } else {
             return _mdns_append_ptr_record(packet, index,
@@ -1478,105 +2106,477 @@ static uint8_t _mdns_append_answer(uint8_t *packet, uint16_t *index, mdns_out_an
                                             answer->bye);
         }
     }
-#endif /* CONFIG_LWIP_IPV6 */
-    return 0;
+#endif /* CONFIG_LWIP_IPV6 */
+    return 0;
+}
+
+/**
+ * Serialized bodies of recently sent packets. Responses to the same query on
+ * the same interface carry the same records, so after the first one has been
+ * encoded the following ones are a memcpy. Only packets without questions or
+ * goodbyes, built from our own service and host records, qualify; the cache is
+ * dropped whenever any of those records may change (see _mdns_answer_cache_clear()).
+ */
+static mdns_answer_cache_entry_t s_answer_cache[MDNS_ANSWER_CACHE_SIZE];
+static uint8_t s_answer_cache_next;
+
+/**
+ * @brief  drops all cached packet bodies
+ */
+static void _mdns_answer_cache_clear(void)
+{
+    for (int i = 0; i < MDNS_ANSWER_CACHE_SIZE; i++) {
+        mdns_mem_free(s_answer_cache[i].key);
+        s_answer_cache[i].key = NULL;
+        s_answer_cache[i].key_len = 0;
+    }
+}
+
+/**
+ * @brief  describes the records of a packet as a cache key
+ *
+ * @return number of key entries, 0 if the packet cannot be cached
+ */
+static uint8_t _mdns_answer_cache_make_key(mdns_tx_packet_t *p, mdns_answer_cache_key_t *key)
+{
+    mdns_out_answer_t *sections[3] = { p->answers, p->servers, p->additional };
+    uint8_t len = 0;
+
+    if (p->questions) {
+        return 0;
+    }
+    for (uint8_t s = 0; s < 3; s++) {
+        for (mdns_out_answer_t *a = sections[s]; a; a = a->next) {
+            if (len == MDNS_ANSWER_CACHE_MAX_RECORDS || a->custom_service || a->bye) {
+                return 0;
+            }
+            key[len].service = a->service;
+            key[len].host = a->host;
+            key[len].type = a->type;
+            key[len].section = s;
+            key[len].flush = a->flush;
+            len++;
+        }
+    }
+    return len;
+}
+
+static bool _mdns_answer_cache_key_equal(const mdns_answer_cache_key_t *a, const mdns_answer_cache_key_t *b, uint8_t len)
+{
+    for (uint8_t i = 0; i < len; i++) {
+        if (a[i].service != b[i].service || a[i].host != b[i].host || a[i].type != b[i].type
+                || a[i].section != b[i].section || a[i].flush != b[i].flush) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static mdns_answer_cache_entry_t *_mdns_answer_cache_find(mdns_tx_packet_t *p, const mdns_answer_cache_key_t *key, uint8_t key_len)
+{
+    for (int i = 0; i < MDNS_ANSWER_CACHE_SIZE; i++) {
+        mdns_answer_cache_entry_t *e = &s_answer_cache[i];
+        if (e->key_len == key_len && e->tcpip_if == p->tcpip_if && e->ip_protocol == p->ip_protocol
+                && e->pcb_state[MDNS_IP_PROTOCOL_V4] == _mdns_server->interfaces[p->tcpip_if].pcbs[MDNS_IP_PROTOCOL_V4].state
+                && e->pcb_state[MDNS_IP_PROTOCOL_V6] == _mdns_server->interfaces[p->tcpip_if].pcbs[MDNS_IP_PROTOCOL_V6].state
+                && _mdns_answer_cache_key_equal(e->key, key, key_len)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief  keeps the body of a freshly serialized packet, replacing the oldest entry
+ */
+static void _mdns_answer_cache_store(mdns_tx_packet_t *p, const mdns_answer_cache_key_t *key, uint8_t key_len,
+                                     const uint8_t *packet, uint16_t index)
+{
+    uint16_t len = index - MDNS_HEAD_LEN;
+    if (len > MDNS_ANSWER_CACHE_MAX_LEN) {
+        return;
+    }
+    size_t key_size = key_len * sizeof(mdns_answer_cache_key_t);
+    mdns_answer_cache_key_t *copy = (mdns_answer_cache_key_t *)mdns_mem_malloc(key_size + len);
+    if (!copy) {
+        return;
+    }
+    memcpy(copy, key, key_size);
+    memcpy((uint8_t *)copy + key_size, packet + MDNS_HEAD_LEN, len);
+
+    mdns_answer_cache_entry_t *e = &s_answer_cache[s_answer_cache_next];
+    s_answer_cache_next = (s_answer_cache_next + 1) % MDNS_ANSWER_CACHE_SIZE;
+    mdns_mem_free(e->key);
+    e->key = copy;
+    e->key_len = key_len;
+    e->len = len;
+    e->tcpip_if = p->tcpip_if;
+    e->ip_protocol = p->ip_protocol;
+    e->pcb_state[MDNS_IP_PROTOCOL_V4] = _mdns_server->interfaces[p->tcpip_if].pcbs[MDNS_IP_PROTOCOL_V4].state;
+    e->pcb_state[MDNS_IP_PROTOCOL_V6] = _mdns_server->interfaces[p->tcpip_if].pcbs[MDNS_IP_PROTOCOL_V6].state;
+    e->counts[0] = _mdns_read_u16(packet, MDNS_HEAD_ANSWERS_OFFSET);
+    e->counts[1] = _mdns_read_u16(packet, MDNS_HEAD_SERVERS_OFFSET);
+    e->counts[2] = _mdns_read_u16(packet, MDNS_HEAD_ADDITIONAL_OFFSET);
+}
+
+/**
+ * @brief  writes one serialized packet to the interface and destination of p
+ */
+static void _mdns_send_tx_buffer(const mdns_tx_packet_t *p, uint8_t *packet, uint16_t len)
+{
+#ifdef MDNS_ENABLE_DEBUG
+    _mdns_dbg_printf("\nTX[%lu][%lu]: ", (unsigned long)p->tcpip_if, (unsigned long)p->ip_protocol);
+#ifdef CONFIG_LWIP_IPV4
+    if (p->dst.type == ESP_IPADDR_TYPE_V4) {
+        _mdns_dbg_printf("To: " IPSTR ":%u, ", IP2STR(&p->dst.u_addr.ip4), p->port);
+    }
+#endif
+#ifdef CONFIG_LWIP_IPV6
+    if (p->dst.type == ESP_IPADDR_TYPE_V6) {
+        _mdns_dbg_printf("To: " IPV6STR ":%u, ", IPV62STR(p->dst.u_addr.ip6), p->port);
+    }
+#endif
+    mdns_debug_packet(packet, len);
+#endif
+
+    _mdns_udp_pcb_write(p->tcpip_if, p->ip_protocol, &p->dst, p->port, packet, len);
+}
+
+/**
+ * @brief  sends a packet
+ *
+ * Records that do not fit are carried over to further packets, filling each
+ * packet with the later records that still fit. Queries set the truncated bit
+ * on all but the last packet and repeat their questions only in the first
+ * (RFC 6762 section 7.2). Responses to legacy unicast queries must be a single
+ * packet, they are cut short with the truncated bit set.
+ *
+ * @param  p       the packet
+ */
+static void _mdns_dispatch_tx_packet(mdns_tx_packet_t *p)
+{
+    static uint8_t packet[MDNS_MAX_PACKET_SIZE];
+    static mdns_answer_cache_key_t key[MDNS_ANSWER_CACHE_MAX_RECORDS];
+    uint16_t index = MDNS_HEAD_LEN;
+    memset(packet, 0, MDNS_HEAD_LEN);
+    mdns_out_question_t *q;
+    mdns_out_answer_t *a;
+    uint8_t count;
+
+    _mdns_set_u16(packet, MDNS_HEAD_FLAGS_OFFSET, p->flags);
+    _mdns_set_u16(packet, MDNS_HEAD_ID_OFFSET, p->id);
+
+    uint8_t key_len = _mdns_answer_cache_make_key(p, key);
+    mdns_answer_cache_entry_t *cached = key_len ? _mdns_answer_cache_find(p, key, key_len) : NULL;
+    if (cached) {
+        memcpy(packet + MDNS_HEAD_LEN, (uint8_t *)cached->key + key_len * sizeof(mdns_answer_cache_key_t), cached->len);
+        index += cached->len;
+        _mdns_set_u16(packet, MDNS_HEAD_ANSWERS_OFFSET, cached->counts[0]);
+        _mdns_set_u16(packet, MDNS_HEAD_SERVERS_OFFSET, cached->counts[1]);
+        _mdns_set_u16(packet, MDNS_HEAD_ADDITIONAL_OFFSET, cached->counts[2]);
+        _mdns_send_tx_buffer(p, packet, index);
+        return;
+    }
+
+    mdns_out_answer_t *sections[3] = { p->answers, p->servers, p->additional };
+    static const uint16_t count_offsets[3] = { MDNS_HEAD_ANSWERS_OFFSET, MDNS_HEAD_SERVERS_OFFSET, MDNS_HEAD_ADDITIONAL_OFFSET };
+    for (int s = 0; s < 3; s++) {
+        for (a = sections[s]; a; a = a->next) {
+            a->sent = false;
+        }
+    }
+    bool split = p->port == MDNS_SERVICE_PORT;
+    bool first = true;
+    bool more;
+
+    do {
+        _mdns_name_dict_reset(packet);
+        count = 0;
+        for (q = first ? p->questions : NULL; q; q = q->next) {
+            if (_mdns_append_question(packet, &index, q)) {
+                count++;
+            }
+        }
+        _mdns_set_u16(packet, MDNS_HEAD_QUESTIONS_OFFSET, count);
+
+        more = false;
+        uint16_t records = count;       // anything already in the packet
+        for (int s = 0; s < 3; s++) {
+            count = 0;
+            for (a = sections[s]; a; a = a->next) {
+                if (a->sent) {
+                    continue;
+                }
+                uint16_t start = index;
+                s_tx_full = false;
+                uint8_t n = _mdns_append_answer(packet, &index, a, p->tcpip_if);
+                if (!n || s_tx_full) {
+                    index = start;      // drop whatever part of the record made it in
+                }
+                if (s_tx_full && (records || count)) {
+                    more = true;        // retried in the next packet, smaller records may still fit here
+                    continue;
+                }
+                a->sent = true;         // written, or not sendable at all
+                if (!s_tx_full) {
+                    count += n;
+                }
+            }
+            _mdns_set_u16(packet, count_offsets[s], count);
+            records += count;
+        }
+
+        if (more && (!split || !(p->flags & MDNS_FLAGS_QUERY_REPSONSE))) {
+            _mdns_set_u16(packet, MDNS_HEAD_FLAGS_OFFSET, p->flags | MDNS_FLAGS_DISTRIBUTED);
+        }
+        if (first && !more && key_len) {
+            _mdns_answer_cache_store(p, key, key_len, packet, index);
+        }
+        _mdns_send_tx_buffer(p, packet, index);
+
+        index = MDNS_HEAD_LEN;
+        _mdns_set_u16(packet, MDNS_HEAD_FLAGS_OFFSET, p->flags);
+        first = false;
+    } while (more && split);
+}
+
+/**
+ * @brief  frees a packet
+ *
+ * @param  packet       the packet
+ */
+static void _mdns_free_tx_packet(mdns_tx_packet_t *packet)
+{
+    // a response built in the receive arena goes with it, questions and answers included
+    if (!packet || packet->in_arena) {
+        return;
+    }
+    mdns_out_question_t *q = packet->questions;
+    while (q) {
+        mdns_out_question_t *next = q->next;
+        mdns_mem_free(q);
+        q = next;
+    }
+    queueFree(mdns_out_answer_t, packet->answers);
+    queueFree(mdns_out_answer_t, packet->servers);
+    queueFree(mdns_out_answer_t, packet->additional);
+    mdns_mem_free(packet);
 }
 
-/**
- * @brief  sends a packet
- *
- * @param  p       the packet
+/*
+ * Scheduled packets live in a binary min-heap ordered by send time, ties are
+ * broken by scheduling order. Only the earliest packet is ever needed by the
+ * scheduler, everything else walks the array in no particular order.
  */
-static void _mdns_dispatch_tx_packet(mdns_tx_packet_t *p)
+static inline bool _mdns_tx_before(const mdns_tx_packet_t *a, const mdns_tx_packet_t *b)
 {
-    static uint8_t packet[MDNS_MAX_PACKET_SIZE];
-    uint16_t index = MDNS_HEAD_LEN;
-    memset(packet, 0, MDNS_HEAD_LEN);
-    mdns_out_question_t *q;
-    mdns_out_answer_t *a;
-    uint8_t count;
+    int32_t diff = (int32_t)(a->send_at - b->send_at);
+    return diff < 0 || (diff == 0 && (int32_t)(a->seq - b->seq) < 0);
+}
 
-    _mdns_set_u16(packet, MDNS_HEAD_FLAGS_OFFSET, p->flags);
-    _mdns_set_u16(packet, MDNS_HEAD_ID_OFFSET, p->id);
+static void _mdns_tx_queue_sift_up(uint16_t i)
+{
+    mdns_tx_packet_t **q = _mdns_server->tx_queue;
+    mdns_tx_packet_t *p = q[i];
+    while (i > 0) {
+        uint16_t parent = (i - 1) / 2;
+        if (!_mdns_tx_before(p, q[parent])) {
+            break;
+        }
+        q[i] = q[parent];
+        i = parent;
+    }
+    q[i] = p;
+}
 
-    count = 0;
-    q = p->questions;
-    while (q) {
-        if (_mdns_append_question(packet, &index, q)) {
-            count++;
+static void _mdns_tx_queue_sift_down(uint16_t i)
+{
+    mdns_tx_packet_t **q = _mdns_server->tx_queue;
+    uint16_t len = _mdns_server->tx_queue_len;
+    mdns_tx_packet_t *p = q[i];
+    for (;;) {
+        uint16_t child = 2 * i + 1;
+        if (child >= len) {
+            break;
         }
-        q = q->next;
+        if (child + 1 < len && _mdns_tx_before(q[child + 1], q[child])) {
+            child++;
+        }
+        if (!_mdns_tx_before(q[child], p)) {
+            break;
+        }
+        q[i] = q[child];
+        i = child;
     }
-    _mdns_set_u16(packet, MDNS_HEAD_QUESTIONS_OFFSET, count);
+    q[i] = p;
+}
 
-    count = 0;
-    a = p->answers;
-    while (a) {
-        count += _mdns_append_answer(packet, &index, a, p->tcpip_if);
-        a = a->next;
+/**
+ * @brief  publishes the earliest deadline of the heap to the timer, which reads it without the service lock
+ */
+static void _mdns_tx_queue_publish(void)
+{
+    if (_mdns_server->tx_queue_len) {
+        atomic_store(&_mdns_server->tx_next_at, _mdns_server->tx_queue[0]->send_at);
     }
-    _mdns_set_u16(packet, MDNS_HEAD_ANSWERS_OFFSET, count);
+    atomic_store(&_mdns_server->tx_scheduled, _mdns_server->tx_queue_len != 0);
+}
 
-    count = 0;
-    a = p->servers;
-    while (a) {
-        count += _mdns_append_answer(packet, &index, a, p->tcpip_if);
-        a = a->next;
+/**
+ * @brief  adds a packet to the heap, growing it when full
+ *
+ * @return false if the heap could not grow
+ */
+static bool _mdns_tx_queue_push(mdns_tx_packet_t *packet)
+{
+    if (_mdns_server->tx_queue_len == _mdns_server->tx_queue_size) {
+        if (_mdns_server->tx_queue_size > UINT16_MAX / 2) {
+            return false;
+        }
+        uint16_t size = _mdns_server->tx_queue_size ? _mdns_server->tx_queue_size * 2 : MDNS_TX_QUEUE_INITIAL_SIZE;
+        mdns_tx_packet_t **queue = (mdns_tx_packet_t **)mdns_mem_malloc(size * sizeof(mdns_tx_packet_t *));
+        if (!queue) {
+            return false;
+        }
+        if (_mdns_server->tx_queue_len) {
+            memcpy(queue, _mdns_server->tx_queue, _mdns_server->tx_queue_len * sizeof(mdns_tx_packet_t *));
+        }
+        mdns_mem_free(_mdns_server->tx_queue);
+        _mdns_server->tx_queue = queue;
+        _mdns_server->tx_queue_size = size;
     }
-    _mdns_set_u16(packet, MDNS_HEAD_SERVERS_OFFSET, count);
+    _mdns_server->tx_queue[_mdns_server->tx_queue_len++] = packet;
+    _mdns_tx_queue_sift_up(_mdns_server->tx_queue_len - 1);
+    _mdns_tx_queue_publish();
+    return true;
+}
 
-    count = 0;
-    a = p->additional;
-    while (a) {
-        count += _mdns_append_answer(packet, &index, a, p->tcpip_if);
-        a = a->next;
+/**
+ * @brief  removes and returns the packet due first
+ */
+static mdns_tx_packet_t *_mdns_tx_queue_pop(void)
+{
+    if (!_mdns_server->tx_queue_len) {
+        return NULL;
     }
-    _mdns_set_u16(packet, MDNS_HEAD_ADDITIONAL_OFFSET, count);
+    mdns_tx_packet_t *p = _mdns_server->tx_queue[0];
+    _mdns_server->tx_queue[0] = _mdns_server->tx_queue[--_mdns_server->tx_queue_len];
+    if (_mdns_server->tx_queue_len) {
+        _mdns_tx_queue_sift_down(0);
+    }
+    _mdns_tx_queue_publish();
+    return p;
+}
 
-#ifdef MDNS_ENABLE_DEBUG
-    _mdns_dbg_printf("\nTX[%lu][%lu]: ", (unsigned long)p->tcpip_if, (unsigned long)p->ip_protocol);
-#ifdef CONFIG_LWIP_IPV4
-    if (p->dst.type == ESP_IPADDR_TYPE_V4) {
-        _mdns_dbg_printf("To: " IPSTR ":%u, ", IP2STR(&p->dst.u_addr.ip4), p->port);
+/**
+ * @brief  frees every scheduled packet for which drop() returns true
+ */
+static void _mdns_tx_queue_remove_if(bool (*drop)(const mdns_tx_packet_t *p, const void *arg), const void *arg)
+{
+    uint16_t len = 0;
+    for (uint16_t i = 0; i < _mdns_server->tx_queue_len; i++) {
+        mdns_tx_packet_t *p = _mdns_server->tx_queue[i];
+        if (drop(p, arg)) {
+            _mdns_free_tx_packet(p);
+        } else {
+            _mdns_server->tx_queue[len++] = p;
+        }
     }
-#endif
-#ifdef CONFIG_LWIP_IPV6
-    if (p->dst.type == ESP_IPADDR_TYPE_V6) {
-        _mdns_dbg_printf("To: " IPV6STR ":%u, ", IPV62STR(p->dst.u_addr.ip6), p->port);
+    if (len == _mdns_server->tx_queue_len) {
+        return;
     }
-#endif
-    mdns_debug_packet(packet, index);
-#endif
+    _mdns_server->tx_queue_len = len;
+    for (int i = len / 2 - 1; i >= 0; i--) {
+        _mdns_tx_queue_sift_down(i);
+    }
+    _mdns_tx_queue_publish();
+}
 
-    _mdns_udp_pcb_write(p->tcpip_if, p->ip_protocol, &p->dst, p->port, packet, index);
+/**
+ * @brief  ms from now until the timer has work, called with the search lock held
+ *
+ * Packets are due once the clock is past their send_at, searches once it is past
+ * their next query or their timeout, browse changes at the end of their coalescing
+ * window. A TX or browse flush action in flight is left to the service task, which
+ * calls _mdns_timer_update() when it has handled it.
+ *
+ * @return ms until the earliest deadline, <= 0 if something is overdue, INT32_MAX if nothing is scheduled
+ */
+static int32_t _mdns_timer_next_ms(uint32_t now)
+{
+    int32_t next = INT32_MAX;
+    if (atomic_load(&_mdns_server->tx_scheduled) && !atomic_load(&_mdns_server->tx_pending)) {
+        next = (int32_t)(atomic_load(&_mdns_server->tx_next_at) - now) + 1;
+    }
+    if (atomic_load(&_mdns_server->browse_scheduled) && !atomic_load(&_mdns_server->browse_flush_pending)) {
+        int32_t due = (int32_t)(atomic_load(&_mdns_server->browse_flush_at) - now);
+        if (due < next) {
+            next = due;
+        }
+    }
+    for (mdns_search_once_t *s = _mdns_server->search_once; s; s = s->next) {
+        if (s->state == SEARCH_OFF) {
+            continue;
+        }
+        int32_t due = (int32_t)(s->started_at + s->timeout - now) + 1;
+        if (s->state == SEARCH_INIT) {
+            due = 0;
+        } else if ((int32_t)(s->sent_at + s->interval - now) + 1 < due) {
+            due = (int32_t)(s->sent_at + s->interval - now) + 1;
+        }
+        if (due < next) {
+            next = due;
+        }
+    }
+    return next;
 }
 
 /**
- * @brief  frees a packet
+ * @brief  arms the one-shot service timer for the next deadline, or stops it when nothing is scheduled
  *
- * @param  packet       the packet
+ * Called from the service task and from the timer, serialized by the search lock.
+ * Callers publish their changes to the TX queue before, so that the last caller sees them.
+ * Deadlines are rounded up to a multiple of MDNS_TIMER_SLACK_MS, so that close ones share
+ * a wakeup, except for work that is already due when the service task adds it.
+ *
+ * @param  after_run    called by the timer, anything overdue could not be posted and is retried
+ *                      on the next multiple
  */
-static void _mdns_free_tx_packet(mdns_tx_packet_t *packet)
+static void _mdns_timer_arm(bool after_run)
 {
-    if (!packet) {
+    if (!_mdns_server->timer_handle) {
         return;
     }
-    mdns_out_question_t *q = packet->questions;
-    while (q) {
-        mdns_out_question_t *next = q->next;
-        if (q->own_dynamic_memory) {
-            mdns_mem_free((char *)q->host);
-            mdns_mem_free((char *)q->service);
-            mdns_mem_free((char *)q->proto);
-            mdns_mem_free((char *)q->domain);
+    MDNS_SEARCH_LOCK();
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    int32_t next = _mdns_timer_next_ms(now);
+    bool active = esp_timer_is_active(_mdns_server->timer_handle);
+    if (next == INT32_MAX) {
+        if (active) {
+            esp_timer_stop(_mdns_server->timer_handle);
+        }
+    } else {
+        uint32_t due = now + (next > 0 ? next : after_run);
+        if (next > 0 || after_run) {
+            due += (MDNS_TIMER_SLACK_MS - due % MDNS_TIMER_SLACK_MS) % MDNS_TIMER_SLACK_MS;
+        }
+        if (!active || _mdns_server->timer_due_at != due) {
+            if (active) {
+                esp_timer_stop(_mdns_server->timer_handle);
+            }
+            esp_timer_start_once(_mdns_server->timer_handle, (uint64_t)(due - now) * 1000);
+            _mdns_server->timer_due_at = due;
         }
-        mdns_mem_free(q);
-        q = next;
     }
-    queueFree(mdns_out_answer_t, packet->answers);
-    queueFree(mdns_out_answer_t, packet->servers);
-    queueFree(mdns_out_answer_t, packet->additional);
-    mdns_mem_free(packet);
+    MDNS_SEARCH_UNLOCK();
+}
+
+/**
+ * @brief  rearms the service timer after the service task changed the schedule
+ */
+static void _mdns_timer_update(void)
+{
+    _mdns_timer_arm(false);
 }
 
 /**
@@ -1591,31 +2591,30 @@ static void _mdns_schedule_tx_packet(mdns_tx_packet_t *packet, uint32_t ms_after
         return;
     }
     packet->send_at = (xTaskGetTickCount() * portTICK_PERIOD_MS) + ms_after;
-    packet->next = NULL;
-    if (!_mdns_server->tx_queue_head || _mdns_server->tx_queue_head->send_at > packet->send_at) {
-        packet->next = _mdns_server->tx_queue_head;
-        _mdns_server->tx_queue_head = packet;
+    packet->seq = _mdns_server->tx_queue_seq++;
+    if (!_mdns_tx_queue_push(packet)) {
+        HOOK_MALLOC_FAILED;
+        _mdns_free_tx_packet(packet);
         return;
     }
-    mdns_tx_packet_t *q = _mdns_server->tx_queue_head;
-    while (q->next && q->next->send_at <= packet->send_at) {
-        q = q->next;
-    }
-    packet->next = q->next;
-    q->next = packet;
+    _mdns_timer_update();
 }
 
 /**
  * @brief  free all packets scheduled for sending
  */
-static void _mdns_clear_tx_queue_head(void)
+static void _mdns_clear_tx_queue(void)
 {
-    mdns_tx_packet_t *q;
-    while (_mdns_server->tx_queue_head) {
-        q = _mdns_server->tx_queue_head;
-        _mdns_server->tx_queue_head = _mdns_server->tx_queue_head->next;
-        _mdns_free_tx_packet(q);
+    while (_mdns_server->tx_queue_len) {
+        _mdns_free_tx_packet(_mdns_server->tx_queue[--_mdns_server->tx_queue_len]);
     }
+    _mdns_tx_queue_publish();
+}
+
+static bool _mdns_tx_packet_on_pcb(const mdns_tx_packet_t *p, const void *arg)
+{
+    const mdns_tx_packet_t *pcb = (const mdns_tx_packet_t *)arg;
+    return p->tcpip_if == pcb->tcpip_if && p->ip_protocol == pcb->ip_protocol;
 }
 
 /**
@@ -1624,78 +2623,291 @@ static void _mdns_clear_tx_queue_head(void)
  * @param  tcpip_if     the interface
  * @param  ip_protocol     pcb type V4/V6
  */
-static void _mdns_clear_pcb_tx_queue_head(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
-{
-    mdns_tx_packet_t *q, * p;
-    while (_mdns_server->tx_queue_head && _mdns_server->tx_queue_head->tcpip_if == tcpip_if && _mdns_server->tx_queue_head->ip_protocol == ip_protocol) {
-        q = _mdns_server->tx_queue_head;
-        _mdns_server->tx_queue_head = _mdns_server->tx_queue_head->next;
-        _mdns_free_tx_packet(q);
-    }
-    if (_mdns_server->tx_queue_head) {
-        q = _mdns_server->tx_queue_head;
-        while (q->next) {
-            if (q->next->tcpip_if == tcpip_if && q->next->ip_protocol == ip_protocol) {
-                p = q->next;
-                q->next = p->next;
-                _mdns_free_tx_packet(p);
-            } else {
-                q = q->next;
+static void _mdns_clear_pcb_tx_queue(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
+{
+    mdns_tx_packet_t pcb = { .tcpip_if = tcpip_if, .ip_protocol = ip_protocol };
+    _mdns_tx_queue_remove_if(_mdns_tx_packet_on_pcb, &pcb);
+}
+
+/**
+ * @brief  get the next packet scheduled for sending on a specific interface
+ *
+ * @param  tcpip_if     the interface
+ * @param  ip_protocol     pcb type V4/V6
+ */
+static mdns_tx_packet_t *_mdns_get_next_pcb_packet(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
+{
+    mdns_tx_packet_t *next = NULL;
+    for (uint16_t i = 0; i < _mdns_server->tx_queue_len; i++) {
+        mdns_tx_packet_t *q = _mdns_server->tx_queue[i];
+        if (q->tcpip_if == tcpip_if && q->ip_protocol == ip_protocol && (!next || _mdns_tx_before(q, next))) {
+            next = q;
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief  Find, remove and free answer from the scheduled packets
+ */
+static void _mdns_remove_scheduled_answer(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint16_t type, mdns_srv_item_t *service)
+{
+    mdns_srv_item_t s = {NULL, NULL};
+    if (!service) {
+        service = &s;
+    }
+    for (uint16_t i = 0; i < _mdns_server->tx_queue_len; i++) {
+        mdns_tx_packet_t *q = _mdns_server->tx_queue[i];
+        if (q->tcpip_if == tcpip_if && q->ip_protocol == ip_protocol && q->distributed) {
+            mdns_out_answer_t *a = q->answers;
+            if (a) {
+                if (a->type == type && a->service == service->service) {
+                    q->answers = q->answers->next;
+                    mdns_mem_free(a);
+                } else {
+                    while (a->next) {
+                        if (a->next->type == type && a->next->service == service->service) {
+                            mdns_out_answer_t *b = a->next;
+                            a->next = b->next;
+                            mdns_mem_free(b);
+                            break;
+                        }
+                        a = a->next;
+                    }
+                }
             }
         }
     }
 }
 
 /**
- * @brief  get the next packet scheduled for sending on a specific interface
+ * Records of shared responses multicast recently. A record is not multicast
+ * again on the same interface within MDNS_MULTICAST_INTERVAL_MS (RFC 6762
+ * section 6), which covers other hosts asking the same question right after
+ * us answering it. Entries only compare pointers and expire on their own.
+ */
+static struct {
+    mdns_service_t *service;
+    mdns_host_item_t *host;
+    uint32_t sent_at;
+    uint16_t type;
+    uint8_t tcpip_if;
+    uint8_t ip_protocol;
+} s_recent_answers[MDNS_RECENT_ANSWERS];
+static uint8_t s_recent_answers_next;
+
+/**
+ * @brief  Check whether two queued answers serialize to the same record
+ *
+ * A and AAAA records are written from the host alone, so the service they were queued for does not matter.
+ */
+static bool _mdns_answer_same_record(const mdns_out_answer_t *x, const mdns_out_answer_t *y)
+{
+    if (x->type != y->type || x->host != y->host) {
+        return false;
+    }
+    return x->type == MDNS_TYPE_A || x->type == MDNS_TYPE_AAAA || x->service == y->service;
+}
+
+static bool _mdns_answer_in_list(const mdns_out_answer_t *list, const mdns_out_answer_t *a)
+{
+    for (; list; list = list->next) {
+        if (_mdns_answer_same_record(list, a)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int _mdns_recent_answer_find(const mdns_tx_packet_t *p, const mdns_out_answer_t *a)
+{
+    for (int i = 0; i < MDNS_RECENT_ANSWERS; i++) {
+        if (s_recent_answers[i].type == a->type && s_recent_answers[i].service == a->service && s_recent_answers[i].host == a->host
+                && s_recent_answers[i].tcpip_if == p->tcpip_if && s_recent_answers[i].ip_protocol == p->ip_protocol) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief  remembers the answers of a shared response that is being sent
+ */
+static void _mdns_recent_answers_add(const mdns_tx_packet_t *p)
+{
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    for (const mdns_out_answer_t *a = p->answers; a; a = a->next) {
+        int i = _mdns_recent_answer_find(p, a);
+        if (i < 0) {
+            i = s_recent_answers_next;
+            s_recent_answers_next = (s_recent_answers_next + 1) % MDNS_RECENT_ANSWERS;
+            s_recent_answers[i].service = a->service;
+            s_recent_answers[i].host = a->host;
+            s_recent_answers[i].type = a->type;
+            s_recent_answers[i].tcpip_if = p->tcpip_if;
+            s_recent_answers[i].ip_protocol = p->ip_protocol;
+        }
+        s_recent_answers[i].sent_at = now;
+    }
+}
+
+static bool _mdns_recent_answer_sent(const mdns_tx_packet_t *p, const mdns_out_answer_t *a)
+{
+    int i = _mdns_recent_answer_find(p, a);
+    return i >= 0 && (xTaskGetTickCount() * portTICK_PERIOD_MS) - s_recent_answers[i].sent_at < MDNS_MULTICAST_INTERVAL_MS;
+}
+
+/**
+ * @brief  forgets the shared responses sent recently for a host that is removed
+ */
+static void _mdns_recent_answers_remove_host(const mdns_host_item_t *host)
+{
+    for (int i = 0; i < MDNS_RECENT_ANSWERS; i++) {
+        if (s_recent_answers[i].host == host) {
+            memset(&s_recent_answers[i], 0, sizeof(s_recent_answers[i]));
+        }
+    }
+}
+
+/**
+ * @brief  forgets all the shared responses sent recently
+ */
+static void _mdns_recent_answers_clear(void)
+{
+    memset(s_recent_answers, 0, sizeof(s_recent_answers));
+    s_recent_answers_next = 0;
+}
+
+/*
+ * Responses to a received packet are built in the receive arena, the packet,
+ * its answers and questions. Those sent at once go with the received packet,
+ * only what is scheduled for later is copied to the heap.
+ */
+static bool s_tx_in_arena;
+
+/**
+ * @brief  Allocates a packet, answer or question for the packet being built
+ */
+static void *_mdns_tx_alloc(size_t size)
+{
+    return s_tx_in_arena ? _mdns_rx_arena_alloc(size) : mdns_mem_malloc(size);
+}
+
+/**
+ * @brief  Appends a heap copy of the answer to destination
+ */
+static bool _mdns_answer_to_heap(mdns_out_answer_t **destination, const mdns_out_answer_t *answer)
+{
+    mdns_out_answer_t *a = (mdns_out_answer_t *)mdns_mem_malloc(sizeof(mdns_out_answer_t));
+    if (!a) {
+        HOOK_MALLOC_FAILED;
+        return false;
+    }
+    memcpy(a, answer, sizeof(mdns_out_answer_t));
+    a->next = NULL;
+    queueToEnd(mdns_out_answer_t, *destination, a);
+    return true;
+}
+
+/**
+ * @brief  Appends heap copies of the answers to destination
+ */
+static bool _mdns_answers_to_heap(mdns_out_answer_t **destination, const mdns_out_answer_t *answers)
+{
+    for (; answers; answers = answers->next) {
+        if (!_mdns_answer_to_heap(destination, answers)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief  Copies a response built in the receive arena to the heap, to be scheduled
  *
- * @param  tcpip_if     the interface
- * @param  ip_protocol     pcb type V4/V6
+ * Only legacy unicast responses carry questions, and those are sent at once.
  */
-static mdns_tx_packet_t *_mdns_get_next_pcb_packet(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
+static mdns_tx_packet_t *_mdns_tx_packet_to_heap(const mdns_tx_packet_t *packet)
 {
-    mdns_tx_packet_t *q = _mdns_server->tx_queue_head;
-    while (q) {
-        if (q->tcpip_if == tcpip_if && q->ip_protocol == ip_protocol) {
-            return q;
-        }
-        q = q->next;
+    mdns_tx_packet_t *copy = (mdns_tx_packet_t *)mdns_mem_malloc(sizeof(mdns_tx_packet_t));
+    if (!copy) {
+        HOOK_MALLOC_FAILED;
+        return NULL;
     }
-    return NULL;
+    memcpy(copy, packet, sizeof(mdns_tx_packet_t));
+    copy->in_arena = 0;
+    copy->questions = NULL;
+    copy->answers = copy->servers = copy->additional = NULL;
+    if (!_mdns_answers_to_heap(&copy->answers, packet->answers) || !_mdns_answers_to_heap(&copy->servers, packet->servers)
+            || !_mdns_answers_to_heap(&copy->additional, packet->additional)) {
+        _mdns_free_tx_packet(copy);
+        return NULL;
+    }
+    return copy;
 }
 
 /**
- * @brief  Find, remove and free answer from the scheduled packets
+ * @brief  Schedule a shared multicast response after the aggregation delay
+ *
+ * Answers that an earlier response still waiting on the same interface
+ * already carries, or that were multicast within the last second, are
+ * dropped. What remains joins the waiting response, so questions asked by
+ * several hosts at once are answered with a single packet. The packet is in
+ * the receive arena, what is kept of it is copied to the heap.
  */
-static void _mdns_remove_scheduled_answer(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint16_t type, mdns_srv_item_t *service)
-{
-    mdns_srv_item_t s = {NULL, NULL};
-    if (!service) {
-        service = &s;
+static void _mdns_schedule_shared_response(mdns_tx_packet_t *packet)
+{
+    mdns_tx_packet_t *open = NULL;
+    for (uint16_t i = 0; i < _mdns_server->tx_queue_len; i++) {
+        mdns_tx_packet_t *q = _mdns_server->tx_queue[i];
+        if (q->aggregate && q->tcpip_if == packet->tcpip_if && q->ip_protocol == packet->ip_protocol
+                && q->distributed == packet->distributed) {
+            open = q;
+            break;
+        }
     }
-    mdns_tx_packet_t *q = _mdns_server->tx_queue_head;
-    while (q) {
-        if (q->tcpip_if == tcpip_if && q->ip_protocol == ip_protocol && q->distributed) {
-            mdns_out_answer_t *a = q->answers;
-            if (a) {
-                if (a->type == type && a->service == service->service) {
-                    q->answers = q->answers->next;
-                    mdns_mem_free(a);
-                } else {
-                    while (a->next) {
-                        if (a->next->type == type && a->next->service == service->service) {
-                            mdns_out_answer_t *b = a->next;
-                            a->next = b->next;
-                            mdns_mem_free(b);
-                            break;
-                        }
-                        a = a->next;
-                    }
-                }
+
+    mdns_out_answer_t **a = &packet->answers;
+    while (*a) {
+        if ((open && _mdns_answer_in_list(open->answers, *a)) || _mdns_recent_answer_sent(packet, *a)) {
+            *a = (*a)->next;
+            continue;
+        }
+        a = &(*a)->next;
+    }
+    if (!packet->answers) {
+        return;
+    }
+
+    if (open) {
+        // a record merged in as an answer must not stay in the additional section too
+        a = &open->additional;
+        while (*a) {
+            if (_mdns_answer_in_list(packet->answers, *a)) {
+                mdns_out_answer_t *d = *a;
+                *a = d->next;
+                mdns_mem_free(d);
+                continue;
             }
+            a = &(*a)->next;
         }
-        q = q->next;
+        if (!_mdns_answers_to_heap(&open->answers, packet->answers)) {
+            return;
+        }
+        for (mdns_out_answer_t *d = packet->additional; d; d = d->next) {
+            if (!_mdns_answer_in_list(open->answers, d) && !_mdns_answer_in_list(open->additional, d)
+                    && !_mdns_answer_to_heap(&open->additional, d)) {
+                return;
+            }
+        }
+        return;
+    }
+    packet = _mdns_tx_packet_to_heap(packet);
+    if (!packet) {
+        return;
     }
+    packet->aggregate = 1;
+    _mdns_schedule_tx_packet(packet, (packet->distributed ? MDNS_RESPONSE_DELAY_TC_MS : MDNS_RESPONSE_DELAY_MS) + (esp_random() % 101));
 }
 
 /**
@@ -1741,7 +2953,7 @@ static bool _mdns_alloc_answer(mdns_out_answer_t **destination, uint16_t type, m
         d = d->next;
     }
 
-    mdns_out_answer_t *a = (mdns_out_answer_t *)mdns_mem_malloc(sizeof(mdns_out_answer_t));
+    mdns_out_answer_t *a = (mdns_out_answer_t *)_mdns_tx_alloc(sizeof(mdns_out_answer_t));
     if (!a) {
         HOOK_MALLOC_FAILED;
         return false;
@@ -1762,12 +2974,13 @@ static bool _mdns_alloc_answer(mdns_out_answer_t **destination, uint16_t type, m
  */
 static mdns_tx_packet_t *_mdns_alloc_packet_default(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
 {
-    mdns_tx_packet_t *packet = (mdns_tx_packet_t *)mdns_mem_malloc(sizeof(mdns_tx_packet_t));
+    mdns_tx_packet_t *packet = (mdns_tx_packet_t *)_mdns_tx_alloc(sizeof(mdns_tx_packet_t));
     if (!packet) {
         HOOK_MALLOC_FAILED;
         return NULL;
     }
     memset((uint8_t *)packet, 0, sizeof(mdns_tx_packet_t));
+    packet->in_arena = s_tx_in_arena;
     packet->tcpip_if = tcpip_if;
     packet->ip_protocol = ip_protocol;
     packet->port = MDNS_SERVICE_PORT;
@@ -1959,24 +3172,20 @@ static void _mdns_create_answer_from_parsed_packet(mdns_parsed_packet_t *parsed_
                  || q->type == MDNS_TYPE_PTR
 #endif /* CONFIG_MDNS_RESPOND_REVERSE_QUERIES */
                 )) {
-            mdns_out_question_t *out_question = mdns_mem_malloc(sizeof(mdns_out_question_t));
+            mdns_out_question_t *out_question = _mdns_tx_alloc(sizeof(mdns_out_question_t));
             if (out_question == NULL) {
                 HOOK_MALLOC_FAILED;
                 _mdns_free_tx_packet(packet);
                 return;
             }
+            // the response goes out before the parsed question's names leave the receive arena
             out_question->type = q->type;
             out_question->unicast = q->unicast;
             out_question->host = q->host;
-            q->host = NULL;
             out_question->service = q->service;
-            q->service = NULL;
             out_question->proto = q->proto;
-            q->proto = NULL;
             out_question->domain = q->domain;
-            q->domain = NULL;
             out_question->next = NULL;
-            out_question->own_dynamic_memory = true;
             queueToEnd(mdns_out_question_t, packet->questions, out_question);
         }
         if (q->unicast) {
@@ -1993,13 +3202,16 @@ static void _mdns_create_answer_from_parsed_packet(mdns_parsed_packet_t *parsed_
         packet->port = parsed_packet->src_port;
     }
 
-    static uint8_t share_step = 0;
-    if (shared) {
-        _mdns_schedule_tx_packet(packet, 25 + (share_step * 25));
-        share_step = (share_step + 1) & 0x03;
+    if (shared && !unicast && send_flush) {
+        _mdns_schedule_shared_response(packet);
+    } else if (shared && send_flush) {
+        packet = _mdns_tx_packet_to_heap(packet);
+        if (packet) {
+            _mdns_schedule_tx_packet(packet, MDNS_RESPONSE_DELAY_MS + (esp_random() % 101));
+        }
     } else {
+        // unique answers, and legacy unicast responses, which no other responder's answer can collide with
         _mdns_dispatch_tx_packet(packet);
-        _mdns_free_tx_packet(packet);
     }
 }
 
@@ -2082,7 +3294,6 @@ static bool _mdns_append_host_question(mdns_out_question_t **questions, const ch
     q->service = NULL;
     q->proto = NULL;
     q->domain = MDNS_DEFAULT_DOMAIN;
-    q->own_dynamic_memory = false;
     if (_mdns_question_exists(q, *questions)) {
         mdns_mem_free(q);
     } else {
@@ -2131,7 +3342,6 @@ static mdns_tx_packet_t *_mdns_create_probe_packet(mdns_if_t tcpip_if, mdns_ip_p
         q->service = services[i]->service->service;
         q->proto = services[i]->service->proto;
         q->domain = MDNS_DEFAULT_DOMAIN;
-        q->own_dynamic_memory = false;
         if (!q->host || _mdns_question_exists(q, packet->questions)) {
             mdns_mem_free(q);
             continue;
@@ -2317,7 +3527,7 @@ static void _mdns_init_pcb_probe(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_proto
 {
     mdns_pcb_t *pcb = &_mdns_server->interfaces[tcpip_if].pcbs[ip_protocol];
 
-    _mdns_clear_pcb_tx_queue_head(tcpip_if, ip_protocol);
+    _mdns_clear_pcb_tx_queue(tcpip_if, ip_protocol);
 
     if (_str_null_or_empty(_mdns_server->hostname)) {
         pcb->state = PCB_RUNNING;
@@ -2382,6 +3592,8 @@ static void _mdns_restart_pcb(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol
 static void _mdns_send_bye(mdns_srv_item_t **services, size_t len, bool include_ip)
 {
     uint8_t i, j;
+    // services are freed right after their goodbye, and cached packets are keyed by the service pointer
+    _mdns_answer_cache_clear();
     if (_str_null_or_empty(_mdns_server->hostname)) {
         return;
     }
@@ -2401,6 +3613,8 @@ static void _mdns_send_bye(mdns_srv_item_t **services, size_t len, bool include_
 static void _mdns_send_bye_subtype(mdns_srv_item_t *service, const char *instance_name, mdns_subtype_t *remove_subtypes)
 {
     uint8_t i, j;
+    // the service's PTR answers lose these subtypes
+    _mdns_answer_cache_clear();
     for (i = 0; i < MDNS_MAX_INTERFACES; i++) {
         for (j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
             if (mdns_is_netif_ready(i, j)) {
@@ -2494,6 +3708,10 @@ static void _mdns_announce_pcb(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protoco
 static void _mdns_probe_all_pcbs(mdns_srv_item_t **services, size_t len, bool probe_ip, bool clear_old_probe)
 {
     uint8_t i, j;
+    // records are (re)probed after every change to them
+    _mdns_answer_cache_clear();
+    _mdns_prefilter_clear();
+    _mdns_index_clear();
     for (i = 0; i < MDNS_MAX_INTERFACES; i++) {
         for (j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
             if (mdns_is_netif_ready(i, j)) {
@@ -2516,6 +3734,8 @@ static void _mdns_probe_all_pcbs(mdns_srv_item_t **services, size_t len, bool pr
 static void _mdns_announce_all_pcbs(mdns_srv_item_t **services, size_t len, bool include_ip)
 {
     uint8_t i, j;
+    // records are announced after every change to them
+    _mdns_answer_cache_clear();
     for (i = 0; i < MDNS_MAX_INTERFACES; i++) {
         for (j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
             _mdns_announce_pcb((mdns_if_t)i, (mdns_ip_protocol_t)j, services, len, include_ip);
@@ -2609,7 +3829,7 @@ static void _mdns_restart_all_pcbs_no_instance(void)
  */
 static void _mdns_restart_all_pcbs(void)
 {
-    _mdns_clear_tx_queue_head();
+    _mdns_clear_tx_queue();
     size_t srv_count = 0;
     mdns_srv_item_t *a = _mdns_server->services;
     while (a) {
@@ -2779,14 +3999,45 @@ static void _mdns_dealloc_scheduled_service_answers(mdns_out_answer_t **destinat
 /**
  * @brief  Find, remove and free answers and scheduled packets for service
  */
+static bool _mdns_tx_packet_is_empty(const mdns_tx_packet_t *p, const void *arg)
+{
+    return !p->questions && !p->answers && !p->additional && !p->servers;
+}
+
+static void _mdns_dealloc_scheduled_host_answers(mdns_out_answer_t **destination, const mdns_host_item_t *host)
+{
+    while (*destination) {
+        mdns_out_answer_t *a = *destination;
+        if (a->host == host) {
+            *destination = a->next;
+            mdns_mem_free(a);
+        } else {
+            destination = &a->next;
+        }
+    }
+}
+
+/**
+ * @brief  Remove and free the scheduled answers for a host that is removed, and the packets left empty
+ */
+static void _mdns_remove_scheduled_host_answers(const mdns_host_item_t *host)
+{
+    for (uint16_t idx = 0; idx < _mdns_server->tx_queue_len; idx++) {
+        mdns_tx_packet_t *q = _mdns_server->tx_queue[idx];
+        _mdns_dealloc_scheduled_host_answers(&q->answers, host);
+        _mdns_dealloc_scheduled_host_answers(&q->servers, host);
+        _mdns_dealloc_scheduled_host_answers(&q->additional, host);
+    }
+    _mdns_tx_queue_remove_if(_mdns_tx_packet_is_empty, NULL);
+}
+
 static void _mdns_remove_scheduled_service_packets(mdns_service_t *service)
 {
     if (!service) {
         return;
     }
-    mdns_tx_packet_t *p = NULL;
-    mdns_tx_packet_t *q = _mdns_server->tx_queue_head;
-    while (q) {
+    for (uint16_t idx = 0; idx < _mdns_server->tx_queue_len; idx++) {
+        mdns_tx_packet_t *q = _mdns_server->tx_queue[idx];
         bool had_answers = (q->answers != NULL);
 
         _mdns_dealloc_scheduled_service_answers(&(q->answers), service);
@@ -2850,14 +4101,8 @@ static void _mdns_remove_scheduled_service_packets(mdns_service_t *service)
                 }
             }
         }
-
-        p = q;
-        q = q->next;
-        if (!p->questions && !p->answers && !p->additional && !p->servers) {
-            queueDetach(mdns_tx_packet_t, _mdns_server->tx_queue_head, p);
-            _mdns_free_tx_packet(p);
-        }
     }
+    _mdns_tx_queue_remove_if(_mdns_tx_packet_is_empty, NULL);
 }
 
 static void _mdns_free_subtype(mdns_subtype_t *subtype)
@@ -2872,6 +4117,7 @@ static void _mdns_free_subtype(mdns_subtype_t *subtype)
 
 static void _mdns_free_service_subtype(mdns_service_t *service)
 {
+    _mdns_index_clear();
     _mdns_free_subtype(service->subtype);
     service->subtype = NULL;
 }
@@ -2886,6 +4132,7 @@ static void _mdns_free_service(mdns_service_t *service)
     if (!service) {
         return;
     }
+    _mdns_index_clear();
     mdns_mem_free((char *)service->instance);
     mdns_mem_free((char *)service->service);
     mdns_mem_free((char *)service->proto);
@@ -3015,6 +4262,9 @@ static esp_err_t mdns_pcb_deinit_local(mdns_if_t tcpip_if, mdns_ip_protocol_t ip
     if (_pcb == NULL || err != ESP_OK) {
         return err;
     }
+#if CONFIG_MDNS_PASSIVE_CACHE
+    _mdns_cache_clear(tcpip_if, ip_proto);
+#endif
     mdns_mem_free(_pcb->probe_services);
     _pcb->state = PCB_OFF;
     _pcb->probe_ip = false;
@@ -3038,7 +4288,7 @@ static void _mdns_dup_interface(mdns_if_t tcpip_if)
         if (mdns_is_netif_ready(other_if, i)) {
             //stop this interface and mark as dup
             if (mdns_is_netif_ready(tcpip_if, i)) {
-                _mdns_clear_pcb_tx_queue_head(tcpip_if, i);
+                _mdns_clear_pcb_tx_queue(tcpip_if, i);
                 mdns_pcb_deinit_local(tcpip_if, i);
             }
             _mdns_server->interfaces[tcpip_if].pcbs[i].state = PCB_DUP;
@@ -3155,6 +4405,7 @@ static bool _mdns_delegate_hostname_add(const char *hostname, mdns_ip_addr_t *ad
     }
     host->address_list = address_list;
     host->hostname = hostname;
+    host->reverse = NULL;
     host->next = _mdns_host_list;
     _mdns_host_list = host;
     return true;
@@ -3214,17 +4465,24 @@ static mdns_ip_addr_t *copy_address_list(const mdns_ip_addr_t *address_list)
     return head;
 }
 
+static void free_host_item(mdns_host_item_t *host)
+{
+    free_address_list(host->address_list);
+    mdns_mem_free((char *)host->hostname);
+    mdns_mem_free(host->reverse);
+    mdns_mem_free(host);
+}
+
 static void free_delegated_hostnames(void)
 {
     mdns_host_item_t *host = _mdns_host_list;
     while (host != NULL) {
-        free_address_list(host->address_list);
-        mdns_mem_free((char *)host->hostname);
         mdns_host_item_t *item = host;
         host = host->next;
-        mdns_mem_free(item);
+        free_host_item(item);
     }
     _mdns_host_list = NULL;
+    _mdns_index_clear();
 }
 
 static bool _mdns_delegate_hostname_remove(const char *hostname)
@@ -3250,63 +4508,505 @@ static bool _mdns_delegate_hostname_remove(const char *hostname)
             srv = srv->next;
         }
     }
-    mdns_host_item_t *host = _mdns_host_list;
-    mdns_host_item_t *prev_host = NULL;
-    while (host != NULL) {
-        if (strcasecmp(hostname, host->hostname) == 0) {
-            if (prev_host == NULL) {
-                _mdns_host_list = host->next;
-            } else {
-                prev_host->next = host->next;
+    mdns_host_item_t *host = _mdns_host_list;
+    mdns_host_item_t *prev_host = NULL;
+    while (host != NULL) {
+        if (strcasecmp(hostname, host->hostname) == 0) {
+            if (prev_host == NULL) {
+                _mdns_host_list = host->next;
+            } else {
+                prev_host->next = host->next;
+            }
+            _mdns_remove_scheduled_host_answers(host);
+            _mdns_recent_answers_remove_host(host);
+            free_host_item(host);
+            break;
+        } else {
+            prev_host = host;
+            host = host->next;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief  Check if parsed name is discovery
+ */
+static bool _mdns_name_is_discovery(mdns_name_t *name, uint16_t type)
+{
+    return (
+               (name->host[0] && !strcasecmp(name->host, "_services"))
+               && (name->service[0] && !strcasecmp(name->service, "_dns-sd"))
+               && (name->proto[0] && !strcasecmp(name->proto, "_udp"))
+               && (name->domain[0] && !strcasecmp(name->domain, MDNS_DEFAULT_DOMAIN))
+               && type == MDNS_TYPE_PTR
+           );
+}
+
+/**
+ * @brief  Check if the parsed name is self-hosted, i.e. we should resolve conflicts
+ */
+static bool _mdns_name_is_selfhosted(mdns_name_t *name)
+{
+    if (_str_null_or_empty(_mdns_server->hostname)) { // self-hostname needs to be defined
+        return false;
+    }
+
+    // hostname only -- check if selfhosted name
+    if (_str_null_or_empty(name->service) && _str_null_or_empty(name->proto) &&
+            strcasecmp(name->host, _mdns_server->hostname) == 0) {
+        return true;
+    }
+
+    // service -- check if selfhosted service
+    mdns_srv_item_t *srv = _mdns_get_service_item(name->service, name->proto, NULL);
+    if (srv && strcasecmp(_mdns_server->hostname, srv->service->hostname) == 0) {
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Pre-filter for received packets. Most mDNS traffic on a busy network is
+ * about other hosts' services, so before the full parse every owner name in
+ * the packet is looked up in a set of hashes of the names we answer for: our
+ * hostnames, the types of our services (which also covers their instances and
+ * subtypes), service discovery and, if enabled, reverse lookups. Names are
+ * hashed label by label from the right, so every suffix of a received name is
+ * checked in the same pass. A packet with no matching name is dropped.
+ *
+ * Collisions only let a packet through, so the set may also keep keys of
+ * removed records; it is rebuilt lazily after records were added
+ * (see _mdns_prefilter_clear()). While a search or browse is running every
+ * packet is parsed, as their answers can refer to any name.
+ */
+static struct {
+    uint32_t *slots;            // hashes, 0 marks a free slot
+    uint16_t mask;
+} s_prefilter;
+
+/**
+ * @brief  drops the pre-filter set, it is rebuilt for the next packet
+ */
+static void _mdns_prefilter_clear(void)
+{
+    mdns_mem_free(s_prefilter.slots);
+    s_prefilter.slots = NULL;
+}
+
+/**
+ * @brief  extends the hash of a name suffix by the label to its left
+ */
+static inline uint32_t _mdns_prefilter_hash(uint32_t hash, const uint8_t *label, uint8_t len)
+{
+    for (uint8_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)tolower(label[i])) * 16777619u;
+    }
+    return (hash ^ '.') * 16777619u;
+}
+
+static bool _mdns_prefilter_contains(uint32_t hash)
+{
+    hash = hash ? hash : 1;
+    for (uint16_t i = hash & s_prefilter.mask; s_prefilter.slots[i]; i = (i + 1) & s_prefilter.mask) {
+        if (s_prefilter.slots[i] == hash) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void _mdns_prefilter_add(const char *strings[], uint8_t count)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = count - 1; i >= 0; i--) {
+        hash = _mdns_prefilter_hash(hash, (const uint8_t *)strings[i], strlen(strings[i]));
+    }
+    hash = hash ? hash : 1;
+    uint16_t i = hash & s_prefilter.mask;
+    while (s_prefilter.slots[i] && s_prefilter.slots[i] != hash) {
+        i = (i + 1) & s_prefilter.mask;
+    }
+    s_prefilter.slots[i] = hash;
+}
+
+/**
+ * @brief  builds the set from the current hostnames and services
+ *
+ * @return false if out of memory
+ */
+static bool _mdns_prefilter_build(void)
+{
+    size_t keys = 3;    // hostname, service discovery, reverse lookups
+    for (mdns_host_item_t *h = _mdns_host_list; h; h = h->next) {
+        keys++;
+    }
+    for (mdns_srv_item_t *a = _mdns_server->services; a; a = a->next) {
+        keys++;
+    }
+    size_t size = MDNS_PREFILTER_MIN_SIZE;
+    while (size < 2 * keys) {
+        size *= 2;
+    }
+    if (size > UINT16_MAX) {
+        return false;
+    }
+    s_prefilter.slots = (uint32_t *)mdns_mem_calloc(size, sizeof(uint32_t));
+    if (!s_prefilter.slots) {
+        HOOK_MALLOC_FAILED;
+        return false;
+    }
+    s_prefilter.mask = size - 1;
+
+    if (!_str_null_or_empty(_mdns_server->hostname)) {
+        const char *name[] = { _mdns_server->hostname, MDNS_DEFAULT_DOMAIN };
+        _mdns_prefilter_add(name, 2);
+    }
+    for (mdns_host_item_t *h = _mdns_host_list; h; h = h->next) {
+        const char *name[] = { h->hostname, MDNS_DEFAULT_DOMAIN };
+        _mdns_prefilter_add(name, 2);
+    }
+    if (_mdns_server->services) {
+        const char *name[] = { "_services", "_dns-sd", "_udp", MDNS_DEFAULT_DOMAIN };
+        _mdns_prefilter_add(name, 4);
+    }
+    for (mdns_srv_item_t *a = _mdns_server->services; a; a = a->next) {
+        const char *name[] = { a->service->service, a->service->proto, MDNS_DEFAULT_DOMAIN };
+        _mdns_prefilter_add(name, 3);
+    }
+#ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
+    const char *arpa[] = { "arpa" };
+    _mdns_prefilter_add(arpa, 1);
+#endif /* CONFIG_MDNS_RESPOND_REVERSE_QUERIES */
+    return true;
+}
+
+/**
+ * @brief  checks whether any suffix of the name at *index is in the set
+ *
+ * @param  index   in: offset of the name, out: offset right after it
+ *
+ * @return -1 if the name is malformed, 1 on a match, 0 otherwise
+ */
+static int _mdns_prefilter_match_name(const uint8_t *data, size_t len, size_t *index)
+{
+    uint16_t labels[MDNS_PREFILTER_MAX_LABELS];
+    uint8_t count = 0;
+    size_t pos = *index;
+    size_t end = 0;
+
+    for (;;) {
+        if (pos >= len) {
+            return -1;
+        }
+        uint8_t label_len = data[pos];
+        if (label_len == 0) {
+            break;
+        }
+        if ((label_len & 0xC0) == 0xC0) {
+            if (pos + 1 >= len) {
+                return -1;
+            }
+            size_t target = ((size_t)(label_len & 0x3F) << 8) | data[pos + 1];
+            if (!end) {
+                end = pos + 2;
+            }
+            // compression pointers only point backwards, which also rules out loops
+            if (target >= pos) {
+                return -1;
+            }
+            pos = target;
+            continue;
+        }
+        if (label_len > 63 || pos + 1 + label_len > len || count == MDNS_PREFILTER_MAX_LABELS) {
+            return -1;
+        }
+        labels[count++] = pos;
+        pos += 1 + label_len;
+    }
+    *index = end ? end : pos + 1;
+
+    uint32_t hash = 2166136261u;
+    while (count--) {
+        hash = _mdns_prefilter_hash(hash, data + labels[count] + 1, data[labels[count]]);
+        if (_mdns_prefilter_contains(hash)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief  single pass over the owner names of a received packet
+ *
+ * @return false if the packet cannot concern any of our records
+ */
+static bool _mdns_prefilter_pass(const uint8_t *data, size_t len)
+{
+    if (_mdns_server->search_once || _mdns_server->browse || len <= MDNS_HEAD_ADDITIONAL_OFFSET) {
+        return true;
+    }
+#if CONFIG_MDNS_PASSIVE_CACHE
+    if (_mdns_read_u16(data, MDNS_HEAD_FLAGS_OFFSET) & MDNS_FLAGS_QUERY_REPSONSE) {
+        return true;    // every response can fill the cache
+    }
+#endif
+    if (!s_prefilter.slots && !_mdns_prefilter_build()) {
+        return true;
+    }
+    uint32_t questions = _mdns_read_u16(data, MDNS_HEAD_QUESTIONS_OFFSET);
+    uint32_t records = questions + _mdns_read_u16(data, MDNS_HEAD_ANSWERS_OFFSET)
+                       + _mdns_read_u16(data, MDNS_HEAD_SERVERS_OFFSET) + _mdns_read_u16(data, MDNS_HEAD_ADDITIONAL_OFFSET);
+    size_t index = MDNS_HEAD_LEN;
+
+    for (uint32_t i = 0; i < records; i++) {
+        int match = _mdns_prefilter_match_name(data, len, &index);
+        if (match) {
+            return true;    // ours, or malformed and left to the parser to reject
+        }
+        if (i < questions) {
+            index += 4;     // type, class
+        } else {
+            if (index + 10 > len) {
+                return true;
+            }
+            index += 10 + _mdns_read_u16(data, index + 8);  // type, class, ttl, rdlength, rdata
+        }
+    }
+    return false;
+}
+
+#if CONFIG_MDNS_PASSIVE_CACHE
+/**
+ * Passive cache of the records other hosts multicast (RFC 6762 section 10).
+ * Every PTR, SRV, TXT, A and AAAA record of a response that is not about us is
+ * kept with its name and data uncompressed, so that a new query can be answered
+ * by replaying the cached records through the parser (see _mdns_cache_answer()).
+ * Entries are in a list ordered by last use, the least recently used entry is
+ * dropped when the cache is full. Expired entries are removed while walking the
+ * list.
+ */
+typedef struct mdns_cache_entry_s {
+    struct mdns_cache_entry_s *prev;
+    struct mdns_cache_entry_s *next;
+    uint32_t received_at;       // ms
+    uint32_t ttl;               // s
+    uint16_t type;
+    uint16_t name_len;
+    uint16_t rdata_len;
+    uint8_t tcpip_if;
+    uint8_t ip_protocol;
+    uint8_t refreshed;          // refresh query sent since received
+    uint8_t replay;             // selected for the replay in progress
+    uint8_t data[];             // name followed by rdata
+} mdns_cache_entry_t;
+
+static struct {
+    mdns_cache_entry_t *head;   // most recently used
+    mdns_cache_entry_t *tail;
+    uint16_t count;
+    bool replaying;             // parsing cached records, don't cache them again
+} s_cache;
+
+static void _mdns_cache_unlink(mdns_cache_entry_t *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        s_cache.head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        s_cache.tail = e->prev;
+    }
+}
+
+static void _mdns_cache_push_front(mdns_cache_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = s_cache.head;
+    if (s_cache.head) {
+        s_cache.head->prev = e;
+    } else {
+        s_cache.tail = e;
+    }
+    s_cache.head = e;
+}
+
+static void _mdns_cache_remove(mdns_cache_entry_t *e)
+{
+    _mdns_cache_unlink(e);
+    s_cache.count--;
+    mdns_mem_free(e);
+}
+
+static inline uint32_t _mdns_cache_age(const mdns_cache_entry_t *e, uint32_t now)
+{
+    return now - e->received_at;
+}
+
+static inline bool _mdns_cache_expired(const mdns_cache_entry_t *e, uint32_t now)
+{
+    return _mdns_cache_age(e, now) >= e->ttl * 1000;
+}
+
+/**
+ * @brief  removes the entries of one interface, or all with MDNS_MAX_INTERFACES
+ */
+static void _mdns_cache_clear(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
+{
+    mdns_cache_entry_t *e = s_cache.head;
+    while (e) {
+        mdns_cache_entry_t *next = e->next;
+        if (tcpip_if == MDNS_MAX_INTERFACES || (e->tcpip_if == tcpip_if && e->ip_protocol == ip_protocol)) {
+            _mdns_cache_remove(e);
+        }
+        e = next;
+    }
+}
+
+/**
+ * @brief  copies a possibly compressed name of a packet uncompressed
+ *
+ * @return length of the copy, 0 if the name is malformed or does not fit
+ */
+static uint16_t _mdns_cache_copy_name(const uint8_t *data, size_t len, size_t index, uint8_t *out, uint16_t size)
+{
+    uint16_t written = 0;
+    uint8_t jumps = 0;
+
+    while (index < len) {
+        uint8_t label_len = data[index];
+        if ((label_len & 0xC0) == 0xC0) {
+            if (index + 1 >= len || ++jumps > MDNS_MAX_PACKET_SIZE / 2) {
+                return 0;
             }
-            free_address_list(host->address_list);
-            mdns_mem_free((char *)host->hostname);
-            mdns_mem_free(host);
-            break;
-        } else {
-            prev_host = host;
-            host = host->next;
+            index = ((label_len & 0x3F) << 8) | data[index + 1];
+            continue;
         }
+        if (label_len > 63 || index + 1 + label_len > len || written + 1 + label_len > size) {
+            return 0;
+        }
+        memcpy(out + written, data + index, 1 + label_len);
+        written += 1 + label_len;
+        if (!label_len) {
+            return written;
+        }
+        index += 1 + label_len;
     }
-    return true;
+    return 0;
 }
 
-/**
- * @brief  Check if parsed name is discovery
- */
-static bool _mdns_name_is_discovery(mdns_name_t *name, uint16_t type)
+static bool _mdns_cache_name_eq(const uint8_t *a, uint16_t a_len, const uint8_t *b, uint16_t b_len)
 {
-    return (
-               (name->host[0] && !strcasecmp(name->host, "_services"))
-               && (name->service[0] && !strcasecmp(name->service, "_dns-sd"))
-               && (name->proto[0] && !strcasecmp(name->proto, "_udp"))
-               && (name->domain[0] && !strcasecmp(name->domain, MDNS_DEFAULT_DOMAIN))
-               && type == MDNS_TYPE_PTR
-           );
+    if (a_len != b_len) {
+        return false;
+    }
+    for (uint16_t i = 0; i < a_len; i++) {
+        if (tolower(a[i]) != tolower(b[i])) {
+            return false;
+        }
+    }
+    return true;
 }
 
 /**
- * @brief  Check if the parsed name is self-hosted, i.e. we should resolve conflicts
+ * @brief  stores a record of a received response
+ *
+ * A TTL of zero (goodbye) removes the record, the cache-flush bit removes the
+ * other records of the same name and type received more than a second ago.
  */
-static bool _mdns_name_is_selfhosted(mdns_name_t *name)
+static void _mdns_cache_add(mdns_rx_packet_t *packet, const uint8_t *data, size_t len, const uint8_t *owner,
+                            uint16_t type, bool flush, uint32_t ttl, const uint8_t *rdata, uint16_t rdata_len)
 {
-    if (_str_null_or_empty(_mdns_server->hostname)) { // self-hostname needs to be defined
-        return false;
+    static uint8_t buf[MDNS_CACHE_MAX_NAME + MDNS_CACHE_MAX_RDATA];
+    uint16_t name_len = _mdns_cache_copy_name(data, len, owner - data, buf, MDNS_CACHE_MAX_NAME);
+    uint8_t *out = buf + name_len;
+    uint16_t out_len = 0;
+
+    if (!name_len) {
+        return;
+    }
+    switch (type) {
+    case MDNS_TYPE_PTR:
+        out_len = _mdns_cache_copy_name(data, len, rdata - data, out, MDNS_CACHE_MAX_RDATA);
+        break;
+    case MDNS_TYPE_SRV:
+        if (rdata_len > MDNS_SRV_FQDN_OFFSET) {
+            memcpy(out, rdata, MDNS_SRV_FQDN_OFFSET);
+            out_len = _mdns_cache_copy_name(data, len, rdata + MDNS_SRV_FQDN_OFFSET - data, out + MDNS_SRV_FQDN_OFFSET,
+                                            MDNS_CACHE_MAX_RDATA - MDNS_SRV_FQDN_OFFSET);
+            out_len = out_len ? out_len + MDNS_SRV_FQDN_OFFSET : 0;
+        }
+        break;
+    case MDNS_TYPE_TXT:
+    case MDNS_TYPE_A:
+    case MDNS_TYPE_AAAA:
+        if (rdata_len <= MDNS_CACHE_MAX_RDATA) {
+            memcpy(out, rdata, rdata_len);
+            out_len = rdata_len;
+        }
+        break;
+    default:
+        break;
+    }
+    if (!out_len) {
+        return;
     }
 
-    // hostname only -- check if selfhosted name
-    if (_str_null_or_empty(name->service) && _str_null_or_empty(name->proto) &&
-            strcasecmp(name->host, _mdns_server->hostname) == 0) {
-        return true;
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    bool found = false;
+    mdns_cache_entry_t *e = s_cache.head;
+    while (e) {
+        mdns_cache_entry_t *next = e->next;
+        if (e->type == type && e->tcpip_if == packet->tcpip_if && e->ip_protocol == packet->ip_protocol
+                && _mdns_cache_name_eq(e->data, e->name_len, buf, name_len)) {
+            if (e->rdata_len == out_len && !memcmp(e->data + e->name_len, out, out_len)) {
+                found = true;
+                if (!ttl) {
+                    _mdns_cache_remove(e);
+                } else {
+                    e->received_at = now;
+                    e->ttl = ttl;
+                    e->refreshed = 0;
+                    _mdns_cache_unlink(e);
+                    _mdns_cache_push_front(e);
+                }
+            } else if (flush && _mdns_cache_age(e, now) > MDNS_CACHE_FLUSH_GRACE_MS) {
+                _mdns_cache_remove(e);
+            }
+        } else if (_mdns_cache_expired(e, now)) {
+            _mdns_cache_remove(e);
+        }
+        e = next;
+    }
+    if (found || !ttl) {
+        return;
     }
 
-    // service -- check if selfhosted service
-    mdns_srv_item_t *srv = _mdns_get_service_item(name->service, name->proto, NULL);
-    if (srv && strcasecmp(_mdns_server->hostname, srv->service->hostname) == 0) {
-        return true;
+    if (s_cache.count >= CONFIG_MDNS_PASSIVE_CACHE_SIZE) {
+        _mdns_cache_remove(s_cache.tail);
     }
-    return false;
-}
+    e = (mdns_cache_entry_t *)mdns_mem_malloc(sizeof(mdns_cache_entry_t) + name_len + out_len);
+    if (!e) {
+        HOOK_MALLOC_FAILED;
+        return;
+    }
+    e->received_at = now;
+    e->ttl = ttl;
+    e->type = type;
+    e->name_len = name_len;
+    e->rdata_len = out_len;
+    e->tcpip_if = packet->tcpip_if;
+    e->ip_protocol = packet->ip_protocol;
+    e->refreshed = 0;
+    e->replay = 0;
+    memcpy(e->data, buf, name_len + out_len);
+    _mdns_cache_push_front(e);
+    s_cache.count++;
+}
+#endif /* CONFIG_MDNS_PASSIVE_CACHE */
 
 /**
  * @brief  Check if the parsed name is ours (matches service or host name)
@@ -3413,9 +5113,7 @@ static const uint8_t *_mdns_parse_fqdn(const uint8_t *packet, const uint8_t *sta
     name->domain[0] = 0;
     name->invalid = false;
 
-    static char buf[MDNS_NAME_BUF_LEN];
-
-    const uint8_t *next_data = (uint8_t *)_mdns_read_fqdn(packet, start, name, buf, packet_len);
+    const uint8_t *next_data = _mdns_read_fqdn(packet, start, name, packet_len);
     if (!next_data) {
         return 0;
     }
@@ -3479,13 +5177,9 @@ static void _mdns_remove_parsed_question(mdns_parsed_packet_t *parsed_packet, ui
 {
     mdns_parsed_question_t *q = parsed_packet->questions;
 
+    // questions live in the receive arena, unlinking is enough
     if (_mdns_question_matches(q, type, service)) {
         parsed_packet->questions = q->next;
-        mdns_mem_free(q->host);
-        mdns_mem_free(q->service);
-        mdns_mem_free(q->proto);
-        mdns_mem_free(q->domain);
-        mdns_mem_free(q);
         return;
     }
 
@@ -3493,11 +5187,6 @@ static void _mdns_remove_parsed_question(mdns_parsed_packet_t *parsed_packet, ui
         mdns_parsed_question_t *p = q->next;
         if (_mdns_question_matches(p, type, service)) {
             q->next = p->next;
-            mdns_mem_free(p->host);
-            mdns_mem_free(p->service);
-            mdns_mem_free(p->proto);
-            mdns_mem_free(p->domain);
-            mdns_mem_free(p);
             return;
         }
         q = q->next;
@@ -3628,6 +5317,11 @@ static void _mdns_result_txt_create(const uint8_t *data, size_t len, mdns_txt_it
         }
     }
 
+    if (!txt_num) {
+        // every item was invalid: callers only take ownership of a non-empty result
+        goto handle_error;
+    }
+
     *out_txt = txt;
     *out_count = txt_num;
     *out_value_len = txt_value_len;
@@ -3643,13 +5337,83 @@ handle_error :
     mdns_mem_free(txt);
 }
 
+/*
+ * Per-packet arena. What the parser builds for one packet (the parsed packet,
+ * its questions and known answers, scratch names for browse results, the
+ * response when it is sent at once) is bumped off a static slab and released
+ * at once when the packet is done. Whatever does not fit comes from the heap
+ * and is released with it. Data that outlives the packet (search and browse
+ * results, responses scheduled for later) is not allocated here.
+ * Only the mDNS task parses, one packet at a time.
+ */
+#define MDNS_RX_ARENA_ALIGN _Alignof(max_align_t)
+
+typedef struct mdns_rx_arena_chunk_s {
+    struct mdns_rx_arena_chunk_s *next;
+    _Alignas(max_align_t) uint8_t data[];
+} mdns_rx_arena_chunk_t;
+
+static struct {
+    size_t used;
+    mdns_rx_arena_chunk_t *overflow;    // heap allocations of the current packet
+    _Alignas(max_align_t) uint8_t slab[MDNS_RX_ARENA_SIZE];
+} s_rx_arena;
+
+/**
+ * @brief  Allocates zeroed memory that lives until _mdns_rx_arena_release()
+ */
+static void *_mdns_rx_arena_alloc(size_t size)
+{
+    size_t aligned = (size + MDNS_RX_ARENA_ALIGN - 1) & ~(MDNS_RX_ARENA_ALIGN - 1);
+    if (aligned <= sizeof(s_rx_arena.slab) - s_rx_arena.used) {
+        void *ptr = s_rx_arena.slab + s_rx_arena.used;
+        s_rx_arena.used += aligned;
+        memset(ptr, 0, size);
+        return ptr;
+    }
+    mdns_rx_arena_chunk_t *chunk = (mdns_rx_arena_chunk_t *)mdns_mem_calloc(1, sizeof(mdns_rx_arena_chunk_t) + size);
+    if (!chunk) {
+        HOOK_MALLOC_FAILED;
+        return NULL;
+    }
+    chunk->next = s_rx_arena.overflow;
+    s_rx_arena.overflow = chunk;
+    return chunk->data;
+}
+
+/**
+ * @brief  Releases everything allocated from the arena
+ */
+static void _mdns_rx_arena_release(void)
+{
+    while (s_rx_arena.overflow) {
+        mdns_rx_arena_chunk_t *chunk = s_rx_arena.overflow;
+        s_rx_arena.overflow = chunk->next;
+        mdns_mem_free(chunk);
+    }
+    s_rx_arena.used = 0;
+}
+
+/**
+ * @brief  Copies a name into the arena
+ */
+static char *_mdns_rx_arena_strdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = (char *)_mdns_rx_arena_alloc(len);
+    if (copy) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
 /**
- * @brief  Duplicate string or return error
+ * @brief  Duplicate string into the receive arena or return error
  */
 static esp_err_t _mdns_strdup_check(char **out, char *in)
 {
     if (in && in[0]) {
-        *out = mdns_mem_strdup(in);
+        *out = _mdns_rx_arena_strdup(in);
         if (!*out) {
             return ESP_FAIL;
         }
@@ -3659,17 +5423,44 @@ static esp_err_t _mdns_strdup_check(char **out, char *in)
     return ESP_OK;
 }
 
+/**
+ * @brief  takes the service lock for the parser unless it holds it already
+ */
+static inline void _mdns_rx_lock(bool *locked)
+{
+    if (!*locked) {
+        MDNS_SERVICE_LOCK();
+        *locked = true;
+    }
+}
+
+/**
+ * @brief  gives the service lock back if the parser holds it
+ */
+static inline void _mdns_rx_unlock(bool *locked)
+{
+    if (*locked) {
+        MDNS_SERVICE_UNLOCK();
+        *locked = false;
+    }
+}
+
 /**
  * @brief  main packet parser
  *
- * @param  packet       the packet
+ * Called by the service task without the service lock. The lock is taken for the
+ * questions, for each record until it is known not to be ours, and for building
+ * the answer. Records of other hosts only feed searches, browses and the cache,
+ * which only the service task touches, so API calls do not wait for them.
+ *
+ * @param  packet       the packet, only its addresses and interface are used
+ * @param  data         packet data
+ * @param  len          packet length
  */
-void mdns_parse_packet(mdns_rx_packet_t *packet)
+static void _mdns_parse_packet_data(mdns_rx_packet_t *packet, const uint8_t *data, size_t len)
 {
     static mdns_name_t n;
     mdns_header_t header;
-    const uint8_t *data = _mdns_get_packet_data(packet);
-    size_t len = _mdns_get_packet_len(packet);
     const uint8_t *content = data + MDNS_HEAD_LEN;
     bool do_not_reply = false;
     mdns_search_once_t *search_result = NULL;
@@ -3677,7 +5468,8 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
     char *browse_result_instance = NULL;
     char *browse_result_service = NULL;
     char *browse_result_proto = NULL;
-    mdns_browse_sync_t *out_sync_browse = NULL;
+    bool browse_changed = false;
+    bool locked = false;
 
 #ifdef MDNS_ENABLE_DEBUG
     _mdns_dbg_printf("\nRX[%lu][%lu]: ", (unsigned long)packet->tcpip_if, (unsigned long)packet->ip_protocol);
@@ -3721,12 +5513,10 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
         return;
     }
 
-    mdns_parsed_packet_t *parsed_packet = (mdns_parsed_packet_t *)mdns_mem_malloc(sizeof(mdns_parsed_packet_t));
+    mdns_parsed_packet_t *parsed_packet = (mdns_parsed_packet_t *)_mdns_rx_arena_alloc(sizeof(mdns_parsed_packet_t));
     if (!parsed_packet) {
-        HOOK_MALLOC_FAILED;
         return;
     }
-    memset(parsed_packet, 0, sizeof(mdns_parsed_packet_t));
 
     mdns_name_t *name = &n;
     memset(name, 0, sizeof(mdns_name_t));
@@ -3739,13 +5529,7 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
     header.additional = _mdns_read_u16(data, MDNS_HEAD_ADDITIONAL_OFFSET);
 
     if (header.flags == MDNS_FLAGS_QR_AUTHORITATIVE && packet->src_port != MDNS_SERVICE_PORT) {
-        mdns_mem_free(parsed_packet);
-        return;
-    }
-
-    //if we have not set the hostname, we can not answer questions
-    if (header.questions && !header.answers && _str_null_or_empty(_mdns_server->hostname)) {
-        mdns_mem_free(parsed_packet);
+        _mdns_rx_arena_release();
         return;
     }
 
@@ -3762,7 +5546,14 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
     if (header.questions) {
         uint8_t qs = header.questions;
 
+        _mdns_rx_lock(&locked);
+        //if we have not set the hostname, we can not answer questions
+        if (!header.answers && _str_null_or_empty(_mdns_server->hostname)) {
+            goto clear_rx_packet;
+        }
+
         while (qs--) {
+            _mdns_rx_unlock(&locked);
             content = _mdns_parse_fqdn(data, content, name, len);
             if (!content) {
                 header.answers = 0;
@@ -3784,14 +5575,15 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                 continue;
             }
 
+            // questions are matched against the registry
+            _mdns_rx_lock(&locked);
             if (_mdns_name_is_discovery(name, type)) {
                 //service discovery
                 parsed_packet->discovery = true;
                 mdns_srv_item_t *a = _mdns_server->services;
                 while (a) {
-                    mdns_parsed_question_t *question = (mdns_parsed_question_t *)mdns_mem_calloc(1, sizeof(mdns_parsed_question_t));
+                    mdns_parsed_question_t *question = (mdns_parsed_question_t *)_mdns_rx_arena_alloc(sizeof(mdns_parsed_question_t));
                     if (!question) {
-                        HOOK_MALLOC_FAILED;
                         goto clear_rx_packet;
                     }
                     question->next = parsed_packet->questions;
@@ -3800,9 +5592,9 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     question->unicast = unicast;
                     question->type = MDNS_TYPE_SDPTR;
                     question->host = NULL;
-                    question->service = mdns_mem_strdup(a->service->service);
-                    question->proto = mdns_mem_strdup(a->service->proto);
-                    question->domain = mdns_mem_strdup(MDNS_DEFAULT_DOMAIN);
+                    question->service = _mdns_rx_arena_strdup(a->service->service);
+                    question->proto = _mdns_rx_arena_strdup(a->service->proto);
+                    question->domain = _mdns_rx_arena_strdup(MDNS_DEFAULT_DOMAIN);
                     if (!question->service || !question->proto || !question->domain) {
                         goto clear_rx_packet;
                     }
@@ -3818,9 +5610,8 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                 parsed_packet->probe = true;
             }
 
-            mdns_parsed_question_t *question = (mdns_parsed_question_t *)mdns_mem_calloc(1, sizeof(mdns_parsed_question_t));
+            mdns_parsed_question_t *question = (mdns_parsed_question_t *)_mdns_rx_arena_alloc(sizeof(mdns_parsed_question_t));
             if (!question) {
-                HOOK_MALLOC_FAILED;
                 goto clear_rx_packet;
             }
             question->next = parsed_packet->questions;
@@ -3844,7 +5635,10 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
         uint16_t recordIndex = 0;
 
         while (content < (data + len)) {
-
+            _mdns_rx_unlock(&locked);
+#if CONFIG_MDNS_PASSIVE_CACHE
+            const uint8_t *owner = content;
+#endif
             content = _mdns_parse_fqdn(data, content, name, len);
             if (!content) {
                 goto clear_rx_packet;//error
@@ -3858,6 +5652,7 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
             uint32_t ttl = _mdns_read_u32(content, MDNS_TTL_OFFSET);
             uint16_t data_len = _mdns_read_u16(content, MDNS_LEN_OFFSET);
             const uint8_t *data_ptr = content + MDNS_DATA_OFFSET;
+            bool flush = !!(mdns_class & 0x8000);
             mdns_class &= 0x7FFF;
 
             content = data_ptr + data_len;
@@ -3882,6 +5677,8 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                 continue;
             }
 
+            // held for the rest of the record if it is ours
+            _mdns_rx_lock(&locked);
             if (parsed_packet->discovery && _mdns_name_is_discovery(name, type)) {
                 discovery = true;
             } else if (!name->sub && _mdns_name_is_ours(name)) {
@@ -3890,44 +5687,44 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     service = _mdns_get_service_item(name->service, name->proto, NULL);
                 }
             } else {
+                _mdns_rx_unlock(&locked);
                 if ((header.flags & MDNS_FLAGS_QUERY_REPSONSE) == 0 || record_type == MDNS_NS) {
                     //skip this record
                     continue;
                 }
+#if CONFIG_MDNS_PASSIVE_CACHE
+                if (mdns_class == 0x0001 && !s_cache.replaying) {
+                    _mdns_cache_add(packet, data, len, owner, type, flush, ttl, data_ptr, data_len);
+                }
+#endif
                 search_result = _mdns_search_find_from(_mdns_server->search_once, name, type, packet->tcpip_if, packet->ip_protocol);
+                if (search_result && flush && parsed_packet->authoritative && search_result->type != MDNS_TYPE_PTR
+                        && (search_result->type == type || (search_result->type == MDNS_TYPE_ANY && type != MDNS_TYPE_PTR))) {
+                    // the whole set of a unique record comes in one response (RFC 6762 section 6)
+                    search_result->answered = true;
+                }
                 browse_result = _mdns_browse_find_from(_mdns_server->browse, name, type, packet->tcpip_if, packet->ip_protocol);
                 if (browse_result) {
-                    if (!out_sync_browse) {
-                        // will be freed in function `_mdns_browse_sync`
-                        out_sync_browse = (mdns_browse_sync_t *)mdns_mem_malloc(sizeof(mdns_browse_sync_t));
-                        if (!out_sync_browse) {
-                            HOOK_MALLOC_FAILED;
-                            goto clear_rx_packet;
-                        }
-                        out_sync_browse->browse = browse_result;
-                        out_sync_browse->sync_result = NULL;
-                    }
+                    browse_changed = true;
                     if (!browse_result_service) {
-                        browse_result_service = (char *)mdns_mem_malloc(MDNS_NAME_BUF_LEN);
+                        browse_result_service = (char *)_mdns_rx_arena_alloc(MDNS_NAME_BUF_LEN);
                         if (!browse_result_service) {
-                            HOOK_MALLOC_FAILED;
                             goto clear_rx_packet;
                         }
                     }
-                    memcpy(browse_result_service, browse_result->service, MDNS_NAME_BUF_LEN);
+                    // the browse only holds the string, the last byte stays zero from the arena
+                    strncpy(browse_result_service, browse_result->service, MDNS_NAME_BUF_LEN - 1);
                     if (!browse_result_proto) {
-                        browse_result_proto = (char *)mdns_mem_malloc(MDNS_NAME_BUF_LEN);
+                        browse_result_proto = (char *)_mdns_rx_arena_alloc(MDNS_NAME_BUF_LEN);
                         if (!browse_result_proto) {
-                            HOOK_MALLOC_FAILED;
                             goto clear_rx_packet;
                         }
                     }
-                    memcpy(browse_result_proto, browse_result->proto, MDNS_NAME_BUF_LEN);
+                    strncpy(browse_result_proto, browse_result->proto, MDNS_NAME_BUF_LEN - 1);
                     if (type == MDNS_TYPE_SRV || type == MDNS_TYPE_TXT) {
                         if (!browse_result_instance) {
-                            browse_result_instance = (char *)mdns_mem_malloc(MDNS_NAME_BUF_LEN);
+                            browse_result_instance = (char *)_mdns_rx_arena_alloc(MDNS_NAME_BUF_LEN);
                             if (!browse_result_instance) {
-                                HOOK_MALLOC_FAILED;
                                 goto clear_rx_packet;
                             }
                         }
@@ -3949,10 +5746,15 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     } else {
                         service = _mdns_get_service_item(name->service, name->proto, NULL);
                     }
+                    // known answers suppress our answer only with at least half of its TTL left
                     if (discovery && service) {
-                        _mdns_remove_parsed_question(parsed_packet, MDNS_TYPE_SDPTR, service);
+                        if (ttl > (MDNS_ANSWER_PTR_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, MDNS_TYPE_SDPTR, service);
+                        }
                     } else if (service && parsed_packet->questions && !parsed_packet->probe) {
-                        _mdns_remove_parsed_question(parsed_packet, type, service);
+                        if (ttl > (MDNS_ANSWER_PTR_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, type, service);
+                        }
                     } else if (service) {
                         //check if TTL is more than half of the full TTL value (4500)
                         if (ttl > (MDNS_ANSWER_PTR_TTL / 2)) {
@@ -3960,9 +5762,8 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                         }
                     }
                     if (service) {
-                        mdns_parsed_record_t *record = mdns_mem_malloc(sizeof(mdns_parsed_record_t));
+                        mdns_parsed_record_t *record = (mdns_parsed_record_t *)_mdns_rx_arena_alloc(sizeof(mdns_parsed_record_t));
                         if (!record) {
-                            HOOK_MALLOC_FAILED;
                             goto clear_rx_packet;
                         }
                         record->next = parsed_packet->records;
@@ -3970,32 +5771,10 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                         record->type = MDNS_TYPE_PTR;
                         record->record_type = MDNS_ANSWER;
                         record->ttl = ttl;
-                        record->host = NULL;
-                        record->service = NULL;
-                        record->proto = NULL;
-                        if (name->host[0]) {
-                            record->host = mdns_mem_malloc(MDNS_NAME_BUF_LEN);
-                            if (!record->host) {
-                                HOOK_MALLOC_FAILED;
-                                goto clear_rx_packet;
-                            }
-                            memcpy(record->host, name->host, MDNS_NAME_BUF_LEN);
-                        }
-                        if (name->service[0]) {
-                            record->service = mdns_mem_malloc(MDNS_NAME_BUF_LEN);
-                            if (!record->service) {
-                                HOOK_MALLOC_FAILED;
-                                goto clear_rx_packet;
-                            }
-                            memcpy(record->service, name->service, MDNS_NAME_BUF_LEN);
-                        }
-                        if (name->proto[0]) {
-                            record->proto = mdns_mem_malloc(MDNS_NAME_BUF_LEN);
-                            if (!record->proto) {
-                                HOOK_MALLOC_FAILED;
-                                goto clear_rx_packet;
-                            }
-                            memcpy(record->proto, name->proto, MDNS_NAME_BUF_LEN);
+                        if (_mdns_strdup_check(&record->host, name->host)
+                                || _mdns_strdup_check(&record->service, name->service)
+                                || _mdns_strdup_check(&record->proto, name->proto)) {
+                            goto clear_rx_packet;
                         }
                     }
                 }
@@ -4019,7 +5798,7 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                         }
                     }
                 }
-                bool is_selfhosted = _mdns_name_is_selfhosted(name);
+                bool is_selfhosted = ours && _mdns_name_is_selfhosted(name);
                 if (!_mdns_parse_fqdn(data, data_ptr + MDNS_SRV_FQDN_OFFSET, name, len)) {
                     continue;//error
                 }
@@ -4032,7 +5811,7 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
 
                 if (browse_result) {
                     _mdns_browse_result_add_srv(browse_result, name->host, browse_result_instance, browse_result_service,
-                                                browse_result_proto, port, packet->tcpip_if, packet->ip_protocol, ttl, out_sync_browse);
+                                                browse_result_proto, port, packet->tcpip_if, packet->ip_protocol, ttl);
                 }
                 if (search_result) {
                     if (search_result->type == MDNS_TYPE_PTR) {
@@ -4045,7 +5824,9 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     }
                 } else if (ours) {
                     if (parsed_packet->questions && !parsed_packet->probe) {
-                        _mdns_remove_parsed_question(parsed_packet, type, service);
+                        if (ttl > (MDNS_ANSWER_SRV_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, type, service);
+                        }
                         continue;
                     } else if (parsed_packet->distributed) {
                         _mdns_remove_scheduled_answer(packet->tcpip_if, packet->ip_protocol, type, service);
@@ -4110,7 +5891,7 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                 if (browse_result) {
                     _mdns_result_txt_create(data_ptr, data_len, &txt, &txt_value_len, &txt_count);
                     _mdns_browse_result_add_txt(browse_result, browse_result_instance, browse_result_service, browse_result_proto,
-                                                txt, txt_value_len, txt_count, packet->tcpip_if, packet->ip_protocol, ttl, out_sync_browse);
+                                                txt, txt_value_len, txt_count, packet->tcpip_if, packet->ip_protocol, ttl);
                 }
                 if (search_result) {
                     if (search_result->type == MDNS_TYPE_PTR) {
@@ -4146,7 +5927,9 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     }
                 } else if (ours) {
                     if (parsed_packet->questions && !parsed_packet->probe && service) {
-                        _mdns_remove_parsed_question(parsed_packet, type, service);
+                        if (ttl > (MDNS_ANSWER_TXT_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, type, service);
+                        }
                         continue;
                     }
                     if (!_mdns_name_is_selfhosted(name)) {
@@ -4176,7 +5959,7 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                 ip6.type = ESP_IPADDR_TYPE_V6;
                 memcpy(ip6.u_addr.ip6.addr, data_ptr, MDNS_ANSWER_AAAA_SIZE);
                 if (browse_result) {
-                    _mdns_browse_result_add_ip(browse_result, name->host, &ip6, packet->tcpip_if, packet->ip_protocol, ttl, out_sync_browse);
+                    _mdns_browse_result_add_ip(browse_result, name->host, &ip6, packet->tcpip_if, packet->ip_protocol, ttl);
                 }
                 if (search_result) {
                     //check for more applicable searches (PTR & A/AAAA at the same time)
@@ -4186,7 +5969,9 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     }
                 } else if (ours) {
                     if (parsed_packet->questions && !parsed_packet->probe) {
-                        _mdns_remove_parsed_question(parsed_packet, type, NULL);
+                        if (ttl > (MDNS_ANSWER_AAAA_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, type, NULL);
+                        }
                         continue;
                     }
                     if (!_mdns_name_is_selfhosted(name)) {
@@ -4233,7 +6018,7 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                 ip.type = ESP_IPADDR_TYPE_V4;
                 memcpy(&(ip.u_addr.ip4.addr), data_ptr, 4);
                 if (browse_result) {
-                    _mdns_browse_result_add_ip(browse_result, name->host, &ip, packet->tcpip_if, packet->ip_protocol, ttl, out_sync_browse);
+                    _mdns_browse_result_add_ip(browse_result, name->host, &ip, packet->tcpip_if, packet->ip_protocol, ttl);
                 }
                 if (search_result) {
                     //check for more applicable searches (PTR & A/AAAA at the same time)
@@ -4243,7 +6028,9 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     }
                 } else if (ours) {
                     if (parsed_packet->questions && !parsed_packet->probe) {
-                        _mdns_remove_parsed_question(parsed_packet, type, NULL);
+                        if (ttl > (MDNS_ANSWER_A_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, type, NULL);
+                        }
                         continue;
                     }
                     if (!_mdns_name_is_selfhosted(name)) {
@@ -4286,69 +6073,55 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
 #endif /* CONFIG_LWIP_IPV4 */
         }
         //end while
+        _mdns_rx_unlock(&locked);
         if (parsed_packet->authoritative) {
             _mdns_search_finish_done();
         }
     }
 
-    if (!do_not_reply && _mdns_server->interfaces[packet->tcpip_if].pcbs[packet->ip_protocol].state > PCB_PROBE_3 && (parsed_packet->questions || parsed_packet->discovery)) {
-        _mdns_create_answer_from_parsed_packet(parsed_packet);
-    }
-    if (out_sync_browse) {
-#ifdef MDNS_ENABLE_DEBUG
-        _mdns_dbg_printf("Browse %s%s total result:", out_sync_browse->browse->service, out_sync_browse->browse->proto);
-        debug_printf_browse_result_all(out_sync_browse->browse->result);
-#endif // MDNS_ENABLE_DEBUG
-        if (out_sync_browse->sync_result) {
-#ifdef MDNS_ENABLE_DEBUG
-            _mdns_dbg_printf("Changed result:");
-            debug_printf_browse_result_all(out_sync_browse->sync_result->result);
-#endif // MDNS_ENABLE_DEBUG
-            _mdns_sync_browse_action(ACTION_BROWSE_SYNC, out_sync_browse);
-        } else {
-            mdns_mem_free(out_sync_browse);
+    if (!do_not_reply && (parsed_packet->questions || parsed_packet->discovery)) {
+        _mdns_rx_lock(&locked);
+        if (_mdns_server->interfaces[packet->tcpip_if].pcbs[packet->ip_protocol].state > PCB_PROBE_3) {
+            s_tx_in_arena = true;
+            _mdns_create_answer_from_parsed_packet(parsed_packet);
+            s_tx_in_arena = false;
         }
-        out_sync_browse = NULL;
+        _mdns_rx_unlock(&locked);
+    }
+    if (browse_changed) {
+        // notifies now without a coalescing window, else arms the timer for the window
+        _mdns_browse_flush_due();
     }
 
 clear_rx_packet:
-    while (parsed_packet->questions) {
-        mdns_parsed_question_t *question = parsed_packet->questions;
-        parsed_packet->questions = parsed_packet->questions->next;
-        if (question->host) {
-            mdns_mem_free(question->host);
-        }
-        if (question->service) {
-            mdns_mem_free(question->service);
-        }
-        if (question->proto) {
-            mdns_mem_free(question->proto);
-        }
-        if (question->domain) {
-            mdns_mem_free(question->domain);
-        }
-        mdns_mem_free(question);
-    }
-    while (parsed_packet->records) {
-        mdns_parsed_record_t *record = parsed_packet->records;
-        parsed_packet->records = parsed_packet->records->next;
-        if (record->host) {
-            mdns_mem_free(record->host);
-        }
-        if (record->service) {
-            mdns_mem_free(record->service);
-        }
-        if (record->proto) {
-            mdns_mem_free(record->proto);
-        }
-        record->next = NULL;
-        mdns_mem_free(record);
+    _mdns_rx_unlock(&locked);
+    _mdns_rx_arena_release();
+}
+
+/**
+ * @brief  main packet parser
+ *
+ * @param  packet       the packet
+ */
+void mdns_parse_packet(mdns_rx_packet_t *packet)
+{
+    const uint8_t *data = _mdns_get_packet_data(packet);
+    _mdns_labels_bind(data);
+    _mdns_parse_packet_data(packet, data, _mdns_get_packet_len(packet));
+    _mdns_labels_bind(NULL);
+}
+
+/**
+ * @brief  parses a received packet unless the pre-filter rules it out
+ */
+static void _mdns_handle_rx_packet(mdns_rx_packet_t *packet)
+{
+    MDNS_SERVICE_LOCK();
+    bool pass = _mdns_prefilter_pass(_mdns_get_packet_data(packet), _mdns_get_packet_len(packet));
+    MDNS_SERVICE_UNLOCK();
+    if (pass) {
+        mdns_parse_packet(packet);
     }
-    mdns_mem_free(parsed_packet);
-    mdns_mem_free(browse_result_instance);
-    mdns_mem_free(browse_result_service);
-    mdns_mem_free(browse_result_proto);
-    mdns_mem_free(out_sync_browse);
 }
 
 /**
@@ -4373,7 +6146,7 @@ void _mdns_disable_pcb(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
     _mdns_clean_netif_ptr(tcpip_if);
 
     if (mdns_is_netif_ready(tcpip_if, ip_protocol)) {
-        _mdns_clear_pcb_tx_queue_head(tcpip_if, ip_protocol);
+        _mdns_clear_pcb_tx_queue(tcpip_if, ip_protocol);
         mdns_pcb_deinit_local(tcpip_if, ip_protocol);
         mdns_if_t other_if = _mdns_get_other_if(tcpip_if);
         if (other_if != MDNS_MAX_INTERFACES && _mdns_server->interfaces[other_if].pcbs[ip_protocol].state == PCB_DUP) {
@@ -4385,11 +6158,157 @@ void _mdns_disable_pcb(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
 }
 
 #ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
-static inline char nibble_to_hex(int var)
+static void _mdns_reverse_name_add_label(mdns_reverse_name_t *reverse, const char *label, uint8_t len)
+{
+    reverse->data[reverse->len++] = len;
+    memcpy(reverse->data + reverse->len, label, len);
+    reverse->len += len;
+}
+
+/**
+ * @brief  Builds the reverse lookup name of an address
+ *
+ * @param  addr     the address in network order, 4 or 16 bytes
+ * @param  reverse  out: the name in wire format, with "arpa"
+ * @param  dotted   out: the name as the host list keeps it, without ".arpa"
+ */
+static void _mdns_reverse_name_build(const uint8_t *addr, size_t addr_len, mdns_reverse_name_t *reverse, char *dotted)
+{
+    static const char hex[] = "0123456789abcdef";
+    char label[3];
+
+    reverse->len = 0;
+    for (size_t i = addr_len; i-- > 0;) {
+        if (addr_len == 4) {
+            uint8_t len = 0;
+            if (addr[i] >= 100) {
+                label[len++] = '0' + addr[i] / 100;
+            }
+            if (addr[i] >= 10) {
+                label[len++] = '0' + addr[i] / 10 % 10;
+            }
+            label[len++] = '0' + addr[i] % 10;
+            _mdns_reverse_name_add_label(reverse, label, len);
+        } else {
+            _mdns_reverse_name_add_label(reverse, &hex[addr[i] & 0x0F], 1);
+            _mdns_reverse_name_add_label(reverse, &hex[addr[i] >> 4], 1);
+        }
+    }
+    if (addr_len == 4) {
+        _mdns_reverse_name_add_label(reverse, "in-addr", sizeof("in-addr") - 1);
+    } else {
+        _mdns_reverse_name_add_label(reverse, "ip6", sizeof("ip6") - 1);
+    }
+    // the dotted name is the wire name so far, with the label lengths read as dots
+    for (uint8_t pos = 0; pos < reverse->len; pos += 1 + reverse->data[pos]) {
+        if (pos) {
+            dotted[pos - 1] = '.';
+        }
+        memcpy(dotted + pos, reverse->data + pos + 1, reverse->data[pos]);
+    }
+    dotted[reverse->len - 1] = '\0';
+    _mdns_reverse_name_add_label(reverse, "arpa", sizeof("arpa") - 1);
+    reverse->data[reverse->len++] = 0;
+}
+
+/**
+ * @brief  Unregisters a reverse lookup name, with the answers queued and recently sent for it
+ */
+static void _mdns_reverse_host_remove(mdns_host_item_t *host)
+{
+    mdns_host_item_t **prev = &_mdns_host_list;
+    while (*prev != host) {
+        prev = &(*prev)->next;
+    }
+    *prev = host->next;
+    _mdns_remove_scheduled_host_answers(host);
+    _mdns_recent_answers_remove_host(host);
+    ESP_LOGD(TAG, "Unregistered reverse query: %s.arpa", host->hostname);
+    free_host_item(host);
+}
+
+/**
+ * @brief  Registers the reverse lookup name of the current address of an interface
+ *
+ * The name replaces the one registered for the previous address, and is
+ * unregistered while the interface has no address. Nothing is rebuilt while
+ * the address stays the same.
+ *
+ * @param  add  false to only follow an address change of a name requested before
+ */
+static void _mdns_reverse_host_update(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, bool add)
 {
-    return var > 9 ?  var - 10 + 'a' : var + '0';
+    mdns_pcb_t *pcb = &_mdns_server->interfaces[tcpip_if].pcbs[ip_protocol];
+    if (add) {
+        pcb->reverse_lookup = true;
+    }
+    if (!pcb->reverse_lookup) {
+        return;
+    }
+    mdns_host_item_t *old = _mdns_host_list;
+    while (old && !(old->reverse && old->reverse->tcpip_if == tcpip_if && old->reverse->ip_protocol == ip_protocol)) {
+        old = old->next;
+    }
+
+    uint8_t addr[16];
+    size_t addr_len = 0;
+#ifdef CONFIG_LWIP_IPV4
+    esp_netif_ip_info_t if_ip_info;
+    if (ip_protocol == MDNS_IP_PROTOCOL_V4 && !esp_netif_get_ip_info(_mdns_get_esp_netif(tcpip_if), &if_ip_info)
+            && if_ip_info.ip.addr) {
+        memcpy(addr, &if_ip_info.ip.addr, 4);
+        addr_len = 4;
+    }
+#endif /* CONFIG_LWIP_IPV4 */
+#ifdef CONFIG_LWIP_IPV6
+    esp_ip6_addr_t addr6;
+    if (ip_protocol == MDNS_IP_PROTOCOL_V6 && !esp_netif_get_ip6_linklocal(_mdns_get_esp_netif(tcpip_if), &addr6)
+            && !_ipv6_address_is_zero(addr6)) {
+        memcpy(addr, addr6.addr, 16);
+        addr_len = 16;
+    }
+#endif /* CONFIG_LWIP_IPV6 */
+    if (!addr_len) {
+        if (old) {
+            _mdns_reverse_host_remove(old);
+            _mdns_answer_cache_clear();
+            _mdns_prefilter_clear();
+            _mdns_index_clear();
+        }
+        return;
+    }
+
+    mdns_reverse_name_t reverse = { .tcpip_if = tcpip_if, .ip_protocol = ip_protocol };
+    char dotted[MDNS_REVERSE_NAME_MAX_LEN];
+    _mdns_reverse_name_build(addr, addr_len, &reverse, dotted);
+    if (old && old->reverse->len == reverse.len && !memcmp(old->reverse->data, reverse.data, reverse.len)) {
+        return;
+    }
+
+    char *hostname = mdns_mem_strdup(dotted);
+    mdns_reverse_name_t *copy = (mdns_reverse_name_t *)mdns_mem_malloc(sizeof(mdns_reverse_name_t));
+    if (!hostname || !copy) {
+        HOOK_MALLOC_FAILED;
+        mdns_mem_free(hostname);
+        mdns_mem_free(copy);
+        return;
+    }
+    memcpy(copy, &reverse, sizeof(reverse));
+    if (old) {
+        _mdns_reverse_host_remove(old);
+    }
+    if (_mdns_delegate_hostname_add(hostname, NULL)) {
+        _mdns_host_list->reverse = copy;
+        ESP_LOGD(TAG, "Registered reverse query: %s.arpa", hostname);
+    } else {
+        mdns_mem_free(hostname);
+        mdns_mem_free(copy);
+    }
+    _mdns_answer_cache_clear();
+    _mdns_prefilter_clear();
+    _mdns_index_clear();
 }
-#endif
+#endif /* CONFIG_MDNS_RESPOND_REVERSE_QUERIES */
 
 /**
  * @brief  Performs interface changes based on system events or custom commands
@@ -4419,46 +6338,13 @@ static void perform_event_action(mdns_if_t mdns_if, mdns_event_actions_t action)
     }
 
 #ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
-#ifdef CONFIG_LWIP_IPV4
-    if (action & MDNS_EVENT_IP4_REVERSE_LOOKUP) {
-        esp_netif_ip_info_t if_ip_info;
-        if (esp_netif_get_ip_info(_mdns_get_esp_netif(mdns_if), &if_ip_info) == ESP_OK) {
-            esp_ip4_addr_t *ip = &if_ip_info.ip;
-            char *reverse_query_name = NULL;
-            if (asprintf(&reverse_query_name, "%d.%d.%d.%d.in-addr",
-                         esp_ip4_addr4_16(ip), esp_ip4_addr3_16(ip),
-                         esp_ip4_addr2_16(ip), esp_ip4_addr1_16(ip)) > 0 && reverse_query_name) {
-                ESP_LOGD(TAG, "Registered reverse query: %s.arpa", reverse_query_name);
-                _mdns_delegate_hostname_add(reverse_query_name, NULL);
-            }
-        }
+    // the interface is (re)enabled when it gets an address and disabled when it loses it, the reverse lookup name follows it
+    if (action & (MDNS_EVENT_ENABLE_IP4 | MDNS_EVENT_DISABLE_IP4 | MDNS_EVENT_IP4_REVERSE_LOOKUP)) {
+        _mdns_reverse_host_update(mdns_if, MDNS_IP_PROTOCOL_V4, action & MDNS_EVENT_IP4_REVERSE_LOOKUP);
     }
-#endif /* CONFIG_LWIP_IPV4 */
-#ifdef CONFIG_LWIP_IPV6
-    if (action & MDNS_EVENT_IP6_REVERSE_LOOKUP) {
-        esp_ip6_addr_t addr6;
-        if (!esp_netif_get_ip6_linklocal(_mdns_get_esp_netif(mdns_if), &addr6) && !_ipv6_address_is_zero(addr6)) {
-            uint8_t *paddr = (uint8_t *)&addr6.addr;
-            const char sub[] = "ip6";
-            const size_t query_name_size = 4 * sizeof(addr6.addr) /* (2 nibbles + 2 dots)/per byte of IP address */ + sizeof(sub);
-            char *reverse_query_name = mdns_mem_malloc(query_name_size);
-            if (reverse_query_name) {
-                char *ptr = &reverse_query_name[query_name_size];   // point to the end
-                memcpy(ptr - sizeof(sub), sub, sizeof(sub));        // copy the IP sub-domain
-                ptr -= sizeof(sub) + 1;                             // move before the sub-domain
-                while (reverse_query_name < ptr) {                  // continue populating reverse query from the end
-                    *ptr-- = '.';                                   // nibble by nibble, until we reach the beginning
-                    *ptr-- = nibble_to_hex(((*paddr) >> 4) & 0x0F);
-                    *ptr-- = '.';
-                    *ptr-- = nibble_to_hex((*paddr) & 0x0F);
-                    paddr++;
-                }
-                ESP_LOGD(TAG, "Registered reverse query: %s.arpa", reverse_query_name);
-                _mdns_delegate_hostname_add(reverse_query_name, NULL);
-            }
-        }
+    if (action & (MDNS_EVENT_ENABLE_IP6 | MDNS_EVENT_DISABLE_IP6 | MDNS_EVENT_IP6_REVERSE_LOOKUP)) {
+        _mdns_reverse_host_update(mdns_if, MDNS_IP_PROTOCOL_V6, action & MDNS_EVENT_IP6_REVERSE_LOOKUP);
     }
-#endif /* CONFIG_LWIP_IPV6 */
 #endif /* CONFIG_MDNS_RESPOND_REVERSE_QUERIES */
 }
 
@@ -4634,6 +6520,7 @@ static mdns_search_once_t *_mdns_search_init(const char *name, const char *servi
     search->result = NULL;
     search->state = SEARCH_INIT;
     search->sent_at = 0;
+    search->interval = MDNS_SEARCH_INTERVAL_MS;
     search->started_at = xTaskGetTickCount() * portTICK_PERIOD_MS;
     search->notifier = notifier;
     search->next = NULL;
@@ -4646,25 +6533,200 @@ static mdns_search_once_t *_mdns_search_init(const char *name, const char *servi
  */
 static void _mdns_search_finish(mdns_search_once_t *search)
 {
+    MDNS_SEARCH_LOCK();
     search->state = SEARCH_OFF;
     queueDetach(mdns_search_once_t, _mdns_server->search_once, search);
+    MDNS_SEARCH_UNLOCK();
+    _mdns_timer_update();
     if (search->notifier) {
         search->notifier(search);
     }
     xSemaphoreGive(search->done_semaphore);
 }
 
+#if CONFIG_MDNS_PASSIVE_CACHE
+static int _mdns_cache_type_order(uint16_t type)
+{
+    switch (type) {
+    case MDNS_TYPE_PTR:
+        return 0;
+    case MDNS_TYPE_SRV:
+        return 1;
+    case MDNS_TYPE_TXT:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+/**
+ * @brief  marks the cached records of one interface that answer the search
+ *
+ * Addresses are taken if they belong to the name searched for or to the
+ * target of a selected SRV record.
+ *
+ * @return size of the records on the wire, 0 if there are none
+ */
+static size_t _mdns_cache_select(mdns_search_once_t *search, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint32_t now)
+{
+    static mdns_name_t name;
+    size_t size = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        mdns_cache_entry_t *e = s_cache.head;
+        while (e) {
+            mdns_cache_entry_t *next = e->next;
+            bool address = e->type == MDNS_TYPE_A || e->type == MDNS_TYPE_AAAA;
+            if (_mdns_cache_expired(e, now)) {
+                _mdns_cache_remove(e);
+                e = next;
+                continue;
+            }
+            if (pass == 0) {
+                e->replay = 0;
+            }
+            if (e->tcpip_if != tcpip_if || e->ip_protocol != ip_protocol || address != (pass == 1)
+                    || !_mdns_parse_fqdn(e->data, e->data, &name, e->name_len) || name.invalid
+                    || (!name.sub && _mdns_name_is_ours(&name))) {
+                e = next;
+                continue;
+            }
+            e->replay = _mdns_search_find_from(search, &name, e->type, tcpip_if, ip_protocol) == search;
+            for (mdns_cache_entry_t *srv = s_cache.head; address && !e->replay && srv; srv = srv->next) {
+                e->replay = srv->replay && srv->type == MDNS_TYPE_SRV
+                            && _mdns_cache_name_eq(srv->data + srv->name_len + MDNS_SRV_FQDN_OFFSET,
+                                                   srv->rdata_len - MDNS_SRV_FQDN_OFFSET, e->data, e->name_len);
+            }
+            if (e->replay) {
+                size += e->name_len + MDNS_DATA_OFFSET + e->rdata_len;
+            }
+            e = next;
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief  feeds the cached records that answer a new search to the parser
+ *
+ * The records are replayed as a response received on their interface, in the
+ * order PTR, SRV, TXT, addresses, with the TTL left. Only the new search is
+ * visible to the parser meanwhile, so other searches and browses are not
+ * affected.
+ *
+ * @return true if the search got all its results
+ */
+static bool _mdns_cache_answer(mdns_search_once_t *search)
+{
+    mdns_search_once_t *searches = _mdns_server->search_once;
+    mdns_browse_t *browses = _mdns_server->browse;
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    uint32_t refresh = 0;   // bit per interface and protocol
+
+    if (!s_cache.head) {
+        return false;
+    }
+    MDNS_SEARCH_LOCK();
+    search->next = NULL;
+    _mdns_server->search_once = search;
+    MDNS_SEARCH_UNLOCK();
+    _mdns_server->browse = NULL;
+    s_cache.replaying = true;
+    for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        for (int j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
+            size_t size = _mdns_cache_select(search, i, j, now);
+            if (!size) {
+                continue;
+            }
+            uint8_t *data = (uint8_t *)mdns_mem_malloc(MDNS_HEAD_LEN + size);
+            if (!data) {
+                HOOK_MALLOC_FAILED;
+                continue;
+            }
+            uint8_t *record = data + MDNS_HEAD_LEN;
+            uint16_t count = 0;
+            memset(data, 0, MDNS_HEAD_LEN);
+            _mdns_set_u16(data, MDNS_HEAD_FLAGS_OFFSET, MDNS_FLAGS_QUERY_REPSONSE);
+            for (int order = 0; order < 4; order++) {
+                for (mdns_cache_entry_t *e = s_cache.head; e; e = e->next) {
+                    if (!e->replay || _mdns_cache_type_order(e->type) != order) {
+                        continue;
+                    }
+                    uint32_t age = _mdns_cache_age(e, now);
+                    if (!e->refreshed && age >= e->ttl * 10 * MDNS_CACHE_REFRESH_PERCENT) {
+                        e->refreshed = 1;
+                        refresh |= 1 << (i * MDNS_IP_PROTOCOL_MAX + j);
+                    }
+                    uint32_t ttl = e->ttl - age / 1000;
+                    memcpy(record, e->data, e->name_len);
+                    record += e->name_len;
+                    _mdns_set_u16(record, MDNS_TYPE_OFFSET, e->type);
+                    _mdns_set_u16(record, MDNS_CLASS_OFFSET, 0x0001);
+                    _mdns_set_u16(record, MDNS_TTL_OFFSET, ttl >> 16);
+                    _mdns_set_u16(record, MDNS_TTL_OFFSET + 2, ttl & 0xFFFF);
+                    _mdns_set_u16(record, MDNS_LEN_OFFSET, e->rdata_len);
+                    memcpy(record + MDNS_DATA_OFFSET, e->data + e->name_len, e->rdata_len);
+                    record += MDNS_DATA_OFFSET + e->rdata_len;
+                    count++;
+                }
+            }
+            _mdns_set_u16(data, MDNS_HEAD_ANSWERS_OFFSET, count);
+
+            mdns_rx_packet_t packet = {
+                .tcpip_if = i,
+                .ip_protocol = j,
+                .src_port = MDNS_SERVICE_PORT,
+                .multicast = 1,
+            };
+            _mdns_parse_packet_data(&packet, data, record - data);
+            mdns_mem_free(data);
+        }
+    }
+    s_cache.replaying = false;
+    MDNS_SEARCH_LOCK();
+    _mdns_server->search_once = searches;
+    MDNS_SEARCH_UNLOCK();
+    _mdns_server->browse = browses;
+
+    bool done = search->max_results && search->num_results >= search->max_results;
+#if CONFIG_MDNS_PASSIVE_CACHE_REFRESH
+    if (done && refresh) {
+        MDNS_SERVICE_LOCK();
+        for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+            for (int j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
+                if (refresh & (1 << (i * MDNS_IP_PROTOCOL_MAX + j))) {
+                    _mdns_search_send_pcb(search, i, j);
+                }
+            }
+        }
+        MDNS_SERVICE_UNLOCK();
+    }
+#endif
+    return done;
+}
+#endif /* CONFIG_MDNS_PASSIVE_CACHE */
+
 /**
- * @brief  Add new search to the search chain
+ * @brief  Add new search to the search chain, called without the service lock
  */
 static void _mdns_search_add(mdns_search_once_t *search)
 {
+#if CONFIG_MDNS_PASSIVE_CACHE
+    if (_mdns_cache_answer(search)) {
+        _mdns_search_finish(search);
+        return;
+    }
+#endif
+    MDNS_SEARCH_LOCK();
     search->next = _mdns_server->search_once;
     _mdns_server->search_once = search;
+    MDNS_SEARCH_UNLOCK();
+    _mdns_timer_update();
 }
 
 /**
  * @brief  Called from parser to finish any searches that have reached maximum results
+ *         or got the complete answer of a unique record
  */
 static void _mdns_search_finish_done(void)
 {
@@ -4673,7 +6735,7 @@ static void _mdns_search_finish_done(void)
     while (search) {
         s = search;
         search = search->next;
-        if (s->max_results && s->num_results >= s->max_results) {
+        if ((s->max_results && s->num_results >= s->max_results) || (s->answered && s->num_results)) {
             _mdns_search_finish(s);
         }
     }
@@ -5016,7 +7078,6 @@ static mdns_tx_packet_t *_mdns_create_search_packet(mdns_search_once_t *search,
     q->service = search->service;
     q->proto = search->proto;
     q->domain = MDNS_DEFAULT_DOMAIN;
-    q->own_dynamic_memory = false;
     queueToEnd(mdns_out_question_t, packet->questions, q);
 
     if (search->type == MDNS_TYPE_PTR) {
@@ -5105,6 +7166,10 @@ static void _mdns_tx_handle_packet(mdns_tx_packet_t *p)
         _mdns_free_tx_packet(p);
         return;
     }
+    if (p->aggregate) {
+        _mdns_recent_answers_add(p);
+        p->aggregate = 0;
+    }
     _mdns_dispatch_tx_packet(p);
 
     switch (pcb->state) {
@@ -5165,16 +7230,16 @@ static void _mdns_remap_self_service_hostname(const char *old_hostname, const ch
     }
 }
 
-static void _mdns_sync_browse_result_link_free(mdns_browse_sync_t *browse_sync)
+static void _mdns_browse_pending_free(mdns_browse_t *browse)
 {
-    mdns_browse_result_sync_t *current = browse_sync->sync_result;
+    mdns_browse_result_sync_t *current = browse->pending;
     mdns_browse_result_sync_t *need_free;
     while (current) {
         need_free = current;
         current = current->next;
         mdns_mem_free(need_free);
     }
-    mdns_mem_free(browse_sync);
+    browse->pending = NULL;
 }
 
 /**
@@ -5201,12 +7266,6 @@ static void _mdns_free_action(mdns_action_t *action)
     case ACTION_BROWSE_END:
         _mdns_browse_item_free(action->data.browse_add.browse);
         break;
-    case ACTION_BROWSE_SYNC:
-        _mdns_sync_browse_result_link_free(action->data.browse_sync.browse_sync);
-        break;
-    case ACTION_TX_HANDLE:
-        _mdns_free_tx_packet(action->data.tx_handle.packet);
-        break;
     case ACTION_RX_HANDLE:
         _mdns_packet_free(action->data.rx_handle.packet);
         break;
@@ -5221,7 +7280,6 @@ static void _mdns_free_action(mdns_action_t *action)
     default:
         break;
     }
-    mdns_mem_free(action);
 }
 
 /**
@@ -5232,6 +7290,7 @@ static void _mdns_execute_action(mdns_action_t *action)
     switch (action->type) {
     case ACTION_SYSTEM_EVENT:
         perform_event_action(action->data.sys_event.interface, action->data.sys_event.event_action);
+        _mdns_answer_cache_clear();
         break;
     case ACTION_HOSTNAME_SET:
         _mdns_send_bye_all_pcbs_no_instance(true);
@@ -5262,28 +7321,27 @@ static void _mdns_execute_action(mdns_action_t *action)
     case ACTION_BROWSE_ADD:
         _mdns_browse_add(action->data.browse_add.browse);
         break;
-    case ACTION_BROWSE_SYNC:
-        _mdns_browse_sync(action->data.browse_sync.browse_sync);
-        _mdns_sync_browse_result_link_free(action->data.browse_sync.browse_sync);
+    case ACTION_BROWSE_FLUSH:
+        atomic_store(&_mdns_server->browse_flush_pending, false);
+        _mdns_browse_flush_due();
         break;
     case ACTION_BROWSE_END:
         _mdns_browse_finish(action->data.browse_add.browse);
         break;
 
     case ACTION_TX_HANDLE: {
-        mdns_tx_packet_t *p = _mdns_server->tx_queue_head;
-        // packet to be handled should be at tx head, but must be consistent with the one pushed to action queue
-        if (p && p == action->data.tx_handle.packet && p->queued) {
-            p->queued = false; // clearing, as the packet might be reused (pushed and transmitted again)
-            _mdns_server->tx_queue_head = p->next;
-            _mdns_tx_handle_packet(p);
-        } else {
-            ESP_LOGD(TAG, "Skipping transmit of an unexpected packet!");
+        // send everything that is due in one go, packets rescheduled meanwhile are in the future
+        uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        atomic_store(&_mdns_server->tx_pending, false);
+        while (_mdns_server->tx_queue_len && (int32_t)(_mdns_server->tx_queue[0]->send_at - now) < 0) {
+            _mdns_tx_handle_packet(_mdns_tx_queue_pop());
         }
+        // the timer leaves the packets to us while the action is in flight
+        _mdns_timer_update();
     }
     break;
     case ACTION_RX_HANDLE:
-        mdns_parse_packet(action->data.rx_handle.packet);
+        _mdns_handle_rx_packet(action->data.rx_handle.packet);
         _mdns_packet_free(action->data.rx_handle.packet);
         break;
     case ACTION_DELEGATE_HOSTNAME_ADD:
@@ -5292,6 +7350,9 @@ static void _mdns_execute_action(mdns_action_t *action)
             mdns_mem_free((char *)action->data.delegate_hostname.hostname);
             free_address_list(action->data.delegate_hostname.address_list);
         }
+        _mdns_answer_cache_clear();
+        _mdns_prefilter_clear();
+        _mdns_index_clear();
         xSemaphoreGive(_mdns_server->action_sema);
         break;
     case ACTION_DELEGATE_HOSTNAME_SET_ADDR:
@@ -5300,15 +7361,17 @@ static void _mdns_execute_action(mdns_action_t *action)
             free_address_list(action->data.delegate_hostname.address_list);
         }
         mdns_mem_free((char *)action->data.delegate_hostname.hostname);
+        _mdns_answer_cache_clear();
         break;
     case ACTION_DELEGATE_HOSTNAME_REMOVE:
         _mdns_delegate_hostname_remove(action->data.delegate_hostname.hostname);
         mdns_mem_free((char *)action->data.delegate_hostname.hostname);
+        _mdns_answer_cache_clear();
+        _mdns_index_clear();
         break;
     default:
         break;
     }
-    mdns_mem_free(action);
 }
 
 /**
@@ -5316,62 +7379,50 @@ static void _mdns_execute_action(mdns_action_t *action)
  */
 static esp_err_t _mdns_send_search_action(mdns_action_type_t type, mdns_search_once_t *search)
 {
-    mdns_action_t *action = NULL;
-
-    action = (mdns_action_t *)mdns_mem_malloc(sizeof(mdns_action_t));
-    if (!action) {
-        HOOK_MALLOC_FAILED;
-        return ESP_ERR_NO_MEM;
-    }
-
-    action->type = type;
-    action->data.search_add.search = search;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
-        mdns_mem_free(action);
-        return ESP_ERR_NO_MEM;
-    }
-    return ESP_OK;
+    mdns_action_t action = { .type = type };
+    action.data.search_add.search = search;
+    return _mdns_send_action(&action);
 }
 
 /**
  * @brief  Called from timer task to run mDNS responder
  *
- * periodically checks first unqueued packet (from tx head).
- * if it is scheduled to be transmitted, then pushes the packet to action queue to be handled.
+ * checks the earliest deadline published by the service task and if it is due, posts
+ * the tx action so that the service task transmits all due packets. Runs without the
+ * service lock: a stale deadline only posts an action that sends nothing, or delays
+ * the packets by one tick.
  *
  */
 static void _mdns_scheduler_run(void)
 {
-    MDNS_SERVICE_LOCK();
-    mdns_tx_packet_t *p = _mdns_server->tx_queue_head;
-    mdns_action_t *action = NULL;
+    // a single action hands all due packets to the service task
+    mdns_action_t action = { .type = ACTION_TX_HANDLE };
 
-    // find first unqueued packet
-    while (p && p->queued) {
-        p = p->next;
+    if (!atomic_load(&_mdns_server->tx_scheduled)
+            || (int32_t)(atomic_load(&_mdns_server->tx_next_at) - (xTaskGetTickCount() * portTICK_PERIOD_MS)) >= 0) {
+        return;
     }
-    if (!p) {
-        MDNS_SERVICE_UNLOCK();
+    // claimed before posting, the service task clears it when the action runs
+    if (!atomic_exchange(&_mdns_server->tx_pending, true) && _mdns_send_action(&action) != ESP_OK) {
+        atomic_store(&_mdns_server->tx_pending, false);
+    }
+}
+
+/**
+ * @brief  Called from timer task to notify browse changes whose coalescing window has closed
+ */
+static void _mdns_browse_run(void)
+{
+    mdns_action_t action = { .type = ACTION_BROWSE_FLUSH };
+
+    if (!atomic_load(&_mdns_server->browse_scheduled)
+            || (int32_t)(atomic_load(&_mdns_server->browse_flush_at) - (xTaskGetTickCount() * portTICK_PERIOD_MS)) > 0) {
         return;
     }
-    while (p && (int32_t)(p->send_at - (xTaskGetTickCount() * portTICK_PERIOD_MS)) < 0) {
-        action = (mdns_action_t *)mdns_mem_malloc(sizeof(mdns_action_t));
-        if (action) {
-            action->type = ACTION_TX_HANDLE;
-            action->data.tx_handle.packet = p;
-            p->queued = true;
-            if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
-                mdns_mem_free(action);
-                p->queued = false;
-            }
-        } else {
-            HOOK_MALLOC_FAILED;
-            break;
-        }
-        //Find the next unqued packet
-        p = p->next;
+    // claimed before posting, the service task clears it when the action runs
+    if (!atomic_exchange(&_mdns_server->browse_flush_pending, true) && _mdns_send_action(&action) != ESP_OK) {
+        atomic_store(&_mdns_server->browse_flush_pending, false);
     }
-    MDNS_SERVICE_UNLOCK();
 }
 
 /**
@@ -5379,11 +7430,11 @@ static void _mdns_scheduler_run(void)
  */
 static void _mdns_search_run(void)
 {
-    MDNS_SERVICE_LOCK();
+    MDNS_SEARCH_LOCK();
     mdns_search_once_t *s = _mdns_server->search_once;
     uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
     if (!s) {
-        MDNS_SERVICE_UNLOCK();
+        MDNS_SEARCH_UNLOCK();
         return;
     }
     while (s) {
@@ -5393,17 +7444,32 @@ static void _mdns_search_run(void)
                 if (_mdns_send_search_action(ACTION_SEARCH_END, s) != ESP_OK) {
                     s->state = SEARCH_RUNNING;
                 }
-            } else if (s->state == SEARCH_INIT || (now - s->sent_at) > 1000) {
+            } else if (s->state == SEARCH_INIT || (now - s->sent_at) > s->interval) {
+                bool first = s->state == SEARCH_INIT;
                 s->state = SEARCH_RUNNING;
                 s->sent_at = now;
                 if (_mdns_send_search_action(ACTION_SEARCH_SEND, s) != ESP_OK) {
-                    s->sent_at -= 1000;
+                    s->sent_at -= s->interval;
+                } else if (!first && s->interval < MDNS_SEARCH_INTERVAL_MAX_MS) {
+                    s->interval *= 2;   // queries at 0, 1, 3, 7... seconds
                 }
             }
         }
         s = s->next;
     }
-    MDNS_SERVICE_UNLOCK();
+    MDNS_SEARCH_UNLOCK();
+}
+
+/**
+ * @brief  whether an action takes the service lock only where it touches the registry, the PCBs or the TX queue
+ *
+ * Parsing a packet, adding a search (which may replay cached records through the
+ * parser) and notifying browse results spend most of their time on state that only
+ * the service task touches, and may call back into the application.
+ */
+static bool _mdns_action_locks_itself(mdns_action_type_t type)
+{
+    return type == ACTION_RX_HANDLE || type == ACTION_SEARCH_ADD || type == ACTION_BROWSE_FLUSH;
 }
 
 /**
@@ -5411,17 +7477,25 @@ static void _mdns_search_run(void)
  */
 static void _mdns_service_task(void *pvParameters)
 {
-    mdns_action_t *a = NULL;
+    mdns_action_t a;
     for (;;) {
         if (_mdns_server && _mdns_server->action_queue) {
             if (xQueueReceive(_mdns_server->action_queue, &a, portMAX_DELAY) == pdTRUE) {
-                assert(a);
-                if (a->type == ACTION_TASK_STOP) {
+                if (a.type == ACTION_TASK_STOP) {
                     break;
                 }
-                MDNS_SERVICE_LOCK();
-                _mdns_execute_action(a);
-                MDNS_SERVICE_UNLOCK();
+                atomic_fetch_sub(&s_action_stats.pending, 1);
+                mdns_action_type_t type = a.type;
+                bool locked = !_mdns_action_locks_itself(type);
+                if (locked) {
+                    MDNS_SERVICE_LOCK();
+                }
+                TRACE_BEGIN(TRACE_EV_MDNS_ACTION, type);
+                _mdns_execute_action(&a);
+                TRACE_END(TRACE_EV_MDNS_ACTION, type);
+                if (locked) {
+                    MDNS_SERVICE_UNLOCK();
+                }
             }
         } else {
             vTaskDelay(500 * portTICK_PERIOD_MS);
@@ -5434,7 +7508,10 @@ static void _mdns_service_task(void *pvParameters)
 static void _mdns_timer_cb(void *arg)
 {
     _mdns_scheduler_run();
+    _mdns_browse_run();
     _mdns_search_run();
+    // sleeps until the next deadline, or for good when there is none
+    _mdns_timer_arm(true);
 }
 
 static esp_err_t _mdns_start_timer(void)
@@ -5445,22 +7522,22 @@ static esp_err_t _mdns_start_timer(void)
         .dispatch_method = ESP_TIMER_TASK,
         .name = "mdns_timer"
     };
-    esp_err_t err = esp_timer_create(&timer_conf, &(_mdns_server->timer_handle));
-    if (err) {
-        return err;
-    }
-    return esp_timer_start_periodic(_mdns_server->timer_handle, MDNS_TIMER_PERIOD_US);
+    // armed by _mdns_timer_update() once something is scheduled
+    return esp_timer_create(&timer_conf, &(_mdns_server->timer_handle));
 }
 
 static esp_err_t _mdns_stop_timer(void)
 {
     esp_err_t err = ESP_OK;
     if (_mdns_server->timer_handle) {
-        err = esp_timer_stop(_mdns_server->timer_handle);
-        if (err) {
-            return err;
+        if (esp_timer_is_active(_mdns_server->timer_handle)) {
+            err = esp_timer_stop(_mdns_server->timer_handle);
+            if (err) {
+                return err;
+            }
         }
         err = esp_timer_delete(_mdns_server->timer_handle);
+        _mdns_server->timer_handle = NULL;
     }
     return err;
 }
@@ -5497,6 +7574,10 @@ static esp_err_t _mdns_service_task_start(void)
         _mdns_service_semaphore = xSemaphoreCreateMutex();
         ESP_RETURN_ON_FALSE(_mdns_service_semaphore != NULL, ESP_FAIL, TAG, "Failed to create the mDNS service lock");
     }
+    if (!_mdns_search_semaphore) {
+        _mdns_search_semaphore = xSemaphoreCreateMutex();
+        ESP_GOTO_ON_FALSE(_mdns_search_semaphore != NULL, ESP_FAIL, err_no_lock, TAG, "Failed to create the mDNS search lock");
+    }
     MDNS_SERVICE_LOCK();
     ESP_GOTO_ON_ERROR(_mdns_start_timer(), err, TAG, "Failed to start the mDNS service timer");
 
@@ -5518,6 +7599,9 @@ err_stop_timer:
     _mdns_stop_timer();
 err:
     MDNS_SERVICE_UNLOCK();
+    vSemaphoreDelete(_mdns_search_semaphore);
+    _mdns_search_semaphore = NULL;
+err_no_lock:
     vSemaphoreDelete(_mdns_service_semaphore);
     _mdns_service_semaphore = NULL;
     return ret;
@@ -5534,10 +7618,8 @@ static esp_err_t _mdns_service_task_stop(void)
     _mdns_stop_timer();
     if (_mdns_service_task_handle) {
         TaskHandle_t task_handle = _mdns_service_task_handle;
-        mdns_action_t action;
-        mdns_action_t *a = &action;
-        action.type = ACTION_TASK_STOP;
-        if (xQueueSend(_mdns_server->action_queue, &a, (TickType_t)0) != pdPASS) {
+        mdns_action_t action = { .type = ACTION_TASK_STOP };
+        if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
             _mdns_service_task_handle = NULL;
         }
         while (_mdns_service_task_handle) {
@@ -5545,6 +7627,8 @@ static esp_err_t _mdns_service_task_stop(void)
         }
         vTaskDelete(task_handle);
     }
+    vSemaphoreDelete(_mdns_search_semaphore);
+    _mdns_search_semaphore = NULL;
     vSemaphoreDelete(_mdns_service_semaphore);
     _mdns_service_semaphore = NULL;
     return ESP_OK;
@@ -5556,18 +7640,11 @@ static esp_err_t mdns_post_custom_action_tcpip_if(mdns_if_t mdns_if, mdns_event_
         return ESP_ERR_INVALID_STATE;
     }
 
-    mdns_action_t *action = (mdns_action_t *)mdns_mem_calloc(1, sizeof(mdns_action_t));
-    if (!action) {
-        HOOK_MALLOC_FAILED;
-        return ESP_ERR_NO_MEM;
-    }
-    action->type = ACTION_SYSTEM_EVENT;
-    action->data.sys_event.event_action = event_action;
-    action->data.sys_event.interface = mdns_if;
+    mdns_action_t action = { .type = ACTION_SYSTEM_EVENT };
+    action.data.sys_event.event_action = event_action;
+    action.data.sys_event.interface = mdns_if;
 
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
-        mdns_mem_free(action);
-    }
+    _mdns_send_action(&action);
     return ESP_OK;
 }
 
@@ -5676,11 +7753,14 @@ esp_err_t mdns_init(void)
         s_esp_netifs[i].netif = NULL;
     }
 
-    _mdns_server->action_queue = xQueueCreate(MDNS_ACTION_QUEUE_LEN, sizeof(mdns_action_t *));
+    _mdns_server->action_queue = xQueueCreate(MDNS_ACTION_QUEUE_LEN, sizeof(mdns_action_t));
     if (!_mdns_server->action_queue) {
         err = ESP_ERR_NO_MEM;
         goto free_server;
     }
+    atomic_store(&s_action_stats.pending, 0);
+    atomic_store(&s_action_stats.high_water, 0);
+    atomic_store(&s_action_stats.dropped, 0);
 
     _mdns_server->action_sema = xSemaphoreCreateBinary();
     if (!_mdns_server->action_sema) {
@@ -5734,6 +7814,7 @@ esp_err_t mdns_init(void)
         goto free_all_and_disable_pcbs;
     }
 
+    atomic_store(&s_action_stats.running, true);
     return ESP_OK;
 
 free_all_and_disable_pcbs:
@@ -5761,6 +7842,7 @@ void mdns_free(void)
     if (!_mdns_server) {
         return;
     }
+    atomic_store(&s_action_stats.running, false);
 
     // Unregister handlers before destroying the mdns internals to avoid receiving async events while deinit
     unregister_predefined_handlers();
@@ -5778,13 +7860,21 @@ void mdns_free(void)
     mdns_mem_free((char *)_mdns_server->hostname);
     mdns_mem_free((char *)_mdns_server->instance);
     if (_mdns_server->action_queue) {
-        mdns_action_t *c;
+        mdns_action_t c;
         while (xQueueReceive(_mdns_server->action_queue, &c, 0) == pdTRUE) {
-            _mdns_free_action(c);
+            _mdns_free_action(&c);
         }
         vQueueDelete(_mdns_server->action_queue);
     }
-    _mdns_clear_tx_queue_head();
+    _mdns_clear_tx_queue();
+    mdns_mem_free(_mdns_server->tx_queue);
+    _mdns_answer_cache_clear();
+    _mdns_prefilter_clear();
+    _mdns_index_clear();
+    _mdns_recent_answers_clear();
+#if CONFIG_MDNS_PASSIVE_CACHE
+    _mdns_cache_clear(MDNS_MAX_INTERFACES, MDNS_IP_PROTOCOL_V4);
+#endif
     while (_mdns_server->search_once) {
         mdns_search_once_t *h = _mdns_server->search_once;
         _mdns_server->search_once = h->next;
@@ -5821,19 +7911,12 @@ esp_err_t mdns_hostname_set(const char *hostname)
         return ESP_ERR_NO_MEM;
     }
 
-    mdns_action_t *action = (mdns_action_t *)mdns_mem_malloc(sizeof(mdns_action_t));
-    if (!action) {
-        HOOK_MALLOC_FAILED;
+    mdns_action_t action = { .type = ACTION_HOSTNAME_SET };
+    action.data.hostname_set.hostname = new_hostname;
+    if (_mdns_send_action(&action) != ESP_OK) {
         mdns_mem_free(new_hostname);
         return ESP_ERR_NO_MEM;
     }
-    action->type = ACTION_HOSTNAME_SET;
-    action->data.hostname_set.hostname = new_hostname;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
-        mdns_mem_free(new_hostname);
-        mdns_mem_free(action);
-        return ESP_ERR_NO_MEM;
-    }
     xSemaphoreTake(_mdns_server->action_sema, portMAX_DELAY);
     return ESP_OK;
 }
@@ -5869,18 +7952,12 @@ esp_err_t mdns_delegate_hostname_add(const char *hostname, const mdns_ip_addr_t
         return ESP_ERR_NO_MEM;
     }
 
-    mdns_action_t *action = (mdns_action_t *)mdns_mem_malloc(sizeof(mdns_action_t));
-    if (!action) {
-        HOOK_MALLOC_FAILED;
+    mdns_action_t action = { .type = ACTION_DELEGATE_HOSTNAME_ADD };
+    action.data.delegate_hostname.hostname = new_hostname;
+    action.data.delegate_hostname.address_list = copy_address_list(address_list);
+    if (_mdns_send_action(&action) != ESP_OK) {
         mdns_mem_free(new_hostname);
-        return ESP_ERR_NO_MEM;
-    }
-    action->type = ACTION_DELEGATE_HOSTNAME_ADD;
-    action->data.delegate_hostname.hostname = new_hostname;
-    action->data.delegate_hostname.address_list = copy_address_list(address_list);
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
-        mdns_mem_free(new_hostname);
-        mdns_mem_free(action);
+        free_address_list(action.data.delegate_hostname.address_list);
         return ESP_ERR_NO_MEM;
     }
     xSemaphoreTake(_mdns_server->action_sema, portMAX_DELAY);
@@ -5900,19 +7977,12 @@ esp_err_t mdns_delegate_hostname_remove(const char *hostname)
         return ESP_ERR_NO_MEM;
     }
 
-    mdns_action_t *action = (mdns_action_t *)mdns_mem_malloc(sizeof(mdns_action_t));
-    if (!action) {
-        HOOK_MALLOC_FAILED;
+    mdns_action_t action = { .type = ACTION_DELEGATE_HOSTNAME_REMOVE };
+    action.data.delegate_hostname.hostname = new_hostname;
+    if (_mdns_send_action(&action) != ESP_OK) {
         mdns_mem_free(new_hostname);
         return ESP_ERR_NO_MEM;
     }
-    action->type = ACTION_DELEGATE_HOSTNAME_REMOVE;
-    action->data.delegate_hostname.hostname = new_hostname;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
-        mdns_mem_free(new_hostname);
-        mdns_mem_free(action);
-        return ESP_ERR_NO_MEM;
-    }
     return ESP_OK;
 }
 
@@ -5929,21 +7999,53 @@ esp_err_t mdns_delegate_hostname_set_address(const char *hostname, const mdns_ip
         return ESP_ERR_NO_MEM;
     }
 
-    mdns_action_t *action = (mdns_action_t *)mdns_mem_malloc(sizeof(mdns_action_t));
-    if (!action) {
-        HOOK_MALLOC_FAILED;
+    mdns_action_t action = { .type = ACTION_DELEGATE_HOSTNAME_SET_ADDR };
+    action.data.delegate_hostname.hostname = new_hostname;
+    action.data.delegate_hostname.address_list = copy_address_list(address_list);
+    if (_mdns_send_action(&action) != ESP_OK) {
         mdns_mem_free(new_hostname);
+        free_address_list(action.data.delegate_hostname.address_list);
         return ESP_ERR_NO_MEM;
     }
-    action->type = ACTION_DELEGATE_HOSTNAME_SET_ADDR;
-    action->data.delegate_hostname.hostname = new_hostname;
-    action->data.delegate_hostname.address_list = copy_address_list(address_list);
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
-        mdns_mem_free(new_hostname);
-        mdns_mem_free(action);
-        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+esp_err_t mdns_get_action_queue_stats(mdns_action_queue_stats_t *stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!atomic_load(&s_action_stats.running)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    stats->capacity = MDNS_ACTION_QUEUE_LEN;
+    stats->pending = atomic_load(&s_action_stats.pending);
+    stats->high_water = atomic_load(&s_action_stats.high_water);
+    stats->dropped = atomic_load(&s_action_stats.dropped);
+    return ESP_OK;
+}
+
+esp_err_t mdns_get_lock_stats(mdns_lock_t lock, mdns_lock_stats_t *stats, bool reset)
+{
+#if CONFIG_MDNS_LOCK_STATS
+    if (!stats || lock < 0 || lock >= MDNS_LOCK_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    SemaphoreHandle_t sem = lock == MDNS_LOCK_SERVICE ? _mdns_service_semaphore : _mdns_search_semaphore;
+    if (!sem) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // taken directly, so that reading does not count
+    xSemaphoreTake(sem, portMAX_DELAY);
+    *stats = s_lock_stats[lock].stats;
+    if (reset) {
+        memset(&s_lock_stats[lock].stats, 0, sizeof(mdns_lock_stats_t));
     }
+    xSemaphoreGive(sem);
     return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
 }
 
 bool mdns_hostname_exists(const char *hostname)
@@ -5968,17 +8070,10 @@ esp_err_t mdns_instance_name_set(const char *instance)
         return ESP_ERR_NO_MEM;
     }
 
-    mdns_action_t *action = (mdns_action_t *)mdns_mem_malloc(sizeof(mdns_action_t));
-    if (!action) {
-        HOOK_MALLOC_FAILED;
-        mdns_mem_free(new_instance);
-        return ESP_ERR_NO_MEM;
-    }
-    action->type = ACTION_INSTANCE_SET;
-    action->data.instance = new_instance;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    mdns_action_t action = { .type = ACTION_INSTANCE_SET };
+    action.data.instance = new_instance;
+    if (_mdns_send_action(&action) != ESP_OK) {
         mdns_mem_free(new_instance);
-        mdns_mem_free(action);
         return ESP_ERR_NO_MEM;
     }
     return ESP_OK;
@@ -6409,6 +8504,7 @@ static esp_err_t _mdns_service_subtype_remove_for_host(mdns_srv_item_t *service,
     esp_err_t ret = ESP_ERR_NOT_FOUND;
     mdns_subtype_t *srv_subtype = service->service->subtype;
     mdns_subtype_t *pre = service->service->subtype;
+    _mdns_index_clear();
     while (srv_subtype) {
         if (strcmp(srv_subtype->subtype, subtype) == 0) {
             // Target subtype is found.
@@ -6481,6 +8577,7 @@ static esp_err_t _mdns_service_subtype_add_for_host(mdns_srv_item_t *service, co
     ESP_GOTO_ON_FALSE(subtype_item->subtype, ESP_ERR_NO_MEM, out_of_mem, TAG, "Out of memory");
     subtype_item->next = service->service->subtype;
     service->service->subtype = subtype_item;
+    _mdns_index_clear();
 
 err:
     return ret;
@@ -6649,6 +8746,7 @@ esp_err_t mdns_service_instance_name_set_for_host(const char *instance_old, cons
         _mdns_send_bye(&s, 1, false);
         mdns_mem_free((char *)s->service->instance);
     }
+    _mdns_index_clear();
     s->service->instance = mdns_mem_strndup(instance, MDNS_NAME_BUF_LEN - 1);
     ESP_GOTO_ON_FALSE(s->service->instance, ESP_ERR_NO_MEM, err, TAG, "Out of memory");
     _mdns_probe_all_pcbs(&s, 1, false, false);
@@ -7245,49 +9343,14 @@ void mdns_debug_packet(const uint8_t *data, size_t len)
 }
 #endif /* MDNS_ENABLE_DEBUG */
 
-/**
- * @brief  Browse sync result action
- */
-static esp_err_t _mdns_sync_browse_action(mdns_action_type_t type, mdns_browse_sync_t *browse_sync)
-{
-    mdns_action_t *action = NULL;
-
-    action = (mdns_action_t *)mdns_mem_malloc(sizeof(mdns_action_t));
-    if (!action) {
-        HOOK_MALLOC_FAILED;
-        return ESP_ERR_NO_MEM;
-    }
-
-    action->type = type;
-    action->data.browse_sync.browse_sync = browse_sync;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
-        mdns_mem_free(action);
-        return ESP_ERR_NO_MEM;
-    }
-    return ESP_OK;
-}
-
 /**
  * @brief  Browse action
  */
 static esp_err_t _mdns_send_browse_action(mdns_action_type_t type, mdns_browse_t *browse)
 {
-    mdns_action_t *action = NULL;
-
-    action = (mdns_action_t *)mdns_mem_malloc(sizeof(mdns_action_t));
-
-    if (!action) {
-        HOOK_MALLOC_FAILED;
-        return ESP_ERR_NO_MEM;
-    }
-
-    action->type = type;
-    action->data.browse_add.browse = browse;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
-        mdns_mem_free(action);
-        return ESP_ERR_NO_MEM;
-    }
-    return ESP_OK;
+    mdns_action_t action = { .type = type };
+    action.data.browse_add.browse = browse;
+    return _mdns_send_action(&action);
 }
 
 /**
@@ -7297,6 +9360,7 @@ static void _mdns_browse_item_free(mdns_browse_t *browse)
 {
     mdns_mem_free(browse->service);
     mdns_mem_free(browse->proto);
+    _mdns_browse_pending_free(browse);
     if (browse->result) {
         _mdns_query_results_free(browse->result);
     }
@@ -7306,7 +9370,8 @@ static void _mdns_browse_item_free(mdns_browse_t *browse)
 /**
  * @brief  Allocate new browse structure
  */
-static mdns_browse_t *_mdns_browse_init(const char *service, const char *proto, mdns_browse_notify_t notifier)
+static mdns_browse_t *_mdns_browse_init(const char *service, const char *proto, mdns_browse_notify_t notifier,
+                                        mdns_browse_diff_notify_t diff_notifier)
 {
     mdns_browse_t *browse = (mdns_browse_t *)mdns_mem_malloc(sizeof(mdns_browse_t));
 
@@ -7334,10 +9399,12 @@ static mdns_browse_t *_mdns_browse_init(const char *service, const char *proto,
     }
 
     browse->notifier = notifier;
+    browse->diff_notifier = diff_notifier;
     return browse;
 }
 
-mdns_browse_t *mdns_browse_new(const char *service, const char *proto, mdns_browse_notify_t notifier)
+static mdns_browse_t *_mdns_browse_new(const char *service, const char *proto, mdns_browse_notify_t notifier,
+                                       mdns_browse_diff_notify_t diff_notifier)
 {
     mdns_browse_t *browse = NULL;
 
@@ -7345,7 +9412,7 @@ mdns_browse_t *mdns_browse_new(const char *service, const char *proto, mdns_brow
         return NULL;
     }
 
-    browse = _mdns_browse_init(service, proto, notifier);
+    browse = _mdns_browse_init(service, proto, notifier, diff_notifier);
     if (!browse) {
         return NULL;
     }
@@ -7358,6 +9425,16 @@ mdns_browse_t *mdns_browse_new(const char *service, const char *proto, mdns_brow
     return browse;
 }
 
+mdns_browse_t *mdns_browse_new(const char *service, const char *proto, mdns_browse_notify_t notifier)
+{
+    return _mdns_browse_new(service, proto, notifier, NULL);
+}
+
+mdns_browse_t *mdns_browse_new_diff(const char *service, const char *proto, mdns_browse_diff_notify_t notifier)
+{
+    return _mdns_browse_new(service, proto, NULL, notifier);
+}
+
 esp_err_t mdns_browse_delete(const char *service, const char *proto)
 {
     mdns_browse_t *browse = NULL;
@@ -7366,7 +9443,7 @@ esp_err_t mdns_browse_delete(const char *service, const char *proto)
         return ESP_FAIL;
     }
 
-    browse = _mdns_browse_init(service, proto, NULL);
+    browse = _mdns_browse_init(service, proto, NULL, NULL);
     if (!browse) {
         return ESP_ERR_NO_MEM;
     }
@@ -7398,6 +9475,7 @@ static void _mdns_browse_finish(mdns_browse_t *browse)
         }
     }
     _mdns_browse_item_free(browse);
+    _mdns_browse_publish();
 }
 
 /**
@@ -7451,11 +9529,15 @@ static void _mdns_browse_send(mdns_browse_t *browse, mdns_if_t interface)
 }
 
 /**
- * @brief  Add result to browse, only add when the result is a new one.
+ * @brief  Add result to the pending changes of the browse, only add when the result is a new one.
+ *
+ * The first change opens the coalescing window, see _mdns_browse_flush_due().
+ *
+ * @param  added    the result was just created
  */
-static esp_err_t _mdns_add_browse_result(mdns_browse_sync_t *sync_browse, mdns_result_t *r)
+static esp_err_t _mdns_add_browse_result(mdns_browse_t *browse, mdns_result_t *r, bool added)
 {
-    mdns_browse_result_sync_t *sync_r = sync_browse->sync_result;
+    mdns_browse_result_sync_t *sync_r = browse->pending;
     while (sync_r) {
         if (sync_r->result == r) {
             break;
@@ -7470,9 +9552,13 @@ static esp_err_t _mdns_add_browse_result(mdns_browse_sync_t *sync_browse, mdns_r
             HOOK_MALLOC_FAILED;
             return ESP_ERR_NO_MEM;
         }
+        if (!browse->pending) {
+            browse->flush_at = xTaskGetTickCount() * portTICK_PERIOD_MS + MDNS_BROWSE_COALESCE_MS;
+        }
         new->result = r;
-        new->next = sync_browse->sync_result;
-        sync_browse->sync_result = new;
+        new->added = added;
+        new->next = browse->pending;
+        browse->pending = new;
     }
     return ESP_OK;
 }
@@ -7481,15 +9567,8 @@ static esp_err_t _mdns_add_browse_result(mdns_browse_sync_t *sync_browse, mdns_r
  * @brief  Called from parser to add A/AAAA data to search result
  */
 static void _mdns_browse_result_add_ip(mdns_browse_t *browse, const char *hostname, esp_ip_addr_t *ip,
-                                       mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint32_t ttl, mdns_browse_sync_t *out_sync_browse)
+                                       mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint32_t ttl)
 {
-    if (out_sync_browse->browse == NULL) {
-        return;
-    } else {
-        if (out_sync_browse->browse != browse) {
-            return;
-        }
-    }
     mdns_result_t *r = NULL;
     mdns_ip_addr_t *r_a = NULL;
     if (browse) {
@@ -7529,7 +9608,7 @@ static void _mdns_browse_result_add_ip(mdns_browse_t *browse, const char *hostna
                                 _mdns_result_update_ttl(r, ttl);
                             }
                         }
-                        if (_mdns_add_browse_result(out_sync_browse, r) != ESP_OK) {
+                        if (_mdns_add_browse_result(browse, r, false) != ESP_OK) {
                             return;
                         }
                         break;
@@ -7595,15 +9674,8 @@ static bool is_txt_item_in_list(mdns_txt_item_t txt, uint8_t txt_value_len, mdns
  */
 static void _mdns_browse_result_add_txt(mdns_browse_t *browse, const char *instance, const char *service, const char *proto,
                                         mdns_txt_item_t *txt, uint8_t *txt_value_len, size_t txt_count, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol,
-                                        uint32_t ttl, mdns_browse_sync_t *out_sync_browse)
+                                        uint32_t ttl)
 {
-    if (out_sync_browse->browse == NULL) {
-        return;
-    } else {
-        if (out_sync_browse->browse != browse) {
-            return;
-        }
-    }
     mdns_result_t *r = browse->result;
     while (r) {
         if (r->esp_netif == _mdns_get_esp_netif(tcpip_if) && r->ip_protocol == ip_protocol &&
@@ -7630,6 +9702,9 @@ static void _mdns_browse_result_add_txt(mdns_browse_t *browse, const char *insta
                 }
                 mdns_mem_free(r->txt);
                 mdns_mem_free(r->txt_value_len);
+            } else if (txt_count) {
+                // the first TXT record of an instance found by its SRV record
+                should_update = true;
             }
             r->txt = txt;
             r->txt_value_len = txt_value_len;
@@ -7646,7 +9721,7 @@ static void _mdns_browse_result_add_txt(mdns_browse_t *browse, const char *insta
                 }
             }
             if (should_update) {
-                if (_mdns_add_browse_result(out_sync_browse, r) != ESP_OK) {
+                if (_mdns_add_browse_result(browse, r, false) != ESP_OK) {
                     return;
                 }
             }
@@ -7678,7 +9753,7 @@ static void _mdns_browse_result_add_txt(mdns_browse_t *browse, const char *insta
     r->ttl = ttl;
     r->next = browse->result;
     browse->result = r;
-    _mdns_add_browse_result(out_sync_browse, r);
+    _mdns_add_browse_result(browse, r, true);
     return;
 
 free_txt:
@@ -7713,15 +9788,8 @@ static esp_err_t _mdns_copy_address_in_previous_result(mdns_result_t *result_lis
  * @brief  Called from parser to add SRV data to search result
  */
 static void _mdns_browse_result_add_srv(mdns_browse_t *browse, const char *hostname, const char *instance, const char *service, const char *proto,
-                                        uint16_t port, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint32_t ttl, mdns_browse_sync_t *out_sync_browse)
+                                        uint16_t port, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, uint32_t ttl)
 {
-    if (out_sync_browse->browse == NULL) {
-        return;
-    } else {
-        if (out_sync_browse->browse != browse) {
-            return;
-        }
-    }
     mdns_result_t *r = browse->result;
     while (r) {
         if (r->esp_netif == _mdns_get_esp_netif(tcpip_if) && r->ip_protocol == ip_protocol &&
@@ -7741,7 +9809,7 @@ static void _mdns_browse_result_add_srv(mdns_browse_t *browse, const char *hostn
                         return;
                     }
                 }
-                if (_mdns_add_browse_result(out_sync_browse, r) != ESP_OK) {
+                if (_mdns_add_browse_result(browse, r, false) != ESP_OK) {
                     return;
                 }
             }
@@ -7753,7 +9821,7 @@ static void _mdns_browse_result_add_srv(mdns_browse_t *browse, const char *hostn
                     _mdns_result_update_ttl(r, ttl);
                 }
                 if (previous_ttl != r->ttl) {
-                    if (_mdns_add_browse_result(out_sync_browse, r) != ESP_OK) {
+                    if (_mdns_add_browse_result(browse, r, false) != ESP_OK) {
                         return;
                     }
                 }
@@ -7788,27 +9856,152 @@ static void _mdns_browse_result_add_srv(mdns_browse_t *browse, const char *hostn
     r->ttl = ttl;
     r->next = browse->result;
     browse->result = r;
-    _mdns_add_browse_result(out_sync_browse, r);
+    _mdns_add_browse_result(browse, r, true);
     return;
 }
 
-static void _mdns_browse_sync(mdns_browse_sync_t *browse_sync)
+/**
+ * @brief  publishes the earliest flush_at of the browses to the timer, which reads it without the service lock
+ */
+static void _mdns_browse_publish(void)
+{
+    bool scheduled = false;
+    uint32_t next = 0;
+    for (mdns_browse_t *b = _mdns_server->browse; b; b = b->next) {
+        if (b->pending && (!scheduled || (int32_t)(b->flush_at - next) < 0)) {
+            next = b->flush_at;
+            scheduled = true;
+        }
+    }
+    if (scheduled) {
+        atomic_store(&_mdns_server->browse_flush_at, next);
+    }
+    atomic_store(&_mdns_server->browse_scheduled, scheduled);
+}
+
+/**
+ * @brief  where a pending change goes in the diff
+ *
+ * @return 0 added, 1 updated, 2 removed, -1 not reported
+ */
+static int _mdns_browse_change_kind(const mdns_browse_result_sync_t *p)
+{
+    if (p->result->ttl == 0) {
+        return p->added ? -1 : 2;
+    }
+    return p->added ? 0 : 1;
+}
+
+/**
+ * @brief  passes the pending changes of a browse to its diff notifier
+ *
+ * The pending list is newest first, the diff lists each kind of change oldest first.
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM with the pending changes left untouched
+ */
+static esp_err_t _mdns_browse_notify_diff(mdns_browse_t *browse)
+{
+    size_t num[3] = { 0 };  // added, updated, removed
+    mdns_browse_result_sync_t *p;
+    for (p = browse->pending; p; p = p->next) {
+        int kind = _mdns_browse_change_kind(p);
+        if (kind >= 0) {
+            num[kind]++;
+        }
+    }
+    size_t total = num[0] + num[1] + num[2];
+    if (!total) {
+        return ESP_OK;
+    }
+    mdns_result_t **list = (mdns_result_t **)mdns_mem_malloc(total * sizeof(mdns_result_t *));
+    if (!list) {
+        HOOK_MALLOC_FAILED;
+        return ESP_ERR_NO_MEM;
+    }
+    size_t end[3] = { num[0], num[0] + num[1], total };
+    for (p = browse->pending; p; p = p->next) {
+        int kind = _mdns_browse_change_kind(p);
+        if (kind >= 0) {
+            list[--end[kind]] = p->result;
+        }
+    }
+    mdns_browse_diff_t diff = {
+        .added = list, .num_added = num[0],
+        .updated = list + num[0], .num_updated = num[1],
+        .removed = list + num[0] + num[1], .num_removed = num[2],
+    };
+    browse->diff_notifier(&diff);
+    mdns_mem_free(list);
+    return ESP_OK;
+}
+
+/**
+ * @brief  notifies the pending changes of a browse, and frees the removed results
+ *
+ * A result added and removed within the window is dropped without a notification.
+ * A browse with a diff notifier gets one diff; if it cannot be allocated, the changes
+ * stay pending and are retried MDNS_BROWSE_RETRY_MS later. A plain notifier is called
+ * for each change, oldest first.
+ */
+static void _mdns_browse_notify(mdns_browse_t *browse)
 {
-    mdns_browse_t *browse = browse_sync->browse;
-    mdns_browse_result_sync_t *sync_result = browse_sync->sync_result;
-    while (sync_result) {
-        mdns_result_t *result = sync_result->result;
+    mdns_browse_result_sync_t *p;
+#ifdef MDNS_ENABLE_DEBUG
+    _mdns_dbg_printf("Browse %s%s total result:", browse->service, browse->proto);
+    debug_printf_browse_result_all(browse->result);
+#endif // MDNS_ENABLE_DEBUG
+    if (browse->diff_notifier) {
+        if (_mdns_browse_notify_diff(browse) != ESP_OK) {
+            browse->flush_at = xTaskGetTickCount() * portTICK_PERIOD_MS + MDNS_BROWSE_RETRY_MS;
+            return;
+        }
+    } else if (browse->notifier) {
+        mdns_browse_result_sync_t *oldest_first = NULL;
+        while (browse->pending) {
+            p = browse->pending;
+            browse->pending = p->next;
+            p->next = oldest_first;
+            oldest_first = p;
+        }
+        browse->pending = oldest_first;
+        for (p = browse->pending; p; p = p->next) {
+            if (_mdns_browse_change_kind(p) >= 0) {
 #ifdef MDNS_ENABLE_DEBUG
-        debug_printf_browse_result(result, browse_sync->browse);
+                debug_printf_browse_result(p->result, browse);
 #endif
-        browse->notifier(result);
+                browse->notifier(p->result);
+            }
+        }
+    }
+    for (p = browse->pending; p; p = p->next) {
+        mdns_result_t *result = p->result;
         if (result->ttl == 0) {
             queueDetach(mdns_result_t, browse->result, result);
             // Just free current result
             result->next = NULL;
-            mdns_query_results_free(result);
+            _mdns_query_results_free(result);
+        }
+    }
+    _mdns_browse_pending_free(browse);
+}
+
+/**
+ * @brief  notifies the browses whose coalescing window has closed, and arms the timer for the others
+ *
+ * Called at the end of a packet that changed browse results, and for ACTION_BROWSE_FLUSH.
+ * Without a window (CONFIG_MDNS_BROWSE_COALESCE_MS 0) every change is due at once.
+ */
+static void _mdns_browse_flush_due(void)
+{
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    for (mdns_browse_t *b = _mdns_server->browse; b; b = b->next) {
+        if (b->pending && (int32_t)(b->flush_at - now) <= 0) {
+            _mdns_browse_notify(b);
         }
-        sync_result = sync_result->next;
+    }
+    _mdns_browse_publish();
+    if (atomic_load(&_mdns_server->browse_scheduled)) {
+        _mdns_timer_update();
     }
 }
 
@@ -1414,6 +1414,76 @@ static void register_mdns_browse_del(void)
     ESP_ERROR_CHECK(esp_console_cmd_register(&cmd_browse_del));
 }
 
+#if CONFIG_MDNS_MEMORY_PROFILING
+#include <stdlib.h>
+#if CONFIG_IDF_TARGET_LINUX
+#include <execinfo.h>
+#endif
+
+static struct {
+    struct arg_lit *reset;
+    struct arg_end *end;
+} mdns_mem_args;
+
+static int cmp_site_allocs(const void *a, const void *b)
+{
+    const mdns_mem_site_stats_t *x = a, *y = b;
+    return x->allocs < y->allocs ? 1 : x->allocs > y->allocs ? -1 : 0;
+}
+
+static int cmd_mdns_mem(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &mdns_mem_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, mdns_mem_args.end, argv[0]);
+        return 1;
+    }
+
+    size_t num_sites = CONFIG_MDNS_MEMORY_PROFILING_SITES + 1;
+    mdns_mem_site_stats_t *sites = malloc(num_sites * sizeof(mdns_mem_site_stats_t));
+    if (!sites) {
+        printf("ERROR: No memory!\n");
+        return 1;
+    }
+    mdns_mem_stats_t stats;
+    mdns_get_mem_stats(&stats, sites, &num_sites, mdns_mem_args.reset->count);
+    printf("Allocations: %" PRIu32 " (%" PRIu32 " failed), live: %" PRIu32 " (%" PRIu32 " bytes), peak: %" PRIu32 " bytes\n",
+           stats.allocs, stats.failed, stats.live, stats.live_bytes, stats.peak_bytes);
+    qsort(sites, num_sites, sizeof(mdns_mem_site_stats_t), cmp_site_allocs);
+    printf("%10s %10s %8s %10s  %s\n", "allocs", "bytes", "live", "live bytes", "site");
+    for (size_t i = 0; i < num_sites; i++) {
+        mdns_mem_site_stats_t *site = &sites[i];
+#if CONFIG_IDF_TARGET_LINUX
+        char **sym = site->site ? backtrace_symbols((void *const *)&site->site, 1) : NULL;
+        printf("%10" PRIu32 " %10" PRIu32 " %8" PRIu32 " %10" PRIu32 "  %s\n", site->allocs, site->bytes,
+               site->live, site->live_bytes, sym ? sym[0] : "(other sites)");
+        free(sym);
+#else
+        printf("%10" PRIu32 " %10" PRIu32 " %8" PRIu32 " %10" PRIu32 "  %p\n", site->allocs, site->bytes,
+               site->live, site->live_bytes, site->site);
+#endif
+    }
+    free(sites);
+    return 0;
+}
+
+static void register_mdns_mem(void)
+{
+    mdns_mem_args.reset = arg_lit0("r", "reset", "Start counting again after printing");
+    mdns_mem_args.end = arg_end(1);
+
+    const esp_console_cmd_t cmd_mem = {
+        .command = "mdns_mem",
+        .help = "Print mDNS allocations per call site, most frequent first",
+        .hint = NULL,
+        .func = &cmd_mdns_mem,
+        .argtable = &mdns_mem_args
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd_mem));
+}
+#endif // CONFIG_MDNS_MEMORY_PROFILING
+
 void mdns_console_register(void)
 {
     register_mdns_init();
@@ -1449,4 +1519,8 @@ void mdns_console_register(void)
 
     register_mdns_query_ip();
     register_mdns_query_svc();
+
+#if CONFIG_MDNS_MEMORY_PROFILING
+    register_mdns_mem();
+#endif
 }
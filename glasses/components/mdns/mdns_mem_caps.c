@@ -42,19 +42,127 @@
 #define MDNS_TASK_MEMORY_LOG "internal RAM"
 #endif
 
+#if CONFIG_MDNS_MEMORY_PROFILING
+#include <stdalign.h>
+#include <stdatomic.h>
+
+#define MDNS_MEM_SITES CONFIG_MDNS_MEMORY_PROFILING_SITES
+
+_Static_assert((MDNS_MEM_SITES & (MDNS_MEM_SITES - 1)) == 0, "CONFIG_MDNS_MEMORY_PROFILING_SITES must be a power of two");
+
+/**
+ * @brief  Counters of one call site, the last entry collects sites that did not fit
+ */
+typedef struct {
+    atomic_uintptr_t site;
+    atomic_uint allocs;
+    atomic_uint bytes;
+    atomic_uint live;
+    atomic_uint live_bytes;
+} mem_site_t;
+
+/**
+ * @brief  Prepended to every allocation, so that a free finds its size and site
+ */
+typedef struct {
+    uint32_t size;
+    uint16_t site;
+    alignas(max_align_t) uint8_t data[];
+} mem_hdr_t;
+
+static mem_site_t s_sites[MDNS_MEM_SITES + 1];
+static atomic_uint s_failed;
+static atomic_uint s_live_bytes;
+static atomic_uint s_peak_bytes;
+
+/**
+ * @brief  Finds or claims the table entry of a call site, open addressing on the return address
+ */
+static uint16_t mem_site_index(const void *site)
+{
+    uintptr_t key = (uintptr_t)site;
+    uint32_t hash = (uint32_t)(key >> 2) * 2654435761u;
+    for (uint32_t i = 0; i < MDNS_MEM_SITES; i++) {
+        uint32_t idx = (hash + i) & (MDNS_MEM_SITES - 1);
+        uintptr_t cur = atomic_load_explicit(&s_sites[idx].site, memory_order_relaxed);
+        if (cur == 0 && atomic_compare_exchange_strong(&s_sites[idx].site, &cur, key)) {
+            return idx;
+        }
+        if (cur == key) {
+            return idx;
+        }
+    }
+    return MDNS_MEM_SITES;
+}
+
+static void *mem_alloc(size_t size, const void *site)
+{
+    mem_hdr_t *hdr = size <= UINT32_MAX - sizeof(mem_hdr_t) ? heap_caps_malloc(sizeof(mem_hdr_t) + size, MDNS_MEMORY_CAPS) : NULL;
+    if (!hdr) {
+        atomic_fetch_add_explicit(&s_failed, 1, memory_order_relaxed);
+        return NULL;
+    }
+    hdr->size = size;
+    hdr->site = mem_site_index(site);
+    mem_site_t *s = &s_sites[hdr->site];
+    atomic_fetch_add_explicit(&s->allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->bytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->live, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->live_bytes, size, memory_order_relaxed);
+
+    uint32_t live = atomic_fetch_add_explicit(&s_live_bytes, size, memory_order_relaxed) + size;
+    uint32_t peak = atomic_load_explicit(&s_peak_bytes, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak(&s_peak_bytes, &peak, live)) {
+    }
+    return hdr->data;
+}
+
+static void mem_free(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    mem_hdr_t *hdr = (mem_hdr_t *)((uint8_t *)ptr - offsetof(mem_hdr_t, data));
+    mem_site_t *s = &s_sites[hdr->site];
+    atomic_fetch_sub_explicit(&s->live, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&s->live_bytes, hdr->size, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&s_live_bytes, hdr->size, memory_order_relaxed);
+    heap_caps_free(hdr);
+}
+
+// the site is the caller of the public mdns_mem_* function the macro is used in
+#define MDNS_MEM_ALLOC(size)    mem_alloc((size), __builtin_return_address(0))
+#define MDNS_MEM_FREE(ptr)      mem_free(ptr)
+#else
+#define MDNS_MEM_ALLOC(size)    heap_caps_malloc((size), MDNS_MEMORY_CAPS)
+#define MDNS_MEM_FREE(ptr)      heap_caps_free(ptr)
+#endif // CONFIG_MDNS_MEMORY_PROFILING
+
 void ALLOW_WEAK *mdns_mem_malloc(size_t size)
 {
-    return heap_caps_malloc(size, MDNS_MEMORY_CAPS);
+    return MDNS_MEM_ALLOC(size);
 }
 
 void ALLOW_WEAK *mdns_mem_calloc(size_t num, size_t size)
 {
+#if CONFIG_MDNS_MEMORY_PROFILING
+    if (size && num > SIZE_MAX / size) {
+        atomic_fetch_add_explicit(&s_failed, 1, memory_order_relaxed);
+        return NULL;
+    }
+    void *ptr = MDNS_MEM_ALLOC(num * size);
+    if (ptr) {
+        memset(ptr, 0, num * size);
+    }
+    return ptr;
+#else
     return heap_caps_calloc(num, size, MDNS_MEMORY_CAPS);
+#endif
 }
 
 void ALLOW_WEAK mdns_mem_free(void *ptr)
 {
-    heap_caps_free(ptr);
+    MDNS_MEM_FREE(ptr);
 }
 
 char ALLOW_WEAK *mdns_mem_strdup(const char *s)
@@ -63,7 +171,7 @@ char ALLOW_WEAK *mdns_mem_strdup(const char *s)
         return NULL;
     }
     size_t len = strlen(s) + 1;
-    char *copy = (char *)heap_caps_malloc(len, MDNS_MEMORY_CAPS);
+    char *copy = (char *)MDNS_MEM_ALLOC(len);
     if (copy) {
         memcpy(copy, s, len);
     }
@@ -76,7 +184,7 @@ char ALLOW_WEAK *mdns_mem_strndup(const char *s, size_t n)
         return NULL;
     }
     size_t len = strnlen(s, n);
-    char *copy = (char *)heap_caps_malloc(len + 1, MDNS_MEMORY_CAPS);
+    char *copy = (char *)MDNS_MEM_ALLOC(len + 1);
     if (copy) {
         memcpy(copy, s, len);
         copy[len] = '\0';
@@ -94,3 +202,45 @@ void ALLOW_WEAK mdns_mem_task_free(void *ptr)
 {
     heap_caps_free(ptr);
 }
+
+esp_err_t mdns_get_mem_stats(mdns_mem_stats_t *stats, mdns_mem_site_stats_t *sites, size_t *num_sites, bool reset)
+{
+#if CONFIG_MDNS_MEMORY_PROFILING
+    if (!stats || (sites && !num_sites)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t max_sites = sites ? *num_sites : 0;
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i <= MDNS_MEM_SITES; i++) {
+        mem_site_t *s = &s_sites[i];
+        if (i < MDNS_MEM_SITES && atomic_load(&s->site) == 0) {
+            continue;
+        }
+        mdns_mem_site_stats_t site = {
+            .site = (const void *)atomic_load(&s->site),
+            .allocs = reset ? atomic_exchange(&s->allocs, 0) : atomic_load(&s->allocs),
+            .bytes = reset ? atomic_exchange(&s->bytes, 0) : atomic_load(&s->bytes),
+            .live = atomic_load(&s->live),
+            .live_bytes = atomic_load(&s->live_bytes),
+        };
+        if (i == MDNS_MEM_SITES && site.allocs == 0 && site.live == 0) {
+            continue;   // nothing overflowed the table
+        }
+        stats->allocs += site.allocs;
+        stats->live += site.live;
+        stats->live_bytes += site.live_bytes;
+        stats->sites++;
+        if (stats->sites <= max_sites) {
+            sites[stats->sites - 1] = site;
+        }
+    }
+    if (num_sites) {
+        *num_sites = stats->sites < max_sites ? stats->sites : max_sites;
+    }
+    stats->failed = reset ? atomic_exchange(&s_failed, 0) : atomic_load(&s_failed);
+    stats->peak_bytes = reset ? atomic_exchange(&s_peak_bytes, atomic_load(&s_live_bytes)) : atomic_load(&s_peak_bytes);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
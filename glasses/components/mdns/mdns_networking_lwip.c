@@ -39,6 +39,8 @@ typedef struct interfaces {
 static interfaces_t s_interfaces[MDNS_MAX_INTERFACES];
 
 static struct udp_pcb *_pcb_main = NULL;
+static uint32_t s_rx_received;      // only updated from the tcpip thread
+static uint32_t s_rx_dropped;
 
 static const char *TAG = "mdns_networking";
 
@@ -149,6 +151,7 @@ static void _udp_recv(void *arg, struct udp_pcb *upcb, struct pbuf *pb, const ip
             HOOK_MALLOC_FAILED;
             //missed packet - no memory
             pbuf_free(this_pb);
+            s_rx_dropped++;
             continue;
         }
 
@@ -204,9 +207,15 @@ static void _udp_recv(void *arg, struct udp_pcb *upcb, struct pbuf *pb, const ip
             }
         }
 
-        if (!found || _mdns_send_rx_action(packet) != ESP_OK) {
+        if (!found) {
             pbuf_free(this_pb);
             mdns_mem_free(packet);
+        } else if (_mdns_send_rx_action(packet) != ESP_OK) {
+            pbuf_free(this_pb);
+            mdns_mem_free(packet);
+            s_rx_dropped++;
+        } else {
+            s_rx_received++;
         }
     }
 
@@ -396,3 +405,22 @@ void _mdns_packet_free(mdns_rx_packet_t *packet)
     pbuf_free(packet->pb);
     mdns_mem_free(packet);
 }
+
+esp_err_t mdns_get_rx_stats(mdns_rx_stats_t *stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+esp_err_t mdns_rx_replay(esp_netif_t *netif, const esp_ip_addr_t *src, uint16_t src_port, const uint8_t *data, size_t len)
+{
+    // replaying needs the receive buffers of the BSD sockets networking
+    return ESP_ERR_NOT_SUPPORTED;
+}
+    stats->received = s_rx_received;
+    stats->dropped = s_rx_dropped;
+    // packets stay in the pbufs lwIP received them in
+    stats->slots = 0;
+    stats->slots_high_water = 0;
+    return ESP_OK;
+}
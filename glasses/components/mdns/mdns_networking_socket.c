@@ -9,6 +9,7 @@
  */
 
 #include <string.h>
+#include <stdatomic.h>
 #include "esp_event.h"
 #include "mdns_networking.h"
 #include <sys/types.h>
@@ -58,6 +59,29 @@ struct pbuf  {
 #define s6_addr32 un.u32_addr
 #endif // CONFIG_IDF_TARGET_LINUX
 
+#define MDNS_RX_RING_SLOTS CONFIG_MDNS_RX_RING_SLOTS
+
+/**
+ * @brief  Receive buffer, recvfrom() writes into `data` and the packet handed to
+ *         the mDNS task points at it, so the parser reads it in place.
+ *         The slot stays busy until _mdns_packet_free()
+ */
+typedef struct {
+    mdns_rx_packet_t packet;        // first, so that _mdns_packet_free() can find the slot
+    struct pbuf pbuf;
+    atomic_bool busy;
+    uint8_t data[MDNS_MAX_PACKET_SIZE];
+} rx_slot_t;
+
+static rx_slot_t s_rx_ring[MDNS_RX_RING_SLOTS];
+static unsigned s_rx_next;          // only used by the receive task
+static atomic_uint s_rx_busy;
+static atomic_uint s_rx_busy_max;
+static atomic_uint s_rx_received;
+static atomic_uint s_rx_dropped;
+static rx_slot_t s_replay_slot;     // mdns_rx_replay(), outside the ring and its counters
+static SemaphoreHandle_t s_replay_done;
+
 static void __attribute__((constructor)) ctor_networking_socket(void)
 {
     for (int i = 0; i < sizeof(s_interfaces) / sizeof(s_interfaces[0]); ++i) {
@@ -88,9 +112,108 @@ size_t _mdns_get_packet_len(mdns_rx_packet_t *packet)
 
 void _mdns_packet_free(mdns_rx_packet_t *packet)
 {
-    mdns_mem_free(packet->pb->payload);
-    mdns_mem_free(packet->pb);
-    mdns_mem_free(packet);
+    rx_slot_t *slot = (rx_slot_t *)packet;
+    if (slot == &s_replay_slot) {
+        xSemaphoreGive(s_replay_done);
+        return;
+    }
+    atomic_store(&slot->busy, false);
+    atomic_fetch_sub(&s_rx_busy, 1);
+}
+
+/**
+ * @brief  Returns the next receive slot to read a datagram into
+ *
+ * The mDNS task releases packets in the order they were received, so if the
+ * next slot is still busy, so is the rest of the ring. That only holds if
+ * the ring moves on for packets that reached the mDNS task, see rx_slot_post()
+ *
+ * @return NULL if all slots are busy
+ */
+static rx_slot_t *rx_slot_peek(void)
+{
+    rx_slot_t *slot = &s_rx_ring[s_rx_next];
+    return atomic_load(&slot->busy) ? NULL : slot;
+}
+
+/**
+ * @brief  Hands the packet in the slot to the mDNS task
+ *
+ * The slot is marked busy first, the mDNS task may free it before this returns.
+ * On failure the slot is released again and stays the next one.
+ */
+static esp_err_t rx_slot_post(rx_slot_t *slot)
+{
+    atomic_store(&slot->busy, true);
+    unsigned busy = atomic_fetch_add(&s_rx_busy, 1) + 1;
+    if (busy > atomic_load(&s_rx_busy_max)) {
+        atomic_store(&s_rx_busy_max, busy);
+    }
+    if (_mdns_send_rx_action(&slot->packet) != ESP_OK) {
+        _mdns_packet_free(&slot->packet);
+        return ESP_ERR_NO_MEM;
+    }
+    s_rx_next = (s_rx_next + 1) % MDNS_RX_RING_SLOTS;
+    return ESP_OK;
+}
+
+esp_err_t mdns_get_rx_stats(mdns_rx_stats_t *stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stats->received = atomic_load(&s_rx_received);
+    stats->dropped = atomic_load(&s_rx_dropped);
+    stats->slots = MDNS_RX_RING_SLOTS;
+    stats->slots_high_water = atomic_load(&s_rx_busy_max);
+    return ESP_OK;
+}
+
+esp_err_t mdns_rx_replay(esp_netif_t *netif, const esp_ip_addr_t *src, uint16_t src_port, const uint8_t *data, size_t len)
+{
+    if (!netif || !src || !data || len == 0 || len > sizeof(s_replay_slot.data)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    mdns_if_t tcpip_if = MDNS_MAX_INTERFACES;
+    for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        if (_mdns_get_esp_netif(i) == netif) {
+            tcpip_if = i;
+            break;
+        }
+    }
+    mdns_ip_protocol_t ip_protocol = src->type == ESP_IPADDR_TYPE_V4 ? MDNS_IP_PROTOCOL_V4 : MDNS_IP_PROTOCOL_V6;
+    if (tcpip_if == MDNS_MAX_INTERFACES || !mdns_is_netif_ready(tcpip_if, ip_protocol)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!s_replay_done) {
+        s_replay_done = xSemaphoreCreateBinary();
+        if (!s_replay_done) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    // Same description of the packet as the receive task gives
+    rx_slot_t *slot = &s_replay_slot;
+    mdns_rx_packet_t *packet = &slot->packet;
+    memcpy(slot->data, data, len);
+    memset(packet, 0, sizeof(mdns_rx_packet_t));
+    memset(&slot->pbuf, 0, sizeof(struct pbuf));
+    slot->pbuf.payload = slot->data;
+    slot->pbuf.tot_len = len;
+    slot->pbuf.len = len;
+    packet->tcpip_if = tcpip_if;
+    packet->pb = &slot->pbuf;
+    packet->src_port = src_port;
+    memcpy(&packet->src, src, sizeof(esp_ip_addr_t));
+    packet->multicast = 1;
+    packet->dest.type = packet->src.type;
+    packet->ip_protocol = ip_protocol;
+    if (_mdns_send_rx_action(packet) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    // released by _mdns_packet_free() once the mDNS task is done with it
+    xSemaphoreTake(s_replay_done, portMAX_DELAY);
+    return ESP_OK;
 }
 
 esp_err_t _mdns_pcb_deinit(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
@@ -281,41 +404,39 @@ void sock_recv_task(void *arg)
                     continue;
                 }
                 if (FD_ISSET(sock, &rfds)) {
-                    static char recvbuf[MDNS_MAX_PACKET_SIZE];
+                    rx_slot_t *slot = rx_slot_peek();
+                    if (!slot) {
+                        // no free buffer, read the datagram into a byte to discard it
+                        static uint8_t discard;
+                        recv(sock, &discard, sizeof(discard), 0);
+                        atomic_fetch_add(&s_rx_dropped, 1);
+                        continue;
+                    }
                     uint16_t port = 0;
 
                     struct sockaddr_storage raddr; // Large enough for both IPv4 or IPv6
                     socklen_t socklen = sizeof(struct sockaddr_storage);
                     esp_ip_addr_t addr = {0};
-                    int len = recvfrom(sock, recvbuf, sizeof(recvbuf), 0,
+                    int len = recvfrom(sock, slot->data, sizeof(slot->data), 0,
                                        (struct sockaddr *) &raddr, &socklen);
                     if (len < 0) {
+                        // the slot was never taken, it is still the next one
                         ESP_LOGE(TAG, "multicast recvfrom failed. errno=%d: %s", errno, strerror(errno));
                         break;
                     }
                     ESP_LOGD(TAG, "[sock=%d]: Received from IP:%s", sock, get_string_address(&raddr));
-                    ESP_LOG_BUFFER_HEXDUMP(TAG, recvbuf, len, ESP_LOG_VERBOSE);
+                    ESP_LOG_BUFFER_HEXDUMP(TAG, slot->data, len, ESP_LOG_VERBOSE);
                     inet_to_espaddr(&raddr, &addr, &port);
 
-                    // Allocate the packet structure and pass it to the mdns main engine
-                    mdns_rx_packet_t *packet = (mdns_rx_packet_t *) mdns_mem_calloc(1, sizeof(mdns_rx_packet_t));
-                    struct pbuf *packet_pbuf = mdns_mem_calloc(1, sizeof(struct pbuf));
-                    uint8_t *buf = mdns_mem_malloc(len);
-                    if (packet == NULL || packet_pbuf == NULL || buf == NULL) {
-                        mdns_mem_free(buf);
-                        mdns_mem_free(packet_pbuf);
-                        mdns_mem_free(packet);
-                        HOOK_MALLOC_FAILED;
-                        ESP_LOGE(TAG, "Failed to allocate the mdns packet");
-                        continue;
-                    }
-                    memcpy(buf, recvbuf, len);
-                    packet_pbuf->next = NULL;
-                    packet_pbuf->payload = buf;
-                    packet_pbuf->tot_len = len;
-                    packet_pbuf->len = len;
+                    // Describe the packet in place and pass it to the mdns main engine
+                    mdns_rx_packet_t *packet = &slot->packet;
+                    memset(packet, 0, sizeof(mdns_rx_packet_t));
+                    memset(&slot->pbuf, 0, sizeof(struct pbuf));
+                    slot->pbuf.payload = slot->data;
+                    slot->pbuf.tot_len = len;
+                    slot->pbuf.len = len;
                     packet->tcpip_if = tcpip_if;
-                    packet->pb = packet_pbuf;
+                    packet->pb = &slot->pbuf;
                     packet->src_port = ntohs(port);
                     memcpy(&packet->src, &addr, sizeof(esp_ip_addr_t));
                     // TODO(IDF-3651): Add the correct dest addr -- for mdns to decide multicast/unicast
@@ -325,12 +446,12 @@ void sock_recv_task(void *arg)
                     packet->dest.type = packet->src.type;
                     packet->ip_protocol =
                         packet->src.type == ESP_IPADDR_TYPE_V4 ? MDNS_IP_PROTOCOL_V4 : MDNS_IP_PROTOCOL_V6;
-                    if (_mdns_send_rx_action(packet) != ESP_OK) {
+                    if (rx_slot_post(slot) != ESP_OK) {
                         ESP_LOGE(TAG, "_mdns_send_rx_action failed!");
-                        mdns_mem_free(packet->pb->payload);
-                        mdns_mem_free(packet->pb);
-                        mdns_mem_free(packet);
+                        atomic_fetch_add(&s_rx_dropped, 1);
+                        continue;
                     }
+                    atomic_fetch_add(&s_rx_received, 1);
                 }
             }
         }
@@ -15,6 +15,7 @@
 #include "freertos/semphr.h"
 #include "esp_timer.h"
 #include "esp_system.h"
+#include <stdatomic.h>
 
 #ifdef CONFIG_MDNS_ENABLE_DEBUG_PRINTS
 #define MDNS_ENABLE_DEBUG
@@ -104,6 +105,29 @@
 #define MDNS_ACTION_QUEUE_LEN       CONFIG_MDNS_ACTION_QUEUE_LEN  // Maximum actions pending to the server
 #define MDNS_TXT_MAX_LEN            1024                    // Maximum string length of text data in TXT record
 #define MDNS_MAX_PACKET_SIZE        1460                    // Maximum size of mDNS  outgoing packet
+#define MDNS_NAME_DICT_SIZE         128                     // Name compression dictionary slots per outgoing packet (power of two)
+#define MDNS_ANSWER_CACHE_SIZE      4                       // Serialized packet bodies kept for repeated responses
+#define MDNS_ANSWER_CACHE_MAX_RECORDS 16                    // Records per packet above which the packet is not cached
+#define MDNS_ANSWER_CACHE_MAX_LEN   512                     // Serialized size above which the packet is not cached
+#define MDNS_PREFILTER_MIN_SIZE     16                      // Slots of the received name pre-filter set (power of two)
+#define MDNS_PREFILTER_MAX_LABELS   128                     // Labels of a received name the pre-filter can look at
+#define MDNS_FQDN_MAX_LEN           255                     // Longest received name (RFC 1035 3.1), longer names are ignored
+#define MDNS_FQDN_MAX_HOPS          16                      // Compression pointers a received name may follow before it is ignored
+#define MDNS_REVERSE_NAME_MAX_LEN   74                      // Wire length of an ip6.arpa name: 32 nibble labels, "ip6", "arpa" and the root
+#define MDNS_LABEL_TABLE_SIZE       64                      // Labels of the packet being parsed remembered by their offset (power of two, < 128)
+#define MDNS_RESPONSE_DELAY_MS      20                      // Shared responses wait 20-120ms to aggregate answers (RFC 6762 6)
+#define MDNS_RESPONSE_DELAY_TC_MS   400                     // 400-500ms if the query continues in further packets
+#define MDNS_MULTICAST_INTERVAL_MS  1000                    // Minimum interval between multicasts of the same record
+#define MDNS_RECENT_ANSWERS         16                      // Recently multicast records remembered for the above
+#define MDNS_CACHE_MAX_NAME         256                     // Longest uncompressed name of a cached record
+#define MDNS_CACHE_MAX_RDATA        512                     // Largest uncompressed record data the passive cache keeps
+#define MDNS_CACHE_FLUSH_GRACE_MS   1000                    // Records younger than this survive a cache-flush (RFC 6762 10.2)
+#define MDNS_CACHE_REFRESH_PERCENT  80                      // Cached records used past this part of their TTL are queried again
+#define MDNS_SEARCH_INTERVAL_MS     1000                    // First interval between repeated queries of a search
+#define MDNS_SEARCH_INTERVAL_MAX_MS 3600000                 // Doubled after each query up to this (RFC 6762 5.2)
+#define MDNS_INDEX_MIN_ENTRIES      32                      // Below this many names our services and hosts are looked up by walking the lists
+#define MDNS_INDEX_MIN_SIZE         64                      // Slots of the service and host index (power of two)
+#define MDNS_TX_QUEUE_INITIAL_SIZE  8                       // Scheduled packet slots allocated at first use, doubled when full
 
 #define MDNS_HEAD_LEN               12
 #define MDNS_HEAD_ID_OFFSET         0
@@ -124,10 +148,33 @@
 #define MDNS_SRV_PORT_OFFSET        4
 #define MDNS_SRV_FQDN_OFFSET        6
 
-#define MDNS_TIMER_PERIOD_US        (CONFIG_MDNS_TIMER_PERIOD_MS*1000)
+#define MDNS_TIMER_SLACK_MS         CONFIG_MDNS_TIMER_PERIOD_MS  // Timer deadlines are rounded up to a multiple of this
+#define MDNS_RX_ARENA_SIZE          CONFIG_MDNS_RX_ARENA_SIZE    // Per-packet parse arena, see _mdns_rx_arena_alloc()
+#define MDNS_BROWSE_COALESCE_MS     CONFIG_MDNS_BROWSE_COALESCE_MS  // Browse changes within this window are notified together
+#define MDNS_BROWSE_RETRY_MS        CONFIG_MDNS_TIMER_PERIOD_MS  // Retry of a browse diff that could not be allocated
 
+/*
+ * Lock order is SERVICE, then SEARCH. The service lock guards the registry
+ * (hostname, services, delegated hosts), the PCBs and the TX queue. The
+ * service task holds it for every action except received packets, search
+ * starts and browse flushes, which take it only for the questions, the
+ * records of ours and the answer (see _mdns_parse_packet_data()). Search
+ * results, browses and the passive cache are only touched by the service
+ * task and need no lock. The search lock guards the linkage of the search
+ * list, the timing fields of the searches and the arming of the timer, so
+ * the timer never waits for the service task.
+ */
+#if CONFIG_MDNS_LOCK_STATS
+#define MDNS_SERVICE_LOCK()     _mdns_lock_take(_mdns_service_semaphore, MDNS_LOCK_SERVICE)
+#define MDNS_SERVICE_UNLOCK()   _mdns_lock_give(_mdns_service_semaphore, MDNS_LOCK_SERVICE)
+#define MDNS_SEARCH_LOCK()      _mdns_lock_take(_mdns_search_semaphore, MDNS_LOCK_SEARCH)
+#define MDNS_SEARCH_UNLOCK()    _mdns_lock_give(_mdns_search_semaphore, MDNS_LOCK_SEARCH)
+#else
 #define MDNS_SERVICE_LOCK()     xSemaphoreTake(_mdns_service_semaphore, portMAX_DELAY)
 #define MDNS_SERVICE_UNLOCK()   xSemaphoreGive(_mdns_service_semaphore)
+#define MDNS_SEARCH_LOCK()      xSemaphoreTake(_mdns_search_semaphore, portMAX_DELAY)
+#define MDNS_SEARCH_UNLOCK()    xSemaphoreGive(_mdns_search_semaphore)
+#endif
 
 #define queueToEnd(type, queue, item)       \
     if (!queue) {                           \
@@ -154,7 +201,7 @@
         }                                           \
     }
 
-#define queueFree(type, queue)  while (queue) { type * _q = queue; queue = queue->next; free(_q); }
+#define queueFree(type, queue)  while (queue) { type * _q = queue; queue = queue->next; mdns_mem_free(_q); }
 
 #define PCB_STATE_IS_PROBING(s) (s->state > PCB_OFF && s->state < PCB_ANNOUNCE_1)
 #define PCB_STATE_IS_ANNOUNCING(s) (s->state > PCB_PROBE_3 && s->state < PCB_RUNNING)
@@ -185,7 +232,7 @@ typedef enum {
     ACTION_SEARCH_SEND,
     ACTION_SEARCH_END,
     ACTION_BROWSE_ADD,
-    ACTION_BROWSE_SYNC,
+    ACTION_BROWSE_FLUSH,
     ACTION_BROWSE_END,
     ACTION_TX_HANDLE,
     ACTION_RX_HANDLE,
@@ -304,12 +351,24 @@ typedef struct mdns_out_question_s {
     const char *service;
     const char *proto;
     const char *domain;
-    bool own_dynamic_memory;
 } mdns_out_question_t;
 
+/**
+ * Reverse lookup name of an interface address (1.4.168.192.in-addr.arpa or
+ * the 32 nibbles of an IPv6 address under ip6.arpa), in wire format, built
+ * when the interface gets the address
+ */
+typedef struct {
+    mdns_if_t tcpip_if;
+    mdns_ip_protocol_t ip_protocol;
+    uint8_t len;
+    uint8_t data[MDNS_REVERSE_NAME_MAX_LEN];
+} mdns_reverse_name_t;
+
 typedef struct mdns_host_item_t {
     const char *hostname;
     mdns_ip_addr_t *address_list;
+    mdns_reverse_name_t *reverse;   // set for the reverse lookup names of our addresses
     struct mdns_host_item_t *next;
 } mdns_host_item_t;
 
@@ -318,6 +377,7 @@ typedef struct mdns_out_answer_s {
     uint16_t type;
     uint8_t bye;
     uint8_t flush;
+    uint8_t sent;                   // written to an earlier packet of the same dispatch
     mdns_service_t *service;
     mdns_host_item_t *host;
     const char *custom_instance;
@@ -326,22 +386,41 @@ typedef struct mdns_out_answer_s {
 } mdns_out_answer_t;
 
 typedef struct mdns_tx_packet_s {
-    struct mdns_tx_packet_s *next;
     uint32_t send_at;
+    uint32_t seq;                   // scheduling order, breaks ties between equal send_at
     mdns_if_t tcpip_if;
     mdns_ip_protocol_t ip_protocol;
     esp_ip_addr_t dst;
     uint16_t port;
     uint16_t flags;
     uint8_t distributed;
+    uint8_t aggregate;              // shared multicast response, answers to later queries join it until sent
+    uint8_t in_arena;               // built in the receive arena, released with the received packet
     mdns_out_question_t *questions;
     mdns_out_answer_t *answers;
     mdns_out_answer_t *servers;
     mdns_out_answer_t *additional;
-    bool queued;
     uint16_t id;
 } mdns_tx_packet_t;
 
+typedef struct {
+    mdns_service_t *service;
+    mdns_host_item_t *host;
+    uint16_t type;
+    uint8_t section;                // 0 answers, 1 servers, 2 additional
+    uint8_t flush;
+} mdns_answer_cache_key_t;
+
+typedef struct {
+    mdns_if_t tcpip_if;
+    mdns_ip_protocol_t ip_protocol;
+    mdns_pcb_state_t pcb_state[MDNS_IP_PROTOCOL_MAX];   // address records depend on the interface state
+    uint8_t key_len;
+    uint16_t counts[3];             // answers, servers, additional
+    uint16_t len;
+    mdns_answer_cache_key_t *key;   // key_len entries followed by len bytes of packet body, one allocation
+} mdns_answer_cache_entry_t;
+
 typedef struct {
     mdns_pcb_state_t state;
     mdns_srv_item_t **probe_services;
@@ -349,6 +428,7 @@ typedef struct {
     uint8_t probe_ip;
     uint8_t probe_running;
     uint16_t failed_probes;
+    uint8_t reverse_lookup;         // a reverse lookup name follows the address, kept while the interface is down
 } mdns_pcb_t;
 
 typedef enum {
@@ -371,11 +451,13 @@ typedef struct mdns_search_once_s {
     mdns_search_once_state_t state;
     uint32_t started_at;
     uint32_t sent_at;
+    uint32_t interval;              // until the next query, doubles after each one
     uint32_t timeout;
     mdns_query_notify_t notifier;
     SemaphoreHandle_t done_semaphore;
     uint16_t type;
     bool unicast;
+    bool answered;                  // got a unique record with the cache-flush bit
     uint8_t max_results;
     uint8_t num_results;
     char *instance;
@@ -384,27 +466,26 @@ typedef struct mdns_search_once_s {
     mdns_result_t *result;
 } mdns_search_once_t;
 
+typedef struct mdns_browse_result_sync_t {
+    mdns_result_t *result;
+    bool added;                     // created since the last notification
+    struct mdns_browse_result_sync_t *next;
+} mdns_browse_result_sync_t;
+
 typedef struct mdns_browse_s {
     struct mdns_browse_s *next;
 
     mdns_browse_state_t state;
     mdns_browse_notify_t notifier;
+    mdns_browse_diff_notify_t diff_notifier;
 
     char *service;
     char *proto;
     mdns_result_t *result;
+    mdns_browse_result_sync_t *pending; // results changed since the last notification, newest first
+    uint32_t flush_at;              // when the pending changes are notified
 } mdns_browse_t;
 
-typedef struct mdns_browse_result_sync_t {
-    mdns_result_t *result;
-    struct mdns_browse_result_sync_t *next;
-} mdns_browse_result_sync_t;
-
-typedef struct mdns_browse_sync {
-    mdns_browse_t *browse;
-    mdns_browse_result_sync_t *sync_result;
-} mdns_browse_sync_t;
-
 typedef struct mdns_server_s {
     struct {
         mdns_pcb_t pcbs[MDNS_IP_PROTOCOL_MAX];
@@ -414,10 +495,20 @@ typedef struct mdns_server_s {
     mdns_srv_item_t *services;
     QueueHandle_t action_queue;
     SemaphoreHandle_t action_sema;
-    mdns_tx_packet_t *tx_queue_head;
+    mdns_tx_packet_t **tx_queue;     // binary min-heap of scheduled packets, earliest send_at first
+    uint16_t tx_queue_len;
+    uint16_t tx_queue_size;
+    uint32_t tx_queue_seq;
+    atomic_bool tx_scheduled;       // tx_queue is not empty, published for the timer
+    atomic_uint tx_next_at;         // send_at of tx_queue[0], published for the timer
+    atomic_bool tx_pending;         // ACTION_TX_HANDLE posted and not yet executed
     mdns_search_once_t *search_once;
     esp_timer_handle_t timer_handle;
+    uint32_t timer_due_at;          // when the armed one-shot timer fires, guarded by the search lock
     mdns_browse_t *browse;
+    atomic_bool browse_scheduled;   // a browse has pending changes, published for the timer
+    atomic_uint browse_flush_at;    // earliest flush_at of the browses, published for the timer
+    atomic_bool browse_flush_pending;   // ACTION_BROWSE_FLUSH posted and not yet executed
 } mdns_server_t;
 
 typedef struct {
@@ -434,9 +525,6 @@ typedef struct {
         struct {
             mdns_search_once_t *search;
         } search_add;
-        struct {
-            mdns_tx_packet_t *packet;
-        } tx_handle;
         struct {
             mdns_rx_packet_t *packet;
         } rx_handle;
@@ -447,9 +535,6 @@ typedef struct {
         struct {
             mdns_browse_t *browse;
         } browse_add;
-        struct {
-            mdns_browse_sync_t *browse_sync;
-        } browse_sync;
     } data;
 } mdns_action_t;
 
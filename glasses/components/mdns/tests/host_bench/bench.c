@@ -0,0 +1,2520 @@
+/*
+ * Host microbenchmarks for the mDNS responder
+ *
+ * mdns.c is compiled into this file on top of the fuzzer's mocks, so the
+ * benchmarks can call the static packet builders and the action handler
+ * directly, without the service task or a network stack. Outgoing packets
+ * are captured instead of being sent.
+ *
+ *   ./mdns_bench [bench] [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include "pcap_file.h"
+
+// the mocks turn sends into a no-op, capture them instead
+#undef _mdns_udp_pcb_write
+size_t _mdns_udp_pcb_write(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, const esp_ip_addr_t *ip, uint16_t port, uint8_t *data, size_t len);
+
+/*
+ * The wakeups benchmark runs mdns.c on a clock it advances itself, with a
+ * one-shot esp_timer and a FIFO action queue on top of it. With s_sim.on
+ * unset, everything falls through to the fuzzer's mocks.
+ */
+#define SIM_QUEUE_LEN 64
+
+static struct {
+    bool on;
+    uint32_t now_ms;
+    esp_timer_cb_t cb;
+    bool armed;
+    uint32_t due_ms;
+    size_t wakeups;
+    uint32_t busy_ms;           // time with packets scheduled or searches running
+    mdns_action_t queue[SIM_QUEUE_LEN];
+    size_t head;
+    size_t tail;
+} s_sim;
+
+static uint32_t sim_tick_count(void)
+{
+    return s_sim.on ? s_sim.now_ms / portTICK_PERIOD_MS : xTaskGetTickCount();
+}
+
+static uint32_t sim_queue_send(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    if (!s_sim.on) {
+        return xQueueSend(queue, item, wait);
+    }
+    if (s_sim.tail - s_sim.head == SIM_QUEUE_LEN) {
+        return pdFAIL;
+    }
+    memcpy(&s_sim.queue[s_sim.tail++ % SIM_QUEUE_LEN], item, sizeof(mdns_action_t));
+    return pdPASS;
+}
+
+static esp_err_t sim_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+    if (!s_sim.on) {
+        return esp_timer_create(args, handle);
+    }
+    s_sim.cb = args->callback;
+    *handle = (esp_timer_handle_t)&s_sim;
+    return ESP_OK;
+}
+
+static esp_err_t sim_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (s_sim.armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_sim.armed = true;
+    s_sim.due_ms = s_sim.now_ms + (timeout_us + 999) / 1000;
+    return ESP_OK;
+}
+
+static esp_err_t sim_timer_stop(esp_timer_handle_t timer)
+{
+    s_sim.armed = false;
+    return ESP_OK;
+}
+
+static bool sim_timer_is_active(esp_timer_handle_t timer)
+{
+    return s_sim.armed;
+}
+
+/*
+ * The arena benchmark counts the calls mdns.c makes into the heap, the pcap
+ * benchmark the allocations and the peak of the bytes in use; each block
+ * carries its requested size in front of it. Checks make the next
+ * s_heap_fail allocations fail.
+ */
+#include "mdns_mem_caps.h"
+
+#define BENCH_MEM_HEADER 16
+
+static size_t s_heap_calls;
+static size_t s_heap_allocs;
+static size_t s_heap_live;
+static size_t s_heap_peak;
+static size_t s_heap_fail;
+
+static void *bench_mem_malloc(size_t size)
+{
+    s_heap_calls++;
+    if (s_heap_fail) {
+        s_heap_fail--;
+        return NULL;
+    }
+    uint8_t *p = mdns_mem_malloc(size + BENCH_MEM_HEADER);
+    if (!p) {
+        return NULL;
+    }
+    *(size_t *)p = size;
+    s_heap_allocs++;
+    s_heap_live += size;
+    if (s_heap_live > s_heap_peak) {
+        s_heap_peak = s_heap_live;
+    }
+    return p + BENCH_MEM_HEADER;
+}
+
+static void *bench_mem_calloc(size_t num, size_t size)
+{
+    void *p = bench_mem_malloc(num * size);
+    if (p) {
+        memset(p, 0, num * size);
+    }
+    return p;
+}
+
+static char *bench_mem_strndup(const char *s, size_t n)
+{
+    size_t len = n == SIZE_MAX ? strlen(s) : strnlen(s, n);
+    char *p = bench_mem_malloc(len + 1);
+    if (p) {
+        memcpy(p, s, len);
+        p[len] = '\0';
+    }
+    return p;
+}
+
+static void bench_mem_free(void *ptr)
+{
+    if (ptr) {
+        uint8_t *p = (uint8_t *)ptr - BENCH_MEM_HEADER;
+        s_heap_calls++;
+        s_heap_live -= *(size_t *)p;
+        mdns_mem_free(p);
+    }
+}
+
+#define mdns_mem_malloc(size)       bench_mem_malloc(size)
+#define mdns_mem_calloc(num, size)  bench_mem_calloc(num, size)
+#define mdns_mem_strdup(s)          bench_mem_strndup(s, SIZE_MAX)
+#define mdns_mem_strndup(s, n)      bench_mem_strndup(s, n)
+#define mdns_mem_free(ptr)          bench_mem_free(ptr)
+
+#define xTaskGetTickCount()     sim_tick_count()
+#define xQueueSend(q, i, w)     sim_queue_send(q, i, w)
+#define esp_timer_create(a, h)  sim_timer_create(a, h)
+#define esp_timer_start_once(t, us) sim_timer_start_once(t, us)
+#define esp_timer_stop(t)       sim_timer_stop(t)
+#define esp_timer_is_active(t)  sim_timer_is_active(t)
+
+#include "mdns.c"
+
+void GetLastItem(void *pvBuffer);
+
+static uint8_t s_tx[MDNS_MAX_PACKET_SIZE];
+static size_t s_tx_len;
+static size_t s_tx_count;
+static void (*s_tx_hook)(const uint8_t *data, size_t len);
+
+size_t _mdns_udp_pcb_write(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, const esp_ip_addr_t *ip, uint16_t port, uint8_t *data, size_t len)
+{
+    memcpy(s_tx, data, len);
+    s_tx_len = len;
+    s_tx_count++;
+    if (s_tx_hook) {
+        s_tx_hook(data, len);
+    }
+    return len;
+}
+
+/*
+ * esp_netif replacements (instead of the fuzzer's esp_netif_mock.c), so that
+ * address records have an address to carry
+ */
+const char *IP_EVENT = "IP_EVENT";
+
+esp_netif_t *esp_netif_next_unsafe(esp_netif_t *netif)
+{
+    return NULL;
+}
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key)
+{
+    return NULL;
+}
+
+static uint32_t s_ip4 = 0x0104a8c0;    // 192.168.4.1, network byte order
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info)
+{
+    memset(ip_info, 0, sizeof(*ip_info));
+    ip_info->ip.addr = s_ip4;
+    return ESP_OK;
+}
+
+#ifdef CONFIG_LWIP_IPV6
+// fe80::212:34ff:fe56:789a
+static const uint8_t s_ip6[16] = { 0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0x02, 0x12, 0x34, 0xff, 0xfe, 0x56, 0x78, 0x9a };
+
+esp_err_t esp_netif_get_ip6_linklocal(esp_netif_t *esp_netif, esp_ip6_addr_t *if_ip6)
+{
+    memset(if_ip6, 0, sizeof(*if_ip6));
+    memcpy(if_ip6->addr, s_ip6, sizeof(s_ip6));
+    return ESP_OK;
+}
+
+int esp_netif_get_all_ip6(esp_netif_t *esp_netif, esp_ip6_addr_t if_ip6[])
+{
+    esp_netif_get_ip6_linklocal(esp_netif, &if_ip6[0]);
+    return 1;
+}
+#endif /* CONFIG_LWIP_IPV6 */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Execute an action with the service lock held as _mdns_service_task() does
+ */
+static void execute_action_locked(mdns_action_t *a)
+{
+    bool locked = !_mdns_action_locks_itself(a->type);
+    if (locked) {
+        MDNS_SERVICE_LOCK();
+    }
+    _mdns_execute_action(a);
+    if (locked) {
+        MDNS_SERVICE_UNLOCK();
+    }
+}
+
+static void execute_last_action(void)
+{
+    mdns_action_t a;
+    GetLastItem(&a);
+    _mdns_execute_action(&a);
+}
+
+/*
+ * Totals over the packets captured by check_tx_packet(), which also checks
+ * that each packet is well formed
+ */
+static struct {
+    size_t packets;
+    size_t bytes;
+    size_t questions;
+    size_t records;
+    size_t truncated;           // packets with TC set
+    bool last_truncated;
+} s_split;
+
+static size_t skip_name(const uint8_t *data, size_t len, size_t index)
+{
+    for (;;) {
+        assert(index < len);
+        uint8_t label = data[index];
+        if ((label & 0xC0) == 0xC0) {
+            assert(index + 1 < len);
+            assert((size_t)(((label & 0x3F) << 8) | data[index + 1]) < index);
+            return index + 2;
+        }
+        assert(label <= 63);
+        index += 1 + label;
+        if (!label) {
+            return index;
+        }
+    }
+}
+
+static void check_tx_packet(const uint8_t *data, size_t len)
+{
+    assert(len <= MDNS_MAX_PACKET_SIZE);
+    uint16_t questions = _mdns_read_u16(data, MDNS_HEAD_QUESTIONS_OFFSET);
+    uint16_t records = _mdns_read_u16(data, MDNS_HEAD_ANSWERS_OFFSET) + _mdns_read_u16(data, MDNS_HEAD_SERVERS_OFFSET)
+                       + _mdns_read_u16(data, MDNS_HEAD_ADDITIONAL_OFFSET);
+    size_t index = MDNS_HEAD_LEN;
+    for (uint16_t i = 0; i < questions; i++) {
+        index = skip_name(data, len, index) + 4;
+    }
+    for (uint16_t i = 0; i < records; i++) {
+        index = skip_name(data, len, index);
+        assert(index + 10 <= len);
+        index += 10 + _mdns_read_u16(data, index + 8);
+    }
+    assert(index == len);
+
+    s_split.packets++;
+    s_split.bytes += len;
+    s_split.questions += questions;
+    s_split.records += records;
+    s_split.last_truncated = _mdns_read_u16(data, MDNS_HEAD_FLAGS_OFFSET) & MDNS_FLAGS_DISTRIBUTED;
+    s_split.truncated += s_split.last_truncated;
+}
+
+/**
+ * Records in the packet's lists, each serialised on its own
+ */
+static size_t count_records(mdns_tx_packet_t *p)
+{
+    static uint8_t scratch[MDNS_MAX_PACKET_SIZE];
+    mdns_out_answer_t *sections[] = { p->answers, p->servers, p->additional };
+    size_t records = 0;
+    for (size_t s = 0; s < sizeof(sections) / sizeof(sections[0]); s++) {
+        for (mdns_out_answer_t *a = sections[s]; a; a = a->next) {
+            uint16_t index = MDNS_HEAD_LEN;
+            _mdns_name_dict_reset(scratch);
+            records += _mdns_append_answer(scratch, &index, a, p->tcpip_if);
+        }
+    }
+    return records;
+}
+
+/**
+ * Bring the responder up with a hostname and `services` services, each with
+ * its own type and instance name and a small TXT record, like the camera's
+ * _http._tcp advertisement
+ */
+static void setup_responder(int services)
+{
+    mdns_txt_item_t txt[] = {
+        {"board", "esp32s3"},
+        {"path", "/stream"},
+    };
+
+    if (mdns_init()) {
+        abort();
+    }
+    for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        _mdns_server->interfaces[i].pcbs[MDNS_IP_PROTOCOL_V4].state = PCB_RUNNING;
+        _mdns_server->interfaces[i].pcbs[MDNS_IP_PROTOCOL_V6].state = PCB_RUNNING;
+    }
+    if (mdns_hostname_set("ai-glasses")) {
+        abort();
+    }
+    execute_last_action();
+
+    for (int i = 0; i < services; i++) {
+        char instance[32];
+        char type[16];
+        snprintf(instance, sizeof(instance), "AI Glasses Camera %02d", i);
+        snprintf(type, sizeof(type), "_svc%02d", i);
+        if (mdns_service_add(instance, type, "_tcp", 80 + i, txt, 2)) {
+            abort();
+        }
+    }
+}
+
+/**
+ * Drop the queued probes and mark every PCB as running, as if probing had
+ * completed without conflicts
+ */
+static void finish_probing(void)
+{
+    _mdns_clear_tx_queue();
+    for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        for (int j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
+            mdns_pcb_t *pcb = &_mdns_server->interfaces[i].pcbs[j];
+            mdns_mem_free(pcb->probe_services);
+            pcb->probe_services = NULL;
+            pcb->probe_services_len = 0;
+            pcb->probe_running = false;
+            pcb->state = PCB_RUNNING;
+        }
+    }
+}
+
+static void teardown_responder(void)
+{
+    // the mocked task handle is not a real allocation, there is no task to stop
+    _mdns_service_task_handle = NULL;
+    mdns_free();
+}
+
+static size_t collect_services(mdns_srv_item_t **out, size_t max)
+{
+    size_t n = 0;
+    for (mdns_srv_item_t *s = _mdns_server->services; s && n < max; s = s->next) {
+        out[n++] = s;
+    }
+    return n;
+}
+
+/**
+ * Serialise an announcement (SDPTR, PTR, SRV and TXT per service plus the
+ * host's addresses) into the wire buffer
+ */
+static void bench_announce(int iterations)
+{
+    static const int service_counts[] = { 1, 10, 50 };
+
+    printf("%-10s %8s %8s %8s %12s\n", "services", "records", "packets", "bytes", "ns/announce");
+    for (size_t c = 0; c < sizeof(service_counts) / sizeof(service_counts[0]); c++) {
+        mdns_srv_item_t *services[CONFIG_MDNS_MAX_SERVICES];
+        setup_responder(service_counts[c]);
+        size_t len = collect_services(services, CONFIG_MDNS_MAX_SERVICES);
+
+        mdns_tx_packet_t *p = _mdns_create_announce_packet(0, MDNS_IP_PROTOCOL_V4, services, len, true);
+        if (!p) {
+            abort();
+        }
+        _mdns_dispatch_tx_packet(p);    // warm up
+
+        uint64_t start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            _mdns_answer_cache_clear();     // measure the encoder, not the cache
+            _mdns_dispatch_tx_packet(p);
+        }
+        uint64_t elapsed = now_ns() - start;
+
+        memset(&s_split, 0, sizeof(s_split));
+        s_tx_hook = check_tx_packet;
+        _mdns_dispatch_tx_packet(p);
+        s_tx_hook = NULL;
+        printf("%-10zu %8zu %8zu %8zu %12.0f\n", len, s_split.records, s_split.packets, s_split.bytes,
+               (double)elapsed / iterations);
+
+        _mdns_free_tx_packet(p);
+        teardown_responder();
+    }
+}
+
+/**
+ * Answer a PTR query for the first service the way the responder does: build
+ * the answer list (PTR, SRV, TXT, A) and serialise it, cold (the answer cache
+ * is cleared every time) and warm
+ */
+static void bench_respond(int iterations)
+{
+    static const int service_counts[] = { 1, 10, 50 };
+    mdns_parsed_question_t question = { .type = MDNS_TYPE_PTR };
+
+    printf("%-10s %8s %14s %14s\n", "services", "bytes", "cold ns/resp", "warm ns/resp");
+    for (size_t c = 0; c < sizeof(service_counts) / sizeof(service_counts[0]); c++) {
+        mdns_srv_item_t *services[CONFIG_MDNS_MAX_SERVICES];
+        uint8_t cold[MDNS_MAX_PACKET_SIZE];
+        size_t cold_len = 0;
+        double ns[2];
+        setup_responder(service_counts[c]);
+        size_t len = collect_services(services, CONFIG_MDNS_MAX_SERVICES);
+
+        for (int warm = 0; warm < 2; warm++) {
+            uint64_t start = now_ns();
+            for (int i = 0; i < iterations; i++) {
+                mdns_tx_packet_t *p = _mdns_alloc_packet_default(0, MDNS_IP_PROTOCOL_V4);
+                if (!p || !_mdns_create_answer_from_service(p, services[len - 1]->service, &question, true, true)) {
+                    abort();
+                }
+                if (!warm) {
+                    _mdns_answer_cache_clear();
+                }
+                _mdns_dispatch_tx_packet(p);
+                _mdns_free_tx_packet(p);
+            }
+            ns[warm] = (double)(now_ns() - start) / iterations;
+            if (!warm) {
+                memcpy(cold, s_tx, s_tx_len);
+                cold_len = s_tx_len;
+            } else if (cold_len != s_tx_len || memcmp(cold, s_tx, cold_len)) {
+                fprintf(stderr, "cached response differs from the encoded one\n");
+                abort();
+            }
+        }
+        printf("%-10zu %8zu %14.0f %14.0f\n", len, s_tx_len, ns[0], ns[1]);
+        teardown_responder();
+    }
+}
+
+/**
+ * Schedule `pending` packets with random delays (probes, announcements and
+ * delayed answers all go through this queue), then take them out again in
+ * the order the service task would send them
+ */
+static void bench_schedule(int iterations)
+{
+    static const int pending_counts[] = { 4, 32, 256 };
+
+    printf("%-10s %14s %14s\n", "pending", "ns/schedule", "ns/pop");
+    setup_responder(0);
+    _mdns_clear_tx_queue();     // drop the hostname probes, only the benchmark's packets are queued
+    for (size_t c = 0; c < sizeof(pending_counts) / sizeof(pending_counts[0]); c++) {
+        int pending = pending_counts[c];
+        mdns_tx_packet_t **packets = malloc(pending * sizeof(mdns_tx_packet_t *));
+        uint64_t schedule_ns = 0;
+        uint64_t pop_ns = 0;
+        int rounds = iterations / pending + 1;
+
+        for (int i = 0; i < pending; i++) {
+            packets[i] = _mdns_alloc_packet_default(0, MDNS_IP_PROTOCOL_V4);
+            if (!packets[i]) {
+                abort();
+            }
+        }
+        srand(1);
+        for (int r = 0; r < rounds; r++) {
+            uint64_t start = now_ns();
+            for (int i = 0; i < pending; i++) {
+                _mdns_schedule_tx_packet(packets[i], rand() % 1000);
+            }
+            uint64_t mid = now_ns();
+            uint32_t last = 0;
+            for (int i = 0; i < pending; i++) {
+                mdns_tx_packet_t *p = _mdns_tx_queue_pop();
+                if (!p || (i && (int32_t)(p->send_at - last) < 0)) {
+                    fprintf(stderr, "packets popped out of order\n");
+                    abort();
+                }
+                last = p->send_at;
+            }
+            pop_ns += now_ns() - mid;
+            schedule_ns += mid - start;
+        }
+        printf("%-10d %14.0f %14.0f\n", pending,
+               (double)schedule_ns / ((uint64_t)rounds * pending), (double)pop_ns / ((uint64_t)rounds * pending));
+
+        for (int i = 0; i < pending; i++) {
+            _mdns_free_tx_packet(packets[i]);
+        }
+        free(packets);
+    }
+    teardown_responder();
+}
+
+/*
+ * Synthetic busy-LAN traffic: phones browsing for cast and AirPlay targets,
+ * printers, speakers and bridges announcing themselves, and now and then a
+ * query for the glasses
+ */
+typedef struct {
+    uint8_t data[MDNS_MAX_PACKET_SIZE];
+    size_t len;
+} wire_t;
+
+/*
+ * With s_wire_compress set, names end in a pointer to the longest suffix
+ * already written to the packet, as real responders do
+ */
+static bool s_wire_compress;
+static struct {
+    const char *suffix;
+    uint16_t offset;
+} s_wire_dict[64];
+static size_t s_wire_dict_len;
+
+static void wire_u16(wire_t *w, uint16_t value)
+{
+    w->data[w->len++] = value >> 8;
+    w->data[w->len++] = value & 0xff;
+}
+
+static void wire_name(wire_t *w, const char *name)
+{
+    while (*name) {
+        for (size_t i = 0; s_wire_compress && i < s_wire_dict_len; i++) {
+            if (!strcmp(s_wire_dict[i].suffix, name)) {
+                wire_u16(w, 0xC000 | s_wire_dict[i].offset);
+                return;
+            }
+        }
+        if (s_wire_compress && s_wire_dict_len < sizeof(s_wire_dict) / sizeof(s_wire_dict[0])) {
+            s_wire_dict[s_wire_dict_len].suffix = name;
+            s_wire_dict[s_wire_dict_len++].offset = w->len;
+        }
+        const char *dot = strchr(name, '.');
+        size_t len = dot ? (size_t)(dot - name) : strlen(name);
+        w->data[w->len++] = len;
+        memcpy(w->data + w->len, name, len);
+        w->len += len;
+        name += len + (dot ? 1 : 0);
+    }
+    w->data[w->len++] = 0;
+}
+
+static void wire_header(wire_t *w, uint16_t flags, uint16_t questions, uint16_t answers, uint16_t additional)
+{
+    w->len = 0;
+    s_wire_dict_len = 0;
+    wire_u16(w, 0);
+    wire_u16(w, flags);
+    wire_u16(w, questions);
+    wire_u16(w, answers);
+    wire_u16(w, 0);
+    wire_u16(w, additional);
+}
+
+static void wire_question(wire_t *w, const char *name, uint16_t type)
+{
+    wire_name(w, name);
+    wire_u16(w, type);
+    wire_u16(w, 1);
+}
+
+static void wire_record_head(wire_t *w, const char *name, uint16_t type, uint16_t ttl)
+{
+    wire_name(w, name);
+    wire_u16(w, type);
+    wire_u16(w, 0x8001);
+    wire_u16(w, 0);
+    wire_u16(w, ttl);
+}
+
+static void wire_ptr(wire_t *w, const char *name, const char *target, uint16_t ttl)
+{
+    wire_record_head(w, name, MDNS_TYPE_PTR, ttl);
+    size_t len_at = w->len;
+    wire_u16(w, 0);
+    wire_name(w, target);
+    w->data[len_at + 1] = w->len - len_at - 2;
+}
+
+static void wire_srv(wire_t *w, const char *instance, const char *host, uint16_t ttl)
+{
+    wire_record_head(w, instance, MDNS_TYPE_SRV, ttl);
+    size_t len_at = w->len;
+    wire_u16(w, 0);
+    wire_u16(w, 0);
+    wire_u16(w, 0);
+    wire_u16(w, 8009);
+    wire_name(w, host);
+    w->data[len_at + 1] = w->len - len_at - 2;
+}
+
+static void wire_txt(wire_t *w, const char *instance, const char *txt, uint16_t ttl)
+{
+    wire_record_head(w, instance, MDNS_TYPE_TXT, ttl);
+    wire_u16(w, strlen(txt));
+    for (const char *c = txt; *c; c++) {
+        w->data[w->len++] = *c == '|' ? (uint8_t)strcspn(c + 1, "|") : *c;
+    }
+}
+
+static void wire_a(wire_t *w, const char *host, uint16_t ttl)
+{
+    wire_record_head(w, host, MDNS_TYPE_A, ttl);
+    wire_u16(w, 4);
+    memcpy(w->data + w->len, "\xc0\xa8\x04\x14", 4);
+    w->len += 4;
+}
+
+static void wire_srv_txt_a(wire_t *w, const char *instance, const char *host, const char *txt)
+{
+    wire_srv(w, instance, host, 120);
+    wire_txt(w, instance, txt, 120);
+    wire_a(w, host, 120);
+}
+
+static size_t build_lan_traffic(wire_t *out)
+{
+    // TXT strings are written as |key=value|key=value, '|' becomes the length byte
+    static const char *cast_txt = "|id=5b1e1d2c8c0e4c5d9f3a|cd=0A1B2C3D4E5F|rm=|ve=05|md=Chromecast|ic=/setup/icon.png|fn=Living Room TV|ca=465413|st=0|bs=FA8FCA7E8F4B|nf=1|rs=";
+    static const char *ipp_txt = "|txtvers=1|qtotal=1|rp=ipp/print|ty=HP LaserJet 400|adminurl=http://hp-laserjet.local/|note=Office|priority=50|product=(HP LaserJet 400)|pdl=application/pdf,image/urf|Color=F|Duplex=T|URF=W8,SRGB24,RS600";
+    size_t n = 0;
+    wire_t *w;
+
+    w = &out[n++];
+    wire_header(w, 0, 1, 0, 0);
+    wire_question(w, "_googlecast._tcp.local", MDNS_TYPE_PTR);
+
+    w = &out[n++];
+    wire_header(w, 0, 2, 2, 0);
+    wire_question(w, "_airplay._tcp.local", MDNS_TYPE_PTR);
+    wire_question(w, "_raop._tcp.local", MDNS_TYPE_PTR);
+    wire_ptr(w, "_airplay._tcp.local", "Living Room._airplay._tcp.local", 120);
+    wire_ptr(w, "_raop._tcp.local", "A0B1C2D3E4F5@Living Room._raop._tcp.local", 120);
+
+    w = &out[n++];
+    wire_header(w, MDNS_FLAGS_QR_AUTHORITATIVE, 0, 1, 3);
+    wire_ptr(w, "_googlecast._tcp.local", "Chromecast-5b1e1d2c._googlecast._tcp.local", 120);
+    wire_srv_txt_a(w, "Chromecast-5b1e1d2c._googlecast._tcp.local", "5b1e1d2c-8c0e.local", cast_txt);
+
+    w = &out[n++];
+    wire_header(w, 0, 2, 0, 0);
+    wire_question(w, "MacBook-Pro.local", MDNS_TYPE_A);
+    wire_question(w, "MacBook-Pro.local", MDNS_TYPE_AAAA);
+
+    w = &out[n++];
+    wire_header(w, MDNS_FLAGS_QR_AUTHORITATIVE, 0, 1, 3);
+    wire_ptr(w, "_ipp._tcp.local", "HP LaserJet 400._ipp._tcp.local", 120);
+    wire_srv_txt_a(w, "HP LaserJet 400._ipp._tcp.local", "hp-laserjet.local", ipp_txt);
+
+    w = &out[n++];
+    wire_header(w, 0, 1, 0, 0);
+    wire_question(w, "_companion-link._tcp.local", MDNS_TYPE_PTR);
+
+    w = &out[n++];
+    wire_header(w, MDNS_FLAGS_QR_AUTHORITATIVE, 0, 1, 3);
+    wire_ptr(w, "_sonos._tcp.local", "Sonos-B8E9375A1C2D@Kitchen._sonos._tcp.local", 120);
+    wire_srv_txt_a(w, "Sonos-B8E9375A1C2D@Kitchen._sonos._tcp.local", "Sonos-B8E9375A1C2D.local", "|info=/api/v1/players/RINCON_B8E9375A1C2D01400/info|vers=3|protovers=1.24.1|bootseq=84|hhid=Sonos_abcdef|mhhid=Sonos_abcdef.1|locationid=lc_abcdef");
+
+    w = &out[n++];
+    wire_header(w, 0, 1, 0, 0);
+    wire_question(w, "_hue._tcp.local", MDNS_TYPE_PTR);
+
+    w = &out[n++];
+    wire_header(w, MDNS_FLAGS_QR_AUTHORITATIVE, 0, 1, 3);
+    wire_ptr(w, "_hue._tcp.local", "Hue Bridge - 1A2B3C._hue._tcp.local", 120);
+    wire_srv_txt_a(w, "Hue Bridge - 1A2B3C._hue._tcp.local", "ecb5fa1a2b3c.local", "|bridgeid=ecb5fafffe1a2b3c|modelid=BSB002");
+
+    // one in ten packets concerns us
+    w = &out[n++];
+    wire_header(w, 0, 1, 0, 0);
+    wire_question(w, "_svc00._tcp.local", MDNS_TYPE_PTR);
+    return n;
+}
+
+/**
+ * Wrap a wire packet as if it was multicast by 192.168.4.`host`
+ */
+static void wrap_rx_packet(mdns_rx_packet_t *packet, struct pbuf *pb, wire_t *w, uint8_t host)
+{
+    memset(pb, 0, sizeof(*pb));
+    pb->payload = w->data;
+    pb->len = pb->tot_len = w->len;
+    memset(packet, 0, sizeof(*packet));
+    packet->pb = pb;
+    packet->tcpip_if = 0;
+    packet->ip_protocol = MDNS_IP_PROTOCOL_V4;
+    packet->src.type = ESP_IPADDR_TYPE_V4;
+    packet->src.u_addr.ip4.addr = ((uint32_t)host << 24) | 0x04a8c0;
+    packet->src_port = MDNS_SERVICE_PORT;
+    packet->multicast = 1;
+}
+
+/**
+ * Replay the traffic through the receive path with and without the
+ * pre-filter, counting the packets that reach the full parser
+ */
+static void bench_rx(int iterations)
+{
+    static wire_t traffic[16];
+    struct pbuf pbufs[16];
+    mdns_rx_packet_t packets[16];
+    size_t n = build_lan_traffic(traffic);
+
+    setup_responder(1);
+    finish_probing();
+    for (size_t i = 0; i < n; i++) {
+        wrap_rx_packet(&packets[i], &pbufs[i], &traffic[i], 50);
+    }
+
+    printf("%-12s %12s %12s %10s\n", "mode", "ns/packet", "packets/s", "parsed");
+    double ns[2];
+    for (int filter = 0; filter < 2; filter++) {
+        size_t parsed = 0;
+        uint64_t start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            mdns_rx_packet_t *p = &packets[i % n];
+            if (filter) {
+                if (_mdns_prefilter_pass(p->pb->payload, p->pb->len)) {
+                    parsed++;
+                    mdns_parse_packet(p);
+                }
+            } else {
+                parsed++;
+                mdns_parse_packet(p);
+            }
+            _mdns_clear_tx_queue();     // answers to our queries are not sent here
+        }
+        ns[filter] = (double)(now_ns() - start) / iterations;
+        printf("%-12s %12.0f %12.0f %10zu\n", filter ? "pre-filter" : "full parse", ns[filter], 1e9 / ns[filter], parsed);
+    }
+    printf("CPU time saved: %.0f%%\n", 100.0 * (ns[0] - ns[1]) / ns[0]);
+    teardown_responder();
+}
+
+/**
+ * The recursive name reader _mdns_read_fqdn() replaced, as reference
+ */
+static const uint8_t *ref_read_fqdn(const uint8_t *packet, const uint8_t *start, mdns_name_t *name, char *buf, size_t packet_len)
+{
+    size_t index = 0;
+    const uint8_t *packet_end = packet + packet_len;
+    while (start + index < packet_end && start[index]) {
+        if (name->parts == 4) {
+            name->invalid = true;
+        }
+        uint8_t len = start[index++];
+        if (len < 0xC0) {
+            if (len > 63) {
+                return NULL;
+            }
+            for (uint8_t i = 0; i < len; i++) {
+                if (start + index >= packet_end) {
+                    return NULL;
+                }
+                buf[i] = start[index++];
+            }
+            buf[len] = '\0';
+            if (name->parts == 1 && buf[0] != '_' && strcasecmp(buf, MDNS_DEFAULT_DOMAIN) && strcasecmp(buf, "arpa")
+                    && strcasecmp(buf, "ip6") && strcasecmp(buf, "in-addr")) {
+                strlcat(name->host, ".", sizeof(name->host));
+                strlcat(name->host, buf, sizeof(name->host));
+            } else if (strcasecmp(buf, MDNS_SUB_STR) == 0) {
+                name->sub = 1;
+            } else if (!name->invalid) {
+                char *mdns_name_ptrs[] = {name->host, name->service, name->proto, name->domain};
+                memcpy(mdns_name_ptrs[name->parts++], buf, len + 1);
+            }
+        } else {
+            size_t address = (((uint16_t)len & 0x3F) << 8) | start[index++];
+            if ((packet + address) >= start) {
+                return NULL;
+            }
+            if (ref_read_fqdn(packet, packet + address, name, buf, packet_len)) {
+                return start + index;
+            }
+            return NULL;
+        }
+    }
+    return start + index + 1;
+}
+
+static const uint8_t *ref_parse_fqdn(const uint8_t *packet, const uint8_t *start, mdns_name_t *name, size_t packet_len)
+{
+    static char buf[MDNS_NAME_BUF_LEN];
+    memset(name, 0, sizeof(*name));
+    const uint8_t *next_data = ref_read_fqdn(packet, start, name, buf, packet_len);
+    if (!next_data || !name->parts || name->invalid) {
+        return next_data;
+    }
+    if (name->parts == 3) {
+        memmove((uint8_t *)name + (MDNS_NAME_BUF_LEN), (uint8_t *)name, 3 * (MDNS_NAME_BUF_LEN));
+        name->host[0] = 0;
+    } else if (name->parts == 2) {
+        memmove((uint8_t *)(name->domain), (uint8_t *)(name->service), (MDNS_NAME_BUF_LEN));
+        name->service[0] = 0;
+        name->proto[0] = 0;
+    }
+    if (strcasecmp(name->domain, MDNS_DEFAULT_DOMAIN) && strcasecmp(name->domain, "arpa")) {
+        name->invalid = true;
+    }
+    return next_data;
+}
+
+static bool same_name(const mdns_name_t *a, const mdns_name_t *b)
+{
+    return a->invalid == b->invalid && (a->invalid || (a->parts == b->parts && a->sub == b->sub && !strcmp(a->host, b->host)
+                                        && !strcmp(a->service, b->service) && !strcmp(a->proto, b->proto) && !strcmp(a->domain, b->domain)));
+}
+
+/**
+ * Parse the name at every offset of the packet with and without the label
+ * table, forwards and backwards, and abort if the results differ
+ */
+static void check_fqdn_offsets(const uint8_t *data, size_t len)
+{
+    static mdns_name_t walked[MDNS_MAX_PACKET_SIZE];
+    static const uint8_t *walked_end[MDNS_MAX_PACKET_SIZE];
+    mdns_name_t name;
+
+    for (size_t i = 0; i < len; i++) {
+        walked_end[i] = _mdns_parse_fqdn(data, data + i, &walked[i], len);
+    }
+    _mdns_labels_bind(data);
+    for (size_t n = 0; n < 2 * len; n++) {
+        size_t i = n < len ? n : 2 * len - 1 - n;
+        const uint8_t *end = _mdns_parse_fqdn(data, data + i, &name, len);
+        if (end != walked_end[i] || (end && !same_name(&name, &walked[i]))) {
+            fprintf(stderr, "label table changes the name at offset %zu\n", i);
+            abort();
+        }
+    }
+    _mdns_labels_bind(NULL);
+}
+
+/**
+ * Offsets of the names in a packet: questions, record owners and the
+ * targets of PTR and SRV records
+ */
+static size_t collect_names(const wire_t *w, uint16_t *names, size_t max)
+{
+    uint16_t questions = _mdns_read_u16(w->data, MDNS_HEAD_QUESTIONS_OFFSET);
+    uint16_t records = _mdns_read_u16(w->data, MDNS_HEAD_ANSWERS_OFFSET) + _mdns_read_u16(w->data, MDNS_HEAD_SERVERS_OFFSET)
+                       + _mdns_read_u16(w->data, MDNS_HEAD_ADDITIONAL_OFFSET);
+    size_t index = MDNS_HEAD_LEN;
+    size_t n = 0;
+    for (uint16_t i = 0; i < questions && n < max; i++) {
+        names[n++] = index;
+        index = skip_name(w->data, w->len, index) + 4;
+    }
+    for (uint16_t i = 0; i < records && n < max; i++) {
+        names[n++] = index;
+        index = skip_name(w->data, w->len, index);
+        uint16_t type = _mdns_read_u16(w->data, index);
+        if (type == MDNS_TYPE_PTR && n < max) {
+            names[n++] = index + 10;
+        } else if (type == MDNS_TYPE_SRV && n < max) {
+            names[n++] = index + 10 + MDNS_SRV_FQDN_OFFSET;
+        }
+        index += 10 + _mdns_read_u16(w->data, index + 8);
+    }
+    return n;
+}
+
+/**
+ * Time parsing every name of a set of packets, in ns per name: with the old
+ * recursive reader, walking each name, and with the label table bound to the
+ * packet as mdns_parse_packet() does
+ */
+static void time_fqdn(const char *label, const wire_t *packets, size_t n, uint16_t (*names)[64], const size_t *counts, int iterations)
+{
+    mdns_name_t name;
+    size_t total = 0;
+    double ns[3];
+
+    for (size_t p = 0; p < n; p++) {
+        total += counts[p];
+    }
+    for (int mode = 0; mode < 3; mode++) {
+        uint64_t start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            const wire_t *w = &packets[i % n];
+            const uint16_t *offsets = names[i % n];
+            if (mode == 2) {
+                _mdns_labels_bind(w->data);
+            }
+            for (size_t k = 0; k < counts[i % n]; k++) {
+                if (mode == 0) {
+                    ref_parse_fqdn(w->data, w->data + offsets[k], &name, w->len);
+                } else {
+                    _mdns_parse_fqdn(w->data, w->data + offsets[k], &name, w->len);
+                }
+            }
+            if (mode == 2) {
+                _mdns_labels_bind(NULL);
+            }
+        }
+        ns[mode] = (double)(now_ns() - start) / iterations / ((double)total / n);
+    }
+    printf("%-16s %8zu %12.0f %12.0f %12.0f\n", label, total / n, ns[0], ns[1], ns[2]);
+}
+
+static void bench_fqdn(int iterations)
+{
+    static wire_t traffic[16];
+    static wire_t announce;
+    static wire_t chain;
+    static wire_t loops[3];
+    static uint16_t names[16][64];
+    size_t counts[16];
+    mdns_name_t name, ref;
+
+    // the busy-LAN mix of the rx benchmark, compressed
+    s_wire_compress = true;
+    size_t n = build_lan_traffic(traffic);
+    s_wire_compress = false;
+    for (size_t p = 0; p < n; p++) {
+        counts[p] = collect_names(&traffic[p], names[p], 64);
+        for (size_t k = 0; k < counts[p]; k++) {
+            const uint8_t *end = _mdns_parse_fqdn(traffic[p].data, traffic[p].data + names[p][k], &name, traffic[p].len);
+            if (!end || end != ref_parse_fqdn(traffic[p].data, traffic[p].data + names[p][k], &ref, traffic[p].len)
+                    || !same_name(&name, &ref)) {
+                fprintf(stderr, "name at offset %u of packet %zu differs from the recursive reader\n", names[p][k], p);
+                abort();
+            }
+        }
+        check_fqdn_offsets(traffic[p].data, traffic[p].len);
+    }
+
+    // an announcement of ten services from our own encoder, most names in it end in a pointer
+    mdns_srv_item_t *services[CONFIG_MDNS_MAX_SERVICES];
+    setup_responder(10);
+    size_t len = collect_services(services, CONFIG_MDNS_MAX_SERVICES);
+    mdns_tx_packet_t *packet = _mdns_create_announce_packet(0, MDNS_IP_PROTOCOL_V4, services, len, true);
+    if (!packet) {
+        abort();
+    }
+    _mdns_dispatch_tx_packet(packet);
+    _mdns_free_tx_packet(packet);
+    teardown_responder();
+    memcpy(announce.data, s_tx, s_tx_len);
+    announce.len = s_tx_len;
+    size_t announce_count = collect_names(&announce, names[n], 64);
+    check_fqdn_offsets(announce.data, announce.len);
+
+    // 120 names each adding a label in front of the previous one through a pointer
+    wire_header(&chain, 0, 0, 0, 0);
+    uint16_t chain_names[1][64];
+    size_t chain_count = 0;
+    wire_name(&chain, "local");
+    for (int k = 1; k <= 120; k++) {
+        size_t at = chain.len;
+        chain.data[chain.len++] = 1;
+        chain.data[chain.len++] = 'a' + k % 26;
+        wire_u16(&chain, 0xC000 | (at - (k == 1 ? 7 : 4)));
+        if (k % 4 == 0) {
+            chain_names[0][chain_count++] = at;
+        }
+    }
+    for (size_t k = 0; k < chain_count; k++) {
+        const uint8_t *end = _mdns_parse_fqdn(chain.data, chain.data + chain_names[0][k], &name, chain.len);
+        ref_parse_fqdn(chain.data, chain.data + chain_names[0][k], &ref, chain.len);
+        // a name is ignored after MDNS_FQDN_MAX_HOPS pointers, but its end is still found
+        if (end != chain.data + chain_names[0][k] + 4 || (k * 4 + 4 <= MDNS_FQDN_MAX_HOPS ? !same_name(&name, &ref) : !name.invalid)) {
+            fprintf(stderr, "unexpected result for a name with %zu pointers\n", k * 4 + 4);
+            abort();
+        }
+    }
+    check_fqdn_offsets(chain.data, chain.len);
+
+    // pointers to themselves, forward, and back into a label run the name came through
+    static const uint8_t loop_data[][8] = {
+        { 0xC0, 0x0C },
+        { 0xC0, 0x0E, 0x00 },
+        { 0x01, 'b', 0x01, 'c', 0x01, 'd', 0xC0, 0x0E },
+    };
+    static const size_t loop_len[] = { 2, 3, 8 };
+    for (size_t l = 0; l < sizeof(loop_len) / sizeof(loop_len[0]); l++) {
+        wire_header(&loops[l], 0, 1, 0, 0);
+        memcpy(loops[l].data + loops[l].len, loop_data[l], loop_len[l]);
+        loops[l].len += loop_len[l];
+        if (_mdns_parse_fqdn(loops[l].data, loops[l].data + MDNS_HEAD_LEN, &name, loops[l].len)) {
+            fprintf(stderr, "pointer loop %zu was accepted\n", l);
+            abort();
+        }
+        check_fqdn_offsets(loops[l].data, loops[l].len);
+    }
+
+    printf("%-16s %8s %12s %12s %12s\n", "packets", "names", "recursive", "walk", "label table");
+    time_fqdn("busy LAN", traffic, n, names, counts, iterations);
+    time_fqdn("announcement", &announce, 1, &names[n], &announce_count, iterations / 10 + 1);
+    time_fqdn("pointer chain", &chain, 1, chain_names, &chain_count, iterations / 10 + 1);
+}
+
+/**
+ * Send everything scheduled, as the transmit timer would
+ */
+static void flush_tx_queue(void)
+{
+    while (_mdns_server->tx_queue_len) {
+        _mdns_tx_handle_packet(_mdns_tx_queue_pop());
+    }
+}
+
+/**
+ * No record may be queued as an answer and as an additional record of the same packet
+ */
+static void check_no_duplicate_additional(const char *scenario)
+{
+    for (uint16_t i = 0; i < _mdns_server->tx_queue_len; i++) {
+        mdns_tx_packet_t *p = _mdns_server->tx_queue[i];
+        for (mdns_out_answer_t *a = p->additional; a; a = a->next) {
+            for (mdns_out_answer_t *b = p->answers; b; b = b->next) {
+                // addresses are written from the host alone, whatever service queued them
+                bool address = a->type == MDNS_TYPE_A || a->type == MDNS_TYPE_AAAA;
+                if (a->type == b->type && a->host == b->host && (address || a->service == b->service)) {
+                    fprintf(stderr, "%s: type %u queued as answer and additional\n", scenario, a->type);
+                    abort();
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Several hosts asking for the camera's service type at once, with and
+ * without the answer in their known-answer list, counting the multicast
+ * responses that go out
+ */
+static void bench_suppress(int iterations)
+{
+    static const struct {
+        const char *name;
+        int known_answer_ttl;       // -1 for none
+        bool answered_before;       // the answer was multicast just before
+        bool ask_a;                 // all but the first host also ask for the hostname's A record
+        size_t expected;
+    } scenarios[] = {
+        { "same question", -1, false, false, 1 },
+        { "repeat within 1s", -1, true, false, 0 },
+        { "fresh known answer", MDNS_ANSWER_PTR_TTL, false, false, 0 },
+        { "stale known answer", MDNS_ANSWER_PTR_TTL / 4, false, false, 1 },
+        { "A also asked", -1, false, true, 1 },
+    };
+    enum { HOSTS = 8 };
+    static wire_t queries[HOSTS];
+    struct pbuf pbufs[HOSTS];
+    mdns_rx_packet_t packets[HOSTS];
+
+    setup_responder(1);
+    finish_probing();
+    printf("%-20s %8s %10s %12s\n", "scenario", "queries", "responses", "ns/query");
+    for (size_t c = 0; c < sizeof(scenarios) / sizeof(scenarios[0]); c++) {
+        for (int h = 0; h < HOSTS; h++) {
+            wire_t *w = &queries[h];
+            bool ask_a = scenarios[c].ask_a && h > 0;
+            wire_header(w, 0, ask_a ? 2 : 1, scenarios[c].known_answer_ttl < 0 ? 0 : 1, 0);
+            wire_question(w, "_svc00._tcp.local", MDNS_TYPE_PTR);
+            if (ask_a) {
+                wire_question(w, "ai-glasses.local", MDNS_TYPE_A);
+            }
+            if (scenarios[c].known_answer_ttl >= 0) {
+                wire_ptr(w, "_svc00._tcp.local", "AI Glasses Camera 00._svc00._tcp.local", scenarios[c].known_answer_ttl);
+            }
+            wrap_rx_packet(&packets[h], &pbufs[h], w, 50 + h);
+        }
+
+        size_t responses = 0;
+        uint64_t elapsed = 0;
+        for (int i = 0; i < iterations; i++) {
+            memset(s_recent_answers, 0, sizeof(s_recent_answers));
+            if (scenarios[c].answered_before) {
+                mdns_parse_packet(&packets[0]);
+                flush_tx_queue();
+            }
+            size_t sent = s_tx_count;
+            uint64_t start = now_ns();
+            for (int h = 0; h < HOSTS; h++) {
+                mdns_parse_packet(&packets[h]);
+            }
+            elapsed += now_ns() - start;
+            check_no_duplicate_additional(scenarios[c].name);
+            flush_tx_queue();
+            responses = s_tx_count - sent;
+            if (responses != scenarios[c].expected) {
+                fprintf(stderr, "%s: %zu responses, expected %zu\n", scenarios[c].name, responses, scenarios[c].expected);
+                abort();
+            }
+        }
+        printf("%-20s %8d %10zu %12.0f\n", scenarios[c].name, HOSTS, responses, (double)elapsed / iterations / HOSTS);
+    }
+    teardown_responder();
+}
+
+/**
+ * Answer sets larger than one packet: every record must arrive in one of
+ * the packets, queries continue with TC set, legacy unicast responses are
+ * cut short with TC set
+ */
+static void bench_split(int iterations)
+{
+    mdns_txt_item_t big_txt[24];
+    char keys[24][8];
+    char value[48];
+    memset(value, 'v', sizeof(value) - 1);
+    value[sizeof(value) - 1] = 0;
+    for (int i = 0; i < 24; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "key%02d", i);
+        big_txt[i].key = keys[i];
+        big_txt[i].value = value;
+    }
+
+    printf("%-22s %8s %8s %8s %8s %12s\n", "packet", "records", "packets", "bytes", "TC", "ns/dispatch");
+    for (int c = 0; c < 4; c++) {
+        const char *name;
+        mdns_srv_item_t *services[CONFIG_MDNS_MAX_SERVICES];
+        mdns_tx_packet_t *p;
+
+        setup_responder(c == 1 ? 1 : 50);
+        size_t len = collect_services(services, CONFIG_MDNS_MAX_SERVICES);
+        for (size_t i = 0; i < len; i++) {
+            mdns_service_t *srv = services[i]->service;
+            if (mdns_service_subtype_add_for_host(srv->instance, srv->service, srv->proto, NULL, "_printer")
+                    || mdns_service_subtype_add_for_host(srv->instance, srv->service, srv->proto, NULL, "_camera")) {
+                abort();
+            }
+        }
+        if (c == 1) {
+            name = "1 service, 1.2KB TXT";
+            if (mdns_service_txt_set("_svc00", "_tcp", big_txt, 24)) {
+                abort();
+            }
+            p = _mdns_create_announce_packet(0, MDNS_IP_PROTOCOL_V4, services, len, true);
+        } else if (c == 2) {
+            name = "probe, 50 services";
+            p = _mdns_create_probe_packet(0, MDNS_IP_PROTOCOL_V4, services, len, true, true);
+        } else {
+            name = c == 0 ? "announce, 50 services" : "legacy unicast";
+            p = _mdns_create_announce_packet(0, MDNS_IP_PROTOCOL_V4, services, len, true);
+        }
+        if (!p) {
+            abort();
+        }
+        if (c == 3) {
+            p->port = 12345;
+        }
+        size_t expected = count_records(p);
+
+        s_tx_hook = check_tx_packet;
+        uint64_t elapsed = 0;
+        for (int i = 0; i < iterations; i++) {
+            memset(&s_split, 0, sizeof(s_split));
+            _mdns_answer_cache_clear();
+            uint64_t start = now_ns();
+            _mdns_dispatch_tx_packet(p);
+            elapsed += now_ns() - start;
+
+            if (c == 3) {
+                assert(s_split.packets == 1 && s_split.truncated == 1 && s_split.records < expected);
+            } else {
+                assert(s_split.records == expected);
+                assert(!s_split.last_truncated);
+            }
+            if (c == 2) {
+                assert(s_split.truncated == s_split.packets - 1);
+            } else if (c != 3) {
+                assert(s_split.truncated == 0);
+            }
+        }
+        s_tx_hook = NULL;
+        printf("%-22s %8zu %8zu %8zu %8zu %12.0f\n", name, s_split.records, s_split.packets, s_split.bytes,
+               s_split.truncated, (double)elapsed / iterations);
+
+        _mdns_free_tx_packet(p);
+        teardown_responder();
+    }
+}
+
+/**
+ * Run one search on the mocked clock, which advances a millisecond per
+ * reading, as the search timer and the service task would, and feed it
+ * `answer` once `answer_at` ms have passed
+ *
+ * @return ms until the search finished
+ */
+static uint32_t simulate_lookup(mdns_search_once_t *search, mdns_rx_packet_t *answer, uint32_t answer_at, size_t *queries)
+{
+    mdns_action_t idle = { .type = ACTION_TASK_STOP };
+    size_t tx = s_tx_count;
+    uint32_t started_at = search->started_at;
+
+    _mdns_search_add(search);
+    while (search->state != SEARCH_OFF) {
+        if (answer && xTaskGetTickCount() * portTICK_PERIOD_MS - started_at >= answer_at) {
+            mdns_parse_packet(answer);
+            answer = NULL;
+            continue;
+        }
+        xQueueSend(_mdns_server->action_queue, &idle, 0);
+        _mdns_search_run();
+        mdns_action_t a;
+        GetLastItem(&a);
+        if (a.type != ACTION_TASK_STOP) {
+            _mdns_execute_action(&a);
+        }
+    }
+    *queries = s_tx_count - tx;
+    return xTaskGetTickCount() * portTICK_PERIOD_MS - started_at;
+}
+
+/**
+ * Lookups with no result limit, answered by a responder after 40 ms or not
+ * at all: unique records end the search with the response, shared records
+ * and lookups nobody answers run until the timeout, and the query is
+ * repeated with doubling intervals meanwhile
+ */
+static void bench_lookup(int iterations)
+{
+    static const struct {
+        const char *label;
+        uint16_t type;
+        bool answered;
+        bool flush;
+        uint32_t timeout;
+        uint32_t max_ms;            // expected completion time, at most
+        uint32_t min_ms;            // and at least
+        size_t queries;
+    } lookups[] = {
+        { "A, unique answer", MDNS_TYPE_A, true, true, 3000, 100, 40, 1 },
+        { "ANY, unique answer", MDNS_TYPE_ANY, true, true, 3000, 100, 40, 1 },
+        { "A, no cache-flush", MDNS_TYPE_A, true, false, 3000, 3100, 3000, 2 },
+        { "PTR, shared answer", MDNS_TYPE_PTR, true, false, 3000, 3100, 3000, 2 },
+        { "A, no answer, 10s", MDNS_TYPE_A, false, false, 10000, 10100, 10000, 4 },
+    };
+    wire_t response[2];
+    struct pbuf pbufs[2];
+    mdns_rx_packet_t packets[2];
+
+    // the printer's address with and without the cache-flush bit, and its service
+    for (int flush = 0; flush < 2; flush++) {
+        wire_t *w = &response[flush];
+        wire_header(w, MDNS_FLAGS_QR_AUTHORITATIVE, 0, 2, 0);
+        wire_record_head(w, "hp-laserjet.local", MDNS_TYPE_A, 120);
+        w->data[w->len - 6] = flush ? 0x80 : 0;
+        wire_u16(w, 4);
+        memcpy(w->data + w->len, "\xc0\xa8\x04\x14", 4);
+        w->len += 4;
+        wire_ptr(w, "_ipp._tcp.local", "HP LaserJet 400._ipp._tcp.local", 120);
+        wrap_rx_packet(&packets[flush], &pbufs[flush], w, 20);
+    }
+
+    setup_responder(1);
+    finish_probing();
+    // one interface, so that every query is one packet
+    for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        for (int j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
+            if (i || j != MDNS_IP_PROTOCOL_V4) {
+                _mdns_server->interfaces[i].pcbs[j].state = PCB_OFF;
+            }
+        }
+    }
+    printf("%-22s %14s %10s %10s\n", "lookup", "completed ms", "queries", "results");
+    for (size_t l = 0; l < sizeof(lookups) / sizeof(lookups[0]); l++) {
+        bool ptr = lookups[l].type == MDNS_TYPE_PTR;
+        uint32_t ms = 0;
+        size_t queries = 0;
+        size_t results = 0;
+        for (int i = 0; i < iterations; i++) {
+#if CONFIG_MDNS_PASSIVE_CACHE
+            _mdns_cache_clear(MDNS_MAX_INTERFACES, MDNS_IP_PROTOCOL_V4);   // the network path is measured here
+#endif
+            mdns_search_once_t *search = _mdns_search_init(ptr ? NULL : "hp-laserjet", ptr ? "_ipp" : NULL, ptr ? "_tcp" : NULL,
+                                                           lookups[l].type, !ptr, lookups[l].timeout, 0, NULL);
+            if (!search) {
+                abort();
+            }
+            ms = simulate_lookup(search, lookups[l].answered ? &packets[lookups[l].flush] : NULL, 40, &queries);
+            results = search->num_results;
+            _mdns_query_results_free(search->result);
+            _mdns_search_free(search);
+            _mdns_clear_tx_queue();
+            if (ms < lookups[l].min_ms || ms > lookups[l].max_ms || queries != lookups[l].queries
+                    || results != (lookups[l].answered ? 1 : 0)) {
+                printf("%-22s %14" PRIu32 " %10zu %10zu  unexpected\n", lookups[l].label, ms, queries, results);
+                abort();
+            }
+        }
+        printf("%-22s %14" PRIu32 " %10zu %10zu\n", lookups[l].label, ms, queries, results);
+    }
+    teardown_responder();
+}
+
+/**
+ * The list walks that the registry index replaces, as reference
+ */
+static mdns_srv_item_t *linear_service(const char *instance, const char *service, const char *proto, const char *hostname)
+{
+    for (mdns_srv_item_t *s = _mdns_server->services; s; s = s->next) {
+        if (instance ? _mdns_service_match_instance(s->service, instance, service, proto, hostname)
+                : _mdns_service_match(s->service, service, proto, hostname)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static mdns_srv_item_t *linear_subtype(const char *subtype, const char *service, const char *proto)
+{
+    for (mdns_srv_item_t *s = _mdns_server->services; s; s = s->next) {
+        if (_mdns_service_match(s->service, service, proto, NULL) && _mdns_service_has_subtype(s->service, subtype)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static mdns_host_item_t *linear_host(const char *hostname)
+{
+    if (!strcasecmp(hostname, _mdns_server->hostname)) {
+        return &_mdns_self_host;
+    }
+    for (mdns_host_item_t *host = _mdns_host_list; host; host = host->next) {
+        if (!strcasecmp(host->hostname, hostname)) {
+            return host;
+        }
+    }
+    return NULL;
+}
+
+static void upper(char *out, const char *in)
+{
+    do {
+        *out++ = toupper((unsigned char)*in);
+    } while (*in++);
+}
+
+#define CHECK_SAME(indexed, linear, what, name) do {                            \
+        if ((void *)(indexed) != (void *)(linear)) {                            \
+            fprintf(stderr, "index and list disagree on %s %s\n", what, name);  \
+            abort();                                                            \
+        }                                                                       \
+    } while (0)
+
+/**
+ * Look every service, subtype and host up by its own names, upper-cased and
+ * under an unknown name, and compare with the list walk
+ */
+static void check_registry(void)
+{
+    char name[MDNS_NAME_BUF_LEN];
+    for (mdns_srv_item_t *s = _mdns_server->services; s; s = s->next) {
+        mdns_service_t *srv = s->service;
+        const char *instance = _mdns_get_service_instance_name(srv);
+        CHECK_SAME(_mdns_get_service_item(srv->service, srv->proto, NULL), linear_service(NULL, srv->service, srv->proto, NULL),
+                   "type", srv->service);
+        CHECK_SAME(_mdns_get_service_item(srv->service, srv->proto, srv->hostname),
+                   linear_service(NULL, srv->service, srv->proto, srv->hostname), "type on host", srv->hostname);
+        upper(name, instance);
+        CHECK_SAME(_mdns_get_service_item_instance(name, srv->service, srv->proto, NULL),
+                   linear_service(name, srv->service, srv->proto, NULL), "instance", name);
+        CHECK_SAME(_mdns_get_service_item_instance(instance, srv->service, srv->proto, srv->hostname),
+                   linear_service(instance, srv->service, srv->proto, srv->hostname), "instance on host", instance);
+        CHECK_SAME(_mdns_get_service_item_instance(NULL, srv->service, srv->proto, NULL),
+                   linear_service(NULL, srv->service, srv->proto, NULL), "default instance", srv->service);
+        CHECK_SAME(_mdns_get_service_item_instance("Unknown Camera", srv->service, srv->proto, NULL),
+                   linear_service("Unknown Camera", srv->service, srv->proto, NULL), "instance", "Unknown Camera");
+        for (mdns_subtype_t *sub = srv->subtype; sub; sub = sub->next) {
+            upper(name, sub->subtype);
+            CHECK_SAME(_mdns_get_service_item_subtype(name, srv->service, srv->proto),
+                       linear_subtype(name, srv->service, srv->proto), "subtype", name);
+        }
+        CHECK_SAME(_mdns_get_service_item_subtype("_none", srv->service, srv->proto),
+                   linear_subtype("_none", srv->service, srv->proto), "subtype", "_none");
+        CHECK_SAME(mdns_get_host_item(srv->hostname), linear_host(srv->hostname), "host", srv->hostname);
+    }
+    CHECK_SAME(_mdns_get_service_item("_none", "_tcp", NULL), NULL, "type", "_none");
+    CHECK_SAME(mdns_get_host_item("unknown-host"), NULL, "host", "unknown-host");
+}
+
+/**
+ * Register `services` services with a subtype each and time the lookups the
+ * receive path does for a question or record naming one of them: by type, by
+ * instance, by subtype and by an instance we do not have
+ */
+static void time_registry_lookups(int services, int iterations, double *ns_list, double *ns_index)
+{
+    char instances[CONFIG_MDNS_MAX_SERVICES][32];
+    char types[CONFIG_MDNS_MAX_SERVICES][16];
+    size_t found[2] = { 0, 0 };
+
+    setup_responder(services);
+    for (int i = 0; i < services; i++) {
+        snprintf(instances[i], sizeof(instances[i]), "AI GLASSES CAMERA %02d", i);
+        snprintf(types[i], sizeof(types[i]), "_svc%02d", i);
+        if (mdns_service_subtype_add_for_host(instances[i], types[i], "_tcp", NULL, "_cam")) {
+            abort();
+        }
+    }
+    finish_probing();
+    check_registry();
+
+    for (int indexed = 0; indexed < 2; indexed++) {
+        uint64_t start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            int k = i % services;
+            if (indexed) {
+                found[1] += !!_mdns_get_service_item_instance(instances[k], types[k], "_tcp", NULL);
+                found[1] += !!_mdns_get_service_item(types[k], "_tcp", NULL);
+                found[1] += !!_mdns_get_service_item_subtype("_cam", types[k], "_tcp");
+                found[1] += !!_mdns_get_service_item_instance("Unknown Camera", types[k], "_tcp", NULL);
+            } else {
+                found[0] += !!linear_service(instances[k], types[k], "_tcp", NULL);
+                found[0] += !!linear_service(NULL, types[k], "_tcp", NULL);
+                found[0] += !!linear_subtype("_cam", types[k], "_tcp");
+                found[0] += !!linear_service("Unknown Camera", types[k], "_tcp", NULL);
+            }
+        }
+        (indexed ? ns_index : ns_list)[0] = (double)(now_ns() - start) / iterations / 4;
+    }
+    if (found[0] != found[1] || found[0] != (size_t)iterations * 3) {
+        fprintf(stderr, "unexpected lookup results %zu %zu\n", found[0], found[1]);
+        abort();
+    }
+    teardown_responder();
+}
+
+/**
+ * Change the registry in every way that renames or removes something and
+ * check the index against the list walk after each step
+ */
+static void check_registry_changes(void)
+{
+    mdns_txt_item_t txt[] = { {"path", "/stream"} };
+    mdns_ip_addr_t addr = { 0 };
+    addr.addr.type = ESP_IPADDR_TYPE_V4;
+
+    setup_responder(CONFIG_MDNS_MAX_SERVICES - 2);
+    finish_probing();
+    check_registry();
+    // a service without an instance name goes by the default instance, which follows the hostname
+    if (mdns_service_add(NULL, "_config", "_tcp", 8080, txt, 1)) {
+        abort();
+    }
+    check_registry();
+    if (mdns_hostname_set("ai-glasses-2")) {
+        abort();
+    }
+    execute_last_action();
+    check_registry();
+    if (mdns_instance_name_set("Front Camera")) {
+        abort();
+    }
+    execute_last_action();
+    check_registry();
+    if (mdns_service_instance_name_set("_svc00", "_tcp", "Renamed Camera")) {
+        abort();
+    }
+    check_registry();
+    if (mdns_service_subtype_add_for_host("AI Glasses Camera 03", "_svc03", "_tcp", NULL, "_cam")
+            || !mdns_service_subtype_add_for_host("AI Glasses Camera 04", "_svc03", "_tcp", NULL, "_cam")) {
+        abort();
+    }
+    check_registry();
+    if (mdns_service_subtype_remove_for_host("AI Glasses Camera 03", "_svc03", "_tcp", NULL, "_cam")) {
+        abort();
+    }
+    check_registry();
+    if (mdns_delegate_hostname_add("printer", &addr)) {
+        abort();
+    }
+    execute_last_action();
+    if (mdns_service_add_for_host("Office Printer", "_svc02", "_tcp", "printer", 631, txt, 1)) {
+        abort();
+    }
+    check_registry();
+    if (mdns_service_remove("_svc02", "_tcp")) {
+        abort();
+    }
+    check_registry();
+    if (mdns_delegate_hostname_remove("printer")) {
+        abort();
+    }
+    execute_last_action();
+    check_registry();
+    CHECK_SAME(mdns_get_host_item("printer"), NULL, "host", "printer");
+    teardown_responder();
+}
+
+static void bench_registry(int iterations)
+{
+    static const int service_counts[] = { 1, 10, CONFIG_MDNS_MAX_SERVICES };
+
+    printf("%-10s %14s %14s\n", "services", "list ns/op", "index ns/op");
+    for (size_t c = 0; c < sizeof(service_counts) / sizeof(service_counts[0]); c++) {
+        double ns_list, ns_index;
+        time_registry_lookups(service_counts[c], iterations, &ns_list, &ns_index);
+        printf("%-10d %14.0f %14.0f\n", service_counts[c], ns_list, ns_index);
+    }
+    check_registry_changes();
+}
+
+static void print_lock_stats(const char *lock, const char *holder, mdns_lock_t id)
+{
+    mdns_lock_stats_t stats;
+    if (mdns_get_lock_stats(id, &stats, true)) {
+        abort();
+    }
+    printf("%-8s %-14s %10" PRIu32 " %10.2f %10" PRIu32 "\n", lock, holder, stats.taken,
+           stats.taken ? (double)stats.hold_total_us / stats.taken : 0.0, stats.hold_max_us);
+}
+
+/**
+ * Timer ticks with a running search and announcements scheduled, driven
+ * together with the service task as in simulate_lookup(), then how long the
+ * service lock is held per received packet and per API call, which is what
+ * an API call may have to wait for
+ */
+static void bench_locks(int iterations)
+{
+    static wire_t traffic[16];
+    struct pbuf pbufs[16];
+    mdns_rx_packet_t packets[16];
+    size_t n = build_lan_traffic(traffic);
+    mdns_action_t idle = { .type = ACTION_TASK_STOP };
+    mdns_lock_stats_t stats;
+
+    setup_responder(10);
+    finish_probing();
+    for (size_t i = 0; i < n; i++) {
+        wrap_rx_packet(&packets[i], &pbufs[i], &traffic[i], 50);
+    }
+    mdns_search_once_t *search = _mdns_search_init(NULL, "_ipp", "_tcp", MDNS_TYPE_PTR, false, UINT32_MAX / 2, 0, NULL);
+    if (!search) {
+        abort();
+    }
+    _mdns_search_add(search);
+    mdns_get_lock_stats(MDNS_LOCK_SERVICE, &stats, true);
+    mdns_get_lock_stats(MDNS_LOCK_SEARCH, &stats, true);
+
+    uint32_t by_timer = 0;
+    uint64_t tick_ns = 0;
+    size_t tx = s_tx_count;
+    for (int i = 0; i < iterations; i++) {
+        if (!_mdns_server->tx_queue_len) {
+            mdns_service_txt_item_set("_svc03", "_tcp", "path", i & 1 ? "/stream" : "/capture");
+        }
+        xQueueSend(_mdns_server->action_queue, &idle, 0);
+        uint32_t taken = s_lock_stats[MDNS_LOCK_SERVICE].stats.taken;
+        uint64_t start = now_ns();
+        _mdns_timer_cb(NULL);
+        tick_ns += now_ns() - start;
+        by_timer += s_lock_stats[MDNS_LOCK_SERVICE].stats.taken - taken;
+        mdns_action_t a;
+        GetLastItem(&a);
+        if (a.type != ACTION_TX_HANDLE) {
+            // the mocked queue holds one action, a TX_HANDLE overwritten by a query is lost
+            atomic_store(&_mdns_server->tx_pending, false);
+        }
+        if (a.type != ACTION_TASK_STOP) {
+            execute_action_locked(&a);
+        }
+    }
+    printf("timer: %.0f ns/tick, %zu packets sent, service lock taken %" PRIu32 " times\n",
+           (double)tick_ns / iterations, s_tx_count - tx, by_timer);
+    if (by_timer || s_tx_count == tx) {
+        abort();
+    }
+
+    printf("%-8s %-14s %10s %10s %10s\n", "lock", "holder", "taken", "mean us", "max us");
+    print_lock_stats("search", "timer tick", MDNS_LOCK_SEARCH);
+    mdns_get_lock_stats(MDNS_LOCK_SERVICE, &stats, true);
+    uint64_t parse_ns = 0;
+    uint64_t parse_max_ns = 0;
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+        mdns_parse_packet(&packets[i % n]);
+        uint64_t took = now_ns() - start;
+        parse_ns += took;
+        if (took > parse_max_ns) {
+            parse_max_ns = took;
+        }
+        _mdns_clear_tx_queue();
+    }
+    // the parser used to hold the service lock for the whole packet
+    printf("%-8s %-14s %10d %10.2f %10.0f\n", "(none)", "whole packet", iterations,
+           (double)parse_ns / iterations / 1000, (double)parse_max_ns / 1000);
+    uint64_t held_us = s_lock_stats[MDNS_LOCK_SERVICE].stats.hold_total_us;
+    print_lock_stats("service", "rx packet", MDNS_LOCK_SERVICE);
+    if (held_us * 1000 * 2 > parse_ns) {
+        fprintf(stderr, "the parser holds the service lock for %" PRIu64 " of %" PRIu64 " us\n", held_us, parse_ns / 1000);
+        abort();
+    }
+    for (int i = 0; i < iterations; i++) {
+        mdns_service_txt_item_set("_svc03", "_tcp", "path", i & 1 ? "/stream" : "/capture");
+        _mdns_clear_tx_queue();
+    }
+    print_lock_stats("service", "txt_item_set", MDNS_LOCK_SERVICE);
+    teardown_responder();
+}
+
+/**
+ * Execute the posted actions, as the service task would
+ */
+static void sim_drain(void)
+{
+    while (s_sim.head != s_sim.tail) {
+        mdns_action_t a = s_sim.queue[s_sim.head++ % SIM_QUEUE_LEN];
+        execute_action_locked(&a);
+    }
+}
+
+/**
+ * Advance the clock by `ms`, firing the timer at its deadlines
+ */
+static void sim_run(uint32_t ms)
+{
+    uint32_t until = s_sim.now_ms + ms;
+    for (;;) {
+        uint32_t next = s_sim.armed && (int32_t)(s_sim.due_ms - until) <= 0 ? s_sim.due_ms : until;
+        if ((int32_t)(next - s_sim.now_ms) > 0) {
+            if (atomic_load(&_mdns_server->tx_scheduled) || _mdns_server->search_once) {
+                s_sim.busy_ms += next - s_sim.now_ms;
+            }
+            s_sim.now_ms = next;
+        }
+        if (!s_sim.armed || s_sim.due_ms != next) {
+            break;
+        }
+        s_sim.armed = false;
+        s_sim.wakeups++;
+        s_sim.cb(NULL);
+        sim_drain();
+    }
+}
+
+static void sim_start(void)
+{
+    memset(&s_sim, 0, sizeof(s_sim));
+    s_sim.on = true;
+    if (mdns_init()) {
+        abort();
+    }
+    for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        _mdns_server->interfaces[i].pcbs[MDNS_IP_PROTOCOL_V4].state = PCB_RUNNING;
+        _mdns_server->interfaces[i].pcbs[MDNS_IP_PROTOCOL_V6].state = PCB_RUNNING;
+    }
+}
+
+/**
+ * Print the counters of the last minute if `print`, and start counting again
+ */
+static void sim_report(const char *label, size_t tx, bool print)
+{
+    if (print) {
+        printf("%-28s %8zu %14" PRIu32 " %8zu\n", label, s_sim.wakeups, s_sim.busy_ms / CONFIG_MDNS_TIMER_PERIOD_MS, s_tx_count - tx);
+    }
+    s_sim.wakeups = 0;
+    s_sim.busy_ms = 0;
+}
+
+/**
+ * Timer wakeups per simulated minute while the glasses come up, sit idle,
+ * look something up and update their TXT record, next to the ticks of the
+ * periodic timer this replaced, which ran whenever anything was scheduled
+ */
+static void bench_wakeups(int iterations)
+{
+    mdns_txt_item_t txt[] = {
+        {"board", "esp32s3"},
+        {"path", "/stream"},
+    };
+    size_t tx;
+
+    printf("%-28s %8s %14s %8s\n", "minute", "wakeups", "periodic ticks", "packets");
+    for (int i = 0; i < iterations; i++) {
+        bool last = i == iterations - 1;
+        sim_start();
+        tx = s_tx_count;
+        if (mdns_hostname_set("ai-glasses")) {
+            abort();
+        }
+        sim_drain();
+        if (mdns_service_add("AI Glasses Camera", "_http", "_tcp", 80, txt, 2)) {
+            abort();
+        }
+        sim_run(60000);
+        sim_report("startup, 1 service", tx, last);
+
+        tx = s_tx_count;
+        sim_run(60000);
+        if (s_sim.wakeups || s_sim.armed || s_tx_count != tx) {
+            fprintf(stderr, "the timer runs while nothing is scheduled\n");
+            abort();
+        }
+        sim_report("idle", tx, last);
+
+        tx = s_tx_count;
+        mdns_search_once_t *search = _mdns_search_init(NULL, "_ipp", "_tcp", MDNS_TYPE_PTR, false, 3000, 0, NULL);
+        if (!search || _mdns_send_search_action(ACTION_SEARCH_ADD, search)) {
+            abort();
+        }
+        sim_drain();
+        sim_run(60000);
+        // queries at 0 and 1 s, then the timeout
+        if (search->state != SEARCH_OFF || s_sim.armed || s_sim.wakeups != 3) {
+            fprintf(stderr, "search: %zu wakeups\n", s_sim.wakeups);
+            abort();
+        }
+        _mdns_query_results_free(search->result);
+        _mdns_search_free(search);
+        sim_report("search, 3 s, no answer", tx, last);
+
+        tx = s_tx_count;
+        for (int t = 0; t < 6; t++) {
+            mdns_service_txt_item_set("_http", "_tcp", "path", t & 1 ? "/stream" : "/capture");
+            sim_run(10000);
+        }
+        sim_report("TXT update every 10 s", tx, last);
+
+        teardown_responder();
+        s_sim.on = false;
+    }
+}
+
+#if CONFIG_MDNS_PASSIVE_CACHE
+/**
+ * Run one lookup through _mdns_search_add(), which answers it from the cache
+ * if it can
+ *
+ * @return number of results if it completed right away, -1 if it would have
+ *         to wait for the network
+ */
+static int cached_lookup(const char *name, const char *service, const char *proto, uint16_t type)
+{
+    mdns_search_once_t *search = _mdns_search_init(name, service, proto, type, false, 3000, 1, NULL);
+    if (!search) {
+        abort();
+    }
+    _mdns_search_add(search);
+    int results = search->state == SEARCH_OFF ? search->num_results : -1;
+    if (results < 0) {
+        _mdns_search_finish(search);
+    }
+    _mdns_query_results_free(search->result);
+    _mdns_search_free(search);
+    return results;
+}
+
+static void feed_rx_packets(mdns_rx_packet_t *packets, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        mdns_parse_packet(&packets[i]);
+    }
+    _mdns_clear_tx_queue();
+}
+
+/**
+ * Lookups after the busy-LAN traffic went by: those the cache can answer
+ * complete inside _mdns_search_add(), the others would wait for a response
+ * or their timeout
+ */
+static void bench_cache(int iterations)
+{
+    static const struct {
+        const char *label;
+        const char *name;
+        const char *service;
+        const char *proto;
+        uint16_t type;
+        bool cached;
+    } lookups[] = {
+        { "A printer", "hp-laserjet", NULL, NULL, MDNS_TYPE_A, true },
+        { "PTR _hue._tcp", NULL, "_hue", "_tcp", MDNS_TYPE_PTR, true },
+        { "SRV Sonos speaker", "Sonos-B8E9375A1C2D@Kitchen", "_sonos", "_tcp", MDNS_TYPE_SRV, true },
+        { "TXT Chromecast", "Chromecast-5b1e1d2c", "_googlecast", "_tcp", MDNS_TYPE_TXT, true },
+        { "A unknown host", "MacBook-Pro", NULL, NULL, MDNS_TYPE_A, false },
+    };
+    static wire_t traffic[16];
+    struct pbuf pbufs[16];
+    mdns_rx_packet_t packets[16];
+    size_t n = build_lan_traffic(traffic);
+
+    setup_responder(1);
+    finish_probing();
+    for (size_t i = 0; i < n; i++) {
+        wrap_rx_packet(&packets[i], &pbufs[i], &traffic[i], 50 + i);
+    }
+    feed_rx_packets(packets, n);
+    printf("cached records: %u\n", s_cache.count);
+
+    printf("%-20s %12s %10s %10s %10s\n", "lookup", "ns/lookup", "answered", "results", "queries");
+    for (size_t l = 0; l < sizeof(lookups) / sizeof(lookups[0]); l++) {
+        size_t answered = 0;
+        size_t results = 0;
+        size_t tx = s_tx_count;
+        uint64_t elapsed = 0;
+        for (int i = 0; i < iterations; i++) {
+            if (i % 1000 == 0) {
+                feed_rx_packets(packets, n);    // every lookup reads the mocked clock, keep the records fresh
+            }
+            uint64_t start = now_ns();
+            int r = cached_lookup(lookups[l].name, lookups[l].service, lookups[l].proto, lookups[l].type);
+            elapsed += now_ns() - start;
+            if (r >= 0) {
+                answered++;
+                results += r;
+            }
+        }
+        printf("%-20s %12.0f %10zu %10zu %10zu\n", lookups[l].label, (double)elapsed / iterations, answered, results, s_tx_count - tx);
+        if (answered != (lookups[l].cached ? (size_t)iterations : 0) || s_tx_count != tx) {
+            abort();
+        }
+    }
+
+    // a record with a 1 s TTL, used past 80% of it and after it expired
+    wire_t stale;
+    struct pbuf stale_pb;
+    mdns_rx_packet_t stale_packet;
+    wire_header(&stale, MDNS_FLAGS_QR_AUTHORITATIVE, 0, 1, 0);
+    wire_record_head(&stale, "doorbell.local", MDNS_TYPE_A, 1);
+    wire_u16(&stale, 4);
+    memcpy(stale.data + stale.len, "\xc0\xa8\x04\x21", 4);
+    stale.len += 4;
+    wrap_rx_packet(&stale_packet, &stale_pb, &stale, 33);
+    feed_rx_packets(&stale_packet, 1);
+    uint32_t received = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    while (xTaskGetTickCount() * portTICK_PERIOD_MS - received < 850) {
+    }
+    size_t tx = s_tx_count;
+    int fresh = cached_lookup("doorbell", NULL, NULL, MDNS_TYPE_A);
+    size_t refreshes = s_tx_count - tx;
+    int again = cached_lookup("doorbell", NULL, NULL, MDNS_TYPE_A);
+    while (xTaskGetTickCount() * portTICK_PERIOD_MS - received < 1000) {
+    }
+    int expired = cached_lookup("doorbell", NULL, NULL, MDNS_TYPE_A);
+    printf("1s TTL record at 85%%: %s, %zu refresh query; again: %zu more; after 1s: %s\n", fresh == 1 ? "answered" : "missed",
+           refreshes, s_tx_count - tx - refreshes, expired < 0 ? "expired" : "still cached");
+    if (fresh != 1 || again != 1 || refreshes != 1 || s_tx_count - tx != 1 || expired >= 0) {
+        abort();
+    }
+    teardown_responder();
+}
+#endif /* CONFIG_MDNS_PASSIVE_CACHE */
+
+/**
+ * Heap calls and time per received packet with the parse state in the
+ * per-packet arena, and with every arena allocation sent to its heap
+ * fallback, which makes one allocation and one free per object like the
+ * parser did before the arena
+ */
+static void bench_arena(int iterations)
+{
+    static wire_t traffic[20];
+    struct pbuf pbufs[20];
+    mdns_rx_packet_t packets[20];
+    size_t n = build_lan_traffic(traffic);
+
+    // service discovery, and two of our types asked for with a known answer for one
+    wire_t *w = &traffic[n++];
+    wire_header(w, 0, 1, 0, 0);
+    wire_question(w, "_services._dns-sd._udp.local", MDNS_TYPE_PTR);
+    w = &traffic[n++];
+    wire_header(w, 0, 2, 1, 0);
+    wire_question(w, "_svc01._tcp.local", MDNS_TYPE_PTR);
+    wire_question(w, "_svc02._tcp.local", MDNS_TYPE_PTR);
+    wire_ptr(w, "_svc01._tcp.local", "AI Glasses Camera 01._svc01._tcp.local", 4500);
+    // a legacy unicast query, answered at once
+    size_t legacy = n;
+    w = &traffic[n++];
+    wire_header(w, 0, 1, 0, 0);
+    wire_question(w, "ai-glasses.local", MDNS_TYPE_A);
+
+    setup_responder(10);
+    finish_probing();
+    for (size_t i = 0; i < n; i++) {
+        wrap_rx_packet(&packets[i], &pbufs[i], &traffic[i], 50);
+        if (i == legacy) {
+            packets[i].src_port = 5300;
+        }
+        mdns_parse_packet(&packets[i]);     // the first lookup builds the service index
+        _mdns_clear_tx_queue();
+    }
+
+    printf("%-12s %12s %12s %14s\n", "mode", "ns/packet", "packets/s", "heap/packet");
+    size_t calls[2];
+    for (int arena = 1; arena >= 0; arena--) {
+        size_t heap = 0;
+        uint64_t elapsed = 0;
+        for (int i = 0; i < iterations; i++) {
+            mdns_rx_packet_t *p = &packets[i % n];
+            memset(s_recent_answers, 0, sizeof(s_recent_answers));
+            if (!arena) {
+                s_rx_arena.used = sizeof(s_rx_arena.slab);
+            }
+            size_t before = s_heap_calls;
+            size_t sent = s_tx_count;
+            bool scheduled = _mdns_server->tx_queue_len;
+            uint64_t start = now_ns();
+            mdns_parse_packet(p);
+            elapsed += now_ns() - start;
+            size_t made = s_heap_calls - before;
+            heap += made;
+            scheduled = _mdns_server->tx_queue_len != scheduled;
+            _mdns_clear_tx_queue();
+            // with the arena, only the answers we schedule may touch the heap
+            if (arena && made && !scheduled) {
+                printf("packet %zu made %zu heap calls without a scheduled answer\n", (size_t)(i % n), made);
+                abort();
+            }
+            if ((size_t)(i % n) == legacy && s_tx_count == sent) {
+                printf("the legacy query was not answered at once\n");
+                abort();
+            }
+        }
+        calls[arena] = heap;
+        printf("%-12s %12.0f %12.0f %14.2f\n", arena ? "arena" : "heap", (double)elapsed / iterations,
+               1e9 * iterations / elapsed, (double)heap / iterations);
+    }
+    if (calls[1] >= calls[0]) {
+        abort();
+    }
+    teardown_responder();
+}
+
+/*
+ * The browse benchmark counts what the browse callback gets to see
+ */
+#define BROWSE_PEERS 8
+
+static struct {
+    size_t calls;
+    size_t added;
+    size_t updated;
+    size_t removed;
+} s_browse_seen;
+
+static void browse_count(const mdns_browse_diff_t *diff)
+{
+    s_browse_seen.calls++;
+    s_browse_seen.added += diff->num_added;
+    s_browse_seen.updated += diff->num_updated;
+    s_browse_seen.removed += diff->num_removed;
+}
+
+static void browse_count_result(mdns_result_t *result)
+{
+    s_browse_seen.calls++;
+}
+
+/**
+ * The peers of the browse benchmark are announced with the heap failing at
+ * the flush. A diff that cannot be allocated leaves the changes pending for
+ * the retry, a browse with a plain notifier does not need the allocation.
+ */
+static void check_browse_no_memory(mdns_rx_packet_t *announcements)
+{
+    for (int diff = 1; diff >= 0; diff--) {
+        sim_start();
+        if (!(diff ? mdns_browse_new_diff("_googlecast", "_tcp", browse_count)
+                : mdns_browse_new("_googlecast", "_tcp", browse_count_result))) {
+            abort();
+        }
+        sim_drain();
+        memset(&s_browse_seen, 0, sizeof(s_browse_seen));
+        for (size_t i = 0; i < 3 * BROWSE_PEERS; i++) {
+            mdns_parse_packet(&announcements[i]);
+            _mdns_clear_tx_queue();
+        }
+        _mdns_server->browse->flush_at = s_sim.now_ms;
+        s_heap_fail = 1;
+        _mdns_browse_flush_due();
+        s_heap_fail = 0;
+        if (diff && (s_browse_seen.calls || !_mdns_server->browse->pending)) {
+            fprintf(stderr, "browse changes lost when the diff could not be allocated\n");
+            abort();
+        }
+        sim_run(MDNS_BROWSE_RETRY_MS + MDNS_TIMER_SLACK_MS);
+        if (s_browse_seen.calls != (diff ? 1 : BROWSE_PEERS) || (diff && s_browse_seen.added != BROWSE_PEERS)
+                || _mdns_server->browse->pending) {
+            fprintf(stderr, "%s browse: %zu calls, %zu added after the allocation failure\n",
+                    diff ? "diff" : "plain", s_browse_seen.calls, s_browse_seen.added);
+            abort();
+        }
+        if (mdns_browse_delete("_googlecast", "_tcp")) {
+            abort();
+        }
+        sim_drain();
+        teardown_responder();
+        s_sim.on = false;
+    }
+}
+
+/**
+ * Callback invocations, heap calls and time per peer for a browse of
+ * _googlecast._tcp while 8 peers announce their SRV, TXT and A records in
+ * three packets 2 ms apart, change their TXT record twice in a row and say
+ * goodbye,
+ * with the changes coalesced over CONFIG_MDNS_BROWSE_COALESCE_MS and with
+ * the browse notified at the end of every packet, as before the window
+ */
+static void bench_browse(int iterations)
+{
+    static wire_t traffic[BROWSE_PEERS * 6];
+    static struct pbuf pbufs[BROWSE_PEERS * 6];
+    static mdns_rx_packet_t packets[BROWSE_PEERS * 6];
+    static const char *txt[] = { "|fn=Living Room|st=0", "|fn=Living Room|st=1", "|fn=Living Room|st=2" };
+    size_t n = 0;
+
+    for (int phase = 0; phase < 4; phase++) {
+        for (int i = 0; i < BROWSE_PEERS; i++) {
+            char instance[48];
+            char host[24];
+            snprintf(instance, sizeof(instance), "Peer-%02d._googlecast._tcp.local", i);
+            snprintf(host, sizeof(host), "peer-%02d.local", i);
+            wire_t *w = &traffic[n++];
+            wire_header(w, MDNS_FLAGS_QR_AUTHORITATIVE, 0, 1, 0);
+            switch (phase) {
+            case 0:     // announcement, one record per packet
+                wire_srv(w, instance, host, 120);
+                w = &traffic[n++];
+                wire_header(w, MDNS_FLAGS_QR_AUTHORITATIVE, 0, 1, 0);
+                wire_txt(w, instance, txt[0], 120);
+                w = &traffic[n++];
+                wire_header(w, MDNS_FLAGS_QR_AUTHORITATIVE, 0, 1, 0);
+                wire_a(w, host, 120);
+                break;
+            case 1:
+            case 2:
+                wire_txt(w, instance, txt[phase], 120);
+                break;
+            default:
+                wire_srv(w, instance, host, 0);
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        wrap_rx_packet(&packets[i], &pbufs[i], &traffic[i], 60 + i % BROWSE_PEERS);
+    }
+
+    printf("%-12s %12s %12s %12s %12s\n", "mode", "calls/peer", "results/peer", "heap/peer", "us/peer");
+    size_t calls[2];
+    for (int coalesce = 1; coalesce >= 0; coalesce--) {
+        sim_start();
+        if (!mdns_browse_new_diff("_googlecast", "_tcp", browse_count)) {
+            abort();
+        }
+        sim_drain();
+        memset(&s_browse_seen, 0, sizeof(s_browse_seen));
+        size_t heap = s_heap_calls;
+        uint64_t elapsed = 0;
+        for (int it = 0; it < iterations; it++) {
+            for (size_t i = 0; i < n; i++) {
+                uint64_t start = now_ns();
+                mdns_parse_packet(&packets[i]);
+                if (!coalesce) {
+                    _mdns_server->browse->flush_at = s_sim.now_ms;
+                    _mdns_browse_flush_due();
+                }
+                elapsed += now_ns() - start;
+                _mdns_clear_tx_queue();
+                sim_run(2);
+                // after the announcements, the two TXT changes and the goodbyes, the window closes
+                if (i + 1 == 3 * BROWSE_PEERS || i + 1 == 5 * BROWSE_PEERS || i + 1 == n) {
+                    uint64_t start = now_ns();
+                    sim_run(1000);
+                    elapsed += now_ns() - start;
+                }
+            }
+            if (_mdns_server->browse->result || _mdns_server->browse->pending) {
+                fprintf(stderr, "results left after the goodbyes\n");
+                abort();
+            }
+        }
+        heap = s_heap_calls - heap;
+        // per packet, every peer is added, updated by its first TXT record, its address and two TXT
+        // changes, and removed; coalesced, the TXT changes are one update
+        size_t seen = s_browse_seen.added + s_browse_seen.updated + s_browse_seen.removed;
+        if (s_browse_seen.added != (size_t)iterations * BROWSE_PEERS || s_browse_seen.removed != (size_t)iterations * BROWSE_PEERS
+                || s_browse_seen.updated != (size_t)iterations * BROWSE_PEERS * (coalesce ? 1 : 4)) {
+            fprintf(stderr, "%zu added, %zu updated, %zu removed\n", s_browse_seen.added, s_browse_seen.updated, s_browse_seen.removed);
+            abort();
+        }
+        calls[coalesce] = s_browse_seen.calls;
+        double peers = (double)iterations * BROWSE_PEERS;
+        printf("%-12s %12.2f %12.2f %12.2f %12.2f\n", coalesce ? "coalesced" : "per packet", s_browse_seen.calls / peers,
+               seen / peers, heap / peers, elapsed / peers / 1000);
+        if (mdns_browse_delete("_googlecast", "_tcp")) {
+            abort();
+        }
+        sim_drain();
+        teardown_responder();
+        s_sim.on = false;
+    }
+    if (calls[1] >= calls[0]) {
+        abort();
+    }
+    check_browse_no_memory(packets);
+}
+
+#ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
+static mdns_host_item_t *find_reverse_host(const char *hostname, size_t *hosts)
+{
+    mdns_host_item_t *found = NULL;
+    *hosts = 0;
+    for (mdns_host_item_t *h = _mdns_host_list; h; h = h->next) {
+        (*hosts)++;
+        if (!strcmp(h->hostname, hostname)) {
+            found = h;
+        }
+    }
+    if (!found || !found->reverse) {
+        fprintf(stderr, "no reverse lookup name %s\n", hostname);
+        abort();
+    }
+    return found;
+}
+
+/**
+ * Queues a delayed shared answer for the host and records it as sent, as
+ * answering a query for it leaves them behind. It goes out on the IPv6 PCB,
+ * which an IPv4 address change does not restart.
+ */
+static void queue_host_answer(mdns_host_item_t *host)
+{
+    mdns_tx_packet_t *p = _mdns_alloc_packet_default(0, MDNS_IP_PROTOCOL_V6);
+    if (!p || !_mdns_alloc_answer(&p->answers, MDNS_TYPE_PTR, NULL, host, false, false)) {
+        abort();
+    }
+    p->aggregate = 1;
+    _mdns_recent_answers_add(p);
+    _mdns_schedule_tx_packet(p, 1000);
+}
+
+static bool host_registered(const mdns_host_item_t *host)
+{
+    for (mdns_host_item_t *h = _mdns_host_list; h; h = h->next) {
+        if (h == host) {
+            return true;
+        }
+    }
+    return host == &_mdns_self_host;
+}
+
+/**
+ * Every host a queued or recently sent answer refers to must still be registered
+ */
+static void check_answers_hosts_registered(const char *scenario)
+{
+    for (uint16_t i = 0; i < _mdns_server->tx_queue_len; i++) {
+        mdns_tx_packet_t *p = _mdns_server->tx_queue[i];
+        mdns_out_answer_t *lists[] = { p->answers, p->servers, p->additional };
+        for (size_t l = 0; l < sizeof(lists) / sizeof(lists[0]); l++) {
+            for (mdns_out_answer_t *a = lists[l]; a; a = a->next) {
+                if (a->host && !host_registered(a->host)) {
+                    fprintf(stderr, "%s: queued answer for a removed host\n", scenario);
+                    abort();
+                }
+            }
+        }
+    }
+    for (int i = 0; i < MDNS_RECENT_ANSWERS; i++) {
+        if (s_recent_answers[i].host && !host_registered(s_recent_answers[i].host)) {
+            fprintf(stderr, "%s: recent answer for a removed host\n", scenario);
+            abort();
+        }
+    }
+}
+
+/**
+ * Answering reverse lookups for our IPv4 and IPv6 link-local addresses: the
+ * owner name as the answer writer built it from the dotted host name before,
+ * and copied from the wire name kept with the host, and the whole
+ * query-to-response path. The run aborts if the two names differ, if the
+ * response does not carry the kept name, if an unchanged address allocates
+ * anything, if a new address does not replace the old name, if a lost address
+ * does not remove it until the next one, or if answers queued or sent for a
+ * removed name are kept.
+ */
+static void bench_reverse(int iterations)
+{
+    static const char *names[] = {
+        "1.4.168.192.in-addr",
+#ifdef CONFIG_LWIP_IPV6
+        "a.9.8.7.6.5.e.f.f.f.4.3.2.1.2.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.e.f.ip6",
+#endif
+    };
+    static uint8_t packet[MDNS_MAX_PACKET_SIZE];
+    static uint8_t built[MDNS_MAX_PACKET_SIZE];
+    static wire_t query;
+    struct pbuf pb;
+    mdns_rx_packet_t rx;
+    size_t hosts;
+
+    setup_responder(1);
+    finish_probing();
+    perform_event_action(0, MDNS_EVENT_IP4_REVERSE_LOOKUP | MDNS_EVENT_IP6_REVERSE_LOOKUP);
+
+    printf("%-10s %12s %12s %12s\n", "name", "dotted ns", "kept ns", "query ns");
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        mdns_host_item_t *host = find_reverse_host(names[n], &hosts);
+        uint16_t built_len = 0;
+        uint16_t index = 0;
+
+        uint64_t start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            built_len = 0;
+            append_fqdn_dots(built, &built_len, host->hostname, false);
+        }
+        uint64_t dotted = now_ns() - start;
+
+        start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            index = 0;
+            memcpy(packet, host->reverse->data, host->reverse->len);
+            index += host->reverse->len;
+        }
+        uint64_t kept = now_ns() - start;
+        if (index != built_len || memcmp(packet, built, index)) {
+            fprintf(stderr, "%s: kept name differs from the dotted one\n", names[n]);
+            abort();
+        }
+
+        char qname[MDNS_REVERSE_NAME_MAX_LEN + 8];
+        snprintf(qname, sizeof(qname), "%s.arpa", names[n]);
+        wire_header(&query, 0, 1, 0, 0);
+        wire_question(&query, qname, MDNS_TYPE_PTR);
+        wrap_rx_packet(&rx, &pb, &query, 50);
+        start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            memset(s_recent_answers, 0, sizeof(s_recent_answers));
+            size_t sent = s_tx_count;
+            mdns_parse_packet(&rx);
+            flush_tx_queue();
+            if (s_tx_count != sent + 1 || s_tx_len < MDNS_HEAD_LEN + host->reverse->len
+                    || memcmp(s_tx + MDNS_HEAD_LEN, host->reverse->data, host->reverse->len)) {
+                fprintf(stderr, "%s: no response with the kept name\n", names[n]);
+                abort();
+            }
+        }
+        uint64_t answered = now_ns() - start;
+        printf("%-10s %12.1f %12.1f %12.0f\n", n ? "ip6" : "in-addr", (double)dotted / iterations,
+               (double)kept / iterations, (double)answered / iterations);
+    }
+
+    // the interface got its address again, as on every MDNS_EVENT_ENABLE_IP4
+    mdns_host_item_t *host = find_reverse_host(names[0], &hosts);
+    size_t count = hosts;
+    size_t heap = s_heap_calls;
+    _mdns_reverse_host_update(0, MDNS_IP_PROTOCOL_V4, false);
+    if (s_heap_calls != heap || find_reverse_host(names[0], &hosts) != host || hosts != count) {
+        fprintf(stderr, "unchanged address rebuilt the reverse lookup name\n");
+        abort();
+    }
+
+    // and then a different one, with an answer for the old name still queued
+    queue_host_answer(host);
+    s_ip4 = 0x0204a8c0;
+    perform_event_action(0, MDNS_EVENT_ENABLE_IP4);
+    check_answers_hosts_registered("address change");
+    host = find_reverse_host("2.4.168.192.in-addr", &hosts);
+    for (mdns_host_item_t *h = _mdns_host_list; h; h = h->next) {
+        if (!strcmp(h->hostname, names[0])) {
+            fprintf(stderr, "old reverse lookup name still registered\n");
+            abort();
+        }
+    }
+    if (hosts != count) {
+        fprintf(stderr, "%zu hosts after the address change, expected %zu\n", hosts, count);
+        abort();
+    }
+
+    // then it loses the address, and gets the first one back
+    finish_probing();
+    queue_host_answer(host);
+    s_ip4 = 0;
+    perform_event_action(0, MDNS_EVENT_DISABLE_IP4);
+    check_answers_hosts_registered("address lost");
+    for (mdns_host_item_t *h = _mdns_host_list; h; h = h->next) {
+        if (h->reverse && h->reverse->ip_protocol == MDNS_IP_PROTOCOL_V4) {
+            fprintf(stderr, "reverse lookup name %s kept without an address\n", h->hostname);
+            abort();
+        }
+    }
+    s_ip4 = 0x0104a8c0;
+    perform_event_action(0, MDNS_EVENT_ENABLE_IP4);
+    find_reverse_host(names[0], &hosts);
+    if (hosts != count) {
+        fprintf(stderr, "%zu hosts after the address came back, expected %zu\n", hosts, count);
+        abort();
+    }
+    finish_probing();
+    flush_tx_queue();
+    teardown_responder();
+}
+#endif /* CONFIG_MDNS_RESPOND_REVERSE_QUERIES */
+
+/*
+ * The busy-LAN captures the host_test app replays, with the limits for the
+ * allocations per packet and the peak heap growth it is held to
+ */
+#define PCAP_DIR "../host_test/captures/"
+
+/**
+ * Replay the captures listed in limits.txt, after one warm-up round, to a
+ * responder set up as the host_test app sets it up
+ */
+static void bench_pcap(int iterations)
+{
+    // the limits are for the responder as the host_test app builds it
+#if CONFIG_MDNS_PASSIVE_CACHE || defined(CONFIG_MDNS_RESPOND_REVERSE_QUERIES)
+    const bool check = false;
+#else
+    const bool check = true;
+#endif
+    FILE *limits = fopen(PCAP_DIR "limits.txt", "r");
+    if (!limits) {
+        fprintf(stderr, "cannot open %slimits.txt\n", PCAP_DIR);
+        abort();
+    }
+    printf("%-14s %8s %14s %8s %14s %8s %10s\n", "capture", "packets", "allocs/packet", "limit", "peak growth", "limit",
+           "us/packet");
+    char line[128];
+    bool exceeded = false;
+    while (fgets(line, sizeof(line), limits)) {
+        char name[64];
+        double max_allocs;
+        size_t max_peak;
+        if (line[0] == '#' || sscanf(line, "%63s %lf %zu", name, &max_allocs, &max_peak) != 3) {
+            continue;
+        }
+        char path[sizeof(PCAP_DIR) + sizeof(name)];
+        snprintf(path, sizeof(path), "%s%s", PCAP_DIR, name);
+        pcap_packet_t *packets = NULL;
+        size_t count = 0;
+        if (pcap_load(path, &packets, &count) <= 0) {
+            fprintf(stderr, "no mDNS packets in %s\n", path);
+            abort();
+        }
+
+        sim_start();
+        mdns_txt_item_t txt[] = { { "board", "esp32" }, { "path", "/" } };
+        if (mdns_hostname_set("esp32-mdns")) {
+            abort();
+        }
+        sim_drain();
+        if (mdns_service_add("myesp-web", "_http", "_tcp", 80, txt, 2)
+                || mdns_service_subtype_add_for_host("myesp-web", "_http", "_tcp", NULL, "_printer")
+                || mdns_service_add(NULL, "_workstation", "_tcp", 9, NULL, 0)) {
+            abort();
+        }
+        sim_drain();
+        finish_probing();
+
+        // the app runs IPv4 only, IPv6 packets are not delivered
+        struct pbuf *pbufs = calloc(count, sizeof(struct pbuf));
+        mdns_rx_packet_t *rx = calloc(count, sizeof(mdns_rx_packet_t));
+        uint32_t *gap_ms = calloc(count, sizeof(uint32_t));
+        size_t n = 0;
+        uint32_t last_ms = packets[0].time_ms;
+        for (size_t i = 0; i < count; i++) {
+            if (packets[i].src.type != ESP_IPADDR_TYPE_V4) {
+                continue;
+            }
+            gap_ms[n] = packets[i].time_ms - last_ms;
+            last_ms = packets[i].time_ms;
+            pbufs[n].payload = packets[i].data;
+            pbufs[n].len = pbufs[n].tot_len = packets[i].len;
+            rx[n].pb = &pbufs[n];
+            rx[n].tcpip_if = 0;
+            rx[n].ip_protocol = MDNS_IP_PROTOCOL_V4;
+            rx[n].src = packets[i].src;
+            rx[n].src_port = packets[i].src_port;
+            rx[n].multicast = 1;
+            n++;
+        }
+
+        size_t allocs = 0, live = 0;
+        uint64_t elapsed = 0;
+        for (int round = 0; round <= iterations; round++) {
+            if (round == 1) {
+                // count the measured rounds only
+                allocs = s_heap_allocs;
+                live = s_heap_peak = s_heap_live;
+            }
+            // on the simulated clock, the packets arrive as they were captured
+            for (size_t i = 0; i < n; i++) {
+                sim_run(gap_ms[i]);
+                uint64_t start = now_ns();
+                _mdns_handle_rx_packet(&rx[i]);
+                elapsed += round ? now_ns() - start : 0;
+            }
+            sim_run(1000);
+        }
+        allocs = s_heap_allocs - allocs;
+        size_t peak = s_heap_peak - live;
+        double per_packet = (double)allocs / (n * iterations);
+        printf("%-14s %8zu %14.2f %8.2f %14zu %8zu %10.2f\n", name, n, per_packet, max_allocs, peak, max_peak,
+               elapsed / 1e3 / (n * iterations));
+        if (check && (per_packet > max_allocs || peak > max_peak)) {
+            fprintf(stderr, "%s exceeds its limits in %slimits.txt\n", name, PCAP_DIR);
+            exceeded = true;
+        }
+
+        _mdns_clear_tx_queue();
+        teardown_responder();
+        s_sim.on = false;
+        free(gap_ms);
+        free(rx);
+        free(pbufs);
+        pcap_free(packets, count);
+    }
+    fclose(limits);
+    if (exceeded) {
+        abort();
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(int iterations);
+    int iterations;
+} bench_t;
+
+static const bench_t s_benches[] = {
+    { "announce", bench_announce, 20000 },
+    { "respond", bench_respond, 100000 },
+    { "schedule", bench_schedule, 200000 },
+    { "rx", bench_rx, 200000 },
+    { "fqdn", bench_fqdn, 200000 },
+    { "suppress", bench_suppress, 20000 },
+    { "split", bench_split, 20000 },
+    { "lookup", bench_lookup, 20 },
+    { "registry", bench_registry, 200000 },
+    { "locks", bench_locks, 20000 },
+    { "wakeups", bench_wakeups, 100 },
+    { "arena", bench_arena, 100000 },
+    { "browse", bench_browse, 2000 },
+    { "pcap", bench_pcap, 10 },
+#if CONFIG_MDNS_PASSIVE_CACHE
+    { "cache", bench_cache, 20000 },
+#endif
+#ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
+    { "reverse", bench_reverse, 100000 },
+#endif
+};
+
+int main(int argc, char **argv)
+{
+    const char *only = argc > 1 ? argv[1] : NULL;
+    int iterations = argc > 2 ? atoi(argv[2]) : 0;
+    bool found = false;
+
+    for (size_t i = 0; i < sizeof(s_benches) / sizeof(s_benches[0]); i++) {
+        if (only && strcmp(only, s_benches[i].name)) {
+            continue;
+        }
+        found = true;
+        printf("== %s\n", s_benches[i].name);
+        s_benches[i].run(iterations > 0 ? iterations : s_benches[i].iterations);
+    }
+    if (!found) {
+        fprintf(stderr, "unknown benchmark %s\n", only);
+        return 1;
+    }
+    return 0;
+}
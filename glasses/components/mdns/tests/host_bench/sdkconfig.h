@@ -0,0 +1,33 @@
+/*
+ * Host bench configuration: the fuzzer's sdkconfig with room for the largest
+ * service count the benchmarks register
+ */
+#pragma once
+#include "../test_afl_fuzz_host/sdkconfig.h"
+
+#undef CONFIG_MDNS_MAX_SERVICES
+#define CONFIG_MDNS_MAX_SERVICES 64
+
+// the fuzzer runs without address records, the benchmarks want them
+#define CONFIG_LWIP_IPV4 1
+
+// the fuzzer keeps the receive arena small to run into the heap fallback,
+// the benchmarks measure the default size
+#undef CONFIG_MDNS_RX_ARENA_SIZE
+#define CONFIG_MDNS_RX_ARENA_SIZE 2048
+
+// the locks benchmark reads the lock statistics
+#define CONFIG_MDNS_LOCK_STATS 1
+
+// make CACHE=on
+#ifdef BENCH_PASSIVE_CACHE
+#define CONFIG_MDNS_PASSIVE_CACHE 1
+#define CONFIG_MDNS_PASSIVE_CACHE_SIZE 32
+#define CONFIG_MDNS_PASSIVE_CACHE_REFRESH 1
+#endif
+
+// make REVERSE=on
+#ifdef BENCH_REVERSE_QUERIES
+#define CONFIG_MDNS_RESPOND_REVERSE_QUERIES 1
+#define CONFIG_LWIP_IPV6 1
+#endif
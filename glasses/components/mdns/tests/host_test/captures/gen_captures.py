@@ -0,0 +1,309 @@
+# SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+# SPDX-License-Identifier: Unlicense OR CC0-1.0
+"""
+Writes the busy-LAN captures replayed by the pcap benchmark.
+
+The traffic is built from the records real devices announce and the queries
+they repeat: cast targets, speakers and bridges at home, printers and
+workstations in an office, phones coming and going. A few packets in each
+capture ask for the host test's own records (esp32-mdns.local, _http._tcp
+with the _printer subtype, _workstation._tcp). The output is deterministic,
+so the captures only change when this script does.
+
+    python gen_captures.py
+"""
+import random
+import struct
+
+TYPE_A = 1
+TYPE_PTR = 12
+TYPE_TXT = 16
+TYPE_AAAA = 28
+TYPE_SRV = 33
+TYPE_NSEC = 47
+TYPE_ANY = 255
+FLUSH = 0x8000
+QU = 0x8000
+
+
+class Packet:
+    """An mDNS message with name compression, as responders send them"""
+
+    def __init__(self, flags=0):
+        self.flags = flags
+        self.sections = [[], [], [], []]    # questions, answers, authority, additional
+        self.body = bytearray()
+        self.names = {}
+
+    def name(self, fqdn):
+        labels = fqdn.rstrip('.').split('.')
+        out = bytearray()
+        for i in range(len(labels)):
+            suffix = '.'.join(labels[i:]).lower()
+            if suffix in self.names:
+                out += struct.pack('>H', 0xC000 | self.names[suffix])
+                return bytes(out)
+            offset = 12 + len(self.body) + len(out)
+            if offset < 0x3FFF:
+                self.names[suffix] = offset
+            raw = labels[i].encode()
+            out += bytes([len(raw)]) + raw
+        return bytes(out + b'\0')
+
+    def question(self, fqdn, rtype, qclass=1):
+        self.body += self.name(fqdn) + struct.pack('>HH', rtype, qclass)
+        self.sections[0].append(1)
+        return self
+
+    def record(self, section, fqdn, rtype, ttl, rdata, rclass=1):
+        self.body += self.name(fqdn)
+        header = len(self.body)
+        self.body += struct.pack('>HHIH', rtype, rclass, ttl, 0)
+        start = len(self.body)
+        self.body += rdata(self) if callable(rdata) else rdata
+        struct.pack_into('>H', self.body, header + 8, len(self.body) - start)
+        self.sections[section].append(1)
+        return self
+
+    def ptr(self, owner, target, ttl=4500, section=1):
+        return self.record(section, owner, TYPE_PTR, ttl, lambda p: p.name(target))
+
+    def srv(self, owner, host, port, ttl=120, section=1):
+        return self.record(section, owner, TYPE_SRV, ttl, lambda p: struct.pack('>HHH', 0, 0, port) + p.name(host), FLUSH | 1)
+
+    def txt(self, owner, items, ttl=4500, section=1):
+        data = b''.join(bytes([len(i)]) + i for i in (s.encode() for s in items)) or b'\0'
+        return self.record(section, owner, TYPE_TXT, ttl, data, FLUSH | 1)
+
+    def a(self, owner, addr, ttl=120, section=1):
+        return self.record(section, owner, TYPE_A, ttl, bytes(int(b) for b in addr.split('.')), FLUSH | 1)
+
+    def aaaa(self, owner, addr, ttl=120, section=1):
+        return self.record(section, owner, TYPE_AAAA, ttl, ipv6(addr), FLUSH | 1)
+
+    def nsec(self, owner, types, ttl=120, section=3):
+        bitmap = bytearray(32)
+        for t in types:
+            bitmap[t // 8] |= 0x80 >> (t % 8)
+        used = max(i for i, b in enumerate(bitmap) if b) + 1
+        return self.record(section, owner, TYPE_NSEC, ttl, lambda p: p.name(owner) + bytes([0, used]) + bytes(bitmap[:used]), FLUSH | 1)
+
+    def wire(self):
+        counts = [len(s) for s in self.sections]
+        return struct.pack('>HHHHHH', 0, self.flags, *counts) + bytes(self.body)
+
+
+def ipv6(addr):
+    head, _, tail = addr.partition('::')
+    h = [int(x, 16) for x in head.split(':') if x]
+    t = [int(x, 16) for x in tail.split(':') if x]
+    return struct.pack('>8H', *(h + [0] * (8 - len(h) - len(t)) + t))
+
+
+def query(*questions, known=(), qu=False):
+    p = Packet()
+    for fqdn, rtype in questions:
+        p.question(fqdn, rtype, (QU if qu else 0) | 1)
+    for owner, target, ttl in known:
+        p.ptr(owner, target, ttl)
+    return p
+
+
+def response():
+    return Packet(0x8400)
+
+
+def announce(service, instance, host, addr, port, txt, addr6=None):
+    fqdn = f'{instance}.{service}.local'
+    p = response().ptr(f'{service}.local', fqdn).srv(fqdn, host, port).txt(fqdn, txt).a(host, addr)
+    if addr6:
+        p.aaaa(host, addr6)
+    return p.nsec(fqdn, [TYPE_TXT, TYPE_SRV]).nsec(host, [TYPE_A] + ([TYPE_AAAA] if addr6 else []))
+
+
+def goodbye(service, instance, host, port):
+    fqdn = f'{instance}.{service}.local'
+    return response().ptr(f'{service}.local', fqdn, ttl=0).srv(fqdn, host, port, ttl=0)
+
+
+def probe(host, addr):
+    p = Packet().question(host, TYPE_ANY, QU | 1)
+    return p.a(host, addr, section=2)
+
+
+class Capture:
+    """Frames of one pcap file, Ethernet, UDP to 224.0.0.251 or ff02::fb port 5353"""
+
+    def __init__(self, seed):
+        self.rng = random.Random(seed)
+        self.t = 1700000000.0
+        self.frames = []
+
+    def add(self, packet, src, gap=None):
+        self.t += gap if gap is not None else self.rng.expovariate(1 / 0.15)
+        payload = packet.wire()
+        udp = struct.pack('>HHHH', 5353, 5353, 8 + len(payload), 0) + payload
+        if ':' in src:
+            ip = struct.pack('>IHBB', 0x60000000, len(udp), 17, 255) + ipv6(src) + ipv6('ff02::fb')
+            eth = bytes.fromhex('3333000000fb') + mac(src) + b'\x86\xdd'
+        else:
+            ip = struct.pack('>BBHHHBBH4s4s', 0x45, 0, 20 + len(udp), 0, 0x4000, 255, 17, 0,
+                             bytes(int(b) for b in src.split('.')), bytes([224, 0, 0, 251]))
+            eth = bytes.fromhex('01005e0000fb') + mac(src) + b'\x08\x00'
+        self.frames.append((self.t, eth + ip + udp))
+
+    def write(self, path):
+        with open(path, 'wb') as f:
+            f.write(struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1))
+            for t, frame in self.frames:
+                sec = int(t)
+                f.write(struct.pack('<IIII', sec, int((t - sec) * 1e6), len(frame), len(frame)))
+                f.write(frame)
+
+
+def mac(src):
+    return bytes([0x02, 0, 0, 0, 0, sum(src.encode()) & 0xFF])
+
+
+# the host test's records, see mdns_test_app()
+OURS = [
+    query(('_http._tcp.local', TYPE_PTR)),
+    query(('_printer._sub._http._tcp.local', TYPE_PTR)),
+    query(('_workstation._tcp.local', TYPE_PTR)),
+    query(('esp32-mdns.local', TYPE_A)),
+    query(('myesp-web._http._tcp.local', TYPE_SRV), ('myesp-web._http._tcp.local', TYPE_TXT)),
+    query(('_services._dns-sd._udp.local', TYPE_PTR)),
+]
+
+
+def home():
+    c = Capture(1)
+    cast_txt = ['id=5b1e1d2c8c0e4c5d9f3a0a1b2c3d4e5f', 'cd=0A1B2C3D4E5F60718293A4B5C6D7E8F9', 'rm=', 've=05',
+                'md=Chromecast', 'ic=/setup/icon.png', 'fn=Living Room TV', 'ca=465413', 'st=0', 'bs=FA8FCA7E8F4B', 'nf=1', 'rs=']
+    devices = [
+        ('_googlecast._tcp', 'Chromecast-5b1e1d2c8c0e4c5d', '5b1e1d2c-8c0e-4c5d.local', '192.168.1.21', 8009, cast_txt),
+        ('_googlecast._tcp', 'Google-Nest-Mini-9f3a0a1b', '9f3a0a1b-2c3d-4e5f.local', '192.168.1.22', 8009,
+         cast_txt[:4] + ['md=Google Nest Mini', 'fn=Kitchen speaker']),
+        ('_airplay._tcp', 'Living Room', 'Living-Room.local', '192.168.1.23', 7000,
+         ['acl=0', 'deviceid=A0:B1:C2:D3:E4:F5', 'features=0x4A7FDFD5,0xBC157FDE', 'flags=0x18644', 'model=AppleTV11,1',
+          'pk=0c6e6b33d2ad1f4a5c1a3b9e8f7d6c5b4a39281706f5e4d3c2b1a09f8e7d6c5b', 'srcvers=670.6.2', 'osvers=17.4', 'vv=2']),
+        ('_raop._tcp', 'A0B1C2D3E4F5@Living Room', 'Living-Room.local', '192.168.1.23', 7000,
+         ['cn=0,1,2,3', 'da=true', 'et=0,3,5', 'ft=0x4A7FDFD5,0xBC157FDE', 'md=0,1,2', 'am=AppleTV11,1', 'sf=0x18644', 'tp=UDP', 'vn=65537', 'vs=670.6.2']),
+        ('_sonos._tcp', 'Sonos-B8E9375A1C2D@Kitchen', 'Sonos-B8E9375A1C2D.local', '192.168.1.24', 1443,
+         ['info=/api/v1/players/RINCON_B8E9375A1C2D01400/info', 'vers=3', 'protovers=1.24.1', 'bootseq=84', 'hhid=Sonos_abcdef']),
+        ('_spotify-connect._tcp', 'Sonos-B8E9375A1C2D', 'Sonos-B8E9375A1C2D.local', '192.168.1.24', 1400, ['VERSION=1.0', 'CPath=/spotifyzc']),
+        ('_hue._tcp', 'Hue Bridge - 1A2B3C', 'ecb5fa1a2b3c.local', '192.168.1.25', 443, ['bridgeid=ecb5fafffe1a2b3c', 'modelid=BSB002']),
+        ('_hap._tcp', 'Hue Bridge - 1A2B3C', 'ecb5fa1a2b3c.local', '192.168.1.25', 8080, ['c#=112', 'ff=0', 'id=6A:0B:1C:2D:3E:4F', 'md=BSB002', 's#=1', 'sf=0', 'ci=2']),
+    ]
+    phones = ['192.168.1.40', '192.168.1.41', '192.168.1.42']
+    browses = ['_googlecast._tcp', '_airplay._tcp', '_raop._tcp', '_spotify-connect._tcp', '_sonos._tcp', '_hap._tcp', '_companion-link._tcp', '_sleep-proxy._udp']
+    for d in devices:
+        c.add(announce(*d), d[3])
+    for i in range(360):
+        r = c.rng.random()
+        if r < 0.35:
+            svc = c.rng.choice(browses)
+            known = [(f'{d[0]}.local', f'{d[1]}.{d[0]}.local', 4000) for d in devices if d[0] == svc and c.rng.random() < 0.5]
+            c.add(query((f'{svc}.local', TYPE_PTR), known=known, qu=c.rng.random() < 0.2), c.rng.choice(phones))
+        elif r < 0.75:
+            d = c.rng.choice(devices)
+            c.add(announce(*d), d[3])
+        elif r < 0.85:
+            c.add(query((c.rng.choice(['iPhone.local', 'Pixel-7.local', 'MacBook-Air.local']), TYPE_AAAA)), c.rng.choice(phones))
+        elif r < 0.9:
+            d = c.rng.choice(devices)
+            c.add(announce(*d, addr6='fe80::1c2d:3eff:fe4f:' + format(c.rng.randrange(0x1000, 0xffff), 'x')), 'fe80::1c2d:3eff:fe4f:5a6b')
+        else:
+            c.add(c.rng.choice(OURS), c.rng.choice(phones))
+    return c
+
+
+def office():
+    c = Capture(2)
+    printers = []
+    for n, (model, addr) in enumerate([('HP LaserJet 400', '10.0.4.31'), ('Brother MFC-L2750DW', '10.0.4.32'),
+                                       ('Canon iR-ADV C5535', '10.0.4.33'), ('EPSON WF-C5790', '10.0.4.34')]):
+        host = model.replace(' ', '-') + '.local'
+        txt = ['txtvers=1', 'qtotal=1', 'rp=ipp/print', f'ty={model}', f'adminurl=http://{host}/', f'note=Floor {n + 1}',
+               'priority=50', f'product=({model})', 'pdl=application/pdf,image/urf,image/pwg-raster', 'Color=T', 'Duplex=T',
+               'URF=W8,SRGB24,CP1,RS600', 'UUID=' + '%08x-0000-1000-8000-00000000000%d' % (0x1234abcd + n, n)]
+        for svc, port in [('_ipp._tcp', 631), ('_ipps._tcp', 631), ('_pdl-datastream._tcp', 9100), ('_printer._tcp', 515), ('_uscan._tcp', 8080)]:
+            printers.append((svc, model, host, addr, port, txt if svc.startswith('_ipp') else txt[:6]))
+    stations = []
+    for n in range(12):
+        host = f'WS-{n:02d}.local'
+        addr = f'10.0.4.{100 + n}'
+        stations.append(('_workstation._tcp', f'ws-{n:02d} [00:1b:63:84:45:{n:02x}]', host, addr, 9, []))
+        stations.append(('_smb._tcp', f'WS-{n:02d}', host, addr, 445, []))
+        stations.append(('_device-info._tcp', f'WS-{n:02d}', host, addr, 0, ['model=MacBookPro18,3', 'osxvers=23']))
+    everything = printers + stations
+    browses = ['_ipp._tcp', '_ipps._tcp', '_printer._tcp', '_pdl-datastream._tcp', '_uscan._tcp', '_smb._tcp', '_workstation._tcp',
+               '_universal._sub._ipp._tcp', '_airdrop._tcp', '_afpovertcp._tcp']
+    for d in everything:
+        c.add(announce(*d), d[3], gap=0.01)
+    for i in range(400):
+        r = c.rng.random()
+        src = f'10.0.4.{c.rng.randrange(100, 112)}'
+        if r < 0.4:
+            svc = c.rng.choice(browses)
+            known = [(f'{d[0]}.local', f'{d[1]}.{d[0]}.local', 4000) for d in everything if d[0] == svc][:c.rng.randrange(0, 6)]
+            c.add(query((f'{svc}.local', TYPE_PTR), known=known), src)
+        elif r < 0.78:
+            d = c.rng.choice(everything)
+            c.add(announce(*d), d[3])
+        elif r < 0.86:
+            d = c.rng.choice(printers)
+            fqdn = f'{d[1]}.{d[0]}.local'
+            c.add(query((fqdn, TYPE_SRV), (fqdn, TYPE_TXT), (d[2], TYPE_A), qu=True), src)
+        elif r < 0.9:
+            c.add(query(('_services._dns-sd._udp.local', TYPE_PTR)), src)
+        else:
+            c.add(c.rng.choice(OURS), src)
+    return c
+
+
+def phones():
+    c = Capture(3)
+    kinds = [
+        ('_companion-link._tcp', ['rpBA=4E:5F:60:71:82:93', 'rpHN=1a2b3c4d5e6f', 'rpFl=0x20000', 'rpHA=9f8e7d6c5b4a', 'rpVr=510.12', 'rpAD=c1d2e3f4a5b6', 'rpHI=0a1b2c3d4e5f']),
+        ('_apple-mobdev2._tcp', []),
+        ('_rdlink._tcp', ['rpBA=4E:5F:60:71:82:93', 'rpVr=510.12']),
+        ('_googlezone._tcp', ['id=0123456789abcdef0123456789abcdef']),
+        ('_adb-tls-connect._tcp', []),
+    ]
+    people = []
+    for n in range(24):
+        host = (f'iPhone-{n}' if n % 2 else f'Pixel-{n}') + '.local'
+        addr = f'172.16.0.{50 + n}'
+        svcs = kinds[:3] if n % 2 else kinds[3:]
+        people.append((host, addr, [(s, f'{host[:-6]}-{s[1:5]}', host, addr, 49152 + n, t) for s, t in svcs]))
+    present = []
+    for i in range(420):
+        r = c.rng.random()
+        if (r < 0.12 or not present) and len(present) < len(people):
+            host, addr, svcs = c.rng.choice([p for p in people if p not in present])
+            present.append((host, addr, svcs))
+            for _ in range(3):
+                c.add(probe(host, addr), addr, gap=0.25)
+            for s in svcs:
+                c.add(announce(*s, addr6='fe80::10:' + format(50 + len(present), 'x')), addr, gap=0.02)
+        elif r < 0.2 and len(present) > 3:
+            host, addr, svcs = present.pop(c.rng.randrange(len(present)))
+            for s in svcs:
+                c.add(goodbye(s[0], s[1], s[2], s[4]), addr, gap=0.02)
+        elif r < 0.6:
+            host, addr, svcs = c.rng.choice(present)
+            svc = c.rng.choice(kinds)[0]
+            known = [(f'{s[0]}.local', f'{s[1]}.{s[0]}.local', 4000) for p in present for s in p[2] if s[0] == svc][:8]
+            c.add(query((f'{svc}.local', TYPE_PTR), ('_sleep-proxy._udp.local', TYPE_PTR), known=known, qu=c.rng.random() < 0.3), addr)
+        elif r < 0.9:
+            host, addr, svcs = c.rng.choice(present)
+            c.add(announce(*c.rng.choice(svcs)), addr)
+        else:
+            c.add(c.rng.choice(OURS), c.rng.choice(present)[1])
+    return c
+
+
+if __name__ == '__main__':
+    for name, build in (('home', home), ('office', office), ('phones', phones)):
+        build().write(f'{name}.pcap')
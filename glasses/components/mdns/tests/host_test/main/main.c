@@ -46,6 +46,185 @@ static void query_mdns_host(const char *host_name)
 }
 #endif // TEST_CONSOLE
 
+#ifdef CONFIG_TEST_RX_BENCH
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "esp_timer.h"
+
+// PTR question for _rxbench._tcp.local, nobody answers it, so only receiving and parsing is measured
+static const uint8_t s_bench_query[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x08, '_', 'r', 'x', 'b', 'e', 'n', 'c', 'h', 0x04, '_', 't', 'c', 'p', 0x05, 'l', 'o', 'c', 'a', 'l', 0x00,
+    0x00, 0x0c, 0x00, 0x01,
+};
+
+static void rx_bench(esp_netif_t *interface)
+{
+    esp_netif_ip_info_t ip_info;
+    ESP_ERROR_CHECK(esp_netif_get_ip_info(interface, &ip_info));
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Failed to create the bench socket");
+        return;
+    }
+    struct in_addr local = { .s_addr = ip_info.ip.addr };
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &local, sizeof(local));
+    struct sockaddr_in dest = { .sin_family = AF_INET, .sin_port = htons(5353) };
+    inet_aton("224.0.0.251", &dest.sin_addr);
+
+    mdns_rx_stats_t before, after;
+    mdns_action_queue_stats_t queue;
+    ESP_ERROR_CHECK(mdns_get_rx_stats(&before));
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < CONFIG_TEST_RX_BENCH_PACKETS; i++) {
+        sendto(sock, s_bench_query, sizeof(s_bench_query), 0, (struct sockaddr *)&dest, sizeof(dest));
+    }
+    // done once every packet was received or dropped and the mDNS task went idle
+    uint32_t seen;
+    do {
+        vTaskDelay(pdMS_TO_TICKS(1));
+        mdns_get_rx_stats(&after);
+        mdns_get_action_queue_stats(&queue);
+        seen = (after.received - before.received) + (after.dropped - before.dropped);
+    } while ((seen < CONFIG_TEST_RX_BENCH_PACKETS || queue.pending) && esp_timer_get_time() - start < 10 * 1000 * 1000);
+    int64_t elapsed = esp_timer_get_time() - start;
+    close(sock);
+
+    uint32_t received = after.received - before.received;
+    printf("rx bench: sent %d, received %lu, dropped %lu, lost %lu, %.0f packets/s, slots in use %lu/%lu, action queue %lu/%lu\n",
+           CONFIG_TEST_RX_BENCH_PACKETS, (unsigned long)received, (unsigned long)(after.dropped - before.dropped),
+           (unsigned long)(CONFIG_TEST_RX_BENCH_PACKETS - seen), received * 1e6 / elapsed,
+           (unsigned long)after.slots_high_water, (unsigned long)after.slots,
+           (unsigned long)queue.high_water, (unsigned long)queue.capacity);
+}
+#endif // CONFIG_TEST_RX_BENCH
+
+#ifdef CONFIG_TEST_PCAP_BENCH
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <execinfo.h>
+#include <unistd.h>
+#include "pcap_file.h"
+
+static char **s_pcap_files;
+static int s_pcap_file_count;
+static int s_exit_code;
+static double s_max_allocs_per_packet;  // 0: no limit
+static uint32_t s_max_peak_growth;      // 0: no limit
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int cmp_site_allocs(const void *a, const void *b)
+{
+    const mdns_mem_site_stats_t *x = a, *y = b;
+    return x->allocs < y->allocs ? 1 : x->allocs > y->allocs ? -1 : 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Replays the captures given on the command line through mdns_rx_replay()
+ *
+ * One round warms up, the next CONFIG_TEST_PCAP_BENCH_ROUNDS are measured.
+ * Exits with 1 if nothing could be replayed or if the measured rounds exceed
+ * the limits given with -a (allocations per packet) or -p (peak heap growth
+ * in bytes).
+ */
+static void pcap_bench(esp_netif_t *interface)
+{
+    pcap_packet_t *packets = NULL;
+    size_t count = 0;
+    s_exit_code = 1;
+    for (int i = 0; i < s_pcap_file_count; i++) {
+        if (pcap_load(s_pcap_files[i], &packets, &count) < 0) {
+            ESP_LOGE(TAG, "Cannot open or not a pcap file %s", s_pcap_files[i]);
+            goto out;
+        }
+    }
+    if (count == 0) {
+        ESP_LOGE(TAG, "No mDNS packets, pass pcap files on the command line");
+        goto out;
+    }
+
+    const size_t rounds = CONFIG_TEST_PCAP_BENCH_ROUNDS;
+    uint32_t *latency = malloc(count * rounds * sizeof(uint32_t));
+    if (!latency) {
+        goto out;
+    }
+    size_t replayed = 0, skipped = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (mdns_rx_replay(interface, &packets[i].src, packets[i].src_port, packets[i].data, packets[i].len) != ESP_OK) {
+            skipped++;      // e.g. IPv6 while the interface runs IPv4 only
+            packets[i].len = 0;
+        }
+    }
+    // count allocations and the peak of the measured rounds only
+    mdns_mem_stats_t mem;
+    ESP_ERROR_CHECK(mdns_get_mem_stats(&mem, NULL, NULL, true));
+    uint32_t live = mem.live_bytes;
+    uint64_t start = now_ns();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < count; i++) {
+            if (packets[i].len == 0) {
+                continue;
+            }
+            uint64_t t = now_ns();
+            mdns_rx_replay(interface, &packets[i].src, packets[i].src_port, packets[i].data, packets[i].len);
+            latency[replayed++] = (uint32_t)(now_ns() - t);
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+    size_t num_sites = CONFIG_MDNS_MEMORY_PROFILING_SITES + 1;
+    mdns_mem_site_stats_t *sites = malloc(num_sites * sizeof(mdns_mem_site_stats_t));
+    if (!sites) {
+        num_sites = 0;
+    }
+    mdns_get_mem_stats(&mem, sites, &num_sites, false);
+
+    if (replayed) {
+        qsort(latency, replayed, sizeof(uint32_t), cmp_u32);
+        printf("pcap bench: %zu packets x %zu rounds (%zu skipped), %.0f packets/s, %.2f allocs/packet, "
+               "peak heap %" PRIu32 " bytes (+%" PRIu32 "), latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+               count - skipped, rounds, skipped, replayed * 1e9 / elapsed, (double)mem.allocs / replayed,
+               mem.peak_bytes, mem.peak_bytes - live, latency[replayed / 2] / 1e3, latency[replayed * 99 / 100] / 1e3,
+               latency[replayed - 1] / 1e3);
+        qsort(sites, num_sites, sizeof(mdns_mem_site_stats_t), cmp_site_allocs);
+        for (size_t i = 0; i < num_sites && i < 5 && sites[i].allocs; i++) {
+            char **sym = sites[i].site ? backtrace_symbols((void *const *)&sites[i].site, 1) : NULL;
+            printf("  %.2f allocs/packet from %s\n", (double)sites[i].allocs / replayed, sym ? sym[0] : "(other sites)");
+            free(sym);
+        }
+        s_exit_code = 0;
+        if (s_max_allocs_per_packet > 0 && (double)mem.allocs / replayed > s_max_allocs_per_packet) {
+            ESP_LOGE(TAG, "%.2f allocs/packet exceeds the limit of %.2f", (double)mem.allocs / replayed, s_max_allocs_per_packet);
+            s_exit_code = 1;
+        }
+        if (s_max_peak_growth > 0 && mem.peak_bytes - live > s_max_peak_growth) {
+            ESP_LOGE(TAG, "Peak heap growth of %" PRIu32 " bytes exceeds the limit of %" PRIu32,
+                     mem.peak_bytes - live, s_max_peak_growth);
+            s_exit_code = 1;
+        }
+    }
+    free(sites);
+    free(latency);
+out:
+    pcap_free(packets, count);
+}
+#endif // CONFIG_TEST_PCAP_BENCH
+
 #ifndef CONFIG_IDF_TARGET_LINUX
 #include "protocol_examples_common.h"
 #include "esp_event.h"
@@ -75,6 +254,24 @@ void app_main(void)
 int main(int argc, char *argv[])
 {
     setvbuf(stdout, NULL, _IONBF, 0);
+#ifdef CONFIG_TEST_PCAP_BENCH
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:")) != -1) {
+        switch (opt) {
+        case 'a':
+            s_max_allocs_per_packet = strtod(optarg, NULL);
+            break;
+        case 'p':
+            s_max_peak_growth = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            printf("usage: %s [-a max-allocs-per-packet] [-p max-peak-heap-growth] file.pcap...\n", argv[0]);
+            return 1;
+        }
+    }
+    s_pcap_files = argv + optind;
+    s_pcap_file_count = argc - optind;
+#endif
     const esp_netif_inherent_config_t base_cg = { .if_key = "WIFI_STA_DEF", .if_desc = CONFIG_TEST_NETIF_NAME };
     esp_netif_config_t cfg = { .base = &base_cg  };
     esp_netif_t *sta = esp_netif_new(&cfg);
@@ -82,7 +279,11 @@ int main(int argc, char *argv[])
     mdns_test_app(sta);
 
     esp_netif_destroy(sta);
+#ifdef CONFIG_TEST_PCAP_BENCH
+    return s_exit_code;
+#else
     return 0;
+#endif
 }
 #endif
 
@@ -116,6 +317,17 @@ static void mdns_test_app(esp_netif_t *interface)
     ESP_ERROR_CHECK(esp_console_start_repl(repl));
     xEventGroupWaitBits(s_exit_signal, 1, pdTRUE, pdFALSE, portMAX_DELAY);
     repl->del(repl);
+#elif defined(CONFIG_TEST_RX_BENCH)
+    vTaskDelay(pdMS_TO_TICKS(3000));    // let probing and announcing finish first
+    rx_bench(interface);
+#elif defined(CONFIG_TEST_PCAP_BENCH)
+    // something to answer for, besides the hostname
+    mdns_txt_item_t txt[] = { { "board", "esp32" }, { "path", "/" } };
+    ESP_ERROR_CHECK(mdns_service_add("myesp-web", "_http", "_tcp", 80, txt, 2));
+    ESP_ERROR_CHECK(mdns_service_subtype_add_for_host("myesp-web", "_http", "_tcp", NULL, "_printer"));
+    ESP_ERROR_CHECK(mdns_service_add(NULL, "_workstation", "_tcp", 9, NULL, 0));
+    vTaskDelay(pdMS_TO_TICKS(3000));    // let probing and announcing finish first
+    pcap_bench(interface);
 #else
     vTaskDelay(pdMS_TO_TICKS(10000));
     query_mdns_host("david-work");
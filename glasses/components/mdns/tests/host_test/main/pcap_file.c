@@ -0,0 +1,163 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcap_file.h"
+
+static uint16_t rd16be(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t rd32(const uint8_t *p, bool swap)
+{
+    return swap ? (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]
+           : (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+/**
+ * @brief Finds the mDNS payload of a captured frame, UDP to port 5353 over IPv4 or IPv6
+ *
+ * @return false for anything else, fragments included
+ */
+static bool pcap_frame_parse(uint32_t linktype, const uint8_t *frame, size_t len, pcap_packet_t *out)
+{
+    uint16_t ethertype;
+    size_t off;
+    switch (linktype) {
+    case 1:     // Ethernet
+        if (len < 14) {
+            return false;
+        }
+        ethertype = rd16be(frame + 12);
+        off = 14;
+        if (ethertype == 0x8100 && len >= 18) {
+            ethertype = rd16be(frame + 16);
+            off = 18;
+        }
+        break;
+    case 113:   // Linux cooked capture
+        if (len < 16) {
+            return false;
+        }
+        ethertype = rd16be(frame + 14);
+        off = 16;
+        break;
+    case 276:   // Linux cooked capture v2
+        if (len < 20) {
+            return false;
+        }
+        ethertype = rd16be(frame);
+        off = 20;
+        break;
+    case 101:   // raw IP
+        if (len < 1) {
+            return false;
+        }
+        ethertype = (frame[0] >> 4) == 6 ? 0x86dd : 0x0800;
+        off = 0;
+        break;
+    default:
+        return false;
+    }
+
+    const uint8_t *ip = frame + off;
+    len -= off;
+    size_t udp_off;
+    memset(&out->src, 0, sizeof(out->src));
+    if (ethertype == 0x0800) {
+        if (len < 20 || (ip[0] >> 4) != 4 || ip[9] != 17 || (rd16be(ip + 6) & 0x3fff)) {
+            return false;
+        }
+        udp_off = (ip[0] & 0x0f) * 4;
+        out->src.type = ESP_IPADDR_TYPE_V4;
+        memcpy(&out->src.u_addr.ip4.addr, ip + 12, 4);
+    } else if (ethertype == 0x86dd) {
+        if (len < 40 || ip[6] != 17) {
+            return false;
+        }
+        udp_off = 40;
+        out->src.type = ESP_IPADDR_TYPE_V6;
+        memcpy(out->src.u_addr.ip6.addr, ip + 8, 16);
+    } else {
+        return false;
+    }
+    if (len < udp_off + 8) {
+        return false;
+    }
+    const uint8_t *udp = ip + udp_off;
+    size_t payload = rd16be(udp + 4);
+    if (rd16be(udp + 2) != 5353 || payload <= 8 || udp_off + payload > len || payload - 8 > 1460) {
+        return false;
+    }
+    out->src_port = rd16be(udp);
+    out->len = payload - 8;
+    out->data = (uint8_t *)udp + 8;
+    return true;
+}
+
+int pcap_load(const char *path, pcap_packet_t **packets, size_t *count)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return -1;
+    }
+    uint8_t hdr[24];
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+        fclose(f);
+        return -1;
+    }
+    uint32_t magic = rd32(hdr, false);
+    bool swap;
+    if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) {
+        swap = false;
+    } else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) {
+        swap = true;
+    } else {
+        fclose(f);
+        return -1;
+    }
+    uint32_t linktype = rd32(hdr + 20, swap) & 0x0fffffff;
+    uint32_t frac_per_ms = magic == 0xa1b23c4d || magic == 0x4d3cb2a1 ? 1000000 : 1000;
+    int added = 0;
+    uint8_t rec[16];
+    static uint8_t frame[65536];
+    while (fread(rec, 1, sizeof(rec), f) == sizeof(rec)) {
+        uint32_t caplen = rd32(rec + 8, swap);
+        if (caplen > sizeof(frame) || fread(frame, 1, caplen, f) != caplen) {
+            break;
+        }
+        pcap_packet_t p;
+        if (!pcap_frame_parse(linktype, frame, caplen, &p)) {
+            continue;
+        }
+        p.time_ms = rd32(rec, swap) * 1000 + rd32(rec + 4, swap) / frac_per_ms;
+        pcap_packet_t *grown = realloc(*packets, (*count + 1) * sizeof(pcap_packet_t));
+        uint8_t *data = malloc(p.len);
+        if (!grown || !data) {
+            free(data);
+            *packets = grown ? grown : *packets;
+            break;
+        }
+        memcpy(data, p.data, p.len);
+        p.data = data;
+        *packets = grown;
+        (*packets)[(*count)++] = p;
+        added++;
+    }
+    fclose(f);
+    return added;
+}
+
+void pcap_free(pcap_packet_t *packets, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        free(packets[i].data);
+    }
+    free(packets);
+}
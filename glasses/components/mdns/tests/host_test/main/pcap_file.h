@@ -0,0 +1,40 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_netif_ip_addr.h"
+
+/**
+ * @brief An mDNS packet of a capture, UDP to port 5353
+ */
+typedef struct {
+    esp_ip_addr_t src;
+    uint16_t src_port;
+    uint16_t len;
+    uint8_t *data;
+    uint32_t time_ms;       // capture time in ms, wraps around
+} pcap_packet_t;
+
+/**
+ * @brief Appends the mDNS packets of a pcap file (not pcapng) to *packets
+ *
+ * Ethernet, Linux cooked v1/v2 and raw IP captures are read, with IPv4 and IPv6.
+ * Fragments and payloads over 1460 bytes are left out.
+ *
+ * @param path      the capture
+ * @param packets   grown with realloc(), free with pcap_free()
+ * @param count     number of packets in *packets
+ *
+ * @return number of packets added, -1 if the file can't be read or is not a pcap file
+ */
+int pcap_load(const char *path, pcap_packet_t **packets, size_t *count);
+
+/**
+ * @brief Frees the packets read by pcap_load()
+ */
+void pcap_free(pcap_packet_t *packets, size_t count);
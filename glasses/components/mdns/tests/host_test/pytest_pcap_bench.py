@@ -0,0 +1,32 @@
+# SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+# SPDX-License-Identifier: Unlicense OR CC0-1.0
+import logging
+import os
+import subprocess
+
+import pytest
+
+logging.basicConfig(level=logging.INFO)
+logger = logging.getLogger(__name__)
+
+CAPTURES = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'captures')
+APP = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'build_pcap_bench', 'mdns_host.elf')
+
+
+def read_limits():
+    limits = []
+    with open(os.path.join(CAPTURES, 'limits.txt')) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) == 3 and not fields[0].startswith('#'):
+                limits.append(tuple(fields))
+    return limits
+
+
+@pytest.mark.parametrize('capture, max_allocs, max_peak', read_limits())
+def test_pcap_bench(capture, max_allocs, max_peak):
+    # the app exits with 1 if a limit is exceeded
+    result = subprocess.run([APP, '-a', max_allocs, '-p', max_peak, os.path.join(CAPTURES, capture)],
+                            capture_output=True, text=True, timeout=300)
+    logger.info(result.stdout)
+    assert result.returncode == 0, result.stdout + result.stderr
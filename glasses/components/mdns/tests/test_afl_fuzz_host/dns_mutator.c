@@ -0,0 +1,484 @@
+/*
+ * Structure-aware mutator for the mDNS parser fuzzer
+ *
+ * Byte mutations mostly break the header counts or a record length, and the
+ * parser gives up on the packet early. This mutator splits the packet into
+ * its questions and records and changes them as a whole: the type, class or
+ * TTL, the name (into a compression pointer, or with a broken label), the
+ * rdata (regenerated for the type, or with a wrong length), or the section.
+ * The packet is then written back with matching counts, unless the header
+ * is what was mutated. Bytes after the last complete record are kept.
+ *
+ * The libFuzzer target uses it from LLVMFuzzerCustomMutator() in test.c.
+ * Built with AFL_CUSTOM_MUTATOR, it is an AFL++ custom mutator library.
+ */
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include "dns_mutator.h"
+
+#define DNS_HEADER_LEN      12
+#define DNS_MAX_LEN         1460
+#define DNS_MAX_ENTRIES     64
+#define DNS_QUESTION        0           // sections in packet order, then answer, authority, additional
+#define DNS_SECTIONS        4
+
+#define DNS_TYPE_A          1
+#define DNS_TYPE_PTR        12
+#define DNS_TYPE_TXT        16
+#define DNS_TYPE_AAAA       28
+#define DNS_TYPE_SRV        33
+#define DNS_TYPE_NSEC       47
+
+typedef struct {
+    uint8_t section;
+    uint16_t name_len;                  // the name is at the start of data
+    uint16_t len;
+    uint8_t data[DNS_MAX_LEN];
+} dns_entry_t;
+
+static struct {
+    uint8_t header[DNS_HEADER_LEN];
+    dns_entry_t entries[DNS_MAX_ENTRIES];
+    size_t num;
+    uint8_t tail[DNS_MAX_LEN];
+    size_t tail_len;
+    uint16_t offset[DNS_MAX_ENTRIES];   // where each entry starts in the last written packet
+    uint8_t out[DNS_MAX_LEN];
+    uint32_t rng;
+} s_pkt;
+
+static const uint16_t s_types[] = { DNS_TYPE_A, DNS_TYPE_PTR, DNS_TYPE_TXT, DNS_TYPE_AAAA, DNS_TYPE_SRV, 41, DNS_TYPE_NSEC, 255, 0, 0xffff };
+static const uint32_t s_ttls[] = { 0, 1, 120, 4500, 0x7fffffff, 0xffffffff };
+// the names the fuzz test registers and looks up, and a few the parser treats specially
+static const char *s_labels[] = {
+    "minifritz", "megafritz", "Hristo's Time Capsule", "_fritz", "_server", "_sub", "_http", "_afpovertcp",
+    "_workstation", "_arduino", "_services", "_dns-sd", "_tcp", "_udp", "local", "in-addr", "ip6", "arpa", "1", "0",
+};
+
+static uint32_t rnd(uint32_t n)
+{
+    s_pkt.rng ^= s_pkt.rng << 13;
+    s_pkt.rng ^= s_pkt.rng >> 17;
+    s_pkt.rng ^= s_pkt.rng << 5;
+    return n ? s_pkt.rng % n : 0;
+}
+
+static uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static void wr16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xff;
+}
+
+/**
+ * Bytes the name at p takes, 0 if it runs past len or uses a reserved label type
+ */
+static size_t dns_name_len(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+    while (i < len) {
+        if (p[i] == 0) {
+            return i + 1;
+        }
+        if ((p[i] & 0xC0) == 0xC0) {
+            return i + 2 <= len ? i + 2 : 0;
+        }
+        if (p[i] & 0xC0) {
+            return 0;
+        }
+        i += 1 + p[i];
+    }
+    return 0;
+}
+
+static bool dns_split(const uint8_t *data, size_t size)
+{
+    size_t i = DNS_HEADER_LEN;
+
+    memcpy(s_pkt.header, data, DNS_HEADER_LEN);
+    s_pkt.num = 0;
+    for (int section = 0; section < DNS_SECTIONS; section++) {
+        uint16_t count = rd16(data + 4 + 2 * section);
+        for (uint16_t c = 0; c < count && s_pkt.num < DNS_MAX_ENTRIES; c++) {
+            size_t name_len = dns_name_len(data + i, size - i);
+            size_t len = name_len + (section == DNS_QUESTION ? 4 : 10);
+            if (!name_len || i + len > size) {
+                goto tail;
+            }
+            if (section != DNS_QUESTION) {
+                len += rd16(data + i + name_len + 8);
+                if (i + len > size) {
+                    goto tail;
+                }
+            }
+            dns_entry_t *e = &s_pkt.entries[s_pkt.num++];
+            e->section = section;
+            e->name_len = name_len;
+            e->len = len;
+            memcpy(e->data, data + i, len);
+            i += len;
+        }
+    }
+tail:
+    s_pkt.tail_len = size - i;
+    memcpy(s_pkt.tail, data + i, s_pkt.tail_len);
+    return s_pkt.num > 0;
+}
+
+/**
+ * Write the packet to s_pkt.out, section by section, and note the offset of every entry
+ *
+ * @return its length, 0 if it does not fit in max_size
+ */
+static size_t dns_join(size_t max_size, bool keep_counts)
+{
+    uint16_t counts[DNS_SECTIONS] = { 0 };
+    size_t len = DNS_HEADER_LEN;
+
+    for (int section = 0; section < DNS_SECTIONS; section++) {
+        for (size_t k = 0; k < s_pkt.num; k++) {
+            dns_entry_t *e = &s_pkt.entries[k];
+            if (e->section != section) {
+                continue;
+            }
+            if (len + e->len > max_size) {
+                return 0;
+            }
+            s_pkt.offset[k] = len;
+            memcpy(s_pkt.out + len, e->data, e->len);
+            len += e->len;
+            counts[section]++;
+        }
+    }
+    if (len + s_pkt.tail_len <= max_size) {
+        memcpy(s_pkt.out + len, s_pkt.tail, s_pkt.tail_len);
+        len += s_pkt.tail_len;
+    }
+    memcpy(s_pkt.out, s_pkt.header, DNS_HEADER_LEN);
+    if (!keep_counts) {
+        for (int section = 0; section < DNS_SECTIONS; section++) {
+            wr16(s_pkt.out + 4 + 2 * section, counts[section]);
+        }
+    }
+    return len;
+}
+
+/**
+ * A compression pointer to the name of an entry written before entry idx, to
+ * the suffix of one, or to a place where no name is (the header, entry idx itself)
+ */
+static size_t dns_gen_pointer(uint8_t *out, size_t idx)
+{
+    uint16_t target = s_pkt.offset[idx];
+    size_t tries = 4;
+    while (tries-- && s_pkt.num > 1) {
+        size_t j = rnd(s_pkt.num);
+        if (s_pkt.offset[j] < s_pkt.offset[idx]) {
+            target = s_pkt.offset[j];
+            const uint8_t *name = s_pkt.entries[j].data;
+            if (rnd(2) && name[0] && name[0] < 0x40) {
+                target += 1 + name[0];
+            }
+            break;
+        }
+    }
+    if (!rnd(8)) {
+        target = rnd(2) ? rnd(DNS_HEADER_LEN) : s_pkt.offset[idx];
+    }
+    out[0] = 0xC0 | (target >> 8);
+    out[1] = target & 0xff;
+    return 2;
+}
+
+/**
+ * A name of one to four labels from s_labels, ending in the root or in a pointer
+ */
+static size_t dns_gen_name(uint8_t *out, size_t idx)
+{
+    size_t len = 0;
+    for (uint32_t n = 1 + rnd(4); n; n--) {
+        const char *label = s_labels[rnd(sizeof(s_labels) / sizeof(s_labels[0]))];
+        out[len++] = strlen(label);
+        memcpy(out + len, label, strlen(label));
+        len += strlen(label);
+    }
+    if (rnd(2)) {
+        return len + dns_gen_pointer(out + len, idx);
+    }
+    out[len++] = 0;
+    return len;
+}
+
+static void dns_set_name(dns_entry_t *e, const uint8_t *name, size_t len)
+{
+    size_t rest = e->len - e->name_len;
+    if (len + rest > DNS_MAX_LEN) {
+        return;
+    }
+    memmove(e->data + len, e->data + e->name_len, rest);
+    memcpy(e->data, name, len);
+    e->name_len = len;
+    e->len = len + rest;
+}
+
+static void dns_set_rdata(dns_entry_t *e, const uint8_t *rdata, size_t len)
+{
+    size_t at = e->name_len + 10;
+    if (at + len > DNS_MAX_LEN) {
+        return;
+    }
+    memcpy(e->data + at, rdata, len);
+    wr16(e->data + e->name_len + 8, len);
+    e->len = at + len;
+}
+
+/**
+ * Fill in rdata that is well formed for the type of the record, mostly
+ */
+static void dns_gen_rdata(size_t idx)
+{
+    dns_entry_t *e = &s_pkt.entries[idx];
+    uint8_t rdata[512];
+    size_t len = 0;
+
+    switch (rd16(e->data + e->name_len)) {
+    case DNS_TYPE_A:
+    case DNS_TYPE_AAAA:
+        len = rd16(e->data + e->name_len) == DNS_TYPE_A ? 4 : 16;
+        len = rnd(8) ? len : len - 1 + rnd(3);
+        for (size_t i = 0; i < len; i++) {
+            rdata[i] = rnd(256);
+        }
+        break;
+    case DNS_TYPE_SRV:
+        wr16(rdata, rnd(2));
+        wr16(rdata + 2, rnd(2));
+        wr16(rdata + 4, rnd(2) ? 80 : rnd(65536));
+        len = 6 + dns_gen_name(rdata + 6, idx);
+        break;
+    case DNS_TYPE_TXT:
+        for (uint32_t n = rnd(5); n; n--) {
+            static const char *items[] = { "board=esp32", "tcp_check=no", "key", "=value", "k=", "" };
+            const char *item = items[rnd(sizeof(items) / sizeof(items[0]))];
+            size_t item_len = strlen(item);
+            rdata[len] = rnd(16) ? item_len : item_len + 1 + rnd(4);   // sometimes runs into the next item
+            memcpy(rdata + len + 1, item, item_len);
+            len += 1 + item_len;
+        }
+        break;
+    case DNS_TYPE_NSEC: {
+        len = dns_gen_name(rdata, idx);
+        uint8_t bitmap_len = rnd(8) ? 1 + rnd(32) : rnd(256);
+        rdata[len++] = 0;
+        rdata[len++] = bitmap_len;
+        for (size_t i = 0; i < bitmap_len && len < sizeof(rdata); i++) {
+            rdata[len++] = rnd(256);
+        }
+        break;
+    }
+    case DNS_TYPE_PTR:
+        len = dns_gen_name(rdata, idx);
+        break;
+    default:
+        len = rnd(17);
+        for (size_t i = 0; i < len; i++) {
+            rdata[i] = rnd(256);
+        }
+        break;
+    }
+    dns_set_rdata(e, rdata, len);
+}
+
+/**
+ * Apply one mutation
+ *
+ * @return true if the header counts are to be written as they are
+ */
+static bool dns_mutate_one(void)
+{
+    size_t idx = rnd(s_pkt.num);
+    dns_entry_t *e = &s_pkt.entries[idx];
+    bool record = e->section != DNS_QUESTION;
+    uint8_t *fixed = e->data + e->name_len;     // type, class, and for records TTL and rdlength
+    uint8_t name[300];
+
+    switch (rnd(11)) {
+    case 0:
+        wr16(fixed, s_types[rnd(sizeof(s_types) / sizeof(s_types[0]))]);
+        if (record && rnd(2)) {
+            dns_gen_rdata(idx);
+        }
+        break;
+    case 1:
+        if (rnd(2)) {
+            fixed[2] ^= 0x80;   // cache flush, or unicast response for questions
+        } else {
+            wr16(fixed + 2, rnd(2) ? 1 : (rnd(2) ? 255 : rnd(65536)));
+        }
+        break;
+    case 2:
+        if (record) {
+            uint32_t ttl = s_ttls[rnd(sizeof(s_ttls) / sizeof(s_ttls[0]))];
+            wr16(fixed + 4, ttl >> 16);
+            wr16(fixed + 6, ttl & 0xffff);
+        }
+        break;
+    case 3:
+        if (rnd(2)) {
+            dns_set_name(e, name, dns_gen_pointer(name, idx));
+        } else {
+            dns_set_name(e, name, dns_gen_name(name, idx));
+        }
+        break;
+    case 4:
+        if (e->data[0] && e->data[0] < 0x40) {
+            static const uint8_t lengths[] = { 0, 63, 64, 0x80, 0xC0 };
+            switch (rnd(3)) {
+            case 0:
+                e->data[0] = lengths[rnd(sizeof(lengths))];
+                break;
+            case 1:
+                e->data[1 + rnd(e->data[0])] ^= 0x20;     // letter case
+                break;
+            default:
+                // one more label in front, up to names longer than 255 bytes
+                name[0] = rnd(2) ? 4 : 63;
+                memset(name + 1, 'x', name[0]);
+                memcpy(name + 1, "_sub", 4);
+                if (e->name_len + 1 + name[0] <= (int)sizeof(name)) {
+                    memcpy(name + 1 + name[0], e->data, e->name_len);
+                    dns_set_name(e, name, e->name_len + 1 + name[0]);
+                }
+                break;
+            }
+        }
+        break;
+    case 5:
+        if (record) {
+            dns_gen_rdata(idx);
+        }
+        break;
+    case 6:
+        if (record) {
+            uint16_t rdlength = rd16(fixed + 8);
+            wr16(fixed + 8, rnd(4) ? rdlength + rnd(3) - 1 : rnd(65536));
+        }
+        break;
+    case 7:
+        if (s_pkt.num < DNS_MAX_ENTRIES) {
+            dns_entry_t *copy = &s_pkt.entries[s_pkt.num++];
+            memcpy(copy, e, sizeof(*e));
+        }
+        break;
+    case 8:
+        if (s_pkt.num > 1) {
+            memmove(e, e + 1, (s_pkt.num - idx - 1) * sizeof(*e));
+            s_pkt.num--;
+        }
+        break;
+    case 9: {
+        uint8_t section = rnd(DNS_SECTIONS);
+        if (record && section == DNS_QUESTION) {
+            e->len = e->name_len + 4;
+        } else if (!record && section != DNS_QUESTION) {
+            if (e->len + 6 > DNS_MAX_LEN) {
+                break;
+            }
+            memset(e->data + e->len, 0, 6);
+            e->data[e->len + 3] = 120;
+            e->len += 6;
+            e->section = section;
+            dns_gen_rdata(idx);
+        }
+        e->section = section;
+        break;
+    }
+    default: {
+        uint16_t flags = rd16(s_pkt.header + 2);
+        static const uint16_t bits[] = { 0x8000, 0x0400, 0x0200, 0x7800 };
+        if (rnd(2)) {
+            wr16(s_pkt.header + 2, flags ^ bits[rnd(sizeof(bits) / sizeof(bits[0]))]);
+            break;
+        }
+        // counts that do not match the records
+        dns_join(DNS_MAX_LEN, false);
+        memcpy(s_pkt.header + 4, s_pkt.out + 4, 8);
+        uint8_t *count = s_pkt.header + 4 + 2 * rnd(DNS_SECTIONS);
+        wr16(count, rnd(4) ? rd16(count) + rnd(3) - 1 : 0xffff);
+        return true;
+    }
+    }
+    return false;
+}
+
+size_t dns_mutate(uint8_t *data, size_t size, size_t max_size, unsigned int seed)
+{
+    bool keep_counts = false;
+
+    s_pkt.rng = seed * 2654435761u | 1;
+    if (size < DNS_HEADER_LEN || size > DNS_MAX_LEN || !dns_split(data, size)) {
+        return 0;
+    }
+    for (uint32_t n = 1 + rnd(3); n; n--) {
+        dns_join(DNS_MAX_LEN, true);    // offsets for the compression pointers
+        keep_counts |= dns_mutate_one();
+        if (!s_pkt.num) {
+            return 0;
+        }
+    }
+    size_t len = dns_join(max_size < DNS_MAX_LEN ? max_size : DNS_MAX_LEN, keep_counts);
+    if (len) {
+        memcpy(data, s_pkt.out, len);
+    }
+    return len;
+}
+
+#ifdef AFL_CUSTOM_MUTATOR
+/*
+ * AFL++ custom mutator interface, see docs/custom_mutators.md in AFL++.
+ * Load with AFL_CUSTOM_MUTATOR_LIBRARY=dns_mutator.so, AFL++ keeps running
+ * its own mutations next to these.
+ */
+typedef struct {
+    uint8_t buf[DNS_MAX_LEN];
+    unsigned int seed;
+} afl_dns_mutator_t;
+
+void *afl_custom_init(void *afl, unsigned int seed)
+{
+    afl_dns_mutator_t *m = calloc(1, sizeof(afl_dns_mutator_t));
+    if (m) {
+        m->seed = seed;
+    }
+    return m;
+}
+
+size_t afl_custom_fuzz(void *data, uint8_t *buf, size_t buf_size, uint8_t **out_buf,
+                       uint8_t *add_buf, size_t add_buf_size, size_t max_size)
+{
+    afl_dns_mutator_t *m = data;
+    size_t len = buf_size < DNS_MAX_LEN ? buf_size : DNS_MAX_LEN;
+
+    memcpy(m->buf, buf, len);
+    len = dns_mutate(m->buf, len, max_size, m->seed++);
+    if (!len) {
+        // not a packet we can split, flip a byte
+        len = buf_size < DNS_MAX_LEN ? buf_size : DNS_MAX_LEN;
+        if (len) {
+            m->buf[m->seed % len] ^= 1 << (m->seed % 8);
+        }
+    }
+    *out_buf = m->buf;
+    return len;
+}
+
+void afl_custom_deinit(void *data)
+{
+    free(data);
+}
+#endif /* AFL_CUSTOM_MUTATOR */
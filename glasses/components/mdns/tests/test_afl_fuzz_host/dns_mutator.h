@@ -0,0 +1,20 @@
+/*
+ * Structure-aware mutations of mDNS packets, see dns_mutator.c
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Mutate the packet in place, one record or header field at a time
+ *
+ * @param data      the packet, with room for max_size bytes
+ * @param size      its length
+ * @param max_size  most the mutated packet may take
+ * @param seed      picks the mutation, the same seed and input give the same output
+ *
+ * @return length of the mutated packet, 0 if the header and the first record
+ *         cannot be split out, and the caller should mutate the bytes instead
+ */
+size_t dns_mutate(uint8_t *data, size_t size, size_t max_size, unsigned int seed);
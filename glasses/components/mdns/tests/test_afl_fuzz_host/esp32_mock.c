@@ -8,12 +8,14 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include "esp32_mock.h"
 #include "esp_log.h"
 
 void     *g_queue;
 int       g_queue_send_shall_fail = 0;
 int       g_size = 0;
+bool      g_netif_ready = true;
 
 const char *WIFI_EVENT = "wifi_event";
 const char *ETH_EVENT = "eth_event";
@@ -46,16 +48,39 @@ esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
     return ESP_OK;
 }
 
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return false;
+}
+
 esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args,
                            esp_timer_handle_t *out_handle)
 {
     return ESP_OK;
 }
 
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t g_tick = 0;
+
 uint32_t xTaskGetTickCount(void)
 {
-    static uint32_t tick = 0;
-    return tick++;
+    return g_tick++;
+}
+
+void ResetTickCount(void)
+{
+    g_tick = 0;
 }
 
 /// Queue mock
@@ -88,6 +113,11 @@ uint32_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksTo
     return pdFALSE;
 }
 
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    return 0;
+}
+
 void GetLastItem(void *pvBuffer)
 {
     memcpy(pvBuffer, g_queue, g_size);
@@ -98,6 +128,16 @@ void ForceTaskDelete(void)
     g_queue_send_shall_fail = 1;
 }
 
+void SetNetifReady(bool ready)
+{
+    g_netif_ready = ready;
+}
+
+bool IsNetifReady(void)
+{
+    return g_netif_ready;
+}
+
 TaskHandle_t xTaskGetCurrentTaskHandle(void)
 {
     return NULL;
@@ -83,6 +83,7 @@ typedef void *SemaphoreHandle_t;
 typedef void *QueueHandle_t;
 typedef void *TaskHandle_t;
 typedef int    BaseType_t;
+typedef unsigned int UBaseType_t;
 typedef uint32_t TickType_t;
 typedef void *StackType_t;
 typedef void *StaticTask_t;
@@ -126,10 +127,18 @@ uint32_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t
 
 uint32_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait);
 
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue);
+
 void GetLastItem(void *pvBuffer);
 
 void ForceTaskDelete(void);
 
+void ResetTickCount(void);
+
+void SetNetifReady(bool ready);
+
+bool IsNetifReady(void);
+
 esp_err_t esp_event_handler_register(const char *event_base, int32_t event_id, void *event_handler, void *event_handler_arg);
 
 esp_err_t esp_event_handler_unregister(const char *event_base, int32_t event_id, void *event_handler);
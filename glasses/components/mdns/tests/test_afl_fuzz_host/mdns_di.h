@@ -25,6 +25,28 @@ static mdns_search_once_t *_mdns_search_init(const char *name, const char *servi
         uint32_t timeout, uint8_t max_results, mdns_query_notify_t notifier);
 static esp_err_t _mdns_send_search_action(mdns_action_type_t type, mdns_search_once_t *search);
 static void _mdns_search_free(mdns_search_once_t *search);
+static const uint8_t *_mdns_parse_fqdn(const uint8_t *packet, const uint8_t *start, mdns_name_t *name, size_t packet_len);
+static void _mdns_labels_bind(const uint8_t *packet);
+static void _mdns_recent_answers_clear(void);
+static void _mdns_answer_cache_clear(void);
+static void _mdns_restart_all_pcbs(void);
+static void _mdns_tx_queue_remove_if(bool (*drop)(const mdns_tx_packet_t *p, const void *arg), const void *arg);
+static volatile TaskHandle_t _mdns_service_task_handle;
+extern mdns_server_t *_mdns_server;
+
+/*
+ * The probes queued by mdns_test_restart_pcbs(), kept for the next inputs as
+ * long as none of them touches them
+ */
+#define MDNS_TEST_PROBES_MAX 16
+static struct {
+    mdns_pcb_t pcbs[MDNS_MAX_INTERFACES][MDNS_IP_PROTOCOL_MAX];
+    mdns_tx_packet_t *packets[MDNS_TEST_PROBES_MAX];
+    uint32_t send_at[MDNS_TEST_PROBES_MAX];
+    size_t records[MDNS_TEST_PROBES_MAX];
+    uint16_t len;
+    bool saved;
+} s_test_probes;
 
 void mdns_test_init_di(void)
 {
@@ -55,7 +77,153 @@ mdns_search_once_t *mdns_test_search_init(const char *name, const char *service,
     return mdns_test_static_search_init(name, service, proto, type, timeout, type != MDNS_TYPE_PTR, max_results, NULL);
 }
 
+/*
+ * Frees the responder after an input changed what is registered. The mocked task handle is not an
+ * allocation and there is no task to stop
+ */
+void mdns_test_free(void)
+{
+    _mdns_service_task_handle = NULL;
+    s_test_probes.saved = false;
+    mdns_free();
+}
+
+static size_t mdns_test_packet_records(const mdns_tx_packet_t *p)
+{
+    size_t n = 0;
+    for (const mdns_out_question_t *q = p->questions; q; q = q->next) {
+        n++;
+    }
+    const mdns_out_answer_t *lists[] = { p->answers, p->servers, p->additional };
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        for (const mdns_out_answer_t *a = lists[i]; a; a = a->next) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static int mdns_test_probe_find(const mdns_tx_packet_t *p)
+{
+    for (int i = 0; i < s_test_probes.len; i++) {
+        if (s_test_probes.packets[i] == p) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool mdns_test_packet_not_probe(const mdns_tx_packet_t *p, const void *arg)
+{
+    return mdns_test_probe_find(p) < 0;
+}
+
+/*
+ * Probes all the records again, as setting the hostname does, without first
+ * sending goodbyes for them, and saves the queued probes
+ */
+void mdns_test_restart_pcbs(void)
+{
+    _mdns_restart_all_pcbs();
+    s_test_probes.saved = _mdns_server->tx_queue_len <= MDNS_TEST_PROBES_MAX;
+    s_test_probes.len = _mdns_server->tx_queue_len;
+    for (uint16_t i = 0; s_test_probes.saved && i < s_test_probes.len; i++) {
+        mdns_tx_packet_t *p = _mdns_server->tx_queue[i];
+        s_test_probes.packets[i] = p;
+        s_test_probes.send_at[i] = p->send_at;
+        s_test_probes.records[i] = mdns_test_packet_records(p);
+    }
+    for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        for (int j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
+            s_test_probes.pcbs[i][j] = _mdns_server->interfaces[i].pcbs[j];
+        }
+    }
+}
+
+/*
+ * Drops the packets that the last input queued. Returns false if it changed
+ * the saved probes instead, mdns_test_restart_pcbs() queues them again then
+ */
+bool mdns_test_probes_restore(void)
+{
+    if (!s_test_probes.saved) {
+        return false;
+    }
+    for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        for (int j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
+            const mdns_pcb_t *a = &_mdns_server->interfaces[i].pcbs[j];
+            const mdns_pcb_t *b = &s_test_probes.pcbs[i][j];
+            if (a->state != b->state || a->probe_services != b->probe_services || a->probe_services_len != b->probe_services_len
+                    || a->probe_ip != b->probe_ip || a->probe_running != b->probe_running) {
+                return false;
+            }
+        }
+    }
+    uint16_t found = 0;
+    for (uint16_t i = 0; i < _mdns_server->tx_queue_len; i++) {
+        const mdns_tx_packet_t *p = _mdns_server->tx_queue[i];
+        int k = mdns_test_probe_find(p);
+        if (k >= 0) {
+            if (p->send_at != s_test_probes.send_at[k] || mdns_test_packet_records(p) != s_test_probes.records[k]) {
+                return false;
+            }
+            found++;
+        }
+    }
+    if (found != s_test_probes.len) {
+        return false;
+    }
+    _mdns_tx_queue_remove_if(mdns_test_packet_not_probe, NULL);
+    return true;
+}
+
+/*
+ * Forgets the responses built and sent for the previous input, so that they
+ * are neither reused from the cache nor suppressed as sent recently
+ */
+void mdns_test_answers_clear(void)
+{
+    _mdns_answer_cache_clear();
+    _mdns_recent_answers_clear();
+}
+
 mdns_srv_item_t *mdns_test_mdns_get_service_item(const char *service, const char *proto)
 {
     return mdns_test_static_mdns_get_service_item(service, proto, NULL);
 }
+
+static bool mdns_test_same_name(const mdns_name_t *a, const mdns_name_t *b)
+{
+    if (a->invalid || b->invalid) {
+        return a->invalid == b->invalid;
+    }
+    return a->parts == b->parts && a->sub == b->sub && !strcmp(a->host, b->host) && !strcmp(a->service, b->service)
+           && !strcmp(a->proto, b->proto) && !strcmp(a->domain, b->domain);
+}
+
+/*
+ * Parses the name at every offset of the packet, once walking it and once
+ * through the label table that mdns_parse_packet() uses, and aborts if the
+ * results differ
+ */
+void mdns_test_check_fqdn(const uint8_t *data, size_t len)
+{
+    static mdns_name_t walked[1460];
+    static const uint8_t *walked_end[1460];
+    mdns_name_t name;
+
+    if (len > 1460) {
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        walked_end[i] = _mdns_parse_fqdn(data, data + i, &walked[i], len);
+    }
+    _mdns_labels_bind(data);
+    for (size_t i = len; i-- > 0;) {
+        const uint8_t *end = _mdns_parse_fqdn(data, data + i, &name, len);
+        if (end != walked_end[i] || (end && !mdns_test_same_name(&name, &walked[i]))) {
+            abort();
+        }
+    }
+    _mdns_labels_bind(NULL);
+}
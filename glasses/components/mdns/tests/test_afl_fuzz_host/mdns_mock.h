@@ -27,5 +27,5 @@ static inline void _mdns_packet_free(mdns_rx_packet_t *packet)
 
 static inline bool mdns_is_netif_ready(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
 {
-    return true;
+    return IsNetifReady();
 }
@@ -13,12 +13,14 @@
 #include "esp32_mock.h"
 #include "mdns.h"
 #include "mdns_private.h"
+#include "dns_mutator.h"
 
 //
-// Global stuctures containing packet payload, search
+// Global stuctures containing packet payload, searches
 mdns_rx_packet_t g_packet;
 struct pbuf mypbuf;
-mdns_search_once_t *search = NULL;
+static mdns_search_once_t *searches[3];
+static size_t searches_len;
 
 //
 // Dependency injected test functions
@@ -28,6 +30,11 @@ mdns_search_once_t *mdns_test_search_init(const char *name, const char *service,
 esp_err_t mdns_test_send_search_action(mdns_action_type_t type, mdns_search_once_t *search);
 void mdns_test_search_free(mdns_search_once_t *search);
 void mdns_test_init_di(void);
+void mdns_test_check_fqdn(const uint8_t *data, size_t len);
+void mdns_test_free(void);
+void mdns_test_restart_pcbs(void);
+bool mdns_test_probes_restore(void);
+void mdns_test_answers_clear(void);
 extern mdns_server_t *_mdns_server;
 
 //
@@ -39,80 +46,56 @@ static int mdns_test_hostname_set(const char *mdns_hostname)
         _mdns_server->interfaces[i].pcbs[MDNS_IP_PROTOCOL_V6].state = PCB_RUNNING;
     }
     int ret = mdns_hostname_set(mdns_hostname);
-    mdns_action_t *a = NULL;
+    mdns_action_t a;
     GetLastItem(&a);
-    mdns_test_execute_action(a);
+    mdns_test_execute_action(&a);
     return ret;
 }
 
 static int mdns_test_add_delegated_host(const char *mdns_hostname)
 {
-    mdns_ip_addr_t addr = { .addr = { .u_addr = ESP_IPADDR_TYPE_V4 } };
-    addr.addr.u_addr.ip4.addr = 0x11111111;
+    mdns_ip_addr_t addr = { .addr = { .u_addr = { .ip4 = { .addr = 0x11111111 } }, .type = ESP_IPADDR_TYPE_V4 } };
     int ret = mdns_delegate_hostname_add(mdns_hostname, &addr);
-    mdns_action_t *a = NULL;
+    mdns_action_t a;
     GetLastItem(&a);
-    mdns_test_execute_action(a);
+    mdns_test_execute_action(&a);
     return ret;
 }
 
 
-static int mdns_test_service_instance_name_set(const char *service, const char *proto, const char *instance)
-{
-    int ret = mdns_service_instance_name_set(service, proto, instance);
-    mdns_action_t *a = NULL;
-    GetLastItem(&a);
-    mdns_test_execute_action(a);
-    return ret;
-}
-
-static int mdns_test_service_txt_set(const char *service, const char *proto,  uint8_t num_items, mdns_txt_item_t txt[])
-{
-    int ret = mdns_service_txt_set(service, proto, txt, num_items);
-    mdns_action_t *a = NULL;
-    GetLastItem(&a);
-    mdns_test_execute_action(a);
-    return ret;
-}
-
-static int mdns_test_sub_service_add(const char *sub_name, const char *service_name, const char *proto, uint32_t port)
+static int mdns_test_service_add(const char *service_name, const char *proto, uint32_t port)
 {
     if (mdns_service_add(NULL, service_name, proto, port, NULL, 0)) {
-        // This is expected failure as the service thread is not running
+        return ESP_FAIL;
     }
-    mdns_action_t *a = NULL;
-    GetLastItem(&a);
-    mdns_test_execute_action(a);
-
     if (mdns_test_mdns_get_service_item(service_name, proto) == NULL) {
         return ESP_FAIL;
     }
-    int ret = mdns_service_subtype_add_for_host(NULL, service_name, proto, NULL, sub_name);
-    a = NULL;
-    GetLastItem(&a);
-    mdns_test_execute_action(a);
-    return ret;
+    return ESP_OK;
 }
 
-static int mdns_test_service_add(const char *service_name, const char *proto, uint32_t port)
+static int mdns_test_service_instance_name_set(const char *service, const char *proto, const char *instance)
 {
-    if (mdns_service_add(NULL, service_name, proto, port, NULL, 0)) {
-        // This is expected failure as the service thread is not running
-    }
-    mdns_action_t *a = NULL;
-    GetLastItem(&a);
-    mdns_test_execute_action(a);
+    return mdns_service_instance_name_set(service, proto, instance);
+}
 
-    if (mdns_test_mdns_get_service_item(service_name, proto) == NULL) {
+static int mdns_test_service_txt_set(const char *service, const char *proto,  uint8_t num_items, mdns_txt_item_t txt[])
+{
+    return mdns_service_txt_set(service, proto, txt, num_items);
+}
+
+static int mdns_test_sub_service_add(const char *sub_name, const char *service_name, const char *proto, uint32_t port)
+{
+    if (mdns_test_service_add(service_name, proto, port)) {
         return ESP_FAIL;
     }
-    return ESP_OK;
+    return mdns_service_subtype_add_for_host(NULL, service_name, proto, NULL, sub_name);
 }
 
 static mdns_result_t *mdns_test_query(const char *name, const char *service, const char *proto, uint16_t type)
 {
-    search = mdns_test_search_init(name, service, proto, type, 3000, 20);
-    if (!search) {
+    mdns_search_once_t *search = mdns_test_search_init(name, service, proto, type, 3000, 20);
+    if (!search || searches_len == sizeof(searches) / sizeof(searches[0])) {
         abort();
     }
 
@@ -121,15 +104,25 @@ static mdns_result_t *mdns_test_query(const char *name, const char *service, con
         abort();
     }
 
-    mdns_action_t *a = NULL;
+    mdns_action_t a;
     GetLastItem(&a);
-    mdns_test_execute_action(a);
+    mdns_test_execute_action(&a);
+    searches[searches_len++] = search;
     return NULL;
 }
 
-static void mdns_test_query_free(void)
+//
+// Frees the searches with their results, also the ones that an input finished
+// (they are no longer in the list of the responder then)
+//
+static void mdns_test_queries_free(void)
 {
-    mdns_test_search_free(search);
+    while (searches_len) {
+        mdns_search_once_t *search = searches[--searches_len];
+        queueDetach(mdns_search_once_t, _mdns_server->search_once, search);
+        mdns_query_results_free(search->result);
+        mdns_test_search_free(search);
+    }
 }
 
 //
@@ -138,13 +131,12 @@ static void mdns_test_query_free(void)
 void mdns_parse_packet(mdns_rx_packet_t *packet);
 
 //
-// Test starts here
+// Registers all the hosts and services the input packets refer to. Runs once,
+// and again only after an input changed what is registered
 //
-int main(int argc, char **argv)
+static void mdns_test_setup(void)
 {
-    int i;
     const char *mdns_hostname = "minifritz";
-    const char *mdns_instance = "Hristo's Time Capsule";
     mdns_txt_item_t arduTxtData[4] = {
         {"board", "esp32"},
         {"tcp_check", "no"},
@@ -154,14 +146,13 @@ int main(int argc, char **argv)
 
     const uint8_t mac[6] = {0xDE, 0xAD, 0xBE, 0xEF, 0x00, 0x32};
 
-    uint8_t buf[1460];
     char winstance[21 + strlen(mdns_hostname)];
 
     sprintf(winstance, "%s [%02x:%02x:%02x:%02x:%02x:%02x]", mdns_hostname, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 
-    // Init depencency injected methods
-    mdns_test_init_di();
-
+    // the interfaces come up once everything is registered, instead of probing
+    // all the services again for each one added
+    SetNetifReady(false);
     if (mdns_init()) {
         abort();
     }
@@ -228,49 +219,192 @@ int main(int argc, char **argv)
         abort();
     }
 #endif
-    mdns_result_t *results = NULL;
-    FILE *file;
-    size_t nread;
+}
 
-#ifdef INSTR_IS_OFF
-    size_t len = 1460;
-    memset(buf, 0, 1460);
+//
+// Brings the interfaces up with the probes of all the records queued, and starts
+// the searches, on the same clock for every input. The probes are only queued
+// again when the previous input changed them, otherwise just what it queued
+// itself is dropped
+//
+static void mdns_test_start(void)
+{
+    if (!mdns_test_probes_restore()) {
+        ResetTickCount();
+        srand(0);
+        SetNetifReady(true);
+        for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+            _mdns_server->interfaces[i].pcbs[MDNS_IP_PROTOCOL_V4].state = PCB_RUNNING;
+            _mdns_server->interfaces[i].pcbs[MDNS_IP_PROTOCOL_V6].state = PCB_RUNNING;
+        }
+        mdns_test_restart_pcbs();
+    }
+    ResetTickCount();
+    srand(0);
+    mdns_test_answers_clear();
+    mdns_test_query("minifritz", "_fritz", "_tcp", MDNS_TYPE_ANY);
+    mdns_test_query(NULL, "_fritz", "_tcp", MDNS_TYPE_PTR);
+    mdns_test_query(NULL, "_afpovertcp", "_tcp", MDNS_TYPE_PTR);
+}
 
-    if (argc != 2) {
-        printf("Non-instrumentation mode: please supply a file name created by AFL to reproduce crash\n");
+//
+// Lost probes rename the host or a service instance, the next input needs the
+// responder set up from scratch then
+//
+static bool mdns_test_registry_changed(void)
+{
+    if (strcmp(_mdns_server->hostname, "minifritz")) {
+        return true;
+    }
+    for (int i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        for (int j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
+            if (_mdns_server->interfaces[i].pcbs[j].failed_probes) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//
+// Parses one input on a responder in the same state for every input: the
+// searches are started again, the answers queued, cached and sent for the
+// previous input are dropped and the clock is reset. Whatever else the parser allocated
+// must be freed by then, so that the sanitizers see a leak in the parser as one
+//
+static void mdns_test_one_input(const uint8_t *data, size_t len)
+{
+    if (len > 1460) {
+        len = 1460;
+    }
+    if (!_mdns_server) {
+        mdns_test_setup();
+    }
+    mdns_test_start();
+    // exactly the size of the input, reads past it are caught by ASan
+    mypbuf.payload = malloc(len);
+    memcpy(mypbuf.payload, data, len);
+    mypbuf.len = len;
+    g_packet.pb = &mypbuf;
+    mdns_test_check_fqdn(mypbuf.payload, len);
+    mdns_parse_packet(&g_packet);
+    free(mypbuf.payload);
+    mdns_test_queries_free();
+    if (mdns_test_registry_changed()) {
+        mdns_test_free();
+    }
+}
+
+#if defined(FUZZ_LIBFUZZER)
+//
+// libFuzzer entry points, mutations are split between dns_mutate() and libFuzzer's own
+//
+size_t LLVMFuzzerMutate(uint8_t *data, size_t size, size_t max_size);
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    mdns_test_init_di();
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    mdns_test_one_input(data, size);
+    return 0;
+}
+
+size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size, size_t max_size, unsigned int seed)
+{
+    size_t len = seed % 4 ? dns_mutate(data, size, max_size, seed) : 0;
+    return len ? len : LLVMFuzzerMutate(data, size, max_size);
+}
+
+#elif defined(INSTR_IS_OFF)
+//
+// Runs the given files, to reproduce a crash found by the fuzzer. With -m, each of
+// them is also mutated the given number of times by dns_mutate(), as a quick run
+// of the harness and the mutator without AFL
+//
+int main(int argc, char **argv)
+{
+    uint8_t buf[1460];
+    uint8_t mutated[1460];
+    unsigned int rounds = 0;
+    int first = 1;
+    size_t execs = 0;
+
+    if (argc > 2 && !strcmp(argv[1], "-m")) {
+        rounds = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc) {
+        printf("Non-instrumentation mode: please supply file names created by AFL to reproduce crash\n");
+        printf("usage: %s [-m rounds] file...\n", argv[0]);
         return 1;
-    } else {
-        //
-        // Note: parameter1 is a file (mangled packet) which caused the crash
-        file = fopen(argv[1], "r");
-        assert(file >= 0);
-        len = fread(buf, 1, 1460, file);
+    }
+
+    // Init depencency injected methods
+    mdns_test_init_di();
+
+    int64_t start = esp_timer_get_time();
+    for (int i = first; i < argc; i++) {
+        FILE *file = fopen(argv[i], "r");
+        if (!file) {
+            perror(argv[i]);
+            return 1;
+        }
+        size_t len = fread(buf, 1, sizeof(buf), file);
         fclose(file);
+
+        mdns_test_one_input(buf, len);
+        execs++;
+        for (unsigned int seed = 0; seed < rounds; seed++) {
+            memcpy(mutated, buf, len);
+            size_t mutated_len = dns_mutate(mutated, len, sizeof(mutated), seed);
+            if (mutated_len) {
+                mdns_test_one_input(mutated, mutated_len);
+                execs++;
+            }
+        }
+    }
+    if (rounds) {
+        double seconds = (esp_timer_get_time() - start) / 1e6;
+        printf("%zu inputs in %.2f s, %.0f exec/s\n", execs, seconds, execs / seconds);
     }
+    mdns_test_free();
+    return 0;
+}
 
-    for (i = 0; i < 1; i++) {
 #else
-    while (__AFL_LOOP(1000)) {
-        memset(buf, 0, 1460);
-        size_t len = read(0, buf, 1460);
+//
+// AFL++ persistent mode, the test case is read from shared memory. Plain afl-clang-fast
+// (AFL 2.x) has no __AFL_FUZZ_TESTCASE_*, it gets the test case on stdin instead
+//
+#ifdef __AFL_FUZZ_TESTCASE_LEN
+__AFL_FUZZ_INIT();
 #endif
-        mypbuf.payload = malloc(len);
-        memcpy(mypbuf.payload, buf, len);
-        mypbuf.len = len;
-        g_packet.pb = &mypbuf;
-        mdns_test_query("minifritz", "_fritz", "_tcp", MDNS_TYPE_ANY);
-        mdns_test_query(NULL, "_fritz", "_tcp", MDNS_TYPE_PTR);
-        mdns_test_query(NULL, "_afpovertcp", "_tcp", MDNS_TYPE_PTR);
-        mdns_parse_packet(&g_packet);
-        free(mypbuf.payload);
+
+int main(int argc, char **argv)
+{
+    // Init depencency injected methods
+    mdns_test_init_di();
+
+    // registered before the fork server starts, so that the children don't each do it again
+    mdns_test_setup();
+#ifdef __AFL_FUZZ_TESTCASE_LEN
+    __AFL_INIT();
+    const uint8_t *data = __AFL_FUZZ_TESTCASE_BUF;
+    while (__AFL_LOOP(10000)) {
+        mdns_test_one_input(data, __AFL_FUZZ_TESTCASE_LEN);
+    }
+#else
+    uint8_t buf[1460];
+    while (__AFL_LOOP(1000)) {
+        ssize_t len = read(0, buf, sizeof(buf));
+        mdns_test_one_input(buf, len > 0 ? len : 0);
     }
-#ifndef MDNS_NO_SERVICES
-    mdns_service_remove_all();
-    mdns_action_t *a = NULL;
-    GetLastItem(&a);
-    mdns_test_execute_action(a);
 #endif
-    ForceTaskDelete();
-    mdns_free();
+    mdns_test_free();
     return 0;
 }
+#endif
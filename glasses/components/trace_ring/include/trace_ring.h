@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Traced event identifiers, names are in trace_ring.c
+ */
+typedef enum {
+    TRACE_EV_CAM_VSYNC_ISR = 0,     /*!< ll_cam_vsync_isr */
+    TRACE_EV_CAM_DMA_ISR,           /*!< ll_cam_dma_isr */
+    TRACE_EV_CAM_COPY,              /*!< cam_task copy of one DMA half buffer, arg = chunk index */
+    TRACE_EV_CAM_FRAME,             /*!< cam_task handed a finished frame to the queue, arg = frame index */
+    TRACE_EV_CAM_TAKE,              /*!< esp_camera_fb_get() in the frame hub task */
+    TRACE_EV_HTTPD_SEND,            /*!< httpd send of one frame, arg = length in KiB */
+    TRACE_EV_MDNS_ACTION,           /*!< mDNS action execution, arg = mdns_action_type_t */
+    TRACE_EV_HEARTBEAT,             /*!< Recorded by the tick hook of each core as a time reference, not exported */
+    TRACE_EV_MAX
+} trace_event_t;
+
+typedef enum {
+    TRACE_PH_BEGIN = 0,
+    TRACE_PH_END,
+    TRACE_PH_INSTANT,
+} trace_phase_t;
+
+#if CONFIG_TRACE_RING_ENABLE
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "esp_cpu.h"
+
+#define TRACE_RING_SIZE CONFIG_TRACE_RING_SIZE
+
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "CONFIG_TRACE_RING_SIZE must be a power of two");
+
+/**
+ * @brief One recorded event, 8 bytes
+ */
+typedef struct {
+    uint32_t cycles;                /*!< CCOUNT of the recording core, the two cores' counters are not in sync */
+    uint16_t arg;                   /*!< Event specific argument */
+    uint8_t event;                  /*!< trace_event_t */
+    uint8_t phase_core;             /*!< trace_phase_t in bits 0..6, core id in bit 7 */
+} trace_ring_entry_t;
+
+extern trace_ring_entry_t trace_ring_buf[TRACE_RING_SIZE];
+extern atomic_uint trace_ring_head;
+extern atomic_bool trace_ring_frozen;
+
+/**
+ * @brief Record one event. Safe from ISRs (including IRAM ISRs) and any task.
+ *
+ * Slots are claimed with a single atomic increment, so concurrent writers
+ * never share a slot; the oldest events are overwritten once the ring wraps.
+ */
+static inline __attribute__((always_inline)) void trace_ring_record(trace_event_t event, trace_phase_t phase, uint16_t arg)
+{
+    if (atomic_load_explicit(&trace_ring_frozen, memory_order_relaxed)) {
+        return;
+    }
+    uint32_t idx = atomic_fetch_add_explicit(&trace_ring_head, 1, memory_order_relaxed) & (TRACE_RING_SIZE - 1);
+    trace_ring_entry_t *e = &trace_ring_buf[idx];
+    e->cycles = esp_cpu_get_cycle_count();
+    e->arg = arg;
+    e->event = (uint8_t)event;
+    e->phase_core = (uint8_t)phase | (uint8_t)(esp_cpu_get_core_id() << 7);
+}
+
+#define TRACE_BEGIN(ev, arg)    trace_ring_record((ev), TRACE_PH_BEGIN, (uint16_t)(arg))
+#define TRACE_END(ev, arg)      trace_ring_record((ev), TRACE_PH_END, (uint16_t)(arg))
+#define TRACE_INSTANT(ev, arg)  trace_ring_record((ev), TRACE_PH_INSTANT, (uint16_t)(arg))
+
+#else
+
+#define TRACE_BEGIN(ev, arg)    do { (void)(arg); } while (0)
+#define TRACE_END(ev, arg)      do { (void)(arg); } while (0)
+#define TRACE_INSTANT(ev, arg)  do { (void)(arg); } while (0)
+
+#endif // CONFIG_TRACE_RING_ENABLE
+
+/**
+ * @brief Start the per-core heartbeat and measure the cost of one record
+ *
+ * Call once at startup, before the first export. The measured cost is logged
+ * and included in every export.
+ *
+ * @return
+ *     - ESP_OK Success, also when tracing is disabled in menuconfig
+ *     - other  The tick hook could not be registered
+ */
+esp_err_t trace_ring_init(void);
+
+/**
+ * @brief Output callback for trace_ring_export_chrome()
+ *
+ * @return 0 to continue, non-zero to abort the export
+ */
+typedef int (*trace_ring_write_t)(void *ctx, const char *data, size_t len);
+
+/**
+ * @brief Dump the ring as Chrome trace_event JSON (chrome://tracing, Perfetto)
+ *
+ * Recording is paused while the dump is in progress. The cycle timestamps
+ * of each core are converted to esp_timer microseconds through a reference
+ * read on that core, so events of both cores are ordered correctly. Events
+ * older than a CCOUNT wrap (about 17.9 s at 240 MHz) are placed correctly as
+ * well, because the heartbeat started by trace_ring_init() keeps the gap
+ * between two events of a core below one wrap. If the dump itself takes so
+ * long that this no longer holds, the ring is cleared afterwards.
+ *
+ * @param buf   Scratch buffer used to batch output, at least 128 bytes
+ * @param size  Size of buf
+ * @param write Called whenever buf is full and once at the end
+ * @param ctx   Passed to write
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NOT_SUPPORTED Tracing is disabled in menuconfig
+ *     - ESP_ERR_INVALID_ARG buf too small
+ *     - ESP_FAIL write aborted the export
+ */
+esp_err_t trace_ring_export_chrome(char *buf, size_t size, trace_ring_write_t write, void *ctx);
+
+/**
+ * @brief Discard all recorded events
+ */
+void trace_ring_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
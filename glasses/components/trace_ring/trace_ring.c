@@ -0,0 +1,244 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "esp_log.h"
+#include "trace_ring.h"
+
+#if CONFIG_TRACE_RING_ENABLE
+
+#include "esp_attr.h"
+#include "esp_freertos_hooks.h"
+#include "esp_ipc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#if CONFIG_FREERTOS_UNICORE
+#define TRACE_CORES             1
+#else
+#define TRACE_CORES             2
+#endif
+
+// A core records a heartbeat once this many cycles passed since its last one,
+// so two consecutive events of a core are always less than one CCOUNT wrap apart
+#define TRACE_HEARTBEAT_CYCLES  (1u << 30)
+// An export frozen for longer may have let a core go a whole wrap without events
+#define TRACE_FREEZE_MAX_US     8000000
+#define TRACE_COST_SAMPLES      64
+#define TRACE_COST_ROUNDS       8
+
+static const char *TAG = "trace_ring";
+
+trace_ring_entry_t trace_ring_buf[TRACE_RING_SIZE];
+atomic_uint trace_ring_head;
+atomic_bool trace_ring_frozen;
+
+static const char *const s_event_names[TRACE_EV_MAX] = {
+    [TRACE_EV_CAM_VSYNC_ISR] = "cam_vsync_isr",
+    [TRACE_EV_CAM_DMA_ISR]   = "cam_dma_isr",
+    [TRACE_EV_CAM_COPY]      = "cam_copy",
+    [TRACE_EV_CAM_FRAME]     = "cam_frame",
+    [TRACE_EV_CAM_TAKE]      = "cam_take",
+    [TRACE_EV_HTTPD_SEND]    = "httpd_send",
+    [TRACE_EV_MDNS_ACTION]   = "mdns_action",
+    [TRACE_EV_HEARTBEAT]     = "heartbeat",
+};
+
+// CCOUNT of a core read together with the shared esp_timer clock
+typedef struct {
+    uint32_t cycles;
+    int64_t time_us;
+} trace_anchor_t;
+
+static uint32_t s_heartbeat_cycles[TRACE_CORES];
+static uint32_t s_record_cycles;
+
+static const char s_phase_chars[] = {
+    [TRACE_PH_BEGIN]   = 'B',
+    [TRACE_PH_END]     = 'E',
+    [TRACE_PH_INSTANT] = 'i',
+};
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    trace_ring_write_t write;
+    void *ctx;
+    esp_err_t err;
+} export_ctx_t;
+
+static void export_flush(export_ctx_t *ex)
+{
+    if (ex->err == ESP_OK && ex->len && ex->write(ex->ctx, ex->buf, ex->len) != 0) {
+        ex->err = ESP_FAIL;
+    }
+    ex->len = 0;
+}
+
+// Longest single record is well below 128 bytes, flush before it could overflow
+static void export_printf(export_ctx_t *ex, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void export_printf(export_ctx_t *ex, const char *fmt, ...)
+{
+    if (ex->size - ex->len < 128) {
+        export_flush(ex);
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(ex->buf + ex->len, ex->size - ex->len, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        ex->len += (size_t)n < ex->size - ex->len ? (size_t)n : ex->size - ex->len - 1;
+    }
+}
+
+static void IRAM_ATTR trace_ring_heartbeat(void)
+{
+    uint32_t core = esp_cpu_get_core_id();
+    uint32_t now = esp_cpu_get_cycle_count();
+    // nothing is recorded while frozen, so try again on the next tick after the export
+    if (now - s_heartbeat_cycles[core] < TRACE_HEARTBEAT_CYCLES || atomic_load_explicit(&trace_ring_frozen, memory_order_relaxed)) {
+        return;
+    }
+    s_heartbeat_cycles[core] = now;
+    TRACE_INSTANT(TRACE_EV_HEARTBEAT, 0);
+}
+
+static void read_anchor(void *arg)
+{
+    trace_anchor_t *anchor = &((trace_anchor_t *)arg)[esp_cpu_get_core_id()];
+    anchor->time_us = esp_timer_get_time();
+    anchor->cycles = esp_cpu_get_cycle_count();
+}
+
+// Lowest average over a few rounds, so that an interrupt in between does not count
+static uint32_t measure_record_cost(void)
+{
+    uint32_t best = UINT32_MAX;
+    for (int round = 0; round < TRACE_COST_ROUNDS; round++) {
+        uint32_t start = esp_cpu_get_cycle_count();
+        for (int i = 0; i < TRACE_COST_SAMPLES; i++) {
+            TRACE_INSTANT(TRACE_EV_HEARTBEAT, i);
+        }
+        uint32_t cycles = (esp_cpu_get_cycle_count() - start) / TRACE_COST_SAMPLES;
+        best = cycles < best ? cycles : best;
+    }
+    trace_ring_clear();
+    return best;
+}
+
+esp_err_t trace_ring_init(void)
+{
+    s_record_cycles = measure_record_cost();
+    ESP_LOGI(TAG, "record cost %" PRIu32 " cycles per event, %d events kept", s_record_cycles, TRACE_RING_SIZE);
+    for (int core = 0; core < TRACE_CORES; core++) {
+        esp_err_t err = esp_register_freertos_tick_hook_for_cpu(trace_ring_heartbeat, core);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+static bool entry_valid(const trace_ring_entry_t *e)
+{
+    return e->event < TRACE_EV_MAX && (e->phase_core & 0x7f) <= TRACE_PH_INSTANT
+           && (e->phase_core >> 7) < TRACE_CORES;
+}
+
+esp_err_t trace_ring_export_chrome(char *buf, size_t size, trace_ring_write_t write, void *ctx)
+{
+    if (!buf || size < 128 || !write) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    export_ctx_t ex = { .buf = buf, .size = size, .write = write, .ctx = ctx, .err = ESP_OK };
+    trace_anchor_t anchors[TRACE_CORES];
+
+    atomic_store(&trace_ring_frozen, true);
+#if CONFIG_FREERTOS_UNICORE
+    read_anchor(anchors);
+#else
+    for (int core = 0; core < TRACE_CORES; core++) {
+        esp_ipc_call_blocking(core, read_anchor, anchors);
+    }
+#endif
+    uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    uint32_t head = atomic_load(&trace_ring_head);
+    uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+
+    // Walk back from the anchors, adding up the gaps between the events of each
+    // core. A gap is below one wrap, so its uint32_t difference is exact.
+    uint64_t age[TRACE_CORES] = {0};            // cycles from the oldest event of the core to its anchor
+    uint32_t prev[TRACE_CORES];
+    for (int core = 0; core < TRACE_CORES; core++) {
+        prev[core] = anchors[core].cycles;
+    }
+    for (uint32_t i = head; i != head - count;) {
+        const trace_ring_entry_t *e = &trace_ring_buf[--i & (TRACE_RING_SIZE - 1)];
+        if (entry_valid(e)) {
+            uint8_t core = e->phase_core >> 7;
+            age[core] += (uint32_t)(prev[core] - e->cycles);
+            prev[core] = e->cycles;
+        }
+    }
+
+    export_printf(&ex, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"record_cycles\":%" PRIu32 "},\"traceEvents\":["
+                  "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"core0\"}},"
+                  "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"core1\"}}",
+                  s_record_cycles);
+
+    // and forward again in recording order, taking the gaps off
+    for (uint32_t i = head - count; i != head && ex.err == ESP_OK; i++) {
+        const trace_ring_entry_t *e = &trace_ring_buf[i & (TRACE_RING_SIZE - 1)];
+        if (!entry_valid(e)) {
+            continue;
+        }
+        uint8_t phase = e->phase_core & 0x7f;
+        uint8_t core = e->phase_core >> 7;
+        age[core] -= (uint32_t)(e->cycles - prev[core]);
+        prev[core] = e->cycles;
+        if (e->event == TRACE_EV_HEARTBEAT) {
+            continue;
+        }
+        int64_t ts_ns = anchors[core].time_us * 1000 - (int64_t)(age[core] * 1000 / ticks_per_us);
+        ts_ns = ts_ns > 0 ? ts_ns : 0;
+        export_printf(&ex, ",{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%" PRId64 ".%03u,\"pid\":1,\"tid\":%u,\"args\":{\"v\":%u}}",
+                      s_event_names[e->event], s_phase_chars[phase], phase == TRACE_PH_INSTANT ? "\"s\":\"t\"," : "",
+                      ts_ns / 1000, (unsigned)(ts_ns % 1000), (unsigned)core, (unsigned)e->arg);
+    }
+    export_printf(&ex, "]}");
+    export_flush(&ex);
+
+    if (esp_timer_get_time() - anchors[0].time_us > TRACE_FREEZE_MAX_US) {
+        ESP_LOGW(TAG, "export took too long to tie older events to newer ones, clearing");
+        atomic_store(&trace_ring_head, 0);
+    }
+    atomic_store(&trace_ring_frozen, false);
+    return ex.err;
+}
+
+void trace_ring_clear(void)
+{
+    atomic_store(&trace_ring_frozen, true);
+    atomic_store(&trace_ring_head, 0);
+    atomic_store(&trace_ring_frozen, false);
+}
+
+#else
+
+esp_err_t trace_ring_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t trace_ring_export_chrome(char *buf, size_t size, trace_ring_write_t write, void *ctx)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void trace_ring_clear(void)
+{
+}
+
+#endif // CONFIG_TRACE_RING_ENABLE
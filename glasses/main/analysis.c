@@ -0,0 +1,160 @@
+#include "analysis.h"
+#include "frame_hub.h"
+#include "metrics.h"
+#include "jpg_dc.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "ANALYSIS";
+
+// 双缓冲：任务解码到 back，完成后在锁内与 front 交换
+typedef struct {
+    analysis_result_t result;
+    uint8_t *gray;
+    size_t size;
+} gray_buf_t;
+
+static gray_buf_t s_bufs[2];
+static gray_buf_t *s_front = NULL;
+static gray_buf_t *s_back = &s_bufs[0];
+static SemaphoreHandle_t s_lock = NULL;
+
+static bool ensure_size(gray_buf_t *b, size_t size)
+{
+    if (b->size >= size) {
+        return true;
+    }
+    uint8_t *p = heap_caps_realloc(b->gray, size, MALLOC_CAP_8BIT);
+    if (!p) {
+        return false;
+    }
+    b->gray = p;
+    b->size = size;
+    return true;
+}
+
+static void compute_stats(analysis_result_t *r, const uint8_t *gray)
+{
+    size_t n = (size_t)r->width * r->height;
+    uint32_t sum = 0;
+    uint8_t lo = 255, hi = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint8_t v = gray[i];
+        sum += v;
+        if (v < lo) lo = v;
+        if (v > hi) hi = v;
+    }
+    r->mean_luma = n ? sum / n : 0;
+    r->min_luma = lo;
+    r->max_luma = hi;
+}
+
+static void analysis_task(void *arg)
+{
+    uint32_t seq = 0;
+    bool was_dark = false;
+    bool timed = false;
+
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(ANALYSIS_INTERVAL_MS));
+
+        camera_fb_t *fb = frame_hub_get(&seq, pdMS_TO_TICKS(1000));
+        if (!fb) {
+            continue;
+        }
+        int64_t start_us = esp_timer_get_time();
+
+        uint16_t w = 0, h = 0;
+        esp_err_t err = jpg_dc_get_size(fb->buf, fb->len, &w, &h);
+        size_t need = (size_t)((w + 7) / 8) * ((h + 7) / 8);
+        if (err == ESP_OK && !ensure_size(s_back, need)) {
+            err = ESP_ERR_NO_MEM;
+        }
+        if (err == ESP_OK) {
+            err = jpg_dc_decode_gray(fb->buf, fb->len, s_back->gray, s_back->size,
+                                     &s_back->result.width, &s_back->result.height);
+        }
+        int64_t decoded_us = esp_timer_get_time();
+        size_t jpeg_len = fb->len;
+        frame_hub_release(fb);
+
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "灰度解码失败: %s", esp_err_to_name(err));
+            continue;
+        }
+        if (!timed) {
+            // 首帧解码耗时写入启动日志，便于对比不同板子 (之后见 /metrics 的 analysis_us)
+            ESP_LOGI(TAG, "⏱️ 灰度DC解码 %ux%u (%u 字节) → %ux%u: %lld us", w, h, (unsigned)jpeg_len,
+                     s_back->result.width, s_back->result.height, decoded_us - start_us);
+            timed = true;
+        }
+        analysis_result_t *r = &s_back->result;
+        r->seq = seq;
+        r->timestamp_us = esp_timer_get_time();
+        compute_stats(r, s_back->gray);
+        metrics_inc(METRIC_FRAMES_ANALYZED);
+        metrics_observe(METRIC_HIST_ANALYSIS_US, (uint32_t)(r->timestamp_us - start_us));
+        metrics_gauge_set(METRIC_SCENE_LUMA, r->mean_luma);
+
+        bool dark = r->mean_luma < ANALYSIS_DARK_LUMA;
+        if (dark && !was_dark) {
+            ESP_LOGI(TAG, "🌑 画面过暗 (平均亮度 %u)", r->mean_luma);
+        } else if (!dark && was_dark) {
+            ESP_LOGI(TAG, "🌕 画面亮度恢复 (平均亮度 %u)", r->mean_luma);
+        }
+        was_dark = dark;
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        gray_buf_t *old = s_front;
+        s_front = s_back;
+        s_back = old ? old : &s_bufs[1];
+        xSemaphoreGive(s_lock);
+    }
+}
+
+esp_err_t analysis_start(void)
+{
+    if (s_lock) {
+        return ESP_OK;
+    }
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(analysis_task, "analysis", ANALYSIS_TASK_STACK, NULL, ANALYSIS_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "创建分析任务失败");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "🔍 本地分析任务已启动 (%d ms 周期)", ANALYSIS_INTERVAL_MS);
+    return ESP_OK;
+}
+
+esp_err_t analysis_get_latest(analysis_result_t *result, uint8_t *gray, size_t gray_size)
+{
+    if (!result || !s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (!s_front) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        *result = s_front->result;
+        if (gray) {
+            size_t n = (size_t)result->width * result->height;
+            if (gray_size < n) {
+                err = ESP_ERR_INVALID_SIZE;
+            } else {
+                memcpy(gray, s_front->gray, n);
+            }
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return err;
+}
@@ -0,0 +1,31 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// 本地分析流配置 - 从JPEG的DC系数直接得到 1/8 灰度图，不经过网络
+#define ANALYSIS_INTERVAL_MS    200     // 分析周期 (5Hz)，与视频流共享取帧
+#define ANALYSIS_TASK_STACK     4096
+#define ANALYSIS_TASK_PRIO      3       // 低于取帧和HTTP任务
+#define ANALYSIS_DARK_LUMA      40      // 平均亮度低于该值视为过暗
+
+// 一帧分析结果
+typedef struct {
+    uint32_t seq;               // 源帧序号
+    int64_t timestamp_us;       // 解码完成时间
+    uint16_t width;             // 灰度图宽度 = 源图宽度/8
+    uint16_t height;
+    uint8_t mean_luma;          // 平均亮度 0-255
+    uint8_t min_luma;
+    uint8_t max_luma;
+} analysis_result_t;
+
+esp_err_t analysis_start(void);
+
+// 拷贝最新结果；gray 可为 NULL 只取统计量，否则需至少 width*height 字节
+// 返回 ESP_ERR_INVALID_STATE 表示还没有结果，ESP_ERR_INVALID_SIZE 表示缓冲区不足
+esp_err_t analysis_get_latest(analysis_result_t *result, uint8_t *gray, size_t gray_size);
+
+#endif // ANALYSIS_H
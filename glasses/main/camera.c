@@ -57,9 +57,9 @@ static camera_config_t camera_config = {
     .pixel_format = PIXFORMAT_JPEG,     // JPEG格式输出
     .frame_size = FRAMESIZE_SVGA,       // 1600x1200分辨率
     .jpeg_quality = 10,                 // JPEG质量 (0-63，数字越小质量越高)
-    .fb_count = 2,                      // 双帧缓冲
+    .fb_count = 3,                      // 三帧缓冲：视频流、分析各持有一帧时驱动仍可继续采集
     .fb_location = CAMERA_FB_IN_PSRAM,  // 帧缓冲存储在PSRAM中
-    .grab_mode = CAMERA_GRAB_WHEN_EMPTY // 当缓冲区为空时抓取新帧
+    .grab_mode = CAMERA_GRAB_LATEST     // 总是覆盖为最新帧，取帧任务暂停后恢复不会拿到旧画面
 };
 
 // 初始化摄像头
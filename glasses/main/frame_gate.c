@@ -0,0 +1,143 @@
+#include "frame_gate.h"
+#include <string.h>
+#include <stdlib.h>
+
+static inline uint16_t be16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+void frame_gate_reset(frame_gate_t *gate)
+{
+    memset(gate, 0, sizeof(*gate));
+}
+
+bool frame_gate_signature(const uint8_t *jpg, size_t len, frame_sig_t *sig)
+{
+    memset(sig, 0, sizeof(*sig));
+    sig->len = len;
+    if (len < 4 || jpg[0] != 0xFF || jpg[1] != 0xD8) {
+        return false;
+    }
+
+    // 解析头部，拿到 MCU 数和复位间隔，以计算总的复位区间数
+    uint32_t restart_interval = 0;
+    uint32_t mcus = 0;
+    size_t pos = 2;
+    size_t scan = 0;
+    while (pos + 4 <= len) {
+        if (jpg[pos] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = jpg[pos + 1];
+        if (marker == 0xFF) {               // 填充字节
+            pos++;
+            continue;
+        }
+        uint16_t seg_len = be16(&jpg[pos + 2]);
+        if (seg_len < 2 || pos + 2 + seg_len > len) {
+            return false;
+        }
+        const uint8_t *seg = &jpg[pos + 4];
+        if (marker == 0xDD && seg_len >= 4) {                 // DRI
+            restart_interval = be16(seg);
+        } else if (marker == 0xC0 || marker == 0xC1) {        // SOF0/SOF1
+            if (seg_len < 8) {
+                return false;
+            }
+            uint32_t height = be16(&seg[1]);
+            uint32_t width = be16(&seg[3]);
+            uint8_t ncomp = seg[5];
+            uint8_t hmax = 1, vmax = 1;
+            for (uint8_t i = 0; i < ncomp && 6 + i * 3 + 2 < seg_len - 2; i++) {
+                uint8_t hv = seg[6 + i * 3 + 1];
+                if ((hv >> 4) > hmax) hmax = hv >> 4;
+                if ((hv & 0x0F) > vmax) vmax = hv & 0x0F;
+            }
+            mcus = ((width + 8 * hmax - 1) / (8 * hmax)) * ((height + 8 * vmax - 1) / (8 * vmax));
+        } else if (marker == 0xDA) {                          // SOS
+            scan = pos + 2 + seg_len;
+            break;
+        }
+        pos += 2 + seg_len;
+    }
+    if (!scan) {
+        return false;
+    }
+    if (!restart_interval || !mcus) {
+        return true;
+    }
+
+    // 扫描码流中的 RSTn，按区间序号把每段字节数落入 FRAME_GATE_REGIONS 个箱
+    uint32_t intervals = (mcus + restart_interval - 1) / restart_interval;
+    uint32_t counts[FRAME_GATE_REGIONS] = {0};
+    uint32_t index = 0;
+    size_t seg_start = scan;
+    const uint8_t *p = &jpg[scan];
+    const uint8_t *end = &jpg[len];
+    while ((p = memchr(p, 0xFF, end - p)) != NULL && p + 1 < end) {
+        uint8_t m = p[1];
+        if ((m & 0xF8) == 0xD0 || m == 0xD9) {                // RSTn 或 EOI
+            size_t here = p - jpg;
+            counts[(uint64_t)index * FRAME_GATE_REGIONS / intervals] += here - seg_start;
+            seg_start = here + 2;
+            if (m == 0xD9 || ++index >= intervals) {
+                break;
+            }
+        }
+        p += 2;
+    }
+    if (index == 0) {                       // 声明了DRI却没有RSTn
+        return true;
+    }
+
+    uint32_t total = 0;
+    for (int i = 0; i < FRAME_GATE_REGIONS; i++) {
+        total += counts[i];
+    }
+    if (!total) {
+        return true;
+    }
+    for (int i = 0; i < FRAME_GATE_REGIONS; i++) {
+        sig->region[i] = (uint16_t)((uint64_t)counts[i] * 1000 / total);
+    }
+    sig->has_regions = true;
+    return true;
+}
+
+static bool sig_changed(const frame_sig_t *a, const frame_sig_t *b)
+{
+    uint32_t size_delta = a->len > b->len ? a->len - b->len : b->len - a->len;
+    if ((uint64_t)size_delta * 1000 > (uint64_t)b->len * FRAME_GATE_SIZE_PERMILLE) {
+        return true;
+    }
+    if (a->has_regions != b->has_regions) {
+        return true;
+    }
+    if (a->has_regions) {
+        uint32_t dist = 0;
+        for (int i = 0; i < FRAME_GATE_REGIONS; i++) {
+            dist += abs((int)a->region[i] - (int)b->region[i]);
+        }
+        if (dist > FRAME_GATE_REGION_PERMILLE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool frame_gate_should_send(frame_gate_t *gate, const uint8_t *jpg, size_t len, int64_t now_us)
+{
+    frame_sig_t sig;
+    bool parsed = frame_gate_signature(jpg, len, &sig);
+
+    bool send = !parsed || !gate->valid ||
+                now_us - gate->last_sent_us >= (int64_t)FRAME_GATE_MAX_REFRESH_MS * 1000 ||
+                sig_changed(&sig, &gate->last);
+    if (send) {
+        gate->last = sig;
+        gate->last_sent_us = now_us;
+        gate->valid = parsed;
+    }
+    return send;
+}
@@ -0,0 +1,38 @@
+#ifndef FRAME_GATE_H
+#define FRAME_GATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 场景变化门控配置 - 静止画面不重复发送，省WiFi功耗
+#define FRAME_GATE_ENABLE           1       // 0 = 每帧都发送
+#define FRAME_GATE_SIZE_PERMILLE    30      // 帧大小变化超过 3% 视为变化
+#define FRAME_GATE_REGION_PERMILLE  80      // 各区域码流占比的 L1 距离超过 8% 视为变化
+#define FRAME_GATE_MAX_REFRESH_MS   1000    // 画面不变时的最长刷新间隔
+#define FRAME_GATE_REGIONS          32      // 区域签名的分箱数
+
+// 帧签名：JPEG总长度 + 按复位标记(RSTn)划分的各区域码流占比(千分比)
+// 码流长度直接反映该区域的纹理复杂度，无需哈夫曼解码即可得到粗略的空间分布
+typedef struct {
+    uint32_t len;
+    uint16_t region[FRAME_GATE_REGIONS];
+    bool has_regions;                       // 图像中没有DRI/RSTn时只比较长度
+} frame_sig_t;
+
+// 每个视频流客户端一份状态
+typedef struct {
+    frame_sig_t last;                       // 上一次发送帧的签名
+    int64_t last_sent_us;
+    bool valid;
+} frame_gate_t;
+
+void frame_gate_reset(frame_gate_t *gate);
+
+// 计算JPEG签名，格式不识别时返回 false
+bool frame_gate_signature(const uint8_t *jpg, size_t len, frame_sig_t *sig);
+
+// 判断本帧是否需要发送；返回 true 时已把本帧记为"上一次发送帧"
+bool frame_gate_should_send(frame_gate_t *gate, const uint8_t *jpg, size_t len, int64_t now_us);
+
+#endif // FRAME_GATE_H
@@ -0,0 +1,202 @@
+#include "frame_hub.h"
+#include "metrics.h"
+#include "trace_ring.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+static const char *TAG = "FRAME_HUB";
+
+#define HUB_NEW_FRAME_BIT   BIT0
+#define HUB_DEMAND_BIT      BIT1
+
+// 每个被持有的驱动帧缓冲一个槽位，refs 归零时归还给驱动
+typedef struct {
+    camera_fb_t *fb;
+    uint32_t refs;
+    uint32_t seq;
+    int64_t captured_us;
+} hub_slot_t;
+
+static hub_slot_t s_slots[FRAME_HUB_MAX_FRAMES];
+static hub_slot_t *s_latest = NULL;         // 最新帧，hub 自身持有一个引用
+static uint32_t s_seq = 0;
+static SemaphoreHandle_t s_lock = NULL;
+static EventGroupHandle_t s_events = NULL;
+static bool s_wanted = false;               // 有使用者在等比最新帧更新的帧，受 s_lock 保护
+
+// 调用方持有 s_lock；返回需要归还给驱动的帧
+static camera_fb_t *slot_unref(hub_slot_t *slot)
+{
+    if (--slot->refs) {
+        return NULL;
+    }
+    camera_fb_t *fb = slot->fb;
+    slot->fb = NULL;
+    return fb;
+}
+
+static void publish(camera_fb_t *fb, int64_t captured_us)
+{
+    camera_fb_t *to_return = NULL;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    hub_slot_t *slot = NULL;
+    for (int i = 0; i < FRAME_HUB_MAX_FRAMES; i++) {
+        if (!s_slots[i].fb) {
+            slot = &s_slots[i];
+            break;
+        }
+    }
+    if (slot) {
+        slot->fb = fb;
+        slot->refs = 1;
+        slot->seq = ++s_seq ? s_seq : ++s_seq;      // 0 保留给"尚未取过帧"
+        slot->captured_us = captured_us;
+        if (s_latest) {
+            to_return = slot_unref(s_latest);
+        }
+        s_latest = slot;
+    } else {
+        to_return = fb;                             // 不应发生：fb_count 大于槽位数
+    }
+    // 新帧满足当前所有等待者，之后再有人要更新的帧会重新置位
+    s_wanted = false;
+    xSemaphoreGive(s_lock);
+
+    if (to_return) {
+        esp_camera_fb_return(to_return);
+    }
+    if (slot) {
+        // 广播：唤醒所有等待者后立即清除
+        xEventGroupSetBits(s_events, HUB_NEW_FRAME_BIT);
+        xEventGroupClearBits(s_events, HUB_NEW_FRAME_BIT);
+    }
+}
+
+// 无人取帧时丢掉最新帧，避免下次唤醒后拿到过期画面
+static void drop_latest(void)
+{
+    camera_fb_t *to_return = NULL;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_latest) {
+        to_return = slot_unref(s_latest);
+        s_latest = NULL;
+    }
+    xSemaphoreGive(s_lock);
+    if (to_return) {
+        esp_camera_fb_return(to_return);
+    }
+}
+
+static void frame_hub_task(void *arg)
+{
+    int64_t last_frame_us = 0;
+
+    while (true) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        bool wanted = s_wanted;
+        xSemaphoreGive(s_lock);
+        if (!wanted) {
+            // 没人等新帧就不取帧；置位在检查之后发生时等待会立即返回
+            EventBits_t bits = xEventGroupWaitBits(s_events, HUB_DEMAND_BIT, pdTRUE, pdFALSE,
+                                                   pdMS_TO_TICKS(FRAME_HUB_IDLE_MS));
+            if (!(bits & HUB_DEMAND_BIT)) {
+                drop_latest();
+                last_frame_us = 0;
+                ESP_LOGD(TAG, "空闲，归还缓冲区");
+            }
+            continue;
+        }
+
+        TRACE_BEGIN(TRACE_EV_CAM_TAKE, 0);
+        camera_fb_t *fb = esp_camera_fb_get();
+        TRACE_END(TRACE_EV_CAM_TAKE, 0);
+        if (!fb) {
+            metrics_inc(METRIC_FRAMES_DROPPED);
+            continue;
+        }
+        int64_t got_us = esp_timer_get_time();
+        metrics_inc(METRIC_FRAMES_CAPTURED);
+        if (last_frame_us) {
+            metrics_observe(METRIC_HIST_CAPTURE_INTERVAL_US, (uint32_t)(got_us - last_frame_us));
+        }
+        last_frame_us = got_us;
+
+        publish(fb, got_us);
+    }
+}
+
+esp_err_t frame_hub_start(void)
+{
+    if (s_lock) {
+        return ESP_OK;
+    }
+    s_lock = xSemaphoreCreateMutex();
+    s_events = xEventGroupCreate();
+    if (!s_lock || !s_events) {
+        ESP_LOGE(TAG, "创建同步对象失败");
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(frame_hub_task, "frame_hub", FRAME_HUB_TASK_STACK, NULL, FRAME_HUB_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "创建取帧任务失败");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "📡 帧分发任务已启动");
+    return ESP_OK;
+}
+
+camera_fb_t *frame_hub_get(uint32_t *seq, TickType_t timeout)
+{
+    if (!s_lock) {
+        return NULL;
+    }
+    TickType_t start = xTaskGetTickCount();
+
+    while (true) {
+        camera_fb_t *fb = NULL;
+        int64_t now_us = esp_timer_get_time();
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        if (s_latest && s_latest->seq != *seq && now_us - s_latest->captured_us <= FRAME_HUB_MAX_AGE_MS * 1000) {
+            s_latest->refs++;
+            *seq = s_latest->seq;
+            fb = s_latest->fb;
+        } else {
+            s_wanted = true;
+        }
+        xSemaphoreGive(s_lock);
+        if (fb) {
+            return fb;
+        }
+        xEventGroupSetBits(s_events, HUB_DEMAND_BIT);
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            return NULL;
+        }
+        // 检查与等待之间可能错过广播，因此限制单次等待时长后重新检查
+        TickType_t wait = timeout - elapsed;
+        if (wait > pdMS_TO_TICKS(50)) {
+            wait = pdMS_TO_TICKS(50);
+        }
+        xEventGroupWaitBits(s_events, HUB_NEW_FRAME_BIT, pdFALSE, pdFALSE, wait ? wait : 1);
+    }
+}
+
+void frame_hub_release(camera_fb_t *fb)
+{
+    camera_fb_t *to_return = NULL;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < FRAME_HUB_MAX_FRAMES; i++) {
+        if (s_slots[i].fb == fb) {
+            to_return = slot_unref(&s_slots[i]);
+            break;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    if (to_return) {
+        esp_camera_fb_return(to_return);
+    }
+}
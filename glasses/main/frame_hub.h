@@ -0,0 +1,25 @@
+#ifndef FRAME_HUB_H
+#define FRAME_HUB_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+
+// 帧分发配置 - 唯一的取帧任务，视频流/拍照/本地分析共享同一帧，互不串行等待
+// 只在有使用者等待新帧时才取帧，取帧速率跟随需求而不是传感器帧率
+#define FRAME_HUB_TASK_STACK    3072
+#define FRAME_HUB_TASK_PRIO     6
+#define FRAME_HUB_IDLE_MS       1000    // 超过该时间无人取帧则归还持有的缓冲区
+#define FRAME_HUB_MAX_AGE_MS    100     // 最新帧超过该时间视为过期，需要重新取帧
+#define FRAME_HUB_MAX_FRAMES    4       // 同时被持有的帧数上限，需 >= camera fb_count
+#define FRAME_HUB_GET_TIMEOUT_MS 2000   // HTTP处理函数等待新帧的超时
+
+esp_err_t frame_hub_start(void);
+
+// 取比 *seq 更新的最新帧，成功时更新 *seq；首次调用传 *seq = 0
+// 返回的帧带引用计数，用完必须调用 frame_hub_release，超时返回 NULL
+camera_fb_t *frame_hub_get(uint32_t *seq, TickType_t timeout);
+void frame_hub_release(camera_fb_t *fb);
+
+#endif // FRAME_HUB_H
@@ -5,6 +5,9 @@
 #include "freertos/task.h"
 #include "camera.h"
 #include "wifi_streaming.h"
+#include "frame_hub.h"
+#include "analysis.h"
+#include "trace_ring.h"
 
 static const char *TAG = "MAIN";
 
@@ -21,12 +24,19 @@ void app_main(void)
     ESP_ERROR_CHECK(ret);
     ESP_LOGI(TAG, "✅ NVS初始化完成");
 
+    // 热路径跟踪：测量单条记录开销并启动各核心的时间基准心跳 (未开启时为空操作)
+    ESP_ERROR_CHECK(trace_ring_init());
+
     // 初始化摄像头
     if (init_ov3660_camera() == ESP_OK) {
         ESP_LOGI(TAG, "🎉 摄像头初始化成功");
         
         // 等待摄像头稳定
         vTaskDelay(2000 / portTICK_PERIOD_MS);
+
+        // 启动取帧分发和本地分析，视频流与分析共享同一次采集
+        ESP_ERROR_CHECK(frame_hub_start());
+        ESP_ERROR_CHECK(analysis_start());
         
         // 快速测试拍照功能
         //ESP_LOGI(TAG, "📸 开始快速拍照测试");
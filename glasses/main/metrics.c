@@ -0,0 +1,363 @@
+#include "metrics.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_wifi.h"
+#include "mdns.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "METRICS";
+
+#define METRICS_MAX_TASKS   32      // 导出的最大任务数
+
+// 直方图: 桶i的上界为 1 << (shift + i)，最后一个桶为 +Inf
+typedef struct {
+    const char *name;
+    const char *help;
+    uint8_t shift;
+    atomic_uint buckets[METRICS_HIST_BUCKETS];
+    atomic_uint count;
+    _Atomic uint64_t sum;           // 64位，按微秒或字节累加也不会回绕
+} metric_histogram_t;
+
+typedef struct {
+    const char *name;
+    const char *help;
+} metric_desc_t;
+
+static const metric_desc_t s_counter_desc[METRIC_COUNTER_MAX] = {
+    [METRIC_FRAMES_CAPTURED]  = {"frames_captured", "Frames returned by esp_camera_fb_get"},
+    [METRIC_FRAMES_SENT]      = {"frames_sent", "Frames fully written to stream clients"},
+    [METRIC_FRAMES_DROPPED]   = {"frames_dropped", "Frame grabs that timed out or had no EOI"},
+    [METRIC_SEND_ERRORS]      = {"send_errors", "Failed httpd sends"},
+    [METRIC_BYTES_SENT]       = {"bytes_sent", "JPEG payload bytes sent"},
+    [METRIC_CAPTURE_REQUESTS] = {"capture_requests", "Requests served by /capture"},
+    [METRIC_FRAMES_SKIPPED]   = {"frames_skipped", "Stream frames not sent because the scene was unchanged"},
+    [METRIC_FRAMES_ANALYZED]  = {"frames_analyzed", "Frames decoded by the on-device analysis task"},
+};
+
+static const metric_desc_t s_gauge_desc[METRIC_GAUGE_MAX] = {
+    [METRIC_STREAM_CLIENTS] = {"stream_clients", "Connected /stream clients"},
+    [METRIC_SCENE_LUMA]     = {"scene_luma", "Mean luma of the last analysed frame"},
+};
+
+static _Atomic uint64_t s_counters[METRIC_COUNTER_MAX];
+static atomic_int s_gauges[METRIC_GAUGE_MAX];
+
+static metric_histogram_t s_hists[METRIC_HIST_MAX] = {
+    [METRIC_HIST_CAPTURE_INTERVAL_US] = {.name = "capture_interval_us", .help = "Time between consecutive frames", .shift = 13},
+    [METRIC_HIST_CAM_TAKE_US]         = {.name = "cam_take_us", .help = "Time a stream client waited for a new frame", .shift = 10},
+    [METRIC_HIST_SEND_US]             = {.name = "send_us", .help = "Time to send one frame", .shift = 10},
+    [METRIC_HIST_FRAME_BYTES]         = {.name = "frame_bytes", .help = "JPEG frame size", .shift = 12},
+    [METRIC_HIST_ANALYSIS_US]         = {.name = "analysis_us", .help = "Grayscale DC decode and statistics per frame", .shift = 8},
+};
+
+void metrics_inc(metric_counter_t counter)
+{
+    atomic_fetch_add_explicit(&s_counters[counter], 1, memory_order_relaxed);
+}
+
+void metrics_add(metric_counter_t counter, uint32_t value)
+{
+    atomic_fetch_add_explicit(&s_counters[counter], value, memory_order_relaxed);
+}
+
+void metrics_gauge_add(metric_gauge_t gauge, int32_t delta)
+{
+    atomic_fetch_add_explicit(&s_gauges[gauge], delta, memory_order_relaxed);
+}
+
+void metrics_gauge_set(metric_gauge_t gauge, int32_t value)
+{
+    atomic_store_explicit(&s_gauges[gauge], value, memory_order_relaxed);
+}
+
+// 计算落入的桶: value <= 1 << (shift + i) 的最小i
+static inline unsigned hist_bucket(const metric_histogram_t *h, uint32_t value)
+{
+    uint32_t scaled = value ? (value - 1) >> h->shift : 0;
+    unsigned idx = scaled ? 32 - __builtin_clz(scaled) : 0;
+    return idx < METRICS_HIST_BUCKETS ? idx : METRICS_HIST_BUCKETS - 1;
+}
+
+void metrics_observe(metric_hist_t hist, uint32_t value)
+{
+    metric_histogram_t *h = &s_hists[hist];
+    atomic_fetch_add_explicit(&h->buckets[hist_bucket(h, value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+}
+
+// 分块输出：缓冲区满时交给write，再接着写
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    metrics_write_t write;
+    void *ctx;
+    esp_err_t err;
+} out_buf_t;
+
+static void out_flush(out_buf_t *out)
+{
+    if (out->err == ESP_OK && out->len && out->write(out->ctx, out->buf, out->len) != 0) {
+        out->err = ESP_FAIL;
+    }
+    out->len = 0;
+}
+
+// 每次写入一整条，放不下就先flush再重写；比整个缓冲区还长的一条直接报错，不输出半行
+static void out_printf(out_buf_t *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void out_printf(out_buf_t *out, const char *fmt, ...)
+{
+    while (out->err == ESP_OK) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(out->buf + out->len, out->size - out->len, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            out->err = ESP_FAIL;
+        } else if ((size_t)n < out->size - out->len) {
+            out->len += n;
+            return;
+        } else if (out->len == 0) {
+            out->err = ESP_ERR_INVALID_SIZE;
+        } else {
+            out_flush(out);
+        }
+    }
+}
+
+// 导出时才采样的系统状态
+typedef struct {
+    uint32_t uptime_s;
+    uint32_t heap_free;
+    uint32_t heap_min_free;
+    uint32_t psram_free;
+    int rssi;
+    bool rssi_valid;
+    mdns_action_queue_stats_t mdns;
+    bool mdns_valid;
+} system_sample_t;
+
+static void sample_system(system_sample_t *s)
+{
+    s->uptime_s = (uint32_t)(esp_timer_get_time() / 1000000);
+    s->heap_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    s->heap_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    s->psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+
+    wifi_ap_record_t ap_info;
+    s->rssi_valid = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+    s->rssi = s->rssi_valid ? ap_info.rssi : 0;
+    s->mdns_valid = mdns_get_action_queue_stats(&s->mdns) == ESP_OK;
+}
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+// 各任务CPU占用(自启动以来)，需要在menuconfig中开启
+// FREERTOS_USE_TRACE_FACILITY 和 FREERTOS_GENERATE_RUN_TIME_STATS
+typedef void (*task_cpu_cb_t)(out_buf_t *out, const TaskStatus_t *task, uint32_t permille, bool first);
+
+static void for_each_task(out_buf_t *out, task_cpu_cb_t cb)
+{
+    UBaseType_t count = uxTaskGetNumberOfTasks();
+    if (count > METRICS_MAX_TASKS) {
+        count = METRICS_MAX_TASKS;
+    }
+    TaskStatus_t *tasks = malloc(count * sizeof(TaskStatus_t));
+    if (!tasks) {
+        return;
+    }
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    count = uxTaskGetSystemState(tasks, count, &total);
+    uint64_t total_all_cores = (uint64_t)total * portNUM_PROCESSORS;
+    for (UBaseType_t i = 0; i < count; i++) {
+        uint32_t permille = total_all_cores ? (uint32_t)((uint64_t)tasks[i].ulRunTimeCounter * 1000 / total_all_cores) : 0;
+        cb(out, &tasks[i], permille, i == 0);
+    }
+    free(tasks);
+}
+
+static void task_cpu_prometheus(out_buf_t *out, const TaskStatus_t *task, uint32_t permille, bool first)
+{
+    if (first) {
+        out_printf(out, "# HELP glasses_task_cpu_ratio CPU share per task since boot\n"
+                        "# TYPE glasses_task_cpu_ratio gauge\n");
+    }
+    out_printf(out, "glasses_task_cpu_ratio{task=\"%s\"} %lu.%03lu\n",
+               task->pcTaskName, (unsigned long)(permille / 1000), (unsigned long)(permille % 1000));
+}
+
+static void task_cpu_json(out_buf_t *out, const TaskStatus_t *task, uint32_t permille, bool first)
+{
+    out_printf(out, "%s\"%s\":%lu", first ? "" : ",", task->pcTaskName, (unsigned long)permille);
+}
+#endif
+
+esp_err_t metrics_export_prometheus(char *buf, size_t size, metrics_write_t write, void *ctx)
+{
+    if (!buf || !size || !write) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    out_buf_t out = {.buf = buf, .size = size, .len = 0, .write = write, .ctx = ctx, .err = ESP_OK};
+
+    for (int i = 0; i < METRIC_COUNTER_MAX; i++) {
+        out_printf(&out, "# HELP glasses_%s_total %s\n# TYPE glasses_%s_total counter\nglasses_%s_total %" PRIu64 "\n",
+                   s_counter_desc[i].name, s_counter_desc[i].help, s_counter_desc[i].name, s_counter_desc[i].name,
+                   atomic_load_explicit(&s_counters[i], memory_order_relaxed));
+    }
+    for (int i = 0; i < METRIC_GAUGE_MAX; i++) {
+        out_printf(&out, "# HELP glasses_%s %s\n# TYPE glasses_%s gauge\nglasses_%s %d\n",
+                   s_gauge_desc[i].name, s_gauge_desc[i].help, s_gauge_desc[i].name, s_gauge_desc[i].name,
+                   atomic_load_explicit(&s_gauges[i], memory_order_relaxed));
+    }
+    for (int i = 0; i < METRIC_HIST_MAX; i++) {
+        metric_histogram_t *h = &s_hists[i];
+        out_printf(&out, "# HELP glasses_%s %s\n# TYPE glasses_%s histogram\n", h->name, h->help, h->name);
+        uint32_t cumulative = 0;
+        for (int b = 0; b < METRICS_HIST_BUCKETS - 1; b++) {
+            cumulative += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+            out_printf(&out, "glasses_%s_bucket{le=\"%lu\"} %lu\n", h->name,
+                       (unsigned long)(1UL << (h->shift + b)), (unsigned long)cumulative);
+        }
+        cumulative += atomic_load_explicit(&h->buckets[METRICS_HIST_BUCKETS - 1], memory_order_relaxed);
+        out_printf(&out, "glasses_%s_bucket{le=\"+Inf\"} %lu\nglasses_%s_sum %" PRIu64 "\nglasses_%s_count %lu\n",
+                   h->name, (unsigned long)cumulative,
+                   h->name, atomic_load_explicit(&h->sum, memory_order_relaxed),
+                   h->name, (unsigned long)cumulative);
+    }
+
+    system_sample_t sys;
+    sample_system(&sys);
+    out_printf(&out, "# TYPE glasses_uptime_seconds gauge\nglasses_uptime_seconds %lu\n", (unsigned long)sys.uptime_s);
+    out_printf(&out, "# TYPE glasses_heap_free_bytes gauge\nglasses_heap_free_bytes %lu\n", (unsigned long)sys.heap_free);
+    out_printf(&out, "# TYPE glasses_heap_min_free_bytes gauge\nglasses_heap_min_free_bytes %lu\n", (unsigned long)sys.heap_min_free);
+    out_printf(&out, "# TYPE glasses_psram_free_bytes gauge\nglasses_psram_free_bytes %lu\n", (unsigned long)sys.psram_free);
+    if (sys.rssi_valid) {
+        out_printf(&out, "# TYPE glasses_wifi_rssi_dbm gauge\nglasses_wifi_rssi_dbm %d\n", sys.rssi);
+    }
+    if (sys.mdns_valid) {
+        out_printf(&out, "# TYPE glasses_mdns_actions_high_water gauge\nglasses_mdns_actions_high_water %lu\n",
+                   (unsigned long)sys.mdns.high_water);
+        out_printf(&out, "# TYPE glasses_mdns_actions_dropped_total counter\nglasses_mdns_actions_dropped_total %lu\n",
+                   (unsigned long)sys.mdns.dropped);
+    }
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+    for_each_task(&out, task_cpu_prometheus);
+#endif
+    out_flush(&out);
+    return out.err;
+}
+
+esp_err_t metrics_export_json(char *buf, size_t size, metrics_write_t write, void *ctx)
+{
+    if (!buf || !size || !write) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    out_buf_t out = {.buf = buf, .size = size, .len = 0, .write = write, .ctx = ctx, .err = ESP_OK};
+
+    system_sample_t sys;
+    sample_system(&sys);
+    out_printf(&out, "{\"uptime_s\":%lu,\"heap_free\":%lu,\"heap_min_free\":%lu,\"psram_free\":%lu,",
+               (unsigned long)sys.uptime_s, (unsigned long)sys.heap_free,
+               (unsigned long)sys.heap_min_free, (unsigned long)sys.psram_free);
+    if (sys.rssi_valid) {
+        out_printf(&out, "\"rssi\":%d,", sys.rssi);
+    }
+    if (sys.mdns_valid) {
+        out_printf(&out, "\"mdns_actions\":{\"capacity\":%lu,\"high_water\":%lu,\"dropped\":%lu},",
+                   (unsigned long)sys.mdns.capacity, (unsigned long)sys.mdns.high_water,
+                   (unsigned long)sys.mdns.dropped);
+    }
+
+    out_printf(&out, "\"counters\":{");
+    for (int i = 0; i < METRIC_COUNTER_MAX; i++) {
+        out_printf(&out, "%s\"%s\":%" PRIu64, i ? "," : "", s_counter_desc[i].name,
+                   atomic_load_explicit(&s_counters[i], memory_order_relaxed));
+    }
+    for (int i = 0; i < METRIC_GAUGE_MAX; i++) {
+        out_printf(&out, ",\"%s\":%d", s_gauge_desc[i].name,
+                   atomic_load_explicit(&s_gauges[i], memory_order_relaxed));
+    }
+
+    // 直方图: 非累积的桶计数，桶上界由 shift 推出
+    out_printf(&out, "},\"hist\":{");
+    for (int i = 0; i < METRIC_HIST_MAX; i++) {
+        metric_histogram_t *h = &s_hists[i];
+        out_printf(&out, "%s\"%s\":{\"shift\":%u,\"sum\":%" PRIu64 ",\"count\":%u,\"buckets\":[", i ? "," : "",
+                   h->name, h->shift, atomic_load_explicit(&h->sum, memory_order_relaxed),
+                   atomic_load_explicit(&h->count, memory_order_relaxed));
+        for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+            out_printf(&out, "%s%u", b ? "," : "", atomic_load_explicit(&h->buckets[b], memory_order_relaxed));
+        }
+        out_printf(&out, "]}");
+    }
+    out_printf(&out, "}");
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+    // 各任务CPU占用，单位千分比
+    out_printf(&out, ",\"task_cpu_permille\":{");
+    for_each_task(&out, task_cpu_json);
+    out_printf(&out, "}");
+#endif
+    out_printf(&out, "}");
+    out_flush(&out);
+    return out.err;
+}
+
+static int metrics_write(void *ctx, const char *data, size_t len)
+{
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, data, len) != ESP_OK;
+}
+
+static esp_err_t metrics_send(httpd_req_t *req, const char *type,
+                              esp_err_t (*export)(char *, size_t, metrics_write_t, void *))
+{
+    char *buf = malloc(METRICS_BUF_SIZE);
+    if (!buf) {
+        ESP_LOGE(TAG, "❌ 导出缓冲区分配失败");
+        httpd_resp_send_500(req);
+        return ESP_ERR_NO_MEM;
+    }
+
+    httpd_resp_set_type(req, type);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    esp_err_t res = export(buf, METRICS_BUF_SIZE, metrics_write, req);
+    free(buf);
+    if (res != ESP_OK) {
+        // 不发送结束块，连接被关闭，客户端不会把不完整的输出当作成功
+        ESP_LOGW(TAG, "导出失败: %s", esp_err_to_name(res));
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    return metrics_send(req, "text/plain; version=0.0.4", metrics_export_prometheus);
+}
+
+static esp_err_t metrics_json_handler(httpd_req_t *req)
+{
+    return metrics_send(req, "application/json", metrics_export_json);
+}
+
+esp_err_t metrics_register_handlers(httpd_handle_t server)
+{
+    httpd_uri_t metrics_uri = {.uri = "/metrics", .method = HTTP_GET, .handler = metrics_handler};
+    httpd_uri_t metrics_json_uri = {.uri = "/metrics.json", .method = HTTP_GET, .handler = metrics_json_handler};
+
+    esp_err_t ret = httpd_register_uri_handler(server, &metrics_uri);
+    if (ret == ESP_OK) {
+        ret = httpd_register_uri_handler(server, &metrics_json_uri);
+    }
+    return ret;
+}
@@ -0,0 +1,63 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// 计数器 - 只增不减，64位原子变量，字节数按帧累加也不会回绕
+typedef enum {
+    METRIC_FRAMES_CAPTURED = 0,     // 成功取到的帧
+    METRIC_FRAMES_SENT,             // 成功发送的帧
+    METRIC_FRAMES_DROPPED,          // 取帧失败(超时/无EOI)
+    METRIC_SEND_ERRORS,             // 发送失败次数
+    METRIC_BYTES_SENT,              // 已发送的JPEG字节数
+    METRIC_CAPTURE_REQUESTS,        // /capture 请求数
+    METRIC_FRAMES_SKIPPED,          // 画面无变化未发送的帧
+    METRIC_FRAMES_ANALYZED,         // 本地分析处理的帧
+    METRIC_COUNTER_MAX
+} metric_counter_t;
+
+// 仪表 - 可增可减
+typedef enum {
+    METRIC_STREAM_CLIENTS = 0,      // 当前视频流客户端数
+    METRIC_SCENE_LUMA,              // 最近一次分析的平均亮度
+    METRIC_GAUGE_MAX
+} metric_gauge_t;
+
+// 直方图 - 桶边界按2的幂递增，落桶为O(1)
+typedef enum {
+    METRIC_HIST_CAPTURE_INTERVAL_US = 0,    // 相邻两帧的间隔
+    METRIC_HIST_CAM_TAKE_US,                // 视频流等待新帧的时间
+    METRIC_HIST_SEND_US,                    // 单帧发送耗时
+    METRIC_HIST_FRAME_BYTES,                // 单帧大小
+    METRIC_HIST_ANALYSIS_US,                // 单帧灰度解码+统计耗时
+    METRIC_HIST_MAX
+} metric_hist_t;
+
+#define METRICS_HIST_BUCKETS 12     // 含最后的 +Inf 桶
+
+// 热路径接口：仅一次原子加法，可在任意任务中调用
+// (ESP32没有64位原子指令，计数器和直方图sum的64位加法由IDF在短临界区内完成)
+void metrics_inc(metric_counter_t counter);
+void metrics_add(metric_counter_t counter, uint32_t value);
+void metrics_gauge_add(metric_gauge_t gauge, int32_t delta);
+void metrics_gauge_set(metric_gauge_t gauge, int32_t value);
+void metrics_observe(metric_hist_t hist, uint32_t value);
+
+#define METRICS_BUF_SIZE 1024       // 导出用的分块缓冲区大小，需容纳最长的一条
+
+// 导出输出回调：返回0继续，非0中止导出
+typedef int (*metrics_write_t)(void *ctx, const char *data, size_t len);
+
+// 导出接口：以buf为分块缓冲区，写满时及结束时调用write
+// 返回 ESP_OK；write中止时返回 ESP_FAIL；某一条比buf还长时返回 ESP_ERR_INVALID_SIZE，
+// 该条不会输出半行
+esp_err_t metrics_export_prometheus(char *buf, size_t size, metrics_write_t write, void *ctx);
+esp_err_t metrics_export_json(char *buf, size_t size, metrics_write_t write, void *ctx);
+
+// 注册 /metrics (Prometheus文本) 和 /metrics.json 两个URI
+esp_err_t metrics_register_handlers(httpd_handle_t server);
+
+#endif // METRICS_H
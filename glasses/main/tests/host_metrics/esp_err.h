@@ -0,0 +1,16 @@
+/*
+ * Minimal esp_err.h so metrics.c builds on the host without ESP-IDF
+ */
+#pragma once
+#include <stdbool.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_NO_MEM          0x101
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_INVALID_SIZE    0x104
+#define ESP_ERR_NOT_SUPPORTED   0x106
+
+const char *esp_err_to_name(esp_err_t code);
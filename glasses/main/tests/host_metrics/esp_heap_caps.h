@@ -0,0 +1,8 @@
+#pragma once
+#include <stddef.h>
+
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+
+size_t heap_caps_get_free_size(unsigned caps);
+size_t heap_caps_get_minimum_free_size(unsigned caps);
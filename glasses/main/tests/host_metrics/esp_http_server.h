@@ -0,0 +1,20 @@
+#pragma once
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef void *httpd_handle_t;
+typedef struct httpd_req httpd_req_t;
+
+typedef enum { HTTP_GET = 1 } httpd_method_t;
+
+typedef struct {
+    const char *uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *r);
+} httpd_uri_t;
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, size_t len);
+esp_err_t httpd_resp_send_500(httpd_req_t *r);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler);
@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+
+// per-task CPU export is enabled, so the longest output is rendered
+#define configUSE_TRACE_FACILITY        1
+#define configGENERATE_RUN_TIME_STATS   1
+#define configRUN_TIME_COUNTER_TYPE     uint32_t
+#define configMAX_TASK_NAME_LEN         16
+#define portNUM_PROCESSORS              2
+
+typedef unsigned long UBaseType_t;
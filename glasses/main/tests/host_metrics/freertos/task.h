@@ -0,0 +1,10 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct {
+    const char *pcTaskName;
+    configRUN_TIME_COUNTER_TYPE ulRunTimeCounter;
+} TaskStatus_t;
+
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *tasks, UBaseType_t size, configRUN_TIME_COUNTER_TYPE *total);
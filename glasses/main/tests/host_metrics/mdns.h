@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct {
+    uint32_t capacity;
+    uint32_t high_water;
+    uint32_t dropped;
+} mdns_action_queue_stats_t;
+
+esp_err_t mdns_get_action_queue_stats(mdns_action_queue_stats_t *stats);
@@ -0,0 +1,331 @@
+/*
+ * Host test for the /metrics and /metrics.json exports
+ *
+ * Every counter, gauge and histogram is set past 32 bits and the
+ * system sample reports Wi-Fi, mDNS and the maximum number of tasks with
+ * the longest names, so the full set is rendered. The output must be
+ * complete and well formed with the scratch buffer the handlers use, and
+ * a scratch buffer too small for one line must fail without emitting part
+ * of that line.
+ *
+ *   ./test_metrics         run all checks, print the Prometheus output with -v
+ */
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metrics.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "mdns.h"
+#include "freertos/task.h"
+
+#define TEST_TASKS 40       // more than the export takes
+
+static int s_failures;
+
+#define CHECK(cond, ...) do {                       \
+    if (!(cond)) {                                  \
+        printf("FAIL %s:%d: ", __func__, __LINE__); \
+        printf(__VA_ARGS__);                        \
+        printf("\n");                               \
+        s_failures++;                               \
+    }                                               \
+} while (0)
+
+// ---- IDF stand-ins, reporting the widest values ----
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    return code == ESP_OK ? "ESP_OK" : "ESP_ERR";
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)UINT32_MAX * 1000000;
+}
+
+size_t heap_caps_get_free_size(unsigned caps)
+{
+    return UINT32_MAX;
+}
+
+size_t heap_caps_get_minimum_free_size(unsigned caps)
+{
+    return UINT32_MAX;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+    ap_info->rssi = -128;
+    return ESP_OK;
+}
+
+esp_err_t mdns_get_action_queue_stats(mdns_action_queue_stats_t *stats)
+{
+    stats->capacity = UINT32_MAX;
+    stats->high_water = UINT32_MAX;
+    stats->dropped = UINT32_MAX;
+    return ESP_OK;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    return TEST_TASKS;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *tasks, UBaseType_t size, configRUN_TIME_COUNTER_TYPE *total)
+{
+    static char names[TEST_TASKS][configMAX_TASK_NAME_LEN];
+    for (UBaseType_t i = 0; i < size; i++) {
+        snprintf(names[i], sizeof(names[i]), "task_%010u", (unsigned)(i % TEST_TASKS));
+        tasks[i].pcTaskName = names[i];
+        tasks[i].ulRunTimeCounter = UINT32_MAX;
+    }
+    *total = UINT32_MAX;
+    return size;
+}
+
+// ---- httpd stand-ins: the chunks of one response ----
+
+typedef struct {
+    char *data;
+    size_t len;
+    int writes;
+    int abort_after;        // fail this write, 0 = never
+    bool finished;          // terminating chunk seen
+} sink_t;
+
+static sink_t s_resp;
+static httpd_uri_t s_uris[2];
+static int s_uri_count;
+
+static int sink_write(void *ctx, const char *data, size_t len)
+{
+    sink_t *sink = ctx;
+    if (++sink->writes == sink->abort_after) {
+        return 1;
+    }
+    sink->data = realloc(sink->data, sink->len + len + 1);
+    memcpy(sink->data + sink->len, data, len);
+    sink->len += len;
+    sink->data[sink->len] = '\0';
+    return 0;
+}
+
+static void sink_reset(sink_t *sink)
+{
+    free(sink->data);
+    memset(sink, 0, sizeof(*sink));
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, size_t len)
+{
+    if (!buf) {
+        s_resp.finished = true;
+        return ESP_OK;
+    }
+    return sink_write(&s_resp, buf, len) ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t httpd_resp_send_500(httpd_req_t *r)
+{
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    s_uris[s_uri_count++] = *uri_handler;
+    return ESP_OK;
+}
+
+// ---- checks ----
+
+static void fill_metrics(void)
+{
+    for (int i = 0; i < METRIC_COUNTER_MAX; i++) {
+        metrics_add(i, UINT32_MAX);
+        metrics_add(i, UINT32_MAX);
+    }
+    for (int i = 0; i < METRIC_GAUGE_MAX; i++) {
+        metrics_gauge_set(i, INT32_MIN);
+    }
+    for (int i = 0; i < METRIC_HIST_MAX; i++) {
+        metrics_observe(i, UINT32_MAX);
+        metrics_observe(i, UINT32_MAX);
+        metrics_observe(i, 1);
+    }
+}
+
+static int count_lines(const char *text, const char *prefix, const char *contains)
+{
+    int n = 0;
+    for (const char *line = text; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        const char *end = strchr(line, '\n');
+        size_t len = end ? (size_t)(end - line) : strlen(line);
+        if (!strncmp(line, prefix, strlen(prefix)) && (!contains || memmem(line, len, contains, strlen(contains)))) {
+            n++;
+        }
+    }
+    return n;
+}
+
+// Each sample line is "name[{labels}] value", each family has a TYPE line
+static void check_prometheus(const char *text)
+{
+    CHECK(text[0] && text[strlen(text) - 1] == '\n', "output does not end with a complete line");
+    for (const char *line = text; *line; line = strchr(line, '\n') + 1) {
+        if (line[0] == '#') {
+            continue;
+        }
+        char name[128];
+        char value[32];
+        int end = 0;
+        if (sscanf(line, "%127s %31[-0-9.]%n", name, value, &end) != 2 || line[end] != '\n') {
+            CHECK(false, "malformed sample line: %.*s", (int)(strchr(line, '\n') - line), line);
+            break;
+        }
+    }
+
+    int families = METRIC_COUNTER_MAX + METRIC_GAUGE_MAX + METRIC_HIST_MAX
+                   + 4      // uptime, heap, heap min, psram
+                   + 1      // rssi
+                   + 2      // mdns actions
+                   + 1;     // task cpu
+    CHECK(count_lines(text, "# TYPE ", NULL) == families, "%d families, expected %d",
+          count_lines(text, "# TYPE ", NULL), families);
+    CHECK(count_lines(text, "glasses_", "_total ") == METRIC_COUNTER_MAX + 1, "counter samples missing");
+    CHECK(count_lines(text, "glasses_", "_bucket{le=\"+Inf\"} ") == METRIC_HIST_MAX, "+Inf buckets missing");
+    CHECK(count_lines(text, "glasses_", "_count ") == METRIC_HIST_MAX, "histogram counts missing");
+    // counters and sums are 64-bit and must not have wrapped
+    CHECK(count_lines(text, "glasses_", "_total 8589934590") == METRIC_COUNTER_MAX, "counter wrapped");
+    CHECK(count_lines(text, "glasses_", "_sum 8589934591") == METRIC_HIST_MAX, "histogram sum wrapped");
+    CHECK(count_lines(text, "glasses_task_cpu_ratio{", NULL) == 32, "%d task lines, expected 32",
+          count_lines(text, "glasses_task_cpu_ratio{", NULL));
+}
+
+static void check_json(const char *text)
+{
+    int depth = 0;
+    bool in_string = false;
+    for (const char *p = text; *p; p++) {
+        if (*p == '"') {
+            in_string = !in_string;
+        } else if (!in_string && (*p == '{' || *p == '[')) {
+            depth++;
+        } else if (!in_string && (*p == '}' || *p == ']')) {
+            CHECK(--depth >= 0, "unbalanced JSON");
+        }
+    }
+    CHECK(depth == 0 && !in_string && text[strlen(text) - 1] == '}', "JSON truncated");
+    CHECK(strstr(text, "\"task_cpu_permille\":{") != NULL, "task CPU missing");
+    CHECK(strstr(text, "\"mdns_actions\":{") != NULL, "mDNS stats missing");
+    CHECK(strstr(text, "\"bytes_sent\":8589934590") != NULL, "counter wrapped");
+    CHECK(strstr(text, "\"sum\":8589934591,") != NULL, "histogram sum wrapped");
+}
+
+static void export_full(bool verbose)
+{
+    char *buf = malloc(METRICS_BUF_SIZE);
+    sink_t sink = {0};
+
+    CHECK(metrics_export_prometheus(buf, METRICS_BUF_SIZE, sink_write, &sink) == ESP_OK, "Prometheus export failed");
+    CHECK(sink.writes > 1, "Prometheus output fits one buffer, streaming not exercised");
+    check_prometheus(sink.data);
+    if (verbose) {
+        fputs(sink.data, stdout);
+    }
+    printf("Prometheus: %zu bytes in %d chunks\n", sink.len, sink.writes);
+    sink_reset(&sink);
+
+    CHECK(metrics_export_json(buf, METRICS_BUF_SIZE, sink_write, &sink) == ESP_OK, "JSON export failed");
+    check_json(sink.data);
+    printf("JSON: %zu bytes in %d chunks\n", sink.len, sink.writes);
+    sink_reset(&sink);
+    free(buf);
+}
+
+// Any buffer size gives the same output, or an error with only whole lines written
+static void export_small_buffers(void)
+{
+    char *buf = malloc(METRICS_BUF_SIZE);
+    sink_t ref = {0};
+    metrics_export_prometheus(buf, METRICS_BUF_SIZE, sink_write, &ref);
+
+    bool failed_once = false;
+    for (size_t size = 1; size < METRICS_BUF_SIZE; size += 7) {
+        char *small = malloc(size);
+        sink_t sink = {0};
+        esp_err_t err = metrics_export_prometheus(small, size, sink_write, &sink);
+        if (err == ESP_OK) {
+            CHECK(sink.len == ref.len && !memcmp(sink.data, ref.data, ref.len), "size %zu: output differs", size);
+        } else {
+            failed_once = true;
+            CHECK(err == ESP_ERR_INVALID_SIZE, "size %zu: error %d", size, err);
+            CHECK(!sink.len || sink.data[sink.len - 1] == '\n', "size %zu: partial line written", size);
+            CHECK(sink.len < ref.len && (!sink.len || !memcmp(sink.data, ref.data, sink.len)), "size %zu: bad prefix", size);
+        }
+        sink_reset(&sink);
+        free(small);
+    }
+    CHECK(failed_once, "no buffer was too small");
+    sink_reset(&ref);
+    free(buf);
+}
+
+static void export_abort(void)
+{
+    char *buf = malloc(METRICS_BUF_SIZE);
+    sink_t sink = {.abort_after = 2};
+    CHECK(metrics_export_prometheus(buf, METRICS_BUF_SIZE, sink_write, &sink) == ESP_FAIL, "abort not reported");
+    CHECK(sink.writes == 2, "export went on after the abort");
+    sink_reset(&sink);
+    CHECK(metrics_export_prometheus(NULL, METRICS_BUF_SIZE, sink_write, &sink) == ESP_ERR_INVALID_ARG, "NULL buffer accepted");
+    free(buf);
+}
+
+// The handlers stream the export and finish the chunked response
+static void handlers(void)
+{
+    CHECK(metrics_register_handlers(NULL) == ESP_OK && s_uri_count == 2, "handlers not registered");
+    for (int i = 0; i < s_uri_count; i++) {
+        sink_reset(&s_resp);
+        CHECK(s_uris[i].handler(NULL) == ESP_OK, "%s failed", s_uris[i].uri);
+        CHECK(s_resp.finished && s_resp.writes > 1, "%s not streamed", s_uris[i].uri);
+    }
+
+    sink_reset(&s_resp);
+    s_resp.abort_after = 2;
+    CHECK(s_uris[0].handler(NULL) != ESP_OK, "send failure not reported");
+    CHECK(!s_resp.finished, "response finished after a failed send");
+    sink_reset(&s_resp);
+}
+
+int main(int argc, char **argv)
+{
+    fill_metrics();
+    export_full(argc > 1 && !strcmp(argv[1], "-v"));
+    export_small_buffers();
+    export_abort();
+    handlers();
+
+    if (s_failures) {
+        printf("%d check(s) failed\n", s_failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
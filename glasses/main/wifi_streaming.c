@@ -1,10 +1,15 @@
 #include "wifi_streaming.h"
 #include "camera.h"
+#include "metrics.h"
+#include "frame_gate.h"
+#include "frame_hub.h"
+#include "trace_ring.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
 #include "mdns.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -12,6 +17,7 @@
 #include "lwip/err.h"
 #include "lwip/sys.h"
 #include <string.h>
+#include <stdlib.h>
 
 static const char *TAG = "WIFI";
 
@@ -99,17 +105,41 @@ static esp_err_t stream_handler(httpd_req_t *req)
     esp_err_t res = ESP_OK;
     char part_buf[64];
 
+    uint32_t seq = 0;
+
+    // 场景变化门控，/stream?gate=0 可关闭
+    frame_gate_t gate;
+    frame_gate_reset(&gate);
+    bool gate_on = FRAME_GATE_ENABLE;
+    char query[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK && strstr(query, "gate=0")) {
+        gate_on = false;
+    }
+
     res = httpd_resp_set_type(req, STREAM_CONTENT_TYPE);
     if (res != ESP_OK) return res;
 
+    metrics_gauge_add(METRIC_STREAM_CLIENTS, 1);
     while (true) {
-        fb = esp_camera_fb_get();
+        // 与本地分析任务共享同一帧，不再各自调用 esp_camera_fb_get
+        int64_t take_start_us = esp_timer_get_time();
+        fb = frame_hub_get(&seq, pdMS_TO_TICKS(FRAME_HUB_GET_TIMEOUT_MS));
+        int64_t take_end_us = esp_timer_get_time();
         if (!fb) {
             res = ESP_FAIL;
             break;
         }
+        metrics_observe(METRIC_HIST_CAM_TAKE_US, (uint32_t)(take_end_us - take_start_us));
+
+        if (gate_on && !frame_gate_should_send(&gate, fb->buf, fb->len, take_end_us)) {
+            metrics_inc(METRIC_FRAMES_SKIPPED);
+            frame_hub_release(fb);
+            vTaskDelay(30 / portTICK_PERIOD_MS);
+            continue;
+        }
 
         size_t hlen = snprintf(part_buf, 64, STREAM_PART, fb->len);
+        TRACE_BEGIN(TRACE_EV_HTTPD_SEND, fb->len >> 10);
         res = httpd_resp_send_chunk(req, part_buf, hlen);
         if (res == ESP_OK) {
             res = httpd_resp_send_chunk(req, (const char *)fb->buf, fb->len);
@@ -117,11 +147,22 @@ static esp_err_t stream_handler(httpd_req_t *req)
         if (res == ESP_OK) {
             res = httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY));
         }
+        TRACE_END(TRACE_EV_HTTPD_SEND, fb->len >> 10);
+
+        if (res == ESP_OK) {
+            metrics_inc(METRIC_FRAMES_SENT);
+            metrics_add(METRIC_BYTES_SENT, fb->len);
+            metrics_observe(METRIC_HIST_FRAME_BYTES, fb->len);
+            metrics_observe(METRIC_HIST_SEND_US, (uint32_t)(esp_timer_get_time() - take_end_us));
+        } else {
+            metrics_inc(METRIC_SEND_ERRORS);
+        }
 
-        esp_camera_fb_return(fb);
+        frame_hub_release(fb);
         if (res != ESP_OK) break;
         vTaskDelay(30 / portTICK_PERIOD_MS);  // 控制帧率
     }
+    metrics_gauge_add(METRIC_STREAM_CLIENTS, -1);
     return res;
 }
 
@@ -172,6 +213,7 @@ static esp_err_t index_handler(httpd_req_t *req)
     "<p>🎥 视频流：<a href='/stream' style='color:#4ecdc4'>/stream</a></p>"
     "<p>📸 拍照：<a href='/capture' style='color:#4ecdc4'>/capture</a></p>"
     "<p>ℹ️ 信息：<a href='/info' style='color:#4ecdc4'>/info</a></p>"
+    "<p>📊 指标：<a href='/metrics' style='color:#4ecdc4'>/metrics</a></p>"
     "</div>"
     "</div>"
     
@@ -254,8 +296,10 @@ static esp_err_t capture_handler(httpd_req_t *req)
     esp_err_t res = ESP_OK;
     static uint32_t photo_counter = 0;  // 静态计数器，每次调用自动递增
     ESP_LOGI(TAG, "📸 收到拍照请求");
+    metrics_inc(METRIC_CAPTURE_REQUESTS);
     
-    fb = esp_camera_fb_get();
+    uint32_t seq = 0;
+    fb = frame_hub_get(&seq, pdMS_TO_TICKS(FRAME_HUB_GET_TIMEOUT_MS));
     if (!fb) {
         ESP_LOGE(TAG, "❌ 获取图片失败");
         httpd_resp_send_500(req);
@@ -281,7 +325,7 @@ static esp_err_t capture_handler(httpd_req_t *req)
     res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
     
     ESP_LOGI(TAG, "📷 照片已发送下载: %s (%d bytes)", filename, fb->len);
-    esp_camera_fb_return(fb);
+    frame_hub_release(fb);
     
     return res;
 }
@@ -296,6 +340,14 @@ static esp_err_t info_handler(httpd_req_t *req)
     // 获取WiFi信息
     wifi_ap_record_t ap_info;
     esp_err_t wifi_ret = esp_wifi_sta_get_ap_info(&ap_info);
+
+    // 从传感器读取实际分辨率，而不是写死
+    uint16_t width = 0, height = 0;
+    sensor_t *s = esp_camera_sensor_get();
+    if (s && s->status.framesize < FRAMESIZE_INVALID) {
+        width = resolution[s->status.framesize].width;
+        height = resolution[s->status.framesize].height;
+    }
     
     // 创建JSON响应
     char json_response[512];
@@ -304,7 +356,7 @@ static esp_err_t info_handler(httpd_req_t *req)
         "\"status\":\"online\","
         "\"device\":\"ESP32-S3 Smart Glasses\","
         "\"camera\":\"OV3660\","
-        "\"resolution\":\"1600x1200\","
+        "\"resolution\":\"%ux%u\","
         "\"format\":\"JPEG\","
         "\"wifi_ssid\":\"%s\","
         "\"ip_address\":\"" IPSTR "\","  // ← 直接使用IPSTR宏
@@ -312,9 +364,11 @@ static esp_err_t info_handler(httpd_req_t *req)
         "\"endpoints\":{"
         "\"stream\":\"/stream\","
         "\"capture\":\"/capture\","
-        "\"info\":\"/info\""
+        "\"info\":\"/info\","
+        "\"metrics\":\"/metrics\""
         "}"
         "}",
+        width, height,
         (wifi_ret == ESP_OK) ? (char*)ap_info.ssid : "Unknown",
         IP2STR(&ip_info.ip));  // ← 直接使用，不在三元运算符中
     
@@ -323,6 +377,42 @@ static esp_err_t info_handler(httpd_req_t *req)
     return httpd_resp_send(req, json_response, strlen(json_response));
 }
 
+#if CONFIG_TRACE_RING_ENABLE
+static int trace_write(void *ctx, const char *data, size_t len)
+{
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, data, len) != ESP_OK;
+}
+
+// 热路径跟踪导出 - Chrome trace JSON，可直接拖入 chrome://tracing 或 ui.perfetto.dev
+// /trace?clear=1 导出后清空记录
+static esp_err_t trace_handler(httpd_req_t *req)
+{
+    char query[16] = {0};
+    bool clear = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+                 strstr(query, "clear=1") != NULL;
+
+    char *buf = malloc(2048);
+    if (!buf) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=trace.json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t res = trace_ring_export_chrome(buf, 2048, trace_write, req);
+    free(buf);
+    if (res != ESP_OK) {
+        ESP_LOGW(TAG, "跟踪导出失败: %s", esp_err_to_name(res));
+        return ESP_FAIL;
+    }
+    if (clear) {
+        trace_ring_clear();
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+#endif
+
 // 启动HTTP服务器
 esp_err_t start_streaming_server(void)
 {
@@ -340,12 +430,21 @@ esp_err_t start_streaming_server(void)
         httpd_register_uri_handler(stream_server, &stream_uri);
         httpd_register_uri_handler(stream_server, &capture_uri);
         httpd_register_uri_handler(stream_server, &info_uri);
+        metrics_register_handlers(stream_server);
+#if CONFIG_TRACE_RING_ENABLE
+        httpd_uri_t trace_uri = {.uri = "/trace", .method = HTTP_GET, .handler = trace_handler};
+        httpd_register_uri_handler(stream_server, &trace_uri);
+#endif
         
         ESP_LOGI(TAG, "HTTP服务器启动成功");
         ESP_LOGI(TAG, "📱 主页: http://esp32-glasses.local");
         ESP_LOGI(TAG, "🎥 视频流: http://esp32-glasses.local/stream");
         ESP_LOGI(TAG, "📸 拍照: http://esp32-glasses.local/capture");
         ESP_LOGI(TAG, "ℹ️  信息: http://esp32-glasses.local/info");
+        ESP_LOGI(TAG, "📊 指标: http://esp32-glasses.local/metrics");
+#if CONFIG_TRACE_RING_ENABLE
+        ESP_LOGI(TAG, "⏱️  跟踪: http://esp32-glasses.local/trace");
+#endif
         return ESP_OK;
     }
     return ESP_FAIL;